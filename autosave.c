@@ -0,0 +1,84 @@
+// autosave.c - Background autosave of prepared buffers
+#include "autosave.h"
+
+static int write_buffer(const char* filename, const char* buffer, size_t size) {
+    FILE* file;
+    if (fopen_s(&file, filename, "wb") != 0) {
+        return 0;
+    }
+    
+    int result = fwrite(buffer, 1, size, file) == size;
+    if (fclose(file) != 0) {
+        result = 0;
+    }
+    return result;
+}
+
+static DWORD WINAPI autosave_worker(LPVOID param) {
+    AutosaveJob* job = (AutosaveJob*)param;
+    char temp_filename[MAX_PATH + 4];
+    
+    sprintf_s(temp_filename, sizeof(temp_filename), "%s.tmp", job->filename);
+    
+    job->succeeded = write_buffer(temp_filename, job->buffer, job->buffer_size) &&
+                     MoveFileExA(temp_filename, job->filename,
+                                 MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    if (!job->succeeded) {
+        DeleteFileA(temp_filename);
+    }
+    
+    SetEvent(job->done_event);
+    return 0;
+}
+
+BOOL autosave_init(AutosaveJob* job) {
+    memset(job, 0, sizeof(AutosaveJob));
+    job->done_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+    return job->done_event != NULL;
+}
+
+// Write an already prepared buffer, which the job owns from here on
+BOOL autosave_start_buffer(AutosaveJob* job, char* buffer, size_t size, const char* filename) {
+    if (job->busy || !job->done_event) {
+        free(buffer);
+        return FALSE;
+    }
+    
+    job->buffer = buffer;
+    job->buffer_size = size;
+    strcpy_s(job->filename, sizeof(job->filename), filename);
+    job->succeeded = 0;
+    
+    job->thread = CreateThread(NULL, 0, autosave_worker, job, 0, NULL);
+    if (!job->thread) {
+        free(job->buffer);
+        job->buffer = NULL;
+        return FALSE;
+    }
+    
+    job->busy = TRUE;
+    return TRUE;
+}
+
+// Collect a finished save once done_event fires. Returns whether it succeeded.
+BOOL autosave_finish(AutosaveJob* job) {
+    if (!job->busy) return FALSE;
+    
+    WaitForSingleObject(job->thread, INFINITE);
+    CloseHandle(job->thread);
+    job->thread = NULL;
+    
+    free(job->buffer);
+    job->buffer = NULL;
+    job->busy = FALSE;
+    return job->succeeded != 0;
+}
+
+// Waits for a save still in flight so the file is not left half-written
+void autosave_cleanup(AutosaveJob* job) {
+    autosave_finish(job);
+    if (job->done_event) {
+        CloseHandle(job->done_event);
+        job->done_event = NULL;
+    }
+}
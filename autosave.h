@@ -0,0 +1,26 @@
+// autosave.h - Background autosave of prepared buffers
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <windows.h>
+#include "sheet.h"
+
+// At most one save is in flight. The buffer is prepared on the calling
+// thread; the worker only writes it to a temporary file and renames that
+// over the target, so a partial autosave never appears under its real name.
+typedef struct {
+    HANDLE thread;
+    HANDLE done_event;          // Auto-reset, signaled when the worker finishes
+    char* buffer;
+    size_t buffer_size;
+    char filename[MAX_PATH];
+    int succeeded;              // Set by the worker before done_event
+    BOOL busy;
+} AutosaveJob;
+
+BOOL autosave_init(AutosaveJob* job);
+BOOL autosave_start_buffer(AutosaveJob* job, char* buffer, size_t size, const char* filename);
+BOOL autosave_finish(AutosaveJob* job);
+void autosave_cleanup(AutosaveJob* job);
+
+#endif // AUTOSAVE_H
@@ -0,0 +1,311 @@
+// bench_liveledger.c - Benchmarks over generated workbooks, reported as JSON
+// Compile with: cl /O2 /W3 /TC bench_liveledger.c sheet.c formula.c cellstore.c pool.c reduce.c lookup.c autosave.c journal.c csvload.c llb.c threadpool.c undo.c ranges.c stats.c workbook.c console.c charts.c /Fe:bench_liveledger.exe /link user32.lib
+//
+// Usage: bench_liveledger [csv_rows] [output.json]
+// Every workbook is generated in memory, so runs are repeatable. Results go
+// to stdout, and to output.json if given, as
+//   {"benchmark": "liveledger", "version": 1, "config": {...},
+//    "results": [{"name": ..., "ms": ..., "items": ...}, ...]}
+// where items is the number of cells, formulas or frames the timing covers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "sheet.h"
+#include "constants.h"
+
+#define BENCH_RESULT_VERSION    1
+#define BENCH_DEFAULT_CSV_ROWS  1000000
+#define BENCH_CHAIN_LENGTH      100000
+#define BENCH_FANOUT_WIDTH      100000
+#define BENCH_LOOKUP_TABLE      10000
+#define BENCH_LOOKUP_FORMULAS   10000
+#define BENCH_TOTAL_ROWS        1000000
+#define BENCH_TOTAL_FORMULAS    200
+#define BENCH_VIEW_ROWS         40
+#define BENCH_VIEW_COLS         12
+#define BENCH_FRAMES            2000
+#define BENCH_CSV_FILE          "bench_liveledger.csv"
+#define BENCH_MAX_RESULTS       64
+
+typedef struct {
+    const char* name;
+    double ms;
+    long long items;
+} BenchResult;
+
+static BenchResult results[BENCH_MAX_RESULTS];
+static int result_count = 0;
+static LARGE_INTEGER frequency;
+
+static LARGE_INTEGER bench_now(void) {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now;
+}
+
+static void bench_record(const char* name, LARGE_INTEGER start, long long items) {
+    LARGE_INTEGER end = bench_now();
+    if (result_count >= BENCH_MAX_RESULTS) return;
+
+    results[result_count].name = name;
+    results[result_count].ms = (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+    results[result_count].items = items;
+    fprintf(stderr, "  %-28s %10.2f ms\n", name, results[result_count].ms);
+    result_count++;
+}
+
+// A1 = 1, then every cell adds one to the cell above it
+static void bench_chain(void) {
+    Sheet* sheet = sheet_new(BENCH_CHAIN_LENGTH + 1, 4);
+    if (!sheet) return;
+    char formula[32];
+
+    LARGE_INTEGER start = bench_now();
+    sheet_set_number(sheet, 0, 0, 1.0);
+    for (int row = 1; row < BENCH_CHAIN_LENGTH; row++) {
+        sprintf_s(formula, sizeof(formula), "=A%d+1", row);
+        sheet_set_formula(sheet, row, 0, formula);
+    }
+    bench_record("chain.build", start, BENCH_CHAIN_LENGTH);
+
+    start = bench_now();
+    sheet_recalculate(sheet);
+    bench_record("chain.recalc_full", start, BENCH_CHAIN_LENGTH);
+
+    start = bench_now();
+    sheet_set_number(sheet, 0, 0, 2.0);
+    sheet_recalculate(sheet);
+    bench_record("chain.recalc_edit", start, BENCH_CHAIN_LENGTH);
+
+    sheet_free(sheet);
+}
+
+// One input read by every formula of a column: a single wide level
+static void bench_fanout(void) {
+    Sheet* sheet = sheet_new(BENCH_FANOUT_WIDTH + 1, 4);
+    if (!sheet) return;
+    char formula[32];
+
+    sheet_set_number(sheet, 0, 0, 1.0);
+    for (int row = 0; row < BENCH_FANOUT_WIDTH; row++) {
+        sprintf_s(formula, sizeof(formula), "=A1*%d+1", row);
+        sheet_set_formula(sheet, row, 1, formula);
+    }
+    LARGE_INTEGER start = bench_now();
+    sheet_recalculate(sheet);
+    bench_record("fanout.recalc_full", start, BENCH_FANOUT_WIDTH);
+
+    start = bench_now();
+    sheet_set_number(sheet, 0, 0, 2.0);
+    sheet_recalculate(sheet);
+    bench_record("fanout.recalc_edit", start, BENCH_FANOUT_WIDTH);
+
+    sheet_free(sheet);
+}
+
+// Rate table in A:B read by string and approximate numeric lookups
+static void bench_xlookup(void) {
+    Sheet* sheet = sheet_new(BENCH_LOOKUP_TABLE + 1, 8);
+    if (!sheet) return;
+    char text[96];
+
+    for (int row = 0; row < BENCH_LOOKUP_TABLE; row++) {
+        sprintf_s(text, sizeof(text), "K%d", row);
+        sheet_set_string(sheet, row, 0, text);
+        sheet_set_number(sheet, row, 1, row * 0.5);
+        sheet_set_number(sheet, row, 2, row * 10.0);
+    }
+    for (int i = 0; i < BENCH_LOOKUP_FORMULAS; i++) {
+        int key = (int)(((long long)i * 7919) % BENCH_LOOKUP_TABLE);
+        if (i % 2 == 0) {
+            sprintf_s(text, sizeof(text), "=XLOOKUP(\"K%d\", A1:A%d, B1:B%d, 0)",
+                      key, BENCH_LOOKUP_TABLE, BENCH_LOOKUP_TABLE);
+        } else {
+            sprintf_s(text, sizeof(text), "=XLOOKUP(%d, C1:C%d, B1:B%d, 1)",
+                      key * 10 + 5, BENCH_LOOKUP_TABLE, BENCH_LOOKUP_TABLE);
+        }
+        sheet_set_formula(sheet, i, 4, text);
+    }
+    LARGE_INTEGER start = bench_now();
+    sheet_recalculate(sheet);
+    bench_record("xlookup.recalc_full", start, BENCH_LOOKUP_FORMULAS);
+
+    // Editing a key drops the index; every lookup then reads a rebuilt one
+    start = bench_now();
+    sheet_set_string(sheet, BENCH_LOOKUP_TABLE / 2, 0, "edited");
+    sheet_recalculate(sheet);
+    bench_record("xlookup.recalc_edit", start, BENCH_LOOKUP_FORMULAS);
+
+    sheet_free(sheet);
+}
+
+// Dashboard totals over one large block
+static void bench_totals(void) {
+    Sheet* sheet = sheet_new(BENCH_TOTAL_ROWS + 1, 8);
+    if (!sheet) return;
+    char formula[64];
+    static const char* functions[] = { "SUM", "AVG", "MAX", "MIN" };
+
+    for (int row = 0; row < BENCH_TOTAL_ROWS; row++) {
+        sheet_set_number(sheet, row, 0, (row % 1000) * 0.25);
+    }
+    for (int i = 0; i < BENCH_TOTAL_FORMULAS; i++) {
+        sprintf_s(formula, sizeof(formula), "=%s(A1:A%d)+%d", functions[i % 4], BENCH_TOTAL_ROWS, i);
+        sheet_set_formula(sheet, i, 2, formula);
+    }
+    LARGE_INTEGER start = bench_now();
+    sheet_recalculate(sheet);
+    bench_record("totals.recalc_full", start, BENCH_TOTAL_FORMULAS);
+
+    start = bench_now();
+    for (int edit = 0; edit < 100; edit++) {
+        sheet_set_number(sheet, edit * 997, 0, edit + 0.5);
+        sheet_recalculate(sheet);
+    }
+    bench_record("totals.recalc_edit_x100", start, 100);
+
+    sheet_free(sheet);
+}
+
+// Format a screenful of cells the way app_render does
+static void render_viewport(Sheet* sheet, int top, int left) {
+    char display[51];
+    for (int row = top; row < top + BENCH_VIEW_ROWS && row < sheet->rows; row++) {
+        for (int col = left; col < left + BENCH_VIEW_COLS && col < sheet->cols; col++) {
+            char* value = sheet_get_display_value(sheet, row, col);
+            int max_len = sheet_get_column_width(sheet, col) - 1;
+            if (max_len > 50) max_len = 50;
+            strncpy_s(display, sizeof(display), value, _TRUNCATE);
+            display[max_len < 0 ? 0 : max_len] = '\0';
+            sheet_cell_is_stale(sheet, sheet_get_cell(sheet, row, col));
+        }
+    }
+}
+
+static Sheet* generate_ledger(int rows) {
+    static const char* categories[] = { "Groceries", "Rent", "Utilities", "Travel", "Payroll", "Misc" };
+    Sheet* sheet = sheet_new(rows + 1, 8);
+    if (!sheet) return NULL;
+
+    for (int row = 0; row < rows; row++) {
+        sheet_set_number(sheet, row, 0, row + 1);
+        sheet_set_string(sheet, row, 1, categories[row % 6]);
+        sheet_set_number(sheet, row, 2, (double)(((long long)row * 7919) % 100000) / 100.0);
+        if (row % 4 == 0) cell_set_format(sheet_get_cell(sheet, row, 2), FORMAT_CURRENCY, 0);
+    }
+    return sheet;
+}
+
+static void bench_rendering(Sheet* sheet) {
+    int rows = sheet->rows - BENCH_VIEW_ROWS;
+    if (rows < 1) rows = 1;
+
+    // Scrolling through the sheet formats every frame from scratch
+    LARGE_INTEGER start = bench_now();
+    for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+        render_viewport(sheet, (int)(((long long)frame * BENCH_VIEW_ROWS) % rows), 0);
+    }
+    bench_record("render.scroll_frames", start, BENCH_FRAMES);
+
+    // Redrawing a still screen reuses the cached text
+    start = bench_now();
+    for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+        render_viewport(sheet, 0, 0);
+    }
+    bench_record("render.still_frames", start, BENCH_FRAMES);
+}
+
+static void bench_structure(Sheet* sheet, int rows) {
+    LARGE_INTEGER start = bench_now();
+    sheet_insert_row(sheet, 0);
+    bench_record("structure.insert_row", start, rows);
+
+    start = bench_now();
+    sheet_delete_row(sheet, 0);
+    bench_record("structure.delete_row", start, rows);
+
+    start = bench_now();
+    sheet_insert_column(sheet, 0);
+    bench_record("structure.insert_column", start, rows);
+
+    start = bench_now();
+    sheet_delete_column(sheet, 0);
+    bench_record("structure.delete_column", start, rows);
+}
+
+static void bench_csv(int rows) {
+    LARGE_INTEGER start = bench_now();
+    Sheet* sheet = generate_ledger(rows);
+    if (!sheet) return;
+    bench_record("csv.generate", start, (long long)rows * 3);
+
+    start = bench_now();
+    int saved = sheet_save_csv(sheet, BENCH_CSV_FILE, 0);
+    bench_record("csv.save", start, (long long)rows * 3);
+
+    bench_rendering(sheet);
+    bench_structure(sheet, rows);
+    sheet_free(sheet);
+
+    if (saved) {
+        Sheet* loaded = sheet_new(rows + 1, 8);
+        if (loaded) {
+            start = bench_now();
+            sheet_load_csv(loaded, BENCH_CSV_FILE, 0);
+            bench_record("csv.load", start, (long long)rows * 3);
+            sheet_free(loaded);
+        }
+    }
+    remove(BENCH_CSV_FILE);
+}
+
+static void write_json(FILE* out, int csv_rows) {
+    fprintf(out, "{\n");
+    fprintf(out, "  \"benchmark\": \"liveledger\",\n");
+    fprintf(out, "  \"version\": %d,\n", BENCH_RESULT_VERSION);
+    fprintf(out, "  \"config\": {\"csv_rows\": %d, \"chain_length\": %d, \"fanout_width\": %d, "
+                 "\"lookup_formulas\": %d, \"total_rows\": %d, \"frames\": %d},\n",
+            csv_rows, BENCH_CHAIN_LENGTH, BENCH_FANOUT_WIDTH, BENCH_LOOKUP_FORMULAS, BENCH_TOTAL_ROWS, BENCH_FRAMES);
+    fprintf(out, "  \"results\": [\n");
+    for (int i = 0; i < result_count; i++) {
+        fprintf(out, "    {\"name\": \"%s\", \"ms\": %.3f, \"items\": %lld}%s\n",
+                results[i].name, results[i].ms, results[i].items, i + 1 < result_count ? "," : "");
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+}
+
+int main(int argc, char* argv[]) {
+    int csv_rows = BENCH_DEFAULT_CSV_ROWS;
+    if (argc > 1) {
+        csv_rows = atoi(argv[1]);
+        if (csv_rows <= 0) {
+            fprintf(stderr, "Usage: %s [csv_rows] [output.json]\n", argv[0]);
+            return 1;
+        }
+    }
+    QueryPerformanceFrequency(&frequency);
+
+    // Progress goes to stderr so stdout stays pure JSON
+    fprintf(stderr, "LiveLedger benchmarks\n");
+    bench_chain();
+    bench_fanout();
+    bench_xlookup();
+    bench_totals();
+    bench_csv(csv_rows);
+
+    write_json(stdout, csv_rows);
+    if (argc > 2) {
+        FILE* out = NULL;
+        if (fopen_s(&out, argv[2], "w") != 0 || !out) {
+            fprintf(stderr, "Could not write %s\n", argv[2]);
+            return 1;
+        }
+        write_json(out, csv_rows);
+        fclose(out);
+    }
+    return 0;
+}
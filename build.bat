@@ -16,10 +16,10 @@ if exist "%VCTOOLS%\cl.exe" (
     "%WINSDK%\rc.exe" resource.rc
     if %ERRORLEVEL% EQU 0 (
         echo Compiling and linking with icon...
-        "%VCTOOLS%\cl.exe" /O2 /W3 /TC main.c sheet.c console.c charts.c /Fe:LL.exe /link resource.res user32.lib
+        "%VCTOOLS%\cl.exe" /O2 /W3 /TC main.c sheet.c formula.c cellstore.c pool.c reduce.c lookup.c autosave.c journal.c csvload.c llb.c threadpool.c undo.c ranges.c stats.c workbook.c console.c charts.c /Fe:LL.exe /link resource.res user32.lib
     ) else (
         echo Warning: Resource compilation failed, building without icon...
-        "%VCTOOLS%\cl.exe" /O2 /W3 /TC main.c sheet.c console.c charts.c /Fe:LL.exe /link user32.lib
+        "%VCTOOLS%\cl.exe" /O2 /W3 /TC main.c sheet.c formula.c cellstore.c pool.c reduce.c lookup.c autosave.c journal.c csvload.c llb.c threadpool.c undo.c ranges.c stats.c workbook.c console.c charts.c /Fe:LL.exe /link user32.lib
     )
 ) else (
     echo Error: Visual Studio compiler not found!
@@ -33,6 +33,20 @@ if %ERRORLEVEL% EQU 0 (
     REM Clean up temporary resource files
     if exist resource.res del resource.res >nul 2>nul
     if exist sheet.obj del sheet.obj >nul 2>nul
+    if exist formula.obj del formula.obj >nul 2>nul
+    if exist cellstore.obj del cellstore.obj >nul 2>nul
+    if exist pool.obj del pool.obj >nul 2>nul
+    if exist reduce.obj del reduce.obj >nul 2>nul
+    if exist lookup.obj del lookup.obj >nul 2>nul
+    if exist autosave.obj del autosave.obj >nul 2>nul
+    if exist journal.obj del journal.obj >nul 2>nul
+    if exist csvload.obj del csvload.obj >nul 2>nul
+    if exist llb.obj del llb.obj >nul 2>nul
+    if exist threadpool.obj del threadpool.obj >nul 2>nul
+    if exist undo.obj del undo.obj >nul 2>nul
+    if exist ranges.obj del ranges.obj >nul 2>nul
+    if exist stats.obj del stats.obj >nul 2>nul
+    if exist workbook.obj del workbook.obj >nul 2>nul
     if exist main.obj del main.obj >nul 2>nul
     if exist console.obj del console.obj >nul 2>nul
     if exist charts.obj del charts.obj >nul 2>nul
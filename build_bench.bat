@@ -0,0 +1,47 @@
+@echo off
+REM BUILD SCRIPT FOR BENCHMARKS - Save as build_bench.bat
+echo Building LiveLedger Benchmarks...
+
+REM Set MSVC paths directly to avoid PATH length issues in cmd.exe
+set "VSBASE=C:\Program Files (x86)\Microsoft Visual Studio\2019\BuildTools"
+set "VCTOOLS=%VSBASE%\VC\Tools\MSVC\14.29.30133\bin\Hostx64\x64"
+set "WINSDK=C:\Program Files (x86)\Windows Kits\10\bin\10.0.19041.0\x64"
+set "INCLUDE=%VSBASE%\VC\Tools\MSVC\14.29.30133\include;C:\Program Files (x86)\Windows Kits\10\Include\10.0.19041.0\ucrt;C:\Program Files (x86)\Windows Kits\10\Include\10.0.19041.0\um;C:\Program Files (x86)\Windows Kits\10\Include\10.0.19041.0\shared"
+set "LIB=%VSBASE%\VC\Tools\MSVC\14.29.30133\lib\x64;C:\Program Files (x86)\Windows Kits\10\Lib\10.0.19041.0\ucrt\x64;C:\Program Files (x86)\Windows Kits\10\Lib\10.0.19041.0\um\x64"
+
+REM Check if compiler exists
+if exist "%VCTOOLS%\cl.exe" (
+    echo Using MSVC compiler...
+    "%VCTOOLS%\cl.exe" /O2 /W3 /TC bench_liveledger.c sheet.c formula.c cellstore.c pool.c reduce.c lookup.c autosave.c journal.c csvload.c llb.c threadpool.c undo.c ranges.c stats.c workbook.c console.c charts.c /Fe:bench_liveledger.exe /link user32.lib
+    
+    if %ERRORLEVEL% EQU 0 (
+        echo Benchmark build successful!
+        echo Run bench_liveledger.exe [csv_rows] [output.json]
+        REM Clean up temporary object files
+        if exist sheet.obj del sheet.obj >nul 2>nul
+        if exist formula.obj del formula.obj >nul 2>nul
+        if exist cellstore.obj del cellstore.obj >nul 2>nul
+        if exist pool.obj del pool.obj >nul 2>nul
+        if exist reduce.obj del reduce.obj >nul 2>nul
+        if exist lookup.obj del lookup.obj >nul 2>nul
+        if exist autosave.obj del autosave.obj >nul 2>nul
+        if exist journal.obj del journal.obj >nul 2>nul
+        if exist csvload.obj del csvload.obj >nul 2>nul
+        if exist llb.obj del llb.obj >nul 2>nul
+        if exist threadpool.obj del threadpool.obj >nul 2>nul
+        if exist undo.obj del undo.obj >nul 2>nul
+        if exist ranges.obj del ranges.obj >nul 2>nul
+        if exist stats.obj del stats.obj >nul 2>nul
+        if exist workbook.obj del workbook.obj >nul 2>nul
+        if exist bench_liveledger.obj del bench_liveledger.obj >nul 2>nul
+        if exist console.obj del console.obj >nul 2>nul
+        if exist charts.obj del charts.obj >nul 2>nul
+    ) else (
+        echo Benchmark build failed!
+        exit /b 1
+    )
+) else (
+    echo Error: Visual Studio compiler not found!
+    echo Please install Visual Studio Build Tools or adjust paths in build_bench.bat
+    exit /b 1
+)
@@ -13,19 +13,33 @@ REM Check if compiler exists
 if exist "%VCTOOLS%\cl.exe" (
     echo Using MSVC compiler...
     echo Compiling basic test suite...
-    "%VCTOOLS%\cl.exe" /O2 /W3 /TC test_liveledger.c sheet.c console.c charts.c /Fe:test_liveledger.exe /link user32.lib
+    "%VCTOOLS%\cl.exe" /O2 /W3 /TC test_liveledger.c sheet.c formula.c cellstore.c pool.c reduce.c lookup.c autosave.c journal.c csvload.c llb.c threadpool.c undo.c ranges.c stats.c workbook.c console.c charts.c /Fe:test_liveledger.exe /link user32.lib
     
     if %ERRORLEVEL% EQU 0 (
         echo Basic tests build successful!
         REM Clean up temporary object files
         if exist sheet.obj del sheet.obj >nul 2>nul
+        if exist formula.obj del formula.obj >nul 2>nul
+        if exist cellstore.obj del cellstore.obj >nul 2>nul
+        if exist pool.obj del pool.obj >nul 2>nul
+        if exist reduce.obj del reduce.obj >nul 2>nul
+        if exist lookup.obj del lookup.obj >nul 2>nul
+        if exist autosave.obj del autosave.obj >nul 2>nul
+        if exist journal.obj del journal.obj >nul 2>nul
+        if exist csvload.obj del csvload.obj >nul 2>nul
+        if exist llb.obj del llb.obj >nul 2>nul
+        if exist threadpool.obj del threadpool.obj >nul 2>nul
+        if exist undo.obj del undo.obj >nul 2>nul
+        if exist ranges.obj del ranges.obj >nul 2>nul
+        if exist stats.obj del stats.obj >nul 2>nul
+        if exist workbook.obj del workbook.obj >nul 2>nul
         if exist test_liveledger.obj del test_liveledger.obj >nul 2>nul
         if exist console.obj del console.obj >nul 2>nul
         if exist charts.obj del charts.obj >nul 2>nul
         
         echo.
         echo Compiling advanced test suite...
-        "%VCTOOLS%\cl.exe" /O2 /W3 /TC test_liveledger_advanced.c sheet.c console.c charts.c /Fe:test_liveledger_advanced.exe /link user32.lib
+        "%VCTOOLS%\cl.exe" /O2 /W3 /TC test_liveledger_advanced.c sheet.c formula.c cellstore.c pool.c reduce.c lookup.c autosave.c journal.c csvload.c llb.c threadpool.c undo.c ranges.c stats.c workbook.c console.c charts.c /Fe:test_liveledger_advanced.exe /link user32.lib
         
         if %ERRORLEVEL% EQU 0 (
             echo Advanced tests build successful!
@@ -35,6 +49,20 @@ if exist "%VCTOOLS%\cl.exe" (
             echo Run test_liveledger_advanced.exe for advanced tests
             REM Clean up temporary object files
             if exist sheet.obj del sheet.obj >nul 2>nul
+            if exist formula.obj del formula.obj >nul 2>nul
+            if exist cellstore.obj del cellstore.obj >nul 2>nul
+            if exist pool.obj del pool.obj >nul 2>nul
+            if exist reduce.obj del reduce.obj >nul 2>nul
+            if exist lookup.obj del lookup.obj >nul 2>nul
+            if exist autosave.obj del autosave.obj >nul 2>nul
+            if exist journal.obj del journal.obj >nul 2>nul
+            if exist csvload.obj del csvload.obj >nul 2>nul
+            if exist llb.obj del llb.obj >nul 2>nul
+            if exist threadpool.obj del threadpool.obj >nul 2>nul
+            if exist undo.obj del undo.obj >nul 2>nul
+            if exist ranges.obj del ranges.obj >nul 2>nul
+            if exist stats.obj del stats.obj >nul 2>nul
+            if exist workbook.obj del workbook.obj >nul 2>nul
             if exist test_liveledger_advanced.obj del test_liveledger_advanced.obj >nul 2>nul
             if exist console.obj del console.obj >nul 2>nul
             if exist charts.obj del charts.obj >nul 2>nul
@@ -0,0 +1,195 @@
+// cellstore.c - Sparse chunked storage for sheet cells
+#include <stdlib.h>
+#include "cellstore.h"
+
+#define CHUNK_SLOTS (CELL_CHUNK_ROWS * CELL_CHUNK_COLS)
+#define INITIAL_INDEX_CAPACITY 64
+
+static unsigned int chunk_hash(int chunk_row, int chunk_col) {
+    unsigned int h = (unsigned int)chunk_row * 0x9E3779B1u;
+    h ^= (unsigned int)chunk_col * 0x85EBCA77u;
+    h ^= h >> 16;
+    return h;
+}
+
+CellStore* cell_store_new(void) {
+    CellStore* store = (CellStore*)calloc(1, sizeof(CellStore));
+    if (!store) return NULL;
+
+    store->index = (int*)calloc(INITIAL_INDEX_CAPACITY, sizeof(int));
+    if (!store->index) {
+        free(store);
+        return NULL;
+    }
+    store->index_capacity = INITIAL_INDEX_CAPACITY;
+    return store;
+}
+
+void cell_store_free(CellStore* store) {
+    int i;
+
+    if (!store) return;
+
+    for (i = 0; i < store->chunk_count; i++) {
+        free(store->chunks[i]);
+    }
+    free(store->chunks);
+    free(store->index);
+    free(store);
+}
+
+// Slot in the index holding the chunk, or the empty slot where it belongs
+static int chunk_index_slot(const CellStore* store, int chunk_row, int chunk_col) {
+    unsigned int mask = (unsigned int)store->index_capacity - 1;
+    unsigned int pos = chunk_hash(chunk_row, chunk_col) & mask;
+
+    for (;;) {
+        int entry = store->index[pos];
+        if (entry == 0) return (int)pos;
+
+        CellChunk* chunk = store->chunks[entry - 1];
+        if (chunk->chunk_row == chunk_row && chunk->chunk_col == chunk_col) {
+            return (int)pos;
+        }
+        pos = (pos + 1) & mask;
+    }
+}
+
+static CellChunk* find_chunk(const CellStore* store, int row, int col) {
+    int slot = chunk_index_slot(store, row / CELL_CHUNK_ROWS, col / CELL_CHUNK_COLS);
+    int entry = store->index[slot];
+    return entry ? store->chunks[entry - 1] : NULL;
+}
+
+static int grow_index(CellStore* store) {
+    int new_capacity = store->index_capacity * 2;
+    int* new_index = (int*)calloc(new_capacity, sizeof(int));
+    int* old_index = store->index;
+    int i;
+
+    if (!new_index) return 0;
+
+    store->index = new_index;
+    store->index_capacity = new_capacity;
+    for (i = 0; i < store->chunk_count; i++) {
+        CellChunk* chunk = store->chunks[i];
+        store->index[chunk_index_slot(store, chunk->chunk_row, chunk->chunk_col)] = i + 1;
+    }
+    free(old_index);
+    return 1;
+}
+
+static CellChunk* find_or_add_chunk(CellStore* store, int row, int col) {
+    int chunk_row = row / CELL_CHUNK_ROWS;
+    int chunk_col = col / CELL_CHUNK_COLS;
+    int slot = chunk_index_slot(store, chunk_row, chunk_col);
+    CellChunk* chunk;
+
+    if (store->index[slot]) {
+        return store->chunks[store->index[slot] - 1];
+    }
+
+    if ((store->chunk_count + 1) * 2 > store->index_capacity) {
+        if (!grow_index(store)) return NULL;
+        slot = chunk_index_slot(store, chunk_row, chunk_col);
+    }
+
+    if (store->chunk_count >= store->chunk_capacity) {
+        int new_capacity = store->chunk_capacity ? store->chunk_capacity * 2 : 16;
+        CellChunk** new_chunks = (CellChunk**)realloc(store->chunks, new_capacity * sizeof(CellChunk*));
+        if (!new_chunks) return NULL;
+        store->chunks = new_chunks;
+        store->chunk_capacity = new_capacity;
+    }
+
+    chunk = (CellChunk*)calloc(1, sizeof(CellChunk));
+    if (!chunk) return NULL;
+    chunk->chunk_row = chunk_row;
+    chunk->chunk_col = chunk_col;
+
+    store->chunks[store->chunk_count++] = chunk;
+    store->index[slot] = store->chunk_count;
+    return chunk;
+}
+
+static int slot_of(int row, int col) {
+    return (row % CELL_CHUNK_ROWS) * CELL_CHUNK_COLS + (col % CELL_CHUNK_COLS);
+}
+
+const CellChunk* cell_store_chunk(const CellStore* store, int row, int col) {
+    return find_chunk(store, row, col);
+}
+
+struct Cell* cell_store_get(const CellStore* store, int row, int col) {
+    CellChunk* chunk = find_chunk(store, row, col);
+    return chunk ? chunk->slots[slot_of(row, col)] : NULL;
+}
+
+int cell_store_put(CellStore* store, int row, int col, struct Cell* cell) {
+    CellChunk* chunk = find_or_add_chunk(store, row, col);
+    int slot;
+
+    if (!chunk) return 0;
+
+    slot = slot_of(row, col);
+    if (!chunk->slots[slot]) {
+        chunk->count++;
+        store->cell_count++;
+    }
+    chunk->slots[slot] = cell;
+    return 1;
+}
+
+// Emptied chunks stay allocated so the index never needs deletion; they are
+// reused when cells come back to the same area and skipped by iteration.
+struct Cell* cell_store_take(CellStore* store, int row, int col) {
+    CellChunk* chunk = find_chunk(store, row, col);
+    struct Cell* cell;
+    int slot;
+
+    if (!chunk) return NULL;
+
+    slot = slot_of(row, col);
+    cell = chunk->slots[slot];
+    if (cell) {
+        chunk->slots[slot] = NULL;
+        chunk->count--;
+        store->cell_count--;
+        chunk->values[CELL_CHUNK_VALUE(row, col)] = 0.0;
+        chunk->kinds[CELL_CHUNK_VALUE(row, col)] = CELL_VALUE_EMPTY;
+    }
+    return cell;
+}
+
+void cell_store_set_value(CellStore* store, int row, int col, CellValueKind kind, double value) {
+    CellChunk* chunk = find_chunk(store, row, col);
+    if (!chunk) return;
+
+    chunk->values[CELL_CHUNK_VALUE(row, col)] = value;
+    chunk->kinds[CELL_CHUNK_VALUE(row, col)] = (unsigned char)kind;
+}
+
+void cell_store_iter_begin(const CellStore* store, CellIterator* it) {
+    it->store = store;
+    it->chunk = 0;
+    it->slot = 0;
+}
+
+// Works on indices rather than chunk pointers so the store may grow
+// (new chunks, reallocated arrays) while an iteration is in progress.
+struct Cell* cell_store_iter_next(CellIterator* it) {
+    const CellStore* store = it->store;
+
+    while (it->chunk < store->chunk_count) {
+        CellChunk* chunk = store->chunks[it->chunk];
+        if (chunk->count > 0) {
+            while (it->slot < CHUNK_SLOTS) {
+                struct Cell* cell = chunk->slots[it->slot++];
+                if (cell) return cell;
+            }
+        }
+        it->chunk++;
+        it->slot = 0;
+    }
+    return NULL;
+}
@@ -0,0 +1,70 @@
+// cellstore.h - Sparse chunked storage for sheet cells
+#ifndef CELLSTORE_H
+#define CELLSTORE_H
+
+#include "constants.h"
+
+struct Cell;
+
+// What a slot holds, as range scans see it
+typedef enum {
+    CELL_VALUE_EMPTY,       // No cell or an empty one; ranges read 0
+    CELL_VALUE_NUMBER,      // Number, or formula with a numeric result
+    CELL_VALUE_TEXT,        // String cell; ranges skip it
+    CELL_VALUE_ERROR,       // Formula error, its ErrorType as the value; ranges skip it
+    CELL_VALUE_TEXT_RESULT  // Formula with a text result; ranges read its value
+} CellValueKind;
+
+// Whether ranges read values[] for a slot of this kind
+#define CELL_VALUE_IN_RANGE(kind) \
+    ((kind) == CELL_VALUE_EMPTY || (kind) == CELL_VALUE_NUMBER || (kind) == CELL_VALUE_TEXT_RESULT)
+
+// Fixed-size tile of cell slots. Tiles are only allocated once a cell inside
+// them is created, so memory follows the populated area of the sheet.
+// Alongside the cells, each tile keeps their values column by column:
+// rows r..r+n of one column are n contiguous doubles a scan can use in place.
+typedef struct {
+    int chunk_row;      // Row / CELL_CHUNK_ROWS
+    int chunk_col;      // Column / CELL_CHUNK_COLS
+    int count;          // Occupied slots
+    struct Cell* slots[CELL_CHUNK_ROWS * CELL_CHUNK_COLS];
+    double values[CELL_CHUNK_COLS * CELL_CHUNK_ROWS];          // See CELL_CHUNK_VALUE
+    unsigned char kinds[CELL_CHUNK_COLS * CELL_CHUNK_ROWS];    // CellValueKind per value
+} CellChunk;
+
+// Index of a position in values[] and kinds[]
+#define CELL_CHUNK_VALUE(row, col) \
+    (((col) % CELL_CHUNK_COLS) * CELL_CHUNK_ROWS + (row) % CELL_CHUNK_ROWS)
+
+typedef struct {
+    CellChunk** chunks;     // Every allocated chunk, in creation order
+    int chunk_count;
+    int chunk_capacity;
+    int* index;             // Open-addressed hash of chunk number + 1 (0 = empty)
+    int index_capacity;     // Power of two, kept at most half full
+    int cell_count;         // Occupied slots across all chunks
+} CellStore;
+
+// Iterator over occupied cells. Order is unspecified; storing into the
+// store during iteration is allowed (new cells may or may not be visited).
+typedef struct {
+    const CellStore* store;
+    int chunk;
+    int slot;
+} CellIterator;
+
+CellStore* cell_store_new(void);
+void cell_store_free(CellStore* store);     // Frees chunks, not the cells
+
+struct Cell* cell_store_get(const CellStore* store, int row, int col);
+const CellChunk* cell_store_chunk(const CellStore* store, int row, int col);  // NULL if unallocated
+int cell_store_put(CellStore* store, int row, int col, struct Cell* cell);  // 0 on allocation failure
+struct Cell* cell_store_take(CellStore* store, int row, int col);          // Remove and return; value reads empty
+
+// Record the value ranges see for an occupied position (the sheet keeps this current)
+void cell_store_set_value(CellStore* store, int row, int col, CellValueKind kind, double value);
+
+void cell_store_iter_begin(const CellStore* store, CellIterator* it);
+struct Cell* cell_store_iter_next(CellIterator* it);
+
+#endif // CELLSTORE_H
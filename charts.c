@@ -7,6 +7,20 @@ Chart* chart_create(ChartType type, const char* x_label, const char* y_label) {
     return chart_create_sized(type, x_label, y_label, DEFAULT_CHART_WIDTH + 20, DEFAULT_CHART_HEIGHT);
 }
 
+static void chart_clear_canvas(Chart* chart) {
+    memset(chart->canvas, ' ', (size_t)chart->canvas_height * chart->canvas_stride);
+    for (int y = 0; y < chart->canvas_height; y++) {
+        CHART_ROW(chart, y)[chart->canvas_width] = '\0';
+    }
+}
+
+static void chart_clamp_size(int* width, int* height) {
+    if (*width < MIN_CHART_WIDTH) *width = MIN_CHART_WIDTH;
+    if (*width > MAX_CHART_WIDTH) *width = MAX_CHART_WIDTH;
+    if (*height < MIN_CHART_HEIGHT) *height = MIN_CHART_HEIGHT;
+    if (*height > MAX_CHART_HEIGHT) *height = MAX_CHART_HEIGHT;
+}
+
 Chart* chart_create_sized(ChartType type, const char* x_label, const char* y_label, int width, int height) {
     Chart* chart = (Chart*)calloc(1, sizeof(Chart));
     if (!chart) return NULL;
@@ -16,58 +30,175 @@ Chart* chart_create_sized(ChartType type, const char* x_label, const char* y_lab
     strncpy_s(chart->config.y_label, sizeof(chart->config.y_label), y_label ? y_label : "Y", _TRUNCATE);
     
     // Use provided sizes with more generous bounds checking for full-screen charts
+    chart_clamp_size(&width, &height);
     chart->config.width = width;
     chart->config.height = height;
-    if (chart->config.width < MIN_CHART_WIDTH) chart->config.width = MIN_CHART_WIDTH;
-    if (chart->config.width > MAX_CHART_WIDTH) chart->config.width = MAX_CHART_WIDTH;
-    if (chart->config.height < MIN_CHART_HEIGHT) chart->config.height = MIN_CHART_HEIGHT;
-    if (chart->config.height > MAX_CHART_HEIGHT) chart->config.height = MAX_CHART_HEIGHT;
     
     chart->config.show_grid = 1;
     chart->config.show_legend = 1;
     
-    // Initialize bounds
-    chart->x_min = DBL_MAX;
-    chart->x_max = -DBL_MAX;
-    chart->y_min = DBL_MAX;
-    chart->y_max = -DBL_MAX;      // Allocate canvas with appropriate margins for labels, axes, and legend
+    // Allocate canvas with appropriate margins for labels, axes, and legend
     // Ensure canvas width doesn't exceed what can be displayed
     int legend_space = chart->config.show_legend ? CHART_LEGEND_WIDTH : 5;
     chart->canvas_width = chart->config.width + legend_space;
     chart->canvas_height = chart->config.height + CHART_AXIS_LABEL_SPACE;
-    chart->canvas = (char**)calloc(chart->canvas_height, sizeof(char*));
-    
-    for (int i = 0; i < chart->canvas_height; i++) {
-        chart->canvas[i] = (char*)calloc(chart->canvas_width + 1, sizeof(char));
-        memset(chart->canvas[i], ' ', chart->canvas_width);
-        chart->canvas[i][chart->canvas_width] = '\0';
+    chart->canvas_stride = chart->canvas_width + 1;
+    chart->canvas = (char*)malloc((size_t)chart->canvas_height * chart->canvas_stride);
+    if (!chart->canvas) {
+        free(chart);
+        return NULL;
     }
+    chart_clear_canvas(chart);
     
     return chart;
 }
 
+// Drop the series so the range can be read again
+static void chart_clear_data(Chart* chart) {
+    if (chart->series) {
+        for (int i = 0; i < chart->series_count; i++) {
+            free(chart->series[i].points);
+        }
+        free(chart->series);
+    }
+    chart->series = NULL;
+    chart->series_count = 0;
+    chart->source_sheet = NULL;
+    
+    chart->x_min = DBL_MAX;
+    chart->x_max = -DBL_MAX;
+    chart->y_min = DBL_MAX;
+    chart->y_max = -DBL_MAX;
+}
+
 void chart_free(Chart* chart) {
     if (!chart) return;
     
-    // Free canvas
-    if (chart->canvas) {
-        for (int i = 0; i < chart->canvas_height; i++) {
-            free(chart->canvas[i]);
+    free(chart->canvas);
+    free(chart->cells);
+    chart_clear_data(chart);
+    free(chart);
+}
+
+// Collects one series in a single pass over the store's column arrays.
+// Line and scatter series longer than the plot is wide keep only the
+// lowest and highest point of each plot column's share of the rows, which
+// draws the same picture from at most two points per column.
+typedef struct {
+    Chart* chart;
+    Sheet* sheet;
+    ChartSeries* series;
+    int capacity;
+    int failed;
+    int x_col;
+    int data_start;
+    int data_rows;
+    int valid_count;        // Plottable rows seen so far
+    int buckets;            // Plot columns to reduce to; 0 keeps every point
+    int bucket;             // Bucket the low/high points below belong to
+    int bucket_used;
+    ChartPoint low, high;
+    int low_index, high_index;
+} SeriesBuilder;
+
+static void series_append(SeriesBuilder* builder, const ChartPoint* point) {
+    ChartSeries* series = builder->series;
+    if (series->count >= builder->capacity) {
+        int new_capacity = builder->capacity ? builder->capacity * 2 : 64;
+        ChartPoint* grown = (ChartPoint*)realloc(series->points, new_capacity * sizeof(ChartPoint));
+        if (!grown) {
+            builder->failed = 1;
+            return;
         }
-        free(chart->canvas);
+        series->points = grown;
+        builder->capacity = new_capacity;
     }
-    
-    // Free series data
-    if (chart->series) {
-        for (int i = 0; i < chart->series_count; i++) {
-            if (chart->series[i].points) {
-                free(chart->series[i].points);
+    series->points[series->count++] = *point;
+}
+
+// Emit the bucket's extremes in the order they appear in the range
+static void series_flush_bucket(SeriesBuilder* builder) {
+    if (!builder->bucket_used) return;
+    builder->bucket_used = 0;
+
+    if (builder->low_index == builder->high_index) {
+        series_append(builder, &builder->low);
+    } else if (builder->low_index < builder->high_index) {
+        series_append(builder, &builder->low);
+        series_append(builder, &builder->high);
+    } else {
+        series_append(builder, &builder->high);
+        series_append(builder, &builder->low);
+    }
+}
+
+static void series_add_point(SeriesBuilder* builder, int row, const ChartPoint* point) {
+    Chart* chart = builder->chart;
+    int index = builder->valid_count++;
+
+    // Bounds cover every point, kept or not
+    if (point->x < chart->x_min) chart->x_min = point->x;
+    if (point->x > chart->x_max) chart->x_max = point->x;
+    if (point->y < chart->y_min) chart->y_min = point->y;
+    if (point->y > chart->y_max) chart->y_max = point->y;
+
+    if (builder->buckets == 0) {
+        series_append(builder, point);
+        return;
+    }
+
+    int bucket = (int)((long long)(row - builder->data_start) * builder->buckets / builder->data_rows);
+    if (builder->bucket_used && bucket != builder->bucket) {
+        series_flush_bucket(builder);
+    }
+    if (!builder->bucket_used) {
+        builder->bucket = bucket;
+        builder->bucket_used = 1;
+        builder->low = builder->high = *point;
+        builder->low_index = builder->high_index = index;
+    } else if (point->y < builder->low.y) {
+        builder->low = *point;
+        builder->low_index = index;
+    } else if (point->y > builder->high.y) {
+        builder->high = *point;
+        builder->high_index = index;
+    }
+}
+
+static void series_add_run(void* context, int row, const double* values, const unsigned char* kinds, int count) {
+    SeriesBuilder* builder = (SeriesBuilder*)context;
+    if (!kinds || builder->failed) return;  // No cells here
+
+    // A run with cells lies within one chunk, so the X values fit here
+    double x_values[CELL_CHUNK_ROWS];
+    unsigned char x_kinds[CELL_CHUNK_ROWS];
+    sheet_read_column(builder->sheet, builder->x_col, row, row + count - 1, x_values, x_kinds);
+
+    for (int i = 0; i < count; i++) {
+        // Numbers and formulas that evaluated without error
+        if (kinds[i] != CELL_VALUE_NUMBER && kinds[i] != CELL_VALUE_TEXT_RESULT) continue;
+
+        ChartPoint point;
+        point.y = values[i];
+        point.label = NULL;
+        switch (x_kinds[i]) {
+            case CELL_VALUE_NUMBER:
+            case CELL_VALUE_TEXT_RESULT:
+                point.x = x_values[i];
+                break;
+            case CELL_VALUE_TEXT: {
+                // For string labels, use index as X value
+                Cell* x_cell = sheet_get_cell(builder->sheet, row + i, builder->x_col);
+                point.x = builder->valid_count;
+                point.label = x_cell ? x_cell->data.string : NULL;
+                break;
             }
+            default:
+                point.x = builder->valid_count;  // Use index as X
+                break;
         }
-        free(chart->series);
+        series_add_point(builder, row + i, &point);
     }
-    
-    free(chart);
 }
 
 int chart_add_data_from_range(Chart* chart, Sheet* sheet, RangeSelection* range) {
@@ -79,15 +210,19 @@ int chart_add_data_from_range(Chart* chart, Sheet* sheet, RangeSelection* range)
     int min_col = range->start_col < range->end_col ? range->start_col : range->end_col;
     int max_col = range->start_col > range->end_col ? range->start_col : range->end_col;
     
-    int rows = max_row - min_row + 1;
     int cols = max_col - min_col + 1;
     
     // For now, assume first column is X values (or labels), rest are Y series
     if (cols < 2) return 0;  // Need at least 2 columns
     
+    chart_clear_data(chart);
+    free(chart->cells);
+    chart->cells = NULL;
+    
     // Allocate series
     int num_series = cols - 1;
     chart->series = (ChartSeries*)calloc(num_series, sizeof(ChartSeries));
+    if (!chart->series) return 0;
     chart->series_count = num_series;
     
     // Symbols for different series
@@ -108,6 +243,14 @@ int chart_add_data_from_range(Chart* chart, Sheet* sheet, RangeSelection* range)
         }
     }
     
+    // Only a line runs left to right in row order, so only its rows can be
+    // merged into plot columns. Bars and slices are categories, and
+    // scatter points of neighbouring rows may land anywhere on the X axis.
+    int data_start = has_headers ? min_row + 1 : min_row;
+    int data_rows = max_row - data_start + 1;
+    int reducible = chart->config.type == CHART_LINE;
+    int buckets = (reducible && data_rows > 2 * chart->config.width) ? chart->config.width : 0;
+    
     // Process each Y series
     for (int series_idx = 0; series_idx < num_series; series_idx++) {
         ChartSeries* series = &chart->series[series_idx];
@@ -125,81 +268,29 @@ int chart_add_data_from_range(Chart* chart, Sheet* sheet, RangeSelection* range)
             sprintf_s(series->name, sizeof(series->name), "Series %d", series_idx + 1);
         }
         
-        // Count valid data points
-        int data_start = has_headers ? min_row + 1 : min_row;
-        int point_count = 0;
-        
-        for (int row = data_start; row <= max_row; row++) {
-            Cell* x_cell = sheet_get_cell(sheet, row, min_col);
-            Cell* y_cell = sheet_get_cell(sheet, row, min_col + series_idx + 1);
-            
-            if (y_cell && (y_cell->type == CELL_NUMBER || 
-                         (y_cell->type == CELL_FORMULA && y_cell->data.formula.error == ERROR_NONE))) {
-                point_count++;
-            }
-        }
-        
-        if (point_count == 0) continue;
+        if (data_rows <= 0) continue;
         
-        // Allocate points
-        series->points = (ChartPoint*)calloc(point_count, sizeof(ChartPoint));
-        series->count = point_count;
-        
-        // Fill in data points
-        int point_idx = 0;
-        for (int row = data_start; row <= max_row; row++) {
-            Cell* x_cell = sheet_get_cell(sheet, row, min_col);
-            Cell* y_cell = sheet_get_cell(sheet, row, min_col + series_idx + 1);
-            
-            if (y_cell && (y_cell->type == CELL_NUMBER || 
-                         (y_cell->type == CELL_FORMULA && y_cell->data.formula.error == ERROR_NONE))) {
-                
-                ChartPoint* point = &series->points[point_idx];
-                
-                // Get X value
-                if (x_cell) {
-                    switch (x_cell->type) {
-                        case CELL_NUMBER:
-                            point->x = x_cell->data.number;
-                            break;
-                        case CELL_FORMULA:
-                            if (x_cell->data.formula.error == ERROR_NONE) {
-                                point->x = x_cell->data.formula.cached_value;
-                            } else {
-                                point->x = point_idx;  // Use index as X
-                            }
-                            break;
-                        case CELL_STRING:
-                            // For string labels, use index as X value
-                            point->x = point_idx;
-                            strncpy_s(point->label, sizeof(point->label), x_cell->data.string, _TRUNCATE);
-                            break;
-                        default:
-                            point->x = point_idx;
-                            break;
-                    }
-                } else {
-                    point->x = point_idx;
-                }
-                
-                // Get Y value
-                if (y_cell->type == CELL_NUMBER) {
-                    point->y = y_cell->data.number;
-                } else if (y_cell->type == CELL_FORMULA) {
-                    point->y = y_cell->data.formula.cached_value;
-                }
-                
-                // Update bounds
-                if (point->x < chart->x_min) chart->x_min = point->x;
-                if (point->x > chart->x_max) chart->x_max = point->x;
-                if (point->y < chart->y_min) chart->y_min = point->y;
-                if (point->y > chart->y_max) chart->y_max = point->y;
-                
-                point_idx++;
-            }
+        SeriesBuilder builder;
+        memset(&builder, 0, sizeof(builder));
+        builder.chart = chart;
+        builder.sheet = sheet;
+        builder.series = series;
+        builder.x_col = min_col;
+        builder.data_start = data_start;
+        builder.data_rows = data_rows;
+        builder.buckets = buckets;
+        sheet_visit_column(sheet, min_col + series_idx + 1, data_start, max_row, series_add_run, &builder);
+        series_flush_bucket(&builder);
+        if (builder.failed) {
+            chart_clear_data(chart);
+            return 0;
         }
     }
     
+    chart->source_sheet = sheet;
+    chart->source_range = *range;
+    chart->source_version = sheet_columns_version(sheet, min_col, max_col);
+    
     // Add some padding to bounds
     double x_range = chart->x_max - chart->x_min;
     double y_range = chart->y_max - chart->y_min;
@@ -231,7 +322,7 @@ int chart_add_data_from_range(Chart* chart, Sheet* sheet, RangeSelection* range)
 
 void chart_set_pixel(Chart* chart, int x, int y, char c) {
     if (x >= 0 && x < chart->canvas_width && y >= 0 && y < chart->canvas_height) {
-        chart->canvas[y][x] = c;
+        CHART_ROW(chart, y)[x] = c;
     }
 }
 
@@ -322,7 +413,7 @@ void chart_draw_axes(Chart* chart) {
     int has_string_labels = 0;
     if (chart->series_count > 0 && chart->series[0].count > 0) {
         for (int i = 0; i < chart->series[0].count; i++) {
-            if (strlen(chart->series[0].points[i].label) > 0) {
+            if (chart->series[0].points[i].label && chart->series[0].points[i].label[0]) {
                 has_string_labels = 1;
                 break;
             }
@@ -340,7 +431,7 @@ void chart_draw_axes(Chart* chart) {
         
         for (int i = 0; i < series->count; i += step) {
             int x = chart_scale_x(chart, series->points[i].x);
-            const char* label = series->points[i].label;
+            const char* label = series->points[i].label ? series->points[i].label : "";
             int label_len = (int)strlen(label);
             
             if (label_len > 0) {
@@ -422,7 +513,7 @@ void chart_plot_line_chart(Chart* chart) {
         for (int i = 1; i < 8; i++) {
             int x = 10 + (chart->config.width - 1) * i / 8;
             for (int y = 0; y < chart->config.height; y++) {
-                if (chart->canvas[y][x] == ' ') {
+                if (CHART_ROW(chart, y)[x] == ' ') {
                     chart_set_pixel(chart, x, y, '|');
                 }
             }
@@ -432,7 +523,8 @@ void chart_plot_line_chart(Chart* chart) {
         for (int i = 1; i < 10; i++) {
             int y = (chart->config.height - 1) * i / 10;
             for (int x = 10; x < 10 + chart->config.width; x++) {
-                if (chart->canvas[y][x] == ' ' || chart->canvas[y][x] == '|') {
+                char c = CHART_ROW(chart, y)[x];
+                if (c == ' ' || c == '|') {
                     chart_set_pixel(chart, x, y, '-');
                 }
             }
@@ -597,7 +689,7 @@ void chart_plot_bar_chart(Chart* chart) {
           // Draw label below bar with better handling for string labels
         char label_buffer[64] = {0};  // Local buffer instead of static
         const char* label_text = "";
-        if (strlen(series->points[i].label) > 0) {
+        if (series->points[i].label && series->points[i].label[0]) {
             label_text = series->points[i].label;
         } else {
             // Use index-based label if no string label available
@@ -733,7 +825,7 @@ void chart_plot_pie_chart(Chart* chart) {
         
         // Draw label and percentage with better formatting
         char legend_text[80];
-        if (strlen(series->points[i].label) > 0) {
+        if (series->points[i].label && series->points[i].label[0]) {
             sprintf_s(legend_text, sizeof(legend_text), "%-15s: %8.1f (%5.1f%%)", 
                      series->points[i].label, series->points[i].y, percentage);
         } else {
@@ -757,14 +849,38 @@ void chart_plot_pie_chart(Chart* chart) {
     }
 }
 
+// Color coding based on character type for better visibility
+static WORD chart_char_color(char c) {
+    if (c == '|' || c == '-' || c == '=' || c == '#') {
+        // Axes and grid
+        return MAKE_COLOR(COLOR_CYAN | COLOR_BRIGHT, COLOR_BLACK);
+    } else if (c == 'O' || c == '*') {
+        // First series - bright yellow
+        return MAKE_COLOR(COLOR_YELLOW | COLOR_BRIGHT, COLOR_BLACK);
+    } else if (c == '+' || c == 'X') {
+        // Second series - bright green
+        return MAKE_COLOR(COLOR_GREEN | COLOR_BRIGHT, COLOR_BLACK);
+    } else if (c == 'x' || c == '@') {
+        // Third series - bright magenta
+        return MAKE_COLOR(COLOR_MAGENTA | COLOR_BRIGHT, COLOR_BLACK);
+    } else if (c == '$' || c == '%') {
+        // Fourth series - bright red
+        return MAKE_COLOR(COLOR_RED | COLOR_BRIGHT, COLOR_BLACK);
+    } else if (c == '[' || c == ']') {
+        // Bar chart borders
+        return MAKE_COLOR(COLOR_BLUE | COLOR_BRIGHT, COLOR_BLACK);
+    } else if (isdigit((unsigned char)c) || c == '.') {
+        // Numbers and decimal points
+        return MAKE_COLOR(COLOR_WHITE | COLOR_BRIGHT, COLOR_BLACK);
+    }
+    // Letters (labels, legend text) and everything else
+    return MAKE_COLOR(COLOR_WHITE, COLOR_BLACK);
+}
+
 void chart_render(Chart* chart) {
     if (!chart) return;
     
-    // Clear canvas
-    for (int y = 0; y < chart->canvas_height; y++) {
-        memset(chart->canvas[y], ' ', chart->canvas_width);
-        chart->canvas[y][chart->canvas_width] = '\0';
-    }
+    chart_clear_canvas(chart);
     
     // Render based on chart type
     switch (chart->config.type) {
@@ -781,6 +897,20 @@ void chart_render(Chart* chart) {
             chart_plot_line_chart(chart);  // Use line chart without lines for now
             break;
     }
+    
+    // Color it once here rather than on every display
+    if (!chart->cells) {
+        chart->cells = (CHAR_INFO*)calloc((size_t)chart->canvas_width * chart->canvas_height, sizeof(CHAR_INFO));
+        if (!chart->cells) return;
+    }
+    for (int y = 0; y < chart->canvas_height; y++) {
+        const char* row = CHART_ROW(chart, y);
+        CHAR_INFO* cells = chart->cells + (size_t)y * chart->canvas_width;
+        for (int x = 0; x < chart->canvas_width; x++) {
+            cells[x].Char.AsciiChar = row[x];
+            cells[x].Attributes = chart_char_color(row[x]);
+        }
+    }
 }
 
 void chart_display(Chart* chart, Console* console, int start_x, int start_y) {
@@ -790,17 +920,70 @@ void chart_display(Chart* chart, Console* console, int start_x, int start_y) {
     WORD chartColor = MAKE_COLOR(COLOR_WHITE, COLOR_BLACK);
     
     for (int y = 0; y < chart->canvas_height && start_y + y < console->height; y++) {
-        console_write_string(console, start_x, start_y + y, chart->canvas[y], chartColor);
+        console_write_string(console, start_x, start_y + y, CHART_ROW(chart, y), chartColor);
     }
 }
 
-char** chart_get_output(Chart* chart, int* line_count) {
-    if (!chart || !line_count) return NULL;
+const char* chart_get_output(Chart* chart, int* line_count, int* line_stride) {
+    if (!chart || !line_count || !line_stride) return NULL;
     
     *line_count = chart->canvas_height;
+    *line_stride = chart->canvas_stride;
     return chart->canvas;
 }
 
+void chart_blit(Chart* chart, Console* console, int x, int y, int width, int height) {
+    if (!chart || !console || !console->backBuffer) return;
+    if (!chart->cells) chart_render(chart);
+    if (!chart->cells) return;
+    
+    // Clip to the area, the screen and the chart
+    int src_x = x < 0 ? -x : 0;
+    int src_y = y < 0 ? -y : 0;
+    int columns = chart->canvas_width - src_x;
+    int rows = chart->canvas_height - src_y;
+    if (columns > width - src_x) columns = width - src_x;
+    if (rows > height - src_y) rows = height - src_y;
+    if (columns > console->width - (x + src_x)) columns = console->width - (x + src_x);
+    if (rows > console->height - (y + src_y)) rows = console->height - (y + src_y);
+    if (columns <= 0 || rows <= 0) return;
+    
+    for (int row = 0; row < rows; row++) {
+        const CHAR_INFO* from = chart->cells + (size_t)(src_y + row) * chart->canvas_width + src_x;
+        CHAR_INFO* to = console->backBuffer + (size_t)(y + src_y + row) * console->width + x + src_x;
+        memcpy(to, from, columns * sizeof(CHAR_INFO));
+    }
+}
+
+int chart_matches(const Chart* chart, const Sheet* sheet, const RangeSelection* range, ChartType type,
+                  const char* x_label, const char* y_label, int width, int height) {
+    if (!chart || !chart->source_sheet || chart->source_sheet != sheet) return 0;
+    
+    chart_clamp_size(&width, &height);
+    const RangeSelection* source = &chart->source_range;
+    return chart->config.type == type &&
+           chart->config.width == width && chart->config.height == height &&
+           strcmp(chart->config.x_label, x_label ? x_label : "X") == 0 &&
+           strcmp(chart->config.y_label, y_label ? y_label : "Y") == 0 &&
+           source->start_row == range->start_row && source->start_col == range->start_col &&
+           source->end_row == range->end_row && source->end_col == range->end_col;
+}
+
+int chart_refresh(Chart* chart, Sheet* sheet) {
+    if (!chart || !sheet || chart->source_sheet != sheet) return 0;
+    
+    const RangeSelection* source = &chart->source_range;
+    int min_col = source->start_col < source->end_col ? source->start_col : source->end_col;
+    int max_col = source->start_col > source->end_col ? source->start_col : source->end_col;
+    if (sheet_columns_version(sheet, min_col, max_col) != chart->source_version) {
+        // Labels may point at replaced text: read everything again
+        RangeSelection range = *source;
+        if (!chart_add_data_from_range(chart, sheet, &range)) return 0;
+    }
+    if (!chart->cells) chart_render(chart);
+    return chart->cells != NULL;
+}
+
 // Helper function to parse chart command
 int parse_chart_command(const char* command, ChartType* type, char* x_label, char* y_label) {
     // Format: "chart_type x_label y_label"
@@ -912,51 +1095,8 @@ void display_chart_popup(Console* console, Chart* chart, const char* title) {
     int display_width = border_width;
     int display_height = border_height;
     
-    // Fill the entire available area with the chart
-    int chart_rows = chart->canvas_height;
-    int chart_cols = chart->canvas_width;
+    chart_blit(chart, console, display_start_x, display_start_y, display_width, display_height);
     
-    for (int y = 0; y < chart_rows && y < display_height; y++) {
-        for (int x = 0; x < chart_cols && x < display_width; x++) {
-            if (display_start_x + x < console->width && display_start_y + y < console->height) {
-                // Enhanced color coding for much better visibility
-                WORD color = MAKE_COLOR(COLOR_WHITE, COLOR_BLACK);
-                char c = chart->canvas[y][x];
-                
-                // Color coding based on character type for better visibility
-                if (c == '|' || c == '-' || c == '=' || c == '#') {
-                    // Axes and grid
-                    color = MAKE_COLOR(COLOR_CYAN | COLOR_BRIGHT, COLOR_BLACK);
-                } else if (c == 'O' || c == '*') {
-                    // First series - bright yellow
-                    color = MAKE_COLOR(COLOR_YELLOW | COLOR_BRIGHT, COLOR_BLACK);
-                } else if (c == '+' || c == 'X') {
-                    // Second series - bright green
-                    color = MAKE_COLOR(COLOR_GREEN | COLOR_BRIGHT, COLOR_BLACK);
-                } else if (c == 'x' || c == '@') {
-                    // Third series - bright magenta
-                    color = MAKE_COLOR(COLOR_MAGENTA | COLOR_BRIGHT, COLOR_BLACK);
-                } else if (c == '$' || c == '%') {
-                    // Fourth series - bright red
-                    color = MAKE_COLOR(COLOR_RED | COLOR_BRIGHT, COLOR_BLACK);
-                } else if (c == '[' || c == ']') {
-                    // Bar chart borders
-                    color = MAKE_COLOR(COLOR_BLUE | COLOR_BRIGHT, COLOR_BLACK);
-                } else if (c == '#' && y > 0 && chart->canvas[y-1][x] == '#') {
-                    // Bar chart fill
-                    color = MAKE_COLOR(COLOR_BLUE | COLOR_BRIGHT, COLOR_BLACK);
-                } else if (isdigit(c) || c == '.') {
-                    // Numbers and decimal points
-                    color = MAKE_COLOR(COLOR_WHITE | COLOR_BRIGHT, COLOR_BLACK);
-                } else if (isalpha(c)) {
-                    // Letters (labels, legend text)
-                    color = MAKE_COLOR(COLOR_WHITE, COLOR_BLACK);
-                }
-                
-                console_write_char(console, display_start_x + x, display_start_y + y, c, color);
-            }
-        }
-    }    
     // Draw instructions with better visibility at the bottom
     const char* instructions = "[ Press any key to close ]";
     int inst_x = (console->width - (int)strlen(instructions)) / 2;
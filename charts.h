@@ -35,7 +35,7 @@ typedef struct {
 typedef struct {
     double x;
     double y;
-    char label[64];
+    const char* label;  // Text of the X cell, owned by the sheet (NULL if none)
 } ChartPoint;
 
 // Chart data series
@@ -53,19 +53,43 @@ typedef struct {
     int series_count;
     double x_min, x_max;
     double y_min, y_max;
-    char** canvas;  // ASCII canvas for drawing
+    char* canvas;           // ASCII canvas: canvas_height rows of canvas_stride chars
     int canvas_width;
     int canvas_height;
+    int canvas_stride;      // canvas_width + 1; each row is NUL-terminated
+    CHAR_INFO* cells;       // Colored copy of the canvas as blitted (NULL until rendered)
+    
+    // The range the data came from and its columns' version at the time,
+    // so an unchanged chart is neither extracted nor drawn again
+    const Sheet* source_sheet;
+    RangeSelection source_range;
+    unsigned long long source_version;
 } Chart;
 
+#define CHART_ROW(chart, y)  ((chart)->canvas + (size_t)(y) * (chart)->canvas_stride)
+
 // Function prototypes
 Chart* chart_create(ChartType type, const char* x_label, const char* y_label);
 Chart* chart_create_sized(ChartType type, const char* x_label, const char* y_label, int width, int height);
 void chart_free(Chart* chart);
+// Points refer to the sheet's cell text, so render the chart before the
+// sheet changes. Long line and scatter series are reduced to the plot width.
 int chart_add_data_from_range(Chart* chart, Sheet* sheet, RangeSelection* range);
 void chart_render(Chart* chart);
 void chart_display(Chart* chart, Console* console, int x, int y);
-char** chart_get_output(Chart* chart, int* line_count);
+const char* chart_get_output(Chart* chart, int* line_count, int* line_stride);
+
+// Copy the rendered chart into the console back buffer at x, y, clipped to
+// width x height
+void chart_blit(Chart* chart, Console* console, int x, int y, int width, int height);
+
+// Whether the chart was built with this layout from this range
+int chart_matches(const Chart* chart, const Sheet* sheet, const RangeSelection* range, ChartType type,
+                  const char* x_label, const char* y_label, int width, int height);
+
+// Extract and render again only if the source range changed since, or
+// render if that has not happened yet. 0 if the data could not be read.
+int chart_refresh(Chart* chart, Sheet* sheet);
 
 // Helper functions
 void chart_draw_line(Chart* chart, int x1, int y1, int x2, int y2, char symbol);
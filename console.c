@@ -94,6 +94,12 @@ void console_clear(Console* con) {
     FillConsoleOutputAttribute(con->hOut, MAKE_COLOR(COLOR_WHITE, COLOR_BLACK), 
                                con->width * con->height, topLeft, &written);
     console_set_cursor(con, 0, 0);
+    
+    // The screen is now blank, so the next flip must redraw anything else
+    for (int i = 0; i < con->width * con->height; i++) {
+        con->frontBuffer[i].Char.AsciiChar = ' ';
+        con->frontBuffer[i].Attributes = MAKE_COLOR(COLOR_WHITE, COLOR_BLACK);
+    }
 }
 
 void console_set_cursor(Console* con, SHORT x, SHORT y) {
@@ -159,18 +165,56 @@ void console_flip(Console* con) {
         return;
     }
     
-    // Only update changed characters (optimization)
+    // Only update changed characters. Consecutive changed rows are merged
+    // into one rectangle spanning the union of their changed columns, so a
+    // cursor move costs two small writes instead of a full-screen blit.
     COORD bufferSize = {con->width, con->height};
-    COORD bufferCoord = {0, 0};
-    SMALL_RECT writeRegion = {0, 0, con->width - 1, con->height - 1};
+    int band_top = -1;
+    int band_left = 0, band_right = 0;
     
-    BOOL result = WriteConsoleOutput(con->hOut, con->backBuffer, bufferSize, bufferCoord, &writeRegion);
-    if (!result) {
-        return;
+    for (int y = 0; y <= con->height; y++) {
+        int left = -1, right = -1;
+        
+        if (y < con->height) {
+            CHAR_INFO* back = con->backBuffer + y * con->width;
+            CHAR_INFO* front = con->frontBuffer + y * con->width;
+            for (int x = 0; x < con->width; x++) {
+                if (back[x].Char.AsciiChar != front[x].Char.AsciiChar ||
+                    back[x].Attributes != front[x].Attributes) {
+                    if (left < 0) left = x;
+                    right = x;
+                }
+            }
+        }
+        
+        if (left >= 0) {
+            if (band_top < 0) {
+                band_top = y;
+                band_left = left;
+                band_right = right;
+            } else {
+                if (left < band_left) band_left = left;
+                if (right > band_right) band_right = right;
+            }
+            continue;
+        }
+        
+        // Row unchanged (or past the end): flush the pending band
+        if (band_top >= 0) {
+            COORD bufferCoord = {(SHORT)band_left, (SHORT)band_top};
+            SMALL_RECT writeRegion = {(SHORT)band_left, (SHORT)band_top, (SHORT)band_right, (SHORT)(y - 1)};
+            
+            if (WriteConsoleOutput(con->hOut, con->backBuffer, bufferSize, bufferCoord, &writeRegion)) {
+                // Copy the written rectangle back to the front buffer
+                for (int row = band_top; row < y; row++) {
+                    int offset = row * con->width + band_left;
+                    memcpy(con->frontBuffer + offset, con->backBuffer + offset,
+                           (band_right - band_left + 1) * sizeof(CHAR_INFO));
+                }
+            }
+            band_top = -1;
+        }
     }
-    
-    // Copy back buffer to front buffer
-    memcpy(con->frontBuffer, con->backBuffer, con->width * con->height * sizeof(CHAR_INFO));
 }
 
 BOOL console_get_key(Console* con, KeyEvent* key) {
@@ -296,6 +340,11 @@ BOOL console_get_key(Console* con, KeyEvent* key) {
     return FALSE;
 }
 
+// Block until console input is pending or timeout_ms elapses (INFINITE waits forever)
+BOOL console_wait_input(Console* con, DWORD timeout_ms) {
+    return WaitForSingleObject(con->hIn, timeout_ms) == WAIT_OBJECT_0;
+}
+
 void console_get_size(Console* con, SHORT* width, SHORT* height) {
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     GetConsoleScreenBufferInfo(con->hOut, &csbi);
@@ -72,6 +72,7 @@ void console_write_string(Console* con, SHORT x, SHORT y, const char* str, WORD
 void console_draw_box(Console* con, SHORT x, SHORT y, SHORT w, SHORT h, WORD attr);
 void console_flip(Console* con);
 BOOL console_get_key(Console* con, KeyEvent* key);
+BOOL console_wait_input(Console* con, DWORD timeout_ms);
 void console_get_size(Console* con, SHORT* width, SHORT* height);
 
 #endif // CONSOLE_H
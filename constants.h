@@ -10,9 +10,25 @@
 #define MIN_ROW_HEIGHT              1
 #define MAX_ROW_HEIGHT              10
 
+// Cell storage (sparse tiles; see cellstore.h)
+#define CELL_CHUNK_ROWS             64
+#define CELL_CHUNK_COLS             4
+#define CELL_POOL_SLAB_SIZE         1024    // Cells per allocation slab
+
 // Formula evaluation
-#define MAX_RANGE_VALUES            1000
+#define RANGE_VALUE_BATCH           256     // Values handed to range visitors per call
 #define FLOAT_COMPARISON_EPSILON    1e-10
+#define RECALC_PARALLEL_MIN_CELLS   1024    // Smaller dependency levels are evaluated on the calling thread
+#define RECALC_SLICE_CELLS          4096    // Cells evaluated between checks of a step's time budget
+#define RECALC_STEP_MS              30      // Recalculation per main loop turn while input is idle
+
+// Workbooks (see workbook.h)
+#define WORKBOOK_RECALC_ROUNDS      8       // Per sheet: changes passed between sheets before a loop is left alone
+#define WORKBOOK_MEMORY_BUDGET      (512 * 1024 * 1024)  // Cell memory kept loaded before idle sheets are unloaded
+
+// Thread pool (see threadpool.h)
+#define THREAD_POOL_MAX_THREADS     64
+#define THREAD_POOL_BATCH           64      // Items claimed at a time
 
 // Chart dimensions
 #define DEFAULT_CHART_WIDTH         100
@@ -28,21 +44,30 @@
 #define MAX_CELL_FORMULA_LENGTH     1024
 #define MAX_CELL_DISPLAY_LENGTH     256
 #define MAX_ERROR_MESSAGE_LENGTH    128
-#define MAX_CSV_LINE_LENGTH         4096
 #define MAX_CELL_REF_LENGTH         32
 #define MAX_FUNCTION_NAME_LENGTH    32
+#define MAX_SHEET_NAME_LENGTH       64
+
+// CSV loading and saving
+#define CSV_LOAD_MAX_THREADS        8
+#define CSV_PARALLEL_MIN_BYTES      (1 << 20)  // Smaller files are parsed on the calling thread
+#define CSV_WRITE_BUFFER_SIZE       (1 << 20)  // Output is handed to fwrite in blocks this large
+
+// Clipboard text paste: pastes this large that also cover a quarter of the
+// sheet's cells are written straight into the store, like a CSV load
+#define PASTE_BULK_MIN_CELLS        4096
 
 // Undo/Redo
-#define MAX_UNDO_ACTIONS            100
+#define UNDO_MEMORY_BUDGET          (16 * 1024 * 1024)  // History bytes kept; see :undomem
+#define UNDO_COALESCE_MS            1000    // Typing this soon after typing joins the same undo step
 
 // Autosave
 #define AUTOSAVE_INTERVAL_MS        180000  // 3 minutes in milliseconds
+#define JOURNAL_FILENAME_FORMAT     "AS\\journal-%s.llj"  // One journal per sheet, by name
+#define JOURNAL_COMPACT_MIN_RECORDS 4096    // Never compact a journal shorter than this
 
 // UI and rendering
 #define CURSOR_BLINK_RATE_MS        500     // Cursor blink rate in milliseconds
-#define FRAME_SLEEP_MS              16      // Sleep time per frame (~60 FPS)
-#define CHART_POPUP_SLEEP_MS        50      // Sleep time while chart popup is open
-#define DEFAULT_SLEEP_MS            10      // Default sleep time
 
 // Navigation
 #define PAGE_JUMP_ROWS              10      // Number of rows to jump on Page Up/Down
@@ -88,7 +113,8 @@ typedef enum {
     LL_ERR_FILE_IO,
     LL_ERR_PARSE,
     LL_ERR_OVERFLOW,
-    LL_ERR_CIRCULAR_REF
+    LL_ERR_CIRCULAR_REF,
+    LL_IN_PROGRESS          // Recalculation stopped at its time budget
 } LLResult;
 
 #endif // CONSTANTS_H
@@ -0,0 +1,364 @@
+// csvload.c - Bulk CSV loading
+//
+// The file is read into memory with one read. A single pass that tracks
+// quoting finds where each row ends (quoted fields may span lines), then
+// batches of rows are parsed on worker threads. Parsing unescapes fields in
+// place, sniffs numbers and compiles formulas; the cell store, pool and
+// string table are not thread-safe, so cells are filled on the calling
+// thread once every batch is done, and the sheet is recalculated once at
+// the end (or, in lazy mode, by the following recalculation steps).
+#include <windows.h>
+#include "sheet.h"
+#include "formula.h"
+#include "stats.h"
+
+typedef enum {
+    CSV_FIELD_NUMBER,
+    CSV_FIELD_TEXT,
+    CSV_FIELD_FORMULA
+} CsvFieldKind;
+
+// One non-empty field; text points into the file buffer
+typedef struct {
+    int row;
+    int col;
+    CsvFieldKind kind;
+    double number;
+    const char* text;
+    CompiledFormula* program;   // Formulas only; NULL once owned by a cell
+} CsvField;
+
+// Rows first_row..end_row-1 and the fields parsed from them
+typedef struct {
+    char** row_starts;
+    int first_row;
+    int end_row;
+    int max_cols;
+    int preserve_formulas;
+    CsvField* fields;
+    int field_count;
+    int field_capacity;
+    int failed;
+} CsvBatch;
+
+// Whole file plus a terminator, or NULL
+static char* read_file(const char* filename, size_t* size) {
+    FILE* file;
+    if (fopen_s(&file, filename, "rb") != 0) {
+        return NULL;
+    }
+
+    char* buffer = NULL;
+    __int64 length = -1;
+    if (_fseeki64(file, 0, SEEK_END) == 0) {
+        length = _ftelli64(file);
+    }
+    if (length >= 0 && (unsigned __int64)length < (size_t)-1 &&
+        _fseeki64(file, 0, SEEK_SET) == 0) {
+        buffer = (char*)malloc((size_t)length + 1);
+    }
+    if (buffer) {
+        *size = fread(buffer, 1, (size_t)length, file);
+        if (*size != (size_t)length && ferror(file)) {
+            free(buffer);
+            buffer = NULL;
+        } else {
+            buffer[*size] = '\0';
+        }
+    }
+
+    fclose(file);
+    return buffer;
+}
+
+// Terminate every row in place and record where each starts, stopping after
+// max_rows. Outside quotes "\r\n", '\n' and a lone '\r' each end a row.
+// Returns the row count or -1.
+static int split_rows(char* buffer, size_t size, int max_rows, char*** row_starts) {
+    char** starts = NULL;
+    int count = 0;
+    int capacity = 0;
+    char* p = buffer;
+    char* end = buffer + size;
+
+    while (p < end && count < max_rows) {
+        if (count >= capacity) {
+            int new_capacity = capacity ? capacity * 2 : 1024;
+            if (new_capacity > max_rows) new_capacity = max_rows;
+            char** grown = (char**)realloc(starts, new_capacity * sizeof(char*));
+            if (!grown) {
+                free(starts);
+                return -1;
+            }
+            starts = grown;
+            capacity = new_capacity;
+        }
+        starts[count++] = p;
+
+        int in_quotes = 0;
+        int at_field_start = 1;
+        while (p < end) {
+            char c = *p;
+            if (in_quotes) {
+                if (c == '"') {
+                    if (p + 1 < end && p[1] == '"') p++;
+                    else in_quotes = 0;
+                }
+            } else if (c == '\n' || c == '\r') {
+                break;
+            } else if (c == '"' && at_field_start) {
+                in_quotes = 1;
+                at_field_start = 0;
+            } else if (c == ',') {
+                at_field_start = 1;
+            } else if (c != ' ' && c != '\t') {
+                at_field_start = 0;
+            }
+            p++;
+        }
+
+        if (p < end) {
+            char* terminator = p;
+            if (*p == '\r' && p + 1 < end && p[1] == '\n') p++;
+            p++;
+            *terminator = '\0';
+        }
+    }
+
+    *row_starts = starts;
+    return count;
+}
+
+static int batch_add(CsvBatch* batch, int row, int col, char* text) {
+    if (batch->field_count >= batch->field_capacity) {
+        int new_capacity = batch->field_capacity ? batch->field_capacity * 2 : 1024;
+        CsvField* grown = (CsvField*)realloc(batch->fields, new_capacity * sizeof(CsvField));
+        if (!grown) return 0;
+        batch->fields = grown;
+        batch->field_capacity = new_capacity;
+    }
+
+    CsvField* field = &batch->fields[batch->field_count++];
+    field->row = row;
+    field->col = col;
+    field->text = text;
+    field->number = 0.0;
+    field->program = NULL;
+
+    if (batch->preserve_formulas && text[0] == '=') {
+        // Compiling has no shared state, so it is done here on the workers
+        field->kind = CSV_FIELD_FORMULA;
+        field->program = formula_compile(text);
+        return 1;
+    }
+
+    char* endptr;
+    double value = strtod(text, &endptr);
+    if (*endptr == '\0') {
+        field->kind = CSV_FIELD_NUMBER;
+        field->number = value;
+    } else {
+        field->kind = CSV_FIELD_TEXT;
+    }
+    return 1;
+}
+
+// Split one terminated row into fields. Leading blanks are skipped, unquoted
+// fields lose trailing blanks, "" inside quotes is a quote, and text after a
+// closing quote up to the next comma is ignored.
+static int parse_row(CsvBatch* batch, int row, char* p) {
+    for (int col = 0; col < batch->max_cols; col++) {
+        while (*p == ' ' || *p == '\t') p++;
+
+        char* start = p;
+        char* dest;
+        if (*p == '"') {
+            p++;
+            start = dest = p;
+            while (*p) {
+                if (*p == '"') {
+                    if (p[1] != '"') {
+                        p++;
+                        break;
+                    }
+                    p++;
+                } else if (*p == '\r' && p[1] == '\n') {
+                    p++;  // Line breaks inside quotes read as "\n"
+                }
+                *dest++ = *p++;
+            }
+            while (*p && *p != ',') p++;
+        } else {
+            while (*p && *p != ',') p++;
+            dest = p;
+            while (dest > start && (dest[-1] == ' ' || dest[-1] == '\t')) dest--;
+        }
+
+        int more = *p == ',';
+        *dest = '\0';
+        if (dest > start && !batch_add(batch, row, col, start)) {
+            return 0;
+        }
+        if (!more) break;
+        p++;
+    }
+    return 1;
+}
+
+static void parse_batch(CsvBatch* batch) {
+    for (int row = batch->first_row; row < batch->end_row; row++) {
+        if (!parse_row(batch, row, batch->row_starts[row])) {
+            batch->failed = 1;
+            return;
+        }
+    }
+}
+
+static DWORD WINAPI csv_parse_worker(LPVOID param) {
+    parse_batch((CsvBatch*)param);
+    return 0;
+}
+
+static int parse_thread_count(size_t size, int row_count) {
+    if (size < CSV_PARALLEL_MIN_BYTES) return 1;
+
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int threads = (int)info.dwNumberOfProcessors;
+    if (threads > CSV_LOAD_MAX_THREADS) threads = CSV_LOAD_MAX_THREADS;
+    if (threads > row_count) threads = row_count;
+    return threads < 1 ? 1 : threads;
+}
+
+// Cut the rows into batches holding similar numbers of bytes
+static void assign_batches(CsvBatch* batches, int batch_count, char** row_starts,
+                           int row_count, const char* buffer, size_t size) {
+    int row = 0;
+    for (int b = 0; b < batch_count; b++) {
+        size_t limit = size / batch_count * (b + 1);
+        batches[b].first_row = row;
+        if (b == batch_count - 1) {
+            row = row_count;
+        } else {
+            while (row < row_count && (size_t)(row_starts[row] - buffer) < limit) row++;
+        }
+        batches[b].end_row = row;
+    }
+}
+
+// Load sheet from CSV file. The sheet is left untouched unless the whole
+// file could be read and parsed.
+int sheet_load_csv(Sheet* sheet, const char* filename, int preserve_formulas) {
+    long long start = stats_now();
+    size_t size = 0;
+    char* buffer = read_file(filename, &size);
+    if (!buffer) {
+        return 0;  // Failed to open file
+    }
+    stats_phase_add(STATS_CSV_READ, start);
+
+    start = stats_now();
+
+    char** row_starts = NULL;
+    int row_count = split_rows(buffer, size, sheet->rows, &row_starts);
+    if (row_count < 0) {
+        free(buffer);
+        return 0;
+    }
+
+    int batch_count = parse_thread_count(size, row_count);
+    CsvBatch* batches = (CsvBatch*)calloc(batch_count, sizeof(CsvBatch));
+    HANDLE* threads = (HANDLE*)calloc(batch_count, sizeof(HANDLE));
+    if (!batches || !threads) {
+        free(batches);
+        free(threads);
+        free(row_starts);
+        free(buffer);
+        return 0;
+    }
+
+    assign_batches(batches, batch_count, row_starts, row_count, buffer, size);
+    for (int b = 0; b < batch_count; b++) {
+        batches[b].row_starts = row_starts;
+        batches[b].max_cols = sheet->cols;
+        batches[b].preserve_formulas = preserve_formulas;
+    }
+
+    // The calling thread takes the first batch; a batch whose thread could
+    // not be started is parsed here too
+    for (int b = 1; b < batch_count; b++) {
+        threads[b] = CreateThread(NULL, 0, csv_parse_worker, &batches[b], 0, NULL);
+    }
+    parse_batch(&batches[0]);
+
+    int ok = 1;
+    for (int b = 0; b < batch_count; b++) {
+        if (threads[b]) {
+            WaitForSingleObject(threads[b], INFINITE);
+            CloseHandle(threads[b]);
+        } else if (b > 0) {
+            parse_batch(&batches[b]);
+        }
+        if (batches[b].failed) ok = 0;
+    }
+    stats_phase_add(STATS_CSV_PARSE, start);
+
+    if (ok) {
+        start = stats_now();
+
+        // Edges are rebuilt from every formula by the next recalculation
+        sheet_invalidate_dependencies(sheet);
+
+        CellIterator it;
+        Cell* existing;
+        sheet_iter_begin(sheet, &it);
+        while ((existing = sheet_iter_next(&it)) != NULL) {
+            cell_clear(existing);
+        }
+
+        for (int b = 0; b < batch_count && ok; b++) {
+            for (int i = 0; i < batches[b].field_count; i++) {
+                CsvField* field = &batches[b].fields[i];
+                Cell* cell = sheet_get_or_create_cell(sheet, field->row, field->col);
+                if (!cell) {
+                    ok = 0;
+                    break;
+                }
+
+                switch (field->kind) {
+                    case CSV_FIELD_NUMBER:
+                        cell_set_number(cell, field->number);
+                        break;
+                    case CSV_FIELD_FORMULA:
+                        cell_set_formula_compiled(cell, field->text, field->program);
+                        field->program = NULL;
+                        break;
+                    default:
+                        sheet_assign_string(sheet, cell, field->text);
+                        break;
+                }
+            }
+        }
+        sheet_recount_used_range(sheet);
+        sheet->needs_recalc = 1;
+        stats_phase_add(STATS_CSV_APPLY, start);
+    }
+
+    for (int b = 0; b < batch_count; b++) {
+        for (int i = 0; i < batches[b].field_count; i++) {
+            formula_free(batches[b].fields[i].program);
+        }
+        free(batches[b].fields);
+    }
+    free(batches);
+    free(threads);
+    free(row_starts);
+    free(buffer);
+
+    // Recalculate if we loaded formulas
+    if (ok && preserve_formulas) {
+        sheet_recalculate_loaded(sheet);
+    }
+
+    return ok;
+}
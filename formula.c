@@ -0,0 +1,1440 @@
+// formula.c - Formula compiler and bytecode evaluator
+//
+// The recursive-descent parser that used to evaluate formula text directly
+// is kept here as the compiler front end. Instead of computing values while
+// it parses, it emits postfix instructions in the same order the old parser
+// evaluated operands, so runtime errors and parse errors surface exactly as
+// before. The compiled program is stored on the cell and re-run on every
+// recalculation without touching the text again.
+#include <limits.h>
+#include "formula.h"
+#include "ranges.h"
+#include "stats.h"
+#include "workbook.h"
+
+#define FORMULA_LOCAL_STACK     64
+
+typedef struct {
+    CompiledFormula* program;
+    int depth;
+    int out_of_memory;
+} FormulaCompiler;
+
+static int compile_comparison(FormulaCompiler* c, const char* expr);
+static int compile_arithmetic(FormulaCompiler* c, const char** expr);
+static int compile_term(FormulaCompiler* c, const char** expr);
+static int compile_factor(FormulaCompiler* c, const char** expr);
+static int compile_function(FormulaCompiler* c, const char** expr);
+
+// Stack effect of each operation, used to size the evaluation stack
+static int op_stack_effect(FormulaOp op) {
+    switch (op) {
+        case OP_NUM:
+        case OP_REF:
+        case OP_RANGE_SUM:
+        case OP_STR_CMP:
+        case OP_AGG_RANGE:
+        case OP_AGG_REF:
+        case OP_AGG_NUM:
+        case OP_SHEET_REF:
+            return 1;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_CMP:
+        case OP_POWER:
+        case OP_XLOOKUP:
+            return -1;
+        case OP_IF:
+        case OP_IF_STR:
+            return -2;
+        default:
+            return 0;
+    }
+}
+
+static FormulaInstr* emit(FormulaCompiler* c, FormulaOp op, int arg) {
+    CompiledFormula* p = c->program;
+
+    if (p->code_count >= p->code_capacity) {
+        int new_capacity = p->code_capacity ? p->code_capacity * 2 : 8;
+        FormulaInstr* code = (FormulaInstr*)realloc(p->code, new_capacity * sizeof(FormulaInstr));
+        if (!code) {
+            c->out_of_memory = 1;
+            return NULL;
+        }
+        p->code = code;
+        p->code_capacity = new_capacity;
+    }
+
+    FormulaInstr* instr = &p->code[p->code_count++];
+    memset(instr, 0, sizeof(*instr));
+    instr->op = op;
+    instr->arg = arg;
+    instr->index = -1;
+
+    c->depth += op_stack_effect(op);
+    if (c->depth > p->max_stack) p->max_stack = c->depth;
+
+    return instr;
+}
+
+// Emit a syntax error at the current position and stop compiling
+static int compile_fail(FormulaCompiler* c, ErrorType error) {
+    emit(c, OP_FAIL, error);
+    return 0;
+}
+
+static int add_string(FormulaCompiler* c, const char* str) {
+    CompiledFormula* p = c->program;
+
+    if (p->string_count >= p->string_capacity) {
+        int new_capacity = p->string_capacity ? p->string_capacity * 2 : 4;
+        char** strings = (char**)realloc(p->strings, new_capacity * sizeof(char*));
+        if (!strings) {
+            c->out_of_memory = 1;
+            return -1;
+        }
+        p->strings = strings;
+        p->string_capacity = new_capacity;
+    }
+
+    char* copy = _strdup(str);
+    if (!copy) {
+        c->out_of_memory = 1;
+        return -1;
+    }
+    p->strings[p->string_count] = copy;
+    return p->string_count++;
+}
+
+static FormulaLookup* add_lookup(FormulaCompiler* c, int* index) {
+    CompiledFormula* p = c->program;
+
+    if (p->lookup_count >= p->lookup_capacity) {
+        int new_capacity = p->lookup_capacity ? p->lookup_capacity * 2 : 2;
+        FormulaLookup* lookups = (FormulaLookup*)realloc(p->lookups, new_capacity * sizeof(FormulaLookup));
+        if (!lookups) {
+            c->out_of_memory = 1;
+            return NULL;
+        }
+        p->lookups = lookups;
+        p->lookup_capacity = new_capacity;
+    }
+
+    *index = p->lookup_count;
+    FormulaLookup* lookup = &p->lookups[p->lookup_count++];
+    memset(lookup, 0, sizeof(*lookup));
+    lookup->lookup_string = -1;
+    return lookup;
+}
+
+static int comparison_kind(const char* op) {
+    if (strcmp(op, "=") == 0) return CMP_EQ;
+    if (strcmp(op, "<>") == 0) return CMP_NE;
+    if (strcmp(op, "<") == 0) return CMP_LT;
+    if (strcmp(op, "<=") == 0) return CMP_LE;
+    if (strcmp(op, ">") == 0) return CMP_GT;
+    if (strcmp(op, ">=") == 0) return CMP_GE;
+    return -1;
+}
+
+static CompiledFormula* compile_program(const char* expr) {
+    FormulaCompiler c;
+    c.program = (CompiledFormula*)calloc(1, sizeof(CompiledFormula));
+    if (!c.program) return NULL;
+    c.depth = 0;
+    c.out_of_memory = 0;
+
+    compile_comparison(&c, expr);
+
+    if (c.out_of_memory) {
+        formula_free(c.program);
+        return NULL;
+    }
+    return c.program;
+}
+
+CompiledFormula* formula_compile(const char* formula) {
+    if (!formula) return NULL;
+
+    // Skip leading '='
+    if (*formula == '=') formula++;
+
+    return compile_program(formula);
+}
+
+CompiledFormula* formula_compile_expression(const char* expr) {
+    if (!expr) return NULL;
+    return compile_program(expr);
+}
+
+void formula_free(CompiledFormula* program) {
+    if (!program) return;
+
+    for (int i = 0; i < program->string_count; i++) {
+        free(program->strings[i]);
+    }
+    free(program->strings);
+    free(program->lookups);
+    free(program->code);
+    free(program);
+}
+
+// Operands an operation pops before pushing its result
+static int op_stack_inputs(FormulaOp op) {
+    switch (op) {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_CMP:
+        case OP_POWER:
+        case OP_XLOOKUP:
+            return 2;
+        case OP_IF:
+        case OP_IF_STR:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+static int range_valid(const CellRange* range) {
+    return range->start_row >= 0 && range->start_col >= 0 &&
+           range->start_row <= range->end_row && range->start_col <= range->end_col;
+}
+
+int formula_validate(const CompiledFormula* program) {
+    if (!program || program->code_count < 0 || program->string_count < 0 ||
+        program->lookup_count < 0 || program->max_stack < 0) return 0;
+
+    for (int i = 0; i < program->string_count; i++) {
+        if (!program->strings[i]) return 0;
+    }
+    for (int i = 0; i < program->lookup_count; i++) {
+        const FormulaLookup* lookup = &program->lookups[i];
+        if (lookup->lookup_string < -1 || lookup->lookup_string >= program->string_count) return 0;
+        if (lookup->ranges_valid &&
+            (!range_valid(&lookup->lookup_range) || !range_valid(&lookup->return_range))) return 0;
+    }
+
+    int depth = 0;
+    for (int pc = 0; pc < program->code_count; pc++) {
+        const FormulaInstr* instr = &program->code[pc];
+
+        switch (instr->op) {
+            case OP_NUM:
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_POWER:
+            case OP_IF:
+                break;
+            case OP_REF:
+            case OP_AGG_REF:
+                if (instr->u.ref.row < 0 || instr->u.ref.col < 0) return 0;
+                if (instr->op == OP_AGG_REF && (instr->arg < FUNC_SUM || instr->arg > FUNC_MODE)) return 0;
+                break;
+            case OP_RANGE_SUM:
+                if (!range_valid(&instr->u.range)) return 0;
+                break;
+            case OP_AGG_RANGE:
+                if (!range_valid(&instr->u.range) || instr->arg < FUNC_SUM || instr->arg > FUNC_MODE) return 0;
+                break;
+            case OP_AGG_NUM:
+                if (instr->arg < FUNC_SUM || instr->arg > FUNC_MODE) return 0;
+                break;
+            case OP_CMP:
+                if (instr->arg < CMP_EQ || instr->arg > CMP_GE) return 0;
+                break;
+            case OP_STR_CMP:
+                if (instr->u.ref.row < 0 || instr->u.ref.col < 0 ||
+                    instr->arg < CMP_EQ || instr->arg > CMP_GE ||
+                    instr->index < 0 || instr->index >= program->string_count) return 0;
+                break;
+            case OP_IF_STR:
+                if (instr->arg < -1 || instr->arg >= program->string_count ||
+                    instr->index < -1 || instr->index >= program->string_count) return 0;
+                break;
+            case OP_XLOOKUP:
+                if (instr->index < 0 || instr->index >= program->lookup_count) return 0;
+                break;
+            case OP_FAIL:
+                if (instr->arg < ERROR_NONE || instr->arg > ERROR_CIRCULAR) return 0;
+                break;
+            case OP_SHEET_REF:
+                if (instr->u.ref.row < 0 || instr->u.ref.col < 0 ||
+                    instr->index < 0 || instr->index >= program->string_count) return 0;
+                break;
+            default:
+                return 0;
+        }
+
+        if (depth < op_stack_inputs(instr->op)) return 0;
+        depth += op_stack_effect(instr->op);
+        if (depth > program->max_stack) return 0;
+    }
+    return 1;
+}
+
+void formula_visit_references(const CompiledFormula* program, FormulaReferenceVisitor visit, void* context) {
+    if (!program || !visit) return;
+
+    for (int pc = 0; pc < program->code_count; pc++) {
+        const FormulaInstr* instr = &program->code[pc];
+        CellRange range;
+
+        switch (instr->op) {
+            case OP_REF:
+            case OP_AGG_REF:
+            case OP_STR_CMP:
+                range.start_row = range.end_row = instr->u.ref.row;
+                range.start_col = range.end_col = instr->u.ref.col;
+                visit(context, &range, 0);
+                break;
+            case OP_RANGE_SUM:
+            case OP_AGG_RANGE:
+                visit(context, &instr->u.range, 1);
+                break;
+            case OP_XLOOKUP: {
+                const FormulaLookup* lookup = &program->lookups[instr->index];
+                if (lookup->ranges_valid) {
+                    visit(context, &lookup->lookup_range, 1);
+                    visit(context, &lookup->return_range, 1);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+void formula_visit_sheet_references(const CompiledFormula* program, FormulaSheetVisitor visit, void* context) {
+    if (!program || !visit) return;
+
+    for (int pc = 0; pc < program->code_count; pc++) {
+        const FormulaInstr* instr = &program->code[pc];
+        if (instr->op == OP_SHEET_REF) {
+            visit(context, program->strings[instr->index], instr->u.ref.row, instr->u.ref.col);
+        }
+    }
+}
+
+int formula_reads_other_sheets(const CompiledFormula* program) {
+    if (!program) return 0;
+
+    for (int pc = 0; pc < program->code_count; pc++) {
+        if (program->code[pc].op == OP_SHEET_REF) return 1;
+    }
+    return 0;
+}
+
+// ============================================================================
+// Reference shifting
+// ============================================================================
+
+typedef struct {
+    char* text;
+    size_t length;
+    size_t capacity;
+} ShiftBuffer;
+
+static int shift_append(ShiftBuffer* out, const char* text, size_t length) {
+    if (out->length + length + 1 > out->capacity) {
+        size_t new_capacity = out->capacity * 2;
+        while (new_capacity < out->length + length + 1) new_capacity *= 2;
+        char* grown = (char*)realloc(out->text, new_capacity);
+        if (!grown) return 0;
+        out->text = grown;
+        out->capacity = new_capacity;
+    }
+    memcpy(out->text + out->length, text, length);
+    out->length += length;
+    out->text[out->length] = '\0';
+    return 1;
+}
+
+// New position of a referenced row or column, -1 if it is gone. Positions
+// off the sheet never held a cell and stay as written.
+static int shift_position(int pos, const ReferenceShift* shift) {
+    if (pos < shift->at || pos >= shift->limit) return pos;
+    if (shift->delta < 0) return pos == shift->at ? -1 : pos - 1;
+    return pos + 1 < shift->limit ? pos + 1 : -1;
+}
+
+// Move both ends of a span; 0 if none of it is left
+static int shift_span(int* start, int* end, const ReferenceShift* shift) {
+    int s = *start, e = *end;
+    if (shift->delta < 0) {
+        if (s > shift->at && s < shift->limit) s--;
+        if (e >= shift->at && e < shift->limit) e--;
+    } else {
+        if (s >= shift->at && s < shift->limit && ++s == shift->limit) return 0;
+        if (e >= shift->at && e < shift->limit && e + 1 < shift->limit) e++;
+    }
+    if (s > e) return 0;
+    *start = s;
+    *end = e;
+    return 1;
+}
+
+// Length of a cell reference token (letters then digits) at p, 0 if none
+static int reference_length(const char* p) {
+    const char* q = p;
+    while (isalpha(*q)) q++;
+    if (q == p || !isdigit(*q)) return 0;
+    while (isdigit(*q)) q++;
+    if (isalpha(*q) || *q == '(' || *q == '!') return 0;  // Not a reference after all
+    return (int)(q - p);
+}
+
+static int parse_reference_token(const char* p, int length, int* row, int* col) {
+    char ref[MAX_CELL_REF_LENGTH];
+    if (length >= (int)sizeof(ref)) return 0;
+    memcpy(ref, p, length);
+    ref[length] = '\0';
+    return parse_cell_reference(ref, row, col);
+}
+
+int formula_shift_references(const char* expression, const ReferenceShift* shift, char** result) {
+    ShiftBuffer out;
+    out.capacity = strlen(expression) + 32;
+    out.length = 0;
+    out.text = (char*)malloc(out.capacity);
+    if (!out.text) return -1;
+    out.text[0] = '\0';
+
+    int changed = 0;
+    const char* p = expression;
+    while (*p) {
+        // String literals and quoted sheet names are copied untouched
+        if (*p == '"' || *p == '\'') {
+            const char* close = strchr(p + 1, *p);
+            size_t length = close ? (size_t)(close - p) + 1 : strlen(p);
+            if (!shift_append(&out, p, length)) goto out_of_memory;
+            p += length;
+            continue;
+        }
+
+        // Tokens start where the compiler would start one: not inside a
+        // name or number such as SUM or 1E5. Sheet!A1 names a cell on
+        // another sheet, which this shift does not move.
+        int at_token = isalpha(*p) && (p == expression || !(isalnum(p[-1]) || p[-1] == '.' || p[-1] == '!'));
+        int length = at_token ? reference_length(p) : 0;
+        int row, col;
+        if (length == 0 || !parse_reference_token(p, length, &row, &col)) {
+            // Copy a whole word at once so its tail is not taken for a reference
+            const char* q = p + 1;
+            if (isalnum(*p)) {
+                while (isalnum(*q)) q++;
+            }
+            if (!shift_append(&out, p, q - p)) goto out_of_memory;
+            p = q;
+            continue;
+        }
+
+        // A range A1:B5, with or without spaces around the colon
+        const char* q = p + length;
+        const char* end_token = q;
+        while (*end_token == ' ') end_token++;
+        int end_length = 0, end_row = 0, end_col = 0;
+        if (*end_token == ':') {
+            end_token++;
+            while (*end_token == ' ') end_token++;
+            end_length = reference_length(end_token);
+            if (end_length && !parse_reference_token(end_token, end_length, &end_row, &end_col)) {
+                end_length = 0;
+            }
+        }
+
+        char replacement[2 * MAX_CELL_REF_LENGTH + 2];
+        int gone = 0, moved, resized = 0;
+        if (end_length) {
+            q = end_token + end_length;
+            CellRange range;
+            range.start_row = row < end_row ? row : end_row;
+            range.end_row = row < end_row ? end_row : row;
+            range.start_col = col < end_col ? col : end_col;
+            range.end_col = col < end_col ? end_col : col;
+            CellRange before = range;
+
+            if (shift->by_row) gone = !shift_span(&range.start_row, &range.end_row, shift);
+            else gone = !shift_span(&range.start_col, &range.end_col, shift);
+            moved = gone || memcmp(&before, &range, sizeof(CellRange)) != 0;
+            resized = gone || (before.end_row - before.start_row != range.end_row - range.start_row) ||
+                      (before.end_col - before.start_col != range.end_col - range.start_col);
+
+            if (moved && !gone) {
+                char start_ref[MAX_CELL_REF_LENGTH], end_ref[MAX_CELL_REF_LENGTH];
+                cell_reference_to_string(range.start_row, range.start_col, start_ref, sizeof(start_ref));
+                cell_reference_to_string(range.end_row, range.end_col, end_ref, sizeof(end_ref));
+                sprintf_s(replacement, sizeof(replacement), "%s:%s", start_ref, end_ref);
+            }
+        } else {
+            int pos = shift->by_row ? row : col;
+            int new_pos = shift_position(pos, shift);
+            gone = new_pos < 0;
+            moved = new_pos != pos;
+            resized = gone;
+            if (moved && !gone) {
+                cell_reference_to_string(shift->by_row ? new_pos : row, shift->by_row ? col : new_pos,
+                                         replacement, sizeof(replacement));
+            }
+        }
+
+        if (gone) strcpy_s(replacement, sizeof(replacement), FORMULA_REF_ERROR);
+        if (!moved) {
+            if (!shift_append(&out, p, q - p)) goto out_of_memory;
+        } else {
+            if (!shift_append(&out, replacement, strlen(replacement))) goto out_of_memory;
+            changed |= resized ? FORMULA_SHIFT_RESIZED : FORMULA_SHIFT_MOVED;
+        }
+        p = q;
+    }
+
+    if (!changed) {
+        free(out.text);
+        return 0;
+    }
+    *result = out.text;
+    return changed;
+
+out_of_memory:
+    free(out.text);
+    return -1;
+}
+
+static void shift_range(CellRange* range, const ReferenceShift* shift) {
+    CellRange moved = *range;
+    int ok = shift->by_row ? shift_span(&moved.start_row, &moved.end_row, shift)
+                           : shift_span(&moved.start_col, &moved.end_col, shift);
+    if (ok) *range = moved;
+}
+
+void formula_shift_program(CompiledFormula* program, const ReferenceShift* shift) {
+    for (int i = 0; i < program->code_count; i++) {
+        FormulaInstr* instr = &program->code[i];
+        switch (instr->op) {
+            case OP_REF:
+            case OP_STR_CMP:
+            case OP_AGG_REF: {
+                int* pos = shift->by_row ? &instr->u.ref.row : &instr->u.ref.col;
+                int new_pos = shift_position(*pos, shift);
+                if (new_pos >= 0) *pos = new_pos;
+                break;
+            }
+            case OP_RANGE_SUM:
+            case OP_AGG_RANGE:
+                shift_range(&instr->u.range, shift);
+                break;
+            default:
+                break;
+        }
+    }
+
+    for (int i = 0; i < program->lookup_count; i++) {
+        if (!program->lookups[i].ranges_valid) continue;
+        shift_range(&program->lookups[i].lookup_range, shift);
+        shift_range(&program->lookups[i].return_range, shift);
+    }
+}
+
+// Comparison with string support (cell_ref op "string"), else numeric
+static int compile_comparison(FormulaCompiler* c, const char* expr) {
+    const char* p = expr;
+
+    // Check if left side is a cell reference
+    char left_ref[32] = {0};
+    int left_ref_len = 0;
+    const char* temp_p = p;
+
+    while (*temp_p && (isalpha(*temp_p) || isdigit(*temp_p)) && left_ref_len < 31) {
+        left_ref[left_ref_len++] = *temp_p;
+        temp_p++;
+    }
+    left_ref[left_ref_len] = '\0';
+
+    int is_left_cell_ref = 0;
+    int left_row, left_col;
+    if (left_ref_len > 0 && parse_cell_reference(left_ref, &left_row, &left_col)) {
+        is_left_cell_ref = 1;
+    }
+
+    // Skip whitespace and look for comparison operator
+    skip_whitespace(&temp_p);
+    char comparison_op[3] = {0};
+    int op_len = 0;
+
+    if (*temp_p == '=' || *temp_p == '<' || *temp_p == '>') {
+        comparison_op[op_len++] = *temp_p++;
+        if (*temp_p == '=' || (*temp_p == '>' && comparison_op[0] == '<')) {
+            comparison_op[op_len++] = *temp_p++;
+        }
+        comparison_op[op_len] = '\0';
+    }
+
+    skip_whitespace(&temp_p);
+    int is_right_string = (*temp_p == '"');
+
+    // cell_ref op "string" is compiled as a string comparison
+    if (is_left_cell_ref && op_len > 0 && is_right_string) {
+        temp_p++; // Skip opening quote
+        char right_str[256] = {0};
+        int right_len = 0;
+        while (*temp_p && *temp_p != '"' && right_len < 255) {
+            right_str[right_len++] = *temp_p++;
+        }
+
+        int kind = comparison_kind(comparison_op);
+        if (kind < 0) return compile_fail(c, ERROR_PARSE);
+
+        int str_index = add_string(c, right_str);
+        FormulaInstr* instr = emit(c, OP_STR_CMP, kind);
+        if (!instr) return 0;
+        instr->index = str_index;
+        instr->u.ref.row = left_row;
+        instr->u.ref.col = left_col;
+        return 1;
+    }
+
+    // Fall back to numeric comparison
+    if (!compile_arithmetic(c, &p)) return 0;
+
+    skip_whitespace(&p);
+
+    int kind = -1;
+    if (*p == '>') {
+        p++;
+        if (*p == '=') {
+            p++;
+            kind = CMP_GE;
+        } else {
+            kind = CMP_GT;
+        }
+    } else if (*p == '<') {
+        p++;
+        if (*p == '=') {
+            p++;
+            kind = CMP_LE;
+        } else if (*p == '>') {
+            p++;
+            kind = CMP_NE;
+        } else {
+            kind = CMP_LT;
+        }
+    } else if (*p == '=') {
+        p++;
+        kind = CMP_EQ;
+    }
+
+    // No comparison operator, the arithmetic result stands
+    if (kind < 0) return 1;
+
+    if (!compile_arithmetic(c, &p)) return 0;
+    return emit(c, OP_CMP, kind) != NULL;
+}
+
+// Expression (handles + and -)
+static int compile_arithmetic(FormulaCompiler* c, const char** expr) {
+    if (!compile_term(c, expr)) return 0;
+
+    while (1) {
+        skip_whitespace(expr);
+        if (**expr == '+') {
+            (*expr)++;
+            if (!compile_term(c, expr)) return 0;
+            if (!emit(c, OP_ADD, 0)) return 0;
+        } else if (**expr == '-') {
+            (*expr)++;
+            if (!compile_term(c, expr)) return 0;
+            if (!emit(c, OP_SUB, 0)) return 0;
+        } else {
+            break;
+        }
+    }
+
+    return 1;
+}
+
+// Term (handles * and /)
+static int compile_term(FormulaCompiler* c, const char** expr) {
+    if (!compile_factor(c, expr)) return 0;
+
+    while (1) {
+        skip_whitespace(expr);
+        if (**expr == '*') {
+            (*expr)++;
+            if (!compile_factor(c, expr)) return 0;
+            if (!emit(c, OP_MUL, 0)) return 0;
+        } else if (**expr == '/') {
+            (*expr)++;
+            if (!compile_factor(c, expr)) return 0;
+            if (!emit(c, OP_DIV, 0)) return 0;
+        } else {
+            break;
+        }
+    }
+
+    return 1;
+}
+
+// Read a sheet name and its '!' if expr starts with one
+static int read_sheet_prefix(const char** expr, char* name, int size) {
+    const char* p = *expr;
+    int length = 0;
+
+    if (*p == '\'') {
+        p++;
+        while (*p && *p != '\'') {
+            if (length < size - 1) name[length++] = *p;
+            p++;
+        }
+        if (*p != '\'' || p[1] != '!') return 0;
+        p += 2;
+    } else {
+        while (isalnum(*p) || *p == '_') {
+            if (length < size - 1) name[length++] = *p;
+            p++;
+        }
+        if (length == 0 || *p != '!') return 0;
+        p++;
+    }
+    name[length] = '\0';
+    *expr = p;
+    return 1;
+}
+
+// The cell after a sheet prefix. Only single cells can be named on
+// another sheet.
+static int compile_sheet_reference(FormulaCompiler* c, const char** expr, const char* sheet_name) {
+    char ref_buf[MAX_CELL_REF_LENGTH];
+    int i = 0;
+    while ((isalpha(**expr) || isdigit(**expr)) && i < (int)sizeof(ref_buf) - 1) {
+        ref_buf[i++] = **expr;
+        (*expr)++;
+    }
+    ref_buf[i] = '\0';
+
+    int row, col;
+    if (**expr == ':' || !parse_cell_reference(ref_buf, &row, &col)) return compile_fail(c, ERROR_REF);
+
+    int name_index = add_string(c, sheet_name);
+    if (name_index < 0) return 0;
+    FormulaInstr* instr = emit(c, OP_SHEET_REF, 0);
+    if (!instr) return 0;
+    instr->index = name_index;
+    instr->u.ref.row = row;
+    instr->u.ref.col = col;
+    return 1;
+}
+
+// Factor (number, cell reference, range, parenthesized expression or function call)
+static int compile_factor(FormulaCompiler* c, const char** expr) {
+    skip_whitespace(expr);
+
+    if (**expr == '(') {
+        (*expr)++; // Skip '('
+        if (!compile_arithmetic(c, expr)) return 0;
+
+        skip_whitespace(expr);
+        if (**expr != ')') return compile_fail(c, ERROR_PARSE);
+        (*expr)++; // Skip ')'
+
+        return 1;
+    }
+
+    // Left behind by a deleted row or column (see formula_shift_references)
+    if (strncmp(*expr, FORMULA_REF_ERROR, sizeof(FORMULA_REF_ERROR) - 1) == 0) {
+        *expr += sizeof(FORMULA_REF_ERROR) - 1;
+        return compile_fail(c, ERROR_REF);
+    }
+
+    // Sheet!A1, or 'Sheet name'!A1
+    char sheet_name[MAX_SHEET_NAME_LENGTH];
+    if (read_sheet_prefix(expr, sheet_name, sizeof(sheet_name))) {
+        return compile_sheet_reference(c, expr, sheet_name);
+    }
+
+    // Look ahead to see if this is a function call (letters followed by '(')
+    const char* start = *expr;
+    const char* lookahead = *expr;
+
+    while (*lookahead && isalpha(*lookahead)) lookahead++;
+    skip_whitespace(&lookahead);
+
+    if (*lookahead == '(') {
+        return compile_function(c, expr);
+    }
+
+    // Extract potential cell reference (letters followed by numbers, possibly with colon)
+    char ref_buf[32];
+    int i = 0;
+
+    while (**expr && (isalpha(**expr) || isdigit(**expr) || **expr == ':') && i < 31) {
+        ref_buf[i++] = **expr;
+        (*expr)++;
+    }
+    ref_buf[i] = '\0';
+
+    if (i > 0) {
+        if (strchr(ref_buf, ':')) {
+            // A range without a function evaluates to its sum
+            CellRange range;
+            if (!parse_range(ref_buf, &range)) return compile_fail(c, ERROR_PARSE);
+
+            FormulaInstr* instr = emit(c, OP_RANGE_SUM, 0);
+            if (!instr) return 0;
+            instr->u.range = range;
+            return 1;
+        } else {
+            int row, col;
+            if (parse_cell_reference(ref_buf, &row, &col)) {
+                FormulaInstr* instr = emit(c, OP_REF, 0);
+                if (!instr) return 0;
+                instr->u.ref.row = row;
+                instr->u.ref.col = col;
+                return 1;
+            }
+        }
+    }
+
+    // Reset and try to parse as number
+    *expr = start;
+    char* endptr;
+    double value = strtod(*expr, &endptr);
+    if (endptr != *expr) {
+        *expr = endptr;
+        FormulaInstr* instr = emit(c, OP_NUM, 0);
+        if (!instr) return 0;
+        instr->u.number = value;
+        return 1;
+    }
+
+    return compile_fail(c, ERROR_PARSE);
+}
+
+// Read a "..." literal into buffer; returns 0 if the closing quote is missing
+static int read_string_literal(const char** expr, char* buffer, int size) {
+    (*expr)++; // Skip opening quote
+    int j = 0;
+    while (**expr && **expr != '"' && j < size - 1) {
+        buffer[j++] = **expr;
+        (*expr)++;
+    }
+    buffer[j] = '\0';
+    if (**expr != '"') return 0;
+    (*expr)++; // Skip closing quote
+    return 1;
+}
+
+static int compile_xlookup(FormulaCompiler* c, const char** expr) {
+    // XLOOKUP(lookup_value, lookup_array, return_array, [match_mode])
+    skip_whitespace(expr);
+
+    char lookup_str[256] = {0};
+    int is_string_lookup = 0;
+
+    if (**expr == '"') {
+        if (!read_string_literal(expr, lookup_str, sizeof(lookup_str))) {
+            return compile_fail(c, ERROR_PARSE);
+        }
+        is_string_lookup = 1;
+
+        // Placeholder lookup value keeps the stack layout uniform
+        FormulaInstr* instr = emit(c, OP_NUM, 0);
+        if (!instr) return 0;
+        instr->u.number = 0.0;
+    } else {
+        if (!compile_arithmetic(c, expr)) return 0;
+    }
+
+    skip_whitespace(expr);
+    if (**expr != ',') return compile_fail(c, ERROR_PARSE);
+    (*expr)++;
+
+    // Lookup array text
+    skip_whitespace(expr);
+    char lookup_array[64];
+    int lookup_len = 0;
+    while (**expr && **expr != ',' && lookup_len < 63) {
+        lookup_array[lookup_len++] = **expr;
+        (*expr)++;
+    }
+    lookup_array[lookup_len] = '\0';
+
+    skip_whitespace(expr);
+    if (**expr != ',') return compile_fail(c, ERROR_PARSE);
+    (*expr)++;
+
+    // Return array text
+    skip_whitespace(expr);
+    char return_array[64];
+    int return_len = 0;
+    while (**expr && **expr != ',' && **expr != ')' && return_len < 63) {
+        return_array[return_len++] = **expr;
+        (*expr)++;
+    }
+    return_array[return_len] = '\0';
+
+    // Optional match_mode (0 = exact, the default)
+    skip_whitespace(expr);
+    if (**expr == ',') {
+        (*expr)++;
+        skip_whitespace(expr);
+        if (!compile_arithmetic(c, expr)) return 0;
+    } else {
+        FormulaInstr* instr = emit(c, OP_NUM, 0);
+        if (!instr) return 0;
+        instr->u.number = 0.0;
+    }
+
+    skip_whitespace(expr);
+    if (**expr != ')') return compile_fail(c, ERROR_PARSE);
+    (*expr)++;
+
+    // Resolve both ranges once; a bad range is reported as #REF! at runtime
+    int lookup_index;
+    FormulaLookup* lookup = add_lookup(c, &lookup_index);
+    if (!lookup) return 0;
+    lookup->ranges_valid = parse_range(lookup_array, &lookup->lookup_range) &&
+                           parse_range(return_array, &lookup->return_range);
+    if (is_string_lookup) {
+        lookup->lookup_string = add_string(c, lookup_str);
+    }
+
+    FormulaInstr* instr = emit(c, OP_XLOOKUP, 0);
+    if (!instr) return 0;
+    instr->index = lookup_index;
+    return 1;
+}
+
+static int compile_aggregate(FormulaCompiler* c, const char** expr, FormulaFunction func) {
+    skip_whitespace(expr);
+    const char* arg_start = *expr;
+
+    // Find the end of the argument (matching closing parenthesis)
+    int paren_count = 1;
+    const char* arg_end = *expr;
+    while (*arg_end && paren_count > 0) {
+        if (*arg_end == '(') paren_count++;
+        else if (*arg_end == ')') paren_count--;
+        if (paren_count > 0) arg_end++;
+    }
+
+    int arg_len = (int)(arg_end - arg_start);
+    char arg[256];
+    if (arg_len >= (int)sizeof(arg)) return compile_fail(c, ERROR_PARSE);
+
+    strncpy_s(arg, sizeof(arg), arg_start, arg_len);
+    arg[arg_len] = '\0';
+
+    FormulaInstr* instr;
+    if (strstr(arg, FORMULA_REF_ERROR)) {
+        return compile_fail(c, ERROR_REF);
+    } else if (strchr(arg, ':')) {
+        CellRange range;
+        if (!parse_range(arg, &range)) return compile_fail(c, ERROR_PARSE);
+
+        instr = emit(c, OP_AGG_RANGE, func);
+        if (!instr) return 0;
+        instr->u.range = range;
+    } else {
+        int row, col;
+        if (parse_cell_reference(arg, &row, &col)) {
+            instr = emit(c, OP_AGG_REF, func);
+            if (!instr) return 0;
+            instr->u.ref.row = row;
+            instr->u.ref.col = col;
+        } else {
+            char* endptr;
+            double val = strtod(arg, &endptr);
+            if (*endptr != '\0') return compile_fail(c, ERROR_PARSE);
+
+            instr = emit(c, OP_AGG_NUM, func);
+            if (!instr) return 0;
+            instr->u.number = val;
+        }
+    }
+
+    // Skip closing ')' (stay on the terminator if it is missing)
+    *expr = *arg_end ? arg_end + 1 : arg_end;
+    return 1;
+}
+
+static int compile_power(FormulaCompiler* c, const char** expr) {
+    // POWER(base, exponent)
+    skip_whitespace(expr);
+
+    if (!compile_arithmetic(c, expr)) return 0;
+
+    skip_whitespace(expr);
+    if (**expr != ',') return compile_fail(c, ERROR_PARSE);
+    (*expr)++;
+
+    if (!compile_arithmetic(c, expr)) return 0;
+
+    skip_whitespace(expr);
+    if (**expr != ')') return compile_fail(c, ERROR_PARSE);
+    (*expr)++;
+
+    return emit(c, OP_POWER, 0) != NULL;
+}
+
+// Compile an IF branch: a string literal, or an arithmetic expression that
+// runs up to the next top-level ',' (true branch) or ')' (false branch)
+static int compile_if_branch(FormulaCompiler* c, const char** expr, int is_false_branch,
+                             char* str_buf, int str_size, int* has_str) {
+    skip_whitespace(expr);
+    *has_str = 0;
+
+    if (**expr == '"') {
+        if (!read_string_literal(expr, str_buf, str_size)) {
+            return compile_fail(c, ERROR_PARSE);
+        }
+        *has_str = 1;
+
+        // String branches still occupy a stack slot
+        FormulaInstr* instr = emit(c, OP_NUM, 0);
+        if (!instr) return 0;
+        instr->u.number = 0.0;
+        return 1;
+    }
+
+    const char* branch_start = *expr;
+    int paren_depth = 0;
+    while (**expr) {
+        if (**expr == '(') {
+            paren_depth++;
+        } else if (**expr == ')') {
+            if (is_false_branch && paren_depth == 0) break;
+            paren_depth--;
+        } else if (!is_false_branch && **expr == ',' && paren_depth == 0) {
+            break;
+        }
+        (*expr)++;
+    }
+
+    char branch_expr[256];
+    int branch_len = (int)(*expr - branch_start);
+    if (branch_len >= (int)sizeof(branch_expr)) return compile_fail(c, ERROR_PARSE);
+
+    strncpy_s(branch_expr, sizeof(branch_expr), branch_start, branch_len);
+    branch_expr[branch_len] = '\0';
+
+    const char* branch_ptr = branch_expr;
+    return compile_arithmetic(c, &branch_ptr);
+}
+
+static int compile_if(FormulaCompiler* c, const char** expr) {
+    // IF(condition, true_value, false_value)
+    skip_whitespace(expr);
+
+    if (!compile_comparison(c, *expr)) return 0;
+
+    // Find the comma after the condition
+    int paren_depth = 0;
+    while (**expr) {
+        if (**expr == '(') paren_depth++;
+        else if (**expr == ')') paren_depth--;
+        else if (**expr == ',' && paren_depth == 0) break;
+        (*expr)++;
+    }
+
+    if (**expr != ',') return compile_fail(c, ERROR_PARSE);
+    (*expr)++;
+
+    char true_str[256] = {0};
+    int has_true_str;
+    if (!compile_if_branch(c, expr, 0, true_str, sizeof(true_str), &has_true_str)) return 0;
+
+    skip_whitespace(expr);
+    if (**expr != ',') return compile_fail(c, ERROR_PARSE);
+    (*expr)++;
+
+    char false_str[256] = {0};
+    int has_false_str;
+    if (!compile_if_branch(c, expr, 1, false_str, sizeof(false_str), &has_false_str)) return 0;
+
+    skip_whitespace(expr);
+    if (**expr != ')') return compile_fail(c, ERROR_PARSE);
+    (*expr)++;
+
+    if (has_true_str || has_false_str) {
+        int true_index = has_true_str ? add_string(c, true_str) : -1;
+        int false_index = has_false_str ? add_string(c, false_str) : -1;
+        FormulaInstr* instr = emit(c, OP_IF_STR, true_index);
+        if (!instr) return 0;
+        instr->index = false_index;
+        return 1;
+    }
+
+    return emit(c, OP_IF, 0) != NULL;
+}
+
+static int compile_function(FormulaCompiler* c, const char** expr) {
+    skip_whitespace(expr);
+
+    // Extract function name
+    char func_name[32];
+    int i = 0;
+
+    while (**expr && isalpha(**expr) && i < 31) {
+        func_name[i++] = toupper(**expr);
+        (*expr)++;
+    }
+    func_name[i] = '\0';
+
+    skip_whitespace(expr);
+    if (**expr != '(') return compile_fail(c, ERROR_PARSE);
+    (*expr)++; // Skip '('
+
+    if (strcmp(func_name, "XLOOKUP") == 0) {
+        return compile_xlookup(c, expr);
+    } else if (strcmp(func_name, "SUM") == 0) {
+        return compile_aggregate(c, expr, FUNC_SUM);
+    } else if (strcmp(func_name, "AVG") == 0) {
+        return compile_aggregate(c, expr, FUNC_AVG);
+    } else if (strcmp(func_name, "MAX") == 0) {
+        return compile_aggregate(c, expr, FUNC_MAX);
+    } else if (strcmp(func_name, "MIN") == 0) {
+        return compile_aggregate(c, expr, FUNC_MIN);
+    } else if (strcmp(func_name, "MEDIAN") == 0) {
+        return compile_aggregate(c, expr, FUNC_MEDIAN);
+    } else if (strcmp(func_name, "MODE") == 0) {
+        return compile_aggregate(c, expr, FUNC_MODE);
+    } else if (strcmp(func_name, "POWER") == 0) {
+        return compile_power(c, expr);
+    } else if (strcmp(func_name, "IF") == 0) {
+        return compile_if(c, expr);
+    }
+
+    return compile_fail(c, ERROR_PARSE);
+}
+
+// ============================================================================
+// Evaluator
+// ============================================================================
+
+// Value of a single cell used as an operand
+static double ref_value(Sheet* sheet, int row, int col, ErrorType* error) {
+    Cell* cell = sheet_get_cell(sheet, row, col);
+    if (!cell) return 0.0; // Empty cell
+
+    switch (cell->type) {
+        case CELL_EMPTY:
+            return 0.0;
+        case CELL_NUMBER:
+            return cell->data.number;
+        case CELL_FORMULA:
+            if (cell->data.formula.error != ERROR_NONE) {
+                *error = cell->data.formula.error;
+                return 0.0;
+            }
+            return cell->data.formula.cached_value;
+        default:
+            *error = ERROR_VALUE;
+            return 0.0;
+    }
+}
+
+static double apply_aggregate(FormulaFunction func, double* values, int count) {
+    switch (func) {
+        case FUNC_SUM:    return func_sum(values, count);
+        case FUNC_AVG:    return func_avg(values, count);
+        case FUNC_MAX:    return func_max(values, count);
+        case FUNC_MIN:    return func_min(values, count);
+        case FUNC_MEDIAN: return func_median(values, count);
+        case FUNC_MODE:   return func_mode(values, count);
+        default:          return 0.0;
+    }
+}
+
+// Aggregate over a range. SUM/AVG/MIN/MAX come from the memo of the range's
+// shared descriptor, else stream through the range; only MEDIAN and MODE
+// need the values together and allocate a buffer for them.
+static double aggregate_range(Sheet* sheet, FormulaFunction func, const FormulaInstr* instr, ErrorType* error) {
+    const CellRange* range = &instr->u.range;
+    if (func == FUNC_MEDIAN || func == FUNC_MODE) {
+        size_t cells = (size_t)(range->end_row - range->start_row + 1) *
+                       (size_t)(range->end_col - range->start_col + 1);
+        if (cells > (size_t)INT_MAX) {
+            *error = ERROR_VALUE;
+            return 0.0;
+        }
+        double* values = (double*)malloc(cells * sizeof(double));
+        if (!values) {
+            *error = ERROR_VALUE;
+            return 0.0;
+        }
+        int count = get_range_values(sheet, range, values, (int)cells);
+        double result = apply_aggregate(func, values, count);
+        free(values);
+        return result;
+    }
+
+    RangeAggregate agg;
+    if (!shared_range_aggregate(sheet, instr->index, range, func == FUNC_MIN || func == FUNC_MAX, &agg)) {
+        sheet_aggregate_range(sheet, range, &agg);
+    }
+    switch (func) {
+        case FUNC_SUM: return agg.sum;
+        case FUNC_AVG: return agg.count ? agg.sum / agg.count : 0.0;
+        case FUNC_MAX: return agg.max;
+        case FUNC_MIN: return agg.min;
+        default:       return 0.0;
+    }
+}
+
+// Aggregate argument that is a single cell reference
+static double aggregate_ref(Sheet* sheet, const FormulaInstr* instr, ErrorType* error) {
+    double value = 0.0;
+    int count = 0;
+    Cell* cell = sheet_get_cell(sheet, instr->u.ref.row, instr->u.ref.col);
+
+    if (cell) {
+        switch (cell->type) {
+            case CELL_NUMBER:
+                value = cell->data.number;
+                count = 1;
+                break;
+            case CELL_FORMULA:
+                if (cell->data.formula.error == ERROR_NONE) {
+                    value = cell->data.formula.cached_value;
+                    count = 1;
+                }
+                break;
+            case CELL_EMPTY:
+                count = 1;
+                break;
+            default:
+                *error = ERROR_VALUE;
+                return 0.0;
+        }
+    } else {
+        count = 1;
+    }
+
+    return apply_aggregate((FormulaFunction)instr->arg, &value, count);
+}
+
+static const char* cell_string_value(Sheet* sheet, int row, int col) {
+    Cell* cell = sheet_get_cell(sheet, row, col);
+    if (!cell) return NULL;
+
+    switch (cell->type) {
+        case CELL_STRING:
+            return cell->data.string;
+        case CELL_FORMULA:
+            if (cell->data.formula.is_string_result && cell->data.formula.cached_string) {
+                return cell->data.formula.cached_string;
+            }
+            break;
+        default:
+            break;
+    }
+    return NULL;
+}
+
+static double compare_result(int kind, double left, double right) {
+    switch (kind) {
+        case CMP_EQ: return (fabs(left - right) < FLOAT_COMPARISON_EPSILON) ? 1.0 : 0.0;
+        case CMP_NE: return (left != right) ? 1.0 : 0.0;
+        case CMP_LT: return (left < right) ? 1.0 : 0.0;
+        case CMP_LE: return (left <= right) ? 1.0 : 0.0;
+        case CMP_GT: return (left > right) ? 1.0 : 0.0;
+        case CMP_GE: return (left >= right) ? 1.0 : 0.0;
+        default:     return 0.0;
+    }
+}
+
+static double string_compare_result(int kind, int cmp) {
+    switch (kind) {
+        case CMP_EQ: return (cmp == 0) ? 1.0 : 0.0;
+        case CMP_NE: return (cmp != 0) ? 1.0 : 0.0;
+        case CMP_LT: return (cmp < 0) ? 1.0 : 0.0;
+        case CMP_LE: return (cmp <= 0) ? 1.0 : 0.0;
+        case CMP_GT: return (cmp > 0) ? 1.0 : 0.0;
+        case CMP_GE: return (cmp >= 0) ? 1.0 : 0.0;
+        default:     return 0.0;
+    }
+}
+
+// Profiled function an instruction evaluates, or -1 for plain arithmetic
+static int instr_stats_function(const FormulaInstr* instr) {
+    switch (instr->op) {
+        case OP_RANGE_SUM:  return STATS_FUNC_SUM;
+        case OP_AGG_RANGE:
+        case OP_AGG_REF:
+        case OP_AGG_NUM:    return (instr->arg >= FUNC_SUM && instr->arg <= FUNC_MODE) ? instr->arg : -1;
+        case OP_XLOOKUP:    return STATS_FUNC_XLOOKUP;
+        case OP_IF:
+        case OP_IF_STR:     return STATS_FUNC_IF;
+        case OP_POWER:      return STATS_FUNC_POWER;
+        default:            return -1;
+    }
+}
+
+double formula_evaluate(Sheet* sheet, const CompiledFormula* program, ErrorType* error) {
+    EvalContext context = { sheet, NULL };
+    return formula_evaluate_in(&context, program, error);
+}
+
+double formula_evaluate_in(const EvalContext* context, const CompiledFormula* program, ErrorType* error) {
+    Sheet* sheet = context->sheet;
+    *error = ERROR_NONE;
+    if (!program) {
+        *error = ERROR_PARSE;
+        return 0.0;
+    }
+
+    double local_stack[FORMULA_LOCAL_STACK];
+    double* stack = local_stack;
+    if (program->max_stack > FORMULA_LOCAL_STACK) {
+        stack = (double*)malloc(program->max_stack * sizeof(double));
+        if (!stack) {
+            *error = ERROR_VALUE;
+            return 0.0;
+        }
+    }
+
+    int sp = 0;
+    double result = 0.0;
+    int profiling = stats_profiling();
+
+    for (int pc = 0; pc < program->code_count; pc++) {
+        const FormulaInstr* instr = &program->code[pc];
+        long long op_start = profiling ? stats_now() : 0;
+
+        switch (instr->op) {
+            case OP_NUM:
+                stack[sp++] = instr->u.number;
+                break;
+
+            case OP_REF:
+                stack[sp++] = ref_value(sheet, instr->u.ref.row, instr->u.ref.col, error);
+                break;
+
+            case OP_SHEET_REF: {
+                // Only sheets already in memory are read; the workbook
+                // loads a formula's sources before recalculating it
+                Sheet* other = workbook_find_loaded(sheet->workbook, program->strings[instr->index]);
+                if (other) {
+                    stack[sp++] = ref_value(other, instr->u.ref.row, instr->u.ref.col, error);
+                } else {
+                    *error = ERROR_REF;
+                    stack[sp++] = 0.0;
+                }
+                break;
+            }
+
+            case OP_RANGE_SUM:
+                stack[sp++] = aggregate_range(sheet, FUNC_SUM, instr, error);
+                break;
+
+            case OP_ADD:
+                sp--;
+                stack[sp - 1] += stack[sp];
+                break;
+
+            case OP_SUB:
+                sp--;
+                stack[sp - 1] -= stack[sp];
+                break;
+
+            case OP_MUL:
+                sp--;
+                stack[sp - 1] *= stack[sp];
+                break;
+
+            case OP_DIV:
+                sp--;
+                if (stack[sp] == 0.0) {
+                    *error = ERROR_DIV_ZERO;
+                    break;
+                }
+                stack[sp - 1] /= stack[sp];
+                break;
+
+            case OP_CMP:
+                sp--;
+                stack[sp - 1] = compare_result(instr->arg, stack[sp - 1], stack[sp]);
+                break;
+
+            case OP_STR_CMP: {
+                // Empty or non-string cells compare as ""
+                const char* left = cell_string_value(sheet, instr->u.ref.row, instr->u.ref.col);
+                int cmp = strcmp(left ? left : "", program->strings[instr->index]);
+                stack[sp++] = string_compare_result(instr->arg, cmp);
+                break;
+            }
+
+            case OP_AGG_RANGE:
+                stack[sp++] = aggregate_range(sheet, (FormulaFunction)instr->arg, instr, error);
+                break;
+
+            case OP_AGG_REF:
+                stack[sp++] = aggregate_ref(sheet, instr, error);
+                break;
+
+            case OP_AGG_NUM: {
+                double value = instr->u.number;
+                stack[sp++] = apply_aggregate((FormulaFunction)instr->arg, &value, 1);
+                break;
+            }
+
+            case OP_POWER:
+                sp--;
+                stack[sp - 1] = func_power(stack[sp - 1], stack[sp]);
+                break;
+
+            case OP_IF:
+                sp -= 2;
+                stack[sp - 1] = func_if(stack[sp - 1], stack[sp], stack[sp + 1]);
+                break;
+
+            case OP_IF_STR:
+                sp -= 2;
+                stack[sp - 1] = func_if_enhanced(context->cell, stack[sp - 1], stack[sp], stack[sp + 1],
+                                                 instr->arg >= 0 ? program->strings[instr->arg] : NULL,
+                                                 instr->index >= 0 ? program->strings[instr->index] : NULL);
+                break;
+
+            case OP_XLOOKUP: {
+                const FormulaLookup* lookup = &program->lookups[instr->index];
+                sp--;
+                int exact_match = (stack[sp] == 0.0) ? 1 : 0; // 0 = exact, 1 = approximate
+                if (!lookup->ranges_valid) {
+                    *error = ERROR_REF;
+                    break;
+                }
+                stack[sp - 1] = func_xlookup(sheet, stack[sp - 1],
+                                             lookup->lookup_string >= 0 ? program->strings[lookup->lookup_string] : NULL,
+                                             &lookup->lookup_range, &lookup->return_range,
+                                             exact_match, error);
+                break;
+            }
+
+            case OP_FAIL:
+                *error = (ErrorType)instr->arg;
+                break;
+        }
+
+        if (profiling) {
+            int function = instr_stats_function(instr);
+            if (function >= 0) stats_function_add((StatsFunction)function, op_start);
+        }
+
+        if (*error != ERROR_NONE) break;
+    }
+
+    if (*error == ERROR_NONE && sp > 0) {
+        result = stack[sp - 1];
+    }
+
+    if (stack != local_stack) free(stack);
+    return result;
+}
@@ -0,0 +1,153 @@
+// formula.h - Formula compiler and bytecode evaluator
+#ifndef FORMULA_H
+#define FORMULA_H
+
+#include "sheet.h"
+
+// Bytecode operations for the formula stack machine
+typedef enum {
+    OP_NUM,         // Push constant u.number
+    OP_REF,         // Push value of cell u.ref
+    OP_RANGE_SUM,   // Push SUM of u.range (bare range used as a factor)
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_CMP,         // Pop right, left; push comparison (arg = FormulaCompare)
+    OP_STR_CMP,     // Push string compare of cell u.ref against strings[index]
+    OP_AGG_RANGE,   // Push aggregate (arg = FormulaFunction) over u.range
+    OP_AGG_REF,     // Push aggregate over single cell u.ref
+    OP_AGG_NUM,     // Push aggregate over constant u.number
+    OP_POWER,       // Pop exponent, base; push base^exponent
+    OP_IF,          // Pop false, true, condition; push result
+    OP_IF_STR,      // Like OP_IF with string branches (arg/index = true/false string or -1)
+    OP_XLOOKUP,     // Pop mode, lookup value; push lookup result (index = lookups entry)
+    OP_FAIL,        // Stop with error arg
+    OP_SHEET_REF    // Push value of cell u.ref on the sheet named strings[index] (see workbook.h)
+} FormulaOp;
+
+// Comparison kinds for OP_CMP / OP_STR_CMP
+typedef enum {
+    CMP_EQ,
+    CMP_NE,
+    CMP_LT,
+    CMP_LE,
+    CMP_GT,
+    CMP_GE
+} FormulaCompare;
+
+// Aggregate functions for OP_AGG_*
+typedef enum {
+    FUNC_SUM,
+    FUNC_AVG,
+    FUNC_MAX,
+    FUNC_MIN,
+    FUNC_MEDIAN,
+    FUNC_MODE
+} FormulaFunction;
+
+typedef struct {
+    FormulaOp op;
+    int arg;        // Comparison, function or error code
+    int index;      // String or lookup table index, or shared range id (-1 when unused)
+    union {
+        double number;
+        struct {
+            int row, col;
+        } ref;
+        CellRange range;
+    } u;
+} FormulaInstr;
+
+// Pre-resolved XLOOKUP operands
+typedef struct {
+    CellRange lookup_range;
+    CellRange return_range;
+    int ranges_valid;       // 0 if either range failed to parse (#REF! at runtime)
+    int lookup_string;      // Index into strings for string lookups, -1 for numeric
+} FormulaLookup;
+
+// Compiled formula program stored on the cell
+typedef struct CompiledFormula {
+    FormulaInstr* code;
+    int code_count;
+    int code_capacity;
+
+    char** strings;         // String literals referenced by the code
+    int string_count;
+    int string_capacity;
+
+    FormulaLookup* lookups;
+    int lookup_count;
+    int lookup_capacity;
+
+    int max_stack;          // Deepest evaluation stack the program needs
+} CompiledFormula;
+
+// Bumped whenever the meaning of FormulaInstr changes, so programs saved by
+// an older compiler (see llb.c) are recompiled from their text instead
+#define FORMULA_BYTECODE_VERSION 1
+
+// Compile formula text (leading '=' optional). Syntax errors are compiled
+// into an OP_FAIL at the point they occur so evaluation order is unchanged.
+// Returns NULL only on allocation failure.
+CompiledFormula* formula_compile(const char* formula);
+
+// Compile an expression without skipping a leading '='
+CompiledFormula* formula_compile_expression(const char* expr);
+
+// State of one evaluation. Formulas evaluated in parallel each get their own.
+typedef struct {
+    Sheet* sheet;
+    Cell* cell;             // Cell being evaluated (receives string results), or NULL
+} EvalContext;
+
+// Run a compiled program against the sheet
+double formula_evaluate(Sheet* sheet, const CompiledFormula* program, ErrorType* error);
+double formula_evaluate_in(const EvalContext* context, const CompiledFormula* program, ErrorType* error);
+
+void formula_free(CompiledFormula* program);
+
+// Check a program that did not come from the compiler (read from a file):
+// known operations, operands in range and stack use within max_stack.
+// Returns 1 if it is safe to evaluate.
+int formula_validate(const CompiledFormula* program);
+
+// Visit every cell or range the program reads (dependency graph input).
+// Single cell references are passed as one-cell ranges with is_range = 0.
+typedef void (*FormulaReferenceVisitor)(void* context, const CellRange* range, int is_range);
+void formula_visit_references(const CompiledFormula* program, FormulaReferenceVisitor visit, void* context);
+
+// Visit every Sheet!A1 reference. These are not part of the sheet's own
+// dependency graph; the workbook tracks them (see workbook.h).
+typedef void (*FormulaSheetVisitor)(void* context, const char* sheet_name, int row, int col);
+void formula_visit_sheet_references(const CompiledFormula* program, FormulaSheetVisitor visit, void* context);
+int formula_reads_other_sheets(const CompiledFormula* program);
+
+// Written in place of a reference whose cell was deleted
+#define FORMULA_REF_ERROR "#REF!"
+
+// A row or column inserted before `at` (delta 1) or deleted at `at` (delta -1)
+typedef struct {
+    int by_row;             // Rows move, else columns
+    int at;
+    int delta;
+    int limit;              // Rows or columns in the sheet
+} ReferenceShift;
+
+// formula_shift_references results (0 = no reference changed)
+#define FORMULA_SHIFT_MOVED     1   // References moved but still name the same cells
+#define FORMULA_SHIFT_RESIZED   2   // A range gained or lost cells, or a reference became #REF!
+
+// Rewrite formula text so its references follow the cells they name through
+// the shift. A reference to a deleted cell, or to one pushed off the sheet,
+// becomes #REF!; ranges grow, shrink or move with their ends. Returns the
+// FORMULA_SHIFT_* flags with a new string in *result, 0 if nothing changed,
+// or -1 if out of memory.
+int formula_shift_references(const char* expression, const ReferenceShift* shift, char** result);
+
+// Move the references of a compiled program the same way, for a shift whose
+// text rewrite was FORMULA_SHIFT_MOVED only
+void formula_shift_program(CompiledFormula* program, const ReferenceShift* shift);
+
+#endif // FORMULA_H
@@ -0,0 +1,553 @@
+// journal.c - Append-only change journal for crash recovery
+//
+// Edits the undo system sees are queued here by position. After each batch
+// of input the queued positions are written in their current state, one
+// text record per line:
+//
+//   C <row> <col> <E|N|S|F> <format> <style> <text color> <bg color> [payload]
+//   W <col> <width>
+//   H <row> <height>
+//   I R|C <index>      row or column inserted
+//   D R|C <index>      row or column deleted
+//   R                  every cell cleared (CSV load)
+//
+// Replaying the records in order rebuilds the sheet. Every sheet of the
+// workbook has a journal of its own, so records never name a sheet. Compaction replaces
+// the file with the minimal records for the current contents.
+#include "journal.h"
+
+#define JOURNAL_INITIAL_BUFFER 4096
+
+static int buffer_reserve(JournalBuffer* buffer, size_t extra) {
+    if (buffer->size + extra <= buffer->capacity) return 1;
+    
+    size_t new_capacity = buffer->capacity ? buffer->capacity : JOURNAL_INITIAL_BUFFER;
+    while (new_capacity < buffer->size + extra) new_capacity *= 2;
+    
+    char* grown = (char*)realloc(buffer->data, new_capacity);
+    if (!grown) return 0;
+    buffer->data = grown;
+    buffer->capacity = new_capacity;
+    return 1;
+}
+
+static int buffer_append(JournalBuffer* buffer, const char* text, size_t length) {
+    if (!buffer_reserve(buffer, length)) return 0;
+    memcpy(buffer->data + buffer->size, text, length);
+    buffer->size += length;
+    return 1;
+}
+
+// Text payloads stay on one line: backslash, newline and CR are escaped
+static int buffer_append_escaped(JournalBuffer* buffer, const char* text) {
+    for (const char* p = text; *p; p++) {
+        const char* escape = NULL;
+        if (*p == '\\') escape = "\\\\";
+        else if (*p == '\n') escape = "\\n";
+        else if (*p == '\r') escape = "\\r";
+        
+        if (escape ? !buffer_append(buffer, escape, 2) : !buffer_append(buffer, p, 1)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void buffer_free(JournalBuffer* buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+static int append_cell_record(JournalBuffer* buffer, Sheet* sheet, int row, int col) {
+    Cell* cell = sheet_get_cell(sheet, row, col);
+    char header[128];
+    char type = 'E';
+    
+    if (cell) {
+        switch (cell->type) {
+            case CELL_NUMBER:  type = 'N'; break;
+            case CELL_STRING:  type = 'S'; break;
+            case CELL_FORMULA: type = 'F'; break;
+            default:           type = 'E'; break;
+        }
+    }
+    
+    int length = sprintf_s(header, sizeof(header), "C %d %d %c %d %d %d %d ", row, col, type,
+                           cell ? (int)cell->format : (int)FORMAT_GENERAL,
+                           cell ? (int)cell->format_style : 0,
+                           cell ? cell->text_color : -1,
+                           cell ? cell->background_color : -1);
+    if (!buffer_append(buffer, header, length)) return 0;
+    
+    if (type == 'N') {
+        char number[64];
+        length = sprintf_s(number, sizeof(number), "%.17g", cell->data.number);
+        if (!buffer_append(buffer, number, length)) return 0;
+    } else if (type == 'S') {
+        if (!buffer_append_escaped(buffer, cell->data.string ? cell->data.string : "")) return 0;
+    } else if (type == 'F') {
+        if (!buffer_append_escaped(buffer, cell->data.formula.expression ? cell->data.formula.expression : "")) return 0;
+    }
+    return buffer_append(buffer, "\n", 1);
+}
+
+static int append_size_record(JournalBuffer* buffer, char tag, int index, int size) {
+    char line[64];
+    int length = sprintf_s(line, sizeof(line), "%c %d %d\n", tag, index, size);
+    return buffer_append(buffer, line, length);
+}
+
+// Hands formatted records to the file, or holds them while compacting
+static int journal_emit(Journal* journal, JournalBuffer* records, int record_count) {
+    if (record_count == 0) return 1;
+    
+    if (journal->compacting) {
+        if (!buffer_append(&journal->held, records->data, records->size)) return 0;
+        journal->held_records += record_count;
+        return 1;
+    }
+    
+    if (!journal->file) return 0;
+    if (fwrite(records->data, 1, records->size, journal->file) != records->size) return 0;
+    fflush(journal->file);
+    journal->record_count += record_count;
+    return 1;
+}
+
+static void journal_queue(Journal* journal, JournalTouchKind kind, int row, int col) {
+    if (journal->pending_count >= journal->pending_capacity) {
+        int new_capacity = journal->pending_capacity ? journal->pending_capacity * 2 : 64;
+        JournalTouch* grown = (JournalTouch*)realloc(journal->pending, new_capacity * sizeof(JournalTouch));
+        if (!grown) return;
+        journal->pending = grown;
+        journal->pending_capacity = new_capacity;
+    }
+    
+    JournalTouch* touch = &journal->pending[journal->pending_count++];
+    touch->kind = kind;
+    touch->row = row;
+    touch->col = col;
+}
+
+void journal_touch_cell(Journal* journal, int row, int col) {
+    journal_queue(journal, JOURNAL_TOUCH_CELL, row, col);
+}
+
+void journal_touch_range(Journal* journal, int start_row, int start_col, int end_row, int end_col) {
+    for (int row = start_row; row <= end_row; row++) {
+        for (int col = start_col; col <= end_col; col++) {
+            journal_queue(journal, JOURNAL_TOUCH_CELL, row, col);
+        }
+    }
+}
+
+void journal_touch_columns(Journal* journal, int start_col, int end_col) {
+    for (int col = start_col; col <= end_col; col++) {
+        journal_queue(journal, JOURNAL_TOUCH_COLUMN, 0, col);
+    }
+}
+
+void journal_touch_rows(Journal* journal, int start_row, int end_row) {
+    for (int row = start_row; row <= end_row; row++) {
+        journal_queue(journal, JOURNAL_TOUCH_ROW, row, 0);
+    }
+}
+
+static int compare_touch(const void* a, const void* b) {
+    const JournalTouch* x = (const JournalTouch*)a;
+    const JournalTouch* y = (const JournalTouch*)b;
+    if (x->kind != y->kind) return (int)x->kind - (int)y->kind;
+    if (x->row != y->row) return x->row - y->row;
+    return x->col - y->col;
+}
+
+// Writes each queued position once, in its current state
+int journal_flush(Journal* journal, Sheet* sheet) {
+    JournalBuffer records = {0};
+    int record_count = 0;
+    int ok = 1;
+    
+    if (journal->pending_count == 0) return 1;
+    
+    qsort(journal->pending, journal->pending_count, sizeof(JournalTouch), compare_touch);
+    
+    for (int i = 0; i < journal->pending_count && ok; i++) {
+        const JournalTouch* touch = &journal->pending[i];
+        if (i > 0 && compare_touch(touch, touch - 1) == 0) continue;
+        
+        if (touch->row < 0 || touch->row >= sheet->rows || touch->col < 0 || touch->col >= sheet->cols) {
+            continue;
+        }
+        
+        switch (touch->kind) {
+            case JOURNAL_TOUCH_CELL:
+                ok = append_cell_record(&records, sheet, touch->row, touch->col);
+                break;
+            case JOURNAL_TOUCH_COLUMN:
+                ok = append_size_record(&records, 'W', touch->col, sheet_get_column_width(sheet, touch->col));
+                break;
+            case JOURNAL_TOUCH_ROW:
+                ok = append_size_record(&records, 'H', touch->row, sheet_get_row_height(sheet, touch->row));
+                break;
+        }
+        record_count++;
+    }
+    journal->pending_count = 0;
+    
+    if (ok) ok = journal_emit(journal, &records, record_count);
+    buffer_free(&records);
+    return ok;
+}
+
+void journal_log_structure(Journal* journal, Sheet* sheet, JournalStructureOp op, int index) {
+    static const char* const records[] = { "I R %d\n", "D R %d\n", "I C %d\n", "D C %d\n" };
+    char line[32];
+    JournalBuffer buffer = {0};
+    
+    // Queued positions refer to the layout before the shift
+    journal_flush(journal, sheet);
+    
+    int length = sprintf_s(line, sizeof(line), records[op], index);
+    if (buffer_append(&buffer, line, length)) {
+        journal_emit(journal, &buffer, 1);
+    }
+    buffer_free(&buffer);
+}
+
+void journal_log_reset(Journal* journal, Sheet* sheet) {
+    JournalBuffer buffer = {0};
+    CellIterator it;
+    Cell* cell;
+    
+    // Whatever was queued is superseded by the new contents
+    journal->pending_count = 0;
+    if (buffer_append(&buffer, "R\n", 2)) {
+        journal_emit(journal, &buffer, 1);
+    }
+    buffer_free(&buffer);
+    
+    sheet_iter_begin(sheet, &it);
+    while ((cell = sheet_iter_next(&it)) != NULL) {
+        journal_touch_cell(journal, cell->row, cell->col);
+    }
+}
+
+char* journal_snapshot(Sheet* sheet, size_t* size, int* records) {
+    JournalBuffer buffer = {0};
+    CellIterator it;
+    Cell* cell;
+    int count = 0;
+    
+    // Never return NULL for an empty sheet; the snapshot is then an empty file
+    if (!buffer_reserve(&buffer, 1)) return NULL;
+    
+    sheet_iter_begin(sheet, &it);
+    while ((cell = sheet_iter_next(&it)) != NULL) {
+        if (!append_cell_record(&buffer, sheet, cell->row, cell->col)) goto fail;
+        count++;
+    }
+    for (int col = 0; col < sheet->cols; col++) {
+        int width = sheet_get_column_width(sheet, col);
+        if (width != DEFAULT_COLUMN_WIDTH) {
+            if (!append_size_record(&buffer, 'W', col, width)) goto fail;
+            count++;
+        }
+    }
+    for (int row = 0; row < sheet->rows; row++) {
+        int height = sheet_get_row_height(sheet, row);
+        if (height != DEFAULT_ROW_HEIGHT) {
+            if (!append_size_record(&buffer, 'H', row, height)) goto fail;
+            count++;
+        }
+    }
+    
+    *size = buffer.size;
+    *records = count;
+    return buffer.data;
+    
+fail:
+    buffer_free(&buffer);
+    return NULL;
+}
+
+// Compacting pays off once most records describe overwritten states
+int journal_should_compact(const Journal* journal, Sheet* sheet) {
+    if (journal->compacting || journal->record_count < JOURNAL_COMPACT_MIN_RECORDS) return 0;
+    return journal->record_count > 2 * sheet->cells->cell_count;
+}
+
+void journal_begin_compaction(Journal* journal, int records) {
+    // The compacted copy is renamed over the file, so stop appending to it
+    if (journal->file) {
+        fclose(journal->file);
+        journal->file = NULL;
+    }
+    journal->compacting = 1;
+    journal->compact_records = records;
+    journal->held.size = 0;
+    journal->held_records = 0;
+}
+
+void journal_end_compaction(Journal* journal, int succeeded) {
+    if (!journal->compacting) return;
+    
+    journal->compacting = 0;
+    if (succeeded) {
+        journal->record_count = journal->compact_records;
+    }
+    
+    // On failure the old journal is untouched and the held records extend it
+    if (fopen_s(&journal->file, journal->path, "ab") != 0) {
+        journal->file = NULL;
+    }
+    journal_emit(journal, &journal->held, journal->held_records);
+    buffer_free(&journal->held);
+    journal->held_records = 0;
+}
+
+static void unescape_in_place(char* text) {
+    char* out = text;
+    for (char* p = text; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+            *out++ = *p == 'n' ? '\n' : *p == 'r' ? '\r' : *p;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+}
+
+// Reads one line of any length; returns NULL at end of file
+static char* read_line(FILE* file, JournalBuffer* line) {
+    char chunk[1024];
+    
+    line->size = 0;
+    while (fgets(chunk, sizeof(chunk), file)) {
+        size_t length = strlen(chunk);
+        if (!buffer_append(line, chunk, length)) return NULL;
+        if (length > 0 && chunk[length - 1] == '\n') break;
+    }
+    if (line->size == 0) return NULL;
+    
+    // Drop the line ending and terminate
+    while (line->size > 0 && (line->data[line->size - 1] == '\n' || line->data[line->size - 1] == '\r')) {
+        line->size--;
+    }
+    if (!buffer_append(line, "", 1)) return NULL;
+    return line->data;
+}
+
+// Reads the next space-separated integer field of a record
+static int next_int(char** cursor, int* value) {
+    char* end;
+    long parsed = strtol(*cursor, &end, 10);
+    if (end == *cursor) return 0;
+    *value = (int)parsed;
+    *cursor = end;
+    return 1;
+}
+
+static int replay_cell(Sheet* sheet, char* record) {
+    int row, col, format, style, text_color, background_color;
+    char* cursor = record + 1;
+    
+    if (!next_int(&cursor, &row) || !next_int(&cursor, &col)) return 0;
+    if (cursor[0] != ' ' || !cursor[1] || cursor[2] != ' ') return 0;
+    char type = cursor[1];
+    cursor += 2;
+    if (!next_int(&cursor, &format) || !next_int(&cursor, &style) ||
+        !next_int(&cursor, &text_color) || !next_int(&cursor, &background_color)) {
+        return 0;
+    }
+    if (*cursor == ' ') cursor++;
+    if (row < 0 || row >= sheet->rows || col < 0 || col >= sheet->cols) return 0;
+    
+    char* payload = cursor;
+    
+    sheet_clear_cell(sheet, row, col);
+    switch (type) {
+        case 'N':
+            sheet_set_number(sheet, row, col, strtod(payload, NULL));
+            break;
+        case 'S':
+            unescape_in_place(payload);
+            sheet_set_string(sheet, row, col, payload);
+            break;
+        case 'F':
+            unescape_in_place(payload);
+            sheet_set_formula(sheet, row, col, payload);
+            break;
+        default:
+            break;
+    }
+    
+    // An empty cell is only kept when it carries formatting
+    if (type != 'E' || format != FORMAT_GENERAL || text_color != -1 || background_color != -1) {
+        Cell* cell = sheet_get_or_create_cell(sheet, row, col);
+        if (cell) {
+            cell_set_format(cell, (DataFormat)format, (FormatStyle)style);
+            cell_set_text_color(cell, text_color);
+            cell_set_background_color(cell, background_color);
+        }
+    }
+    return 1;
+}
+
+static void replay_reset(Sheet* sheet) {
+    CellIterator it;
+    Cell* cell;
+    sheet_iter_begin(sheet, &it);
+    while ((cell = sheet_iter_next(&it)) != NULL) {
+        sheet_clear_cell(sheet, cell->row, cell->col);
+    }
+}
+
+int journal_replay(Sheet* sheet, const char* path) {
+    FILE* file;
+    JournalBuffer line = {0};
+    char* record;
+    int applied = 0;
+    
+    if (fopen_s(&file, path, "rb") != 0) {
+        return -1;
+    }
+    
+    while ((record = read_line(file, &line)) != NULL) {
+        int index, size;
+        
+        switch (record[0]) {
+            case 'C':
+                applied += replay_cell(sheet, record);
+                break;
+            case 'W':
+                if (sscanf_s(record, "W %d %d", &index, &size) == 2) {
+                    sheet_set_column_width(sheet, index, size);
+                    applied++;
+                }
+                break;
+            case 'H':
+                if (sscanf_s(record, "H %d %d", &index, &size) == 2) {
+                    sheet_set_row_height(sheet, index, size);
+                    applied++;
+                }
+                break;
+            case 'I':
+            case 'D': {
+                char axis = record[1] == ' ' ? record[2] : '\0';
+                char* cursor = record + 3;
+                if ((axis == 'R' || axis == 'C') && next_int(&cursor, &index) &&
+                    index >= 0 && index < (axis == 'R' ? sheet->rows : sheet->cols)) {
+                    if (record[0] == 'I') {
+                        if (axis == 'R') sheet_insert_row(sheet, index);
+                        else sheet_insert_column(sheet, index);
+                    } else {
+                        if (axis == 'R') sheet_delete_row(sheet, index);
+                        else sheet_delete_column(sheet, index);
+                    }
+                    applied++;
+                }
+                break;
+            }
+            case 'R':
+                replay_reset(sheet);
+                applied++;
+                break;
+            default:
+                break;  // Torn final line or unknown record: skip it
+        }
+    }
+    
+    buffer_free(&line);
+    fclose(file);
+    
+    if (applied > 0) {
+        sheet_recalculate_loaded(sheet);
+    }
+    return applied;
+}
+
+void journal_sheet_path(const char* name, char* path, size_t size) {
+    char encoded[MAX_SHEET_NAME_LENGTH * 3];
+    size_t length = 0;
+    
+    for (const unsigned char* p = (const unsigned char*)name; *p && length + 4 <= sizeof(encoded); p++) {
+        if (isalnum(*p) || *p == ' ' || *p == '-' || *p == '_' || *p == '.') {
+            encoded[length++] = (char)*p;
+        } else {
+            length += sprintf_s(encoded + length, sizeof(encoded) - length, "%%%02X", *p);
+        }
+    }
+    encoded[length] = '\0';
+    sprintf_s(path, size, JOURNAL_FILENAME_FORMAT, encoded);
+}
+
+int journal_open(Journal* journal, const char* path, Sheet* sheet, int* recovered) {
+    memset(journal, 0, sizeof(Journal));
+    strcpy_s(journal->path, sizeof(journal->path), path);
+    
+    int applied = journal_replay(sheet, path);
+    if (recovered) *recovered = applied > 0 ? applied : 0;
+    journal->record_count = applied > 0 ? applied : 0;
+    
+    if (fopen_s(&journal->file, path, "ab") != 0) {
+        journal->file = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+// The journal only guards against crashes; a clean exit discards it.
+// Any background compaction must have finished first.
+void journal_close(Journal* journal, int discard) {
+    if (journal->file) {
+        fclose(journal->file);
+        journal->file = NULL;
+    }
+    if (discard) {
+        remove(journal->path);
+    }
+    free(journal->pending);
+    journal->pending = NULL;
+    journal->pending_count = 0;
+    journal->pending_capacity = 0;
+    buffer_free(&journal->held);
+}
+
+int journal_shelf_reserve(JournalShelf* shelf, int count) {
+    if (count <= shelf->capacity) return 1;
+    
+    int new_capacity = count * 2;
+    Journal* grown = (Journal*)realloc(shelf->journals, new_capacity * sizeof(Journal));
+    if (!grown) return 0;
+    memset(grown + shelf->capacity, 0, (new_capacity - shelf->capacity) * sizeof(Journal));
+    shelf->journals = grown;
+    shelf->capacity = new_capacity;
+    return 1;
+}
+
+void journal_switch(Journal* journal, JournalShelf* shelf, int from, int to, Sheet* sheet, int* recovered) {
+    Journal* shelved = &shelf->journals[to];
+    
+    if (recovered) *recovered = 0;
+    shelf->journals[from] = *journal;
+    if (shelved->path[0]) {
+        *journal = *shelved;
+        memset(shelved, 0, sizeof(Journal));
+    } else {
+        char path[MAX_PATH];
+        journal_sheet_path(sheet->name, path, sizeof(path));
+        journal_open(journal, path, sheet, recovered);
+    }
+}
+
+void journal_shelf_close(JournalShelf* shelf, int discard) {
+    for (int i = 0; i < shelf->capacity; i++) {
+        if (shelf->journals[i].path[0]) journal_close(&shelf->journals[i], discard);
+    }
+    free(shelf->journals);
+    shelf->journals = NULL;
+    shelf->capacity = 0;
+}
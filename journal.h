@@ -0,0 +1,100 @@
+// journal.h - Append-only change journal for crash recovery
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <windows.h>
+#include <stdio.h>
+#include "sheet.h"
+
+typedef enum {
+    JOURNAL_TOUCH_CELL,
+    JOURNAL_TOUCH_COLUMN,   // Column width changed
+    JOURNAL_TOUCH_ROW       // Row height changed
+} JournalTouchKind;
+
+typedef enum {
+    JOURNAL_INSERT_ROW,
+    JOURNAL_DELETE_ROW,
+    JOURNAL_INSERT_COLUMN,
+    JOURNAL_DELETE_COLUMN
+} JournalStructureOp;
+
+typedef struct {
+    JournalTouchKind kind;
+    int row;
+    int col;
+} JournalTouch;
+
+// Growable text buffer records are formatted into
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} JournalBuffer;
+
+typedef struct {
+    char path[MAX_PATH];
+    FILE* file;                 // Open for append; NULL while compacting or disabled
+    
+    // Positions edited since the last flush, written in their state at flush time
+    JournalTouch* pending;
+    int pending_count;
+    int pending_capacity;
+    
+    int record_count;           // Records in the file
+    
+    // While a compacted copy is written in the background, flushed records
+    // are held here and appended to whichever file survives
+    int compacting;
+    int compact_records;        // Records in the compacted copy
+    JournalBuffer held;
+    int held_records;
+} Journal;
+
+// Each sheet keeps its own journal. Characters a file name cannot hold are
+// written as %XX, so every sheet name maps to a different file.
+void journal_sheet_path(const char* name, char* path, size_t size);
+
+// Journals of the sheets not shown, by workbook index. Only the shown sheet
+// is edited, so the others are just kept open, untouched, until shown again.
+typedef struct {
+    Journal* journals;          // path[0] == '\0' where none was opened yet
+    int capacity;
+} JournalShelf;
+
+// Make room for a workbook of `count` sheets; 0 if memory ran out
+int journal_shelf_reserve(JournalShelf* shelf, int count);
+// Shelve the shown sheet's journal (flushed and not compacting, its sheet
+// at `from`) and take the one of the sheet at `to`, replaying it into
+// `sheet` the first time
+void journal_switch(Journal* journal, JournalShelf* shelf, int from, int to, Sheet* sheet, int* recovered);
+void journal_shelf_close(JournalShelf* shelf, int discard);
+
+// Replays an existing journal into the sheet (returning how many records
+// were applied through *recovered) and opens it for appending
+int journal_open(Journal* journal, const char* path, Sheet* sheet, int* recovered);
+void journal_close(Journal* journal, int discard);
+
+// Queue positions whose current state must reach the journal
+void journal_touch_cell(Journal* journal, int row, int col);
+void journal_touch_range(Journal* journal, int start_row, int start_col, int end_row, int end_col);
+void journal_touch_columns(Journal* journal, int start_col, int end_col);
+void journal_touch_rows(Journal* journal, int start_row, int end_row);
+
+// Call before inserting or deleting, so queued positions are written first
+void journal_log_structure(Journal* journal, Sheet* sheet, JournalStructureOp op, int index);
+// Call after replacing the whole sheet (CSV load)
+void journal_log_reset(Journal* journal, Sheet* sheet);
+
+int journal_flush(Journal* journal, Sheet* sheet);
+
+// Compaction: the snapshot is the minimal journal for the sheet's contents
+int journal_should_compact(const Journal* journal, Sheet* sheet);
+char* journal_snapshot(Sheet* sheet, size_t* size, int* records);
+void journal_begin_compaction(Journal* journal, int records);
+void journal_end_compaction(Journal* journal, int succeeded);
+
+// Applies a journal file to the sheet; returns records applied or -1
+int journal_replay(Sheet* sheet, const char* path);
+
+#endif // JOURNAL_H
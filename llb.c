@@ -0,0 +1,795 @@
+// llb.c - Native binary sheet format
+//
+// A .llb file keeps everything CSV loses: cell types, formats and colors,
+// column widths and row heights, cached results and compiled formula
+// programs. Loading maps the file and copies its typed columns straight
+// into cells, so nothing is parsed, compiled or recalculated.
+//
+// Values are little-endian and every section starts on an 8-byte boundary:
+//
+//   LlbHeader
+//   layout       int32 column widths[cols], int32 row heights[rows]
+//   strings      uint64 offsets[string_count + 1], then NUL-terminated text
+//   directory    LlbBlock[block_count]
+//   blocks       one per populated cell store chunk
+//
+// A block holds the n cells of one chunk as columns, in slot order:
+//
+//   double value[n]          number, or cached formula value
+//   uint32 text[n]           string text or formula expression (string index)
+//   uint32 result[n]         cached string result of a formula
+//   int32  width[n], row_height[n], precision[n]   (padded to 8 bytes)
+//   uint8  slot[n], type[n], flags[n], error[n], format[n], format_style[n], align[n]
+//   int8   text_color[n], background_color[n]      (padded to 8 bytes)
+//   programs                 one per cell flagged LLB_FLAG_PROGRAM, in slot order
+//
+// A program is an LlbProgram followed by its instructions, its strings (as
+// string indices) and its lookups. Programs are only used when the file's
+// bytecode version matches FORMULA_BYTECODE_VERSION and formula_validate
+// accepts them; otherwise the formula is compiled from its text.
+#include <stdint.h>
+#include "llb.h"
+#include "formula.h"
+
+#define LLB_MAGIC               "LLB1"
+#define LLB_VERSION             2
+#define LLB_NO_STRING           0xFFFFFFFFu
+#define LLB_FLAG_STRING_RESULT  1
+#define LLB_FLAG_PROGRAM        2
+#define LLB_CHUNK_SLOTS         (CELL_CHUNK_ROWS * CELL_CHUNK_COLS)
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t bytecode_version;
+    int32_t rows;
+    int32_t cols;
+    uint32_t name;              // String index of the sheet name
+    uint32_t string_count;
+    uint32_t block_count;
+    uint64_t layout_offset;
+    uint64_t strings_offset;
+    uint64_t directory_offset;
+    uint64_t file_size;
+} LlbHeader;
+
+typedef struct {
+    int32_t chunk_row;
+    int32_t chunk_col;
+    uint32_t cell_count;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+} LlbBlock;
+
+typedef struct {
+    int32_t code_count;
+    int32_t string_count;
+    int32_t lookup_count;
+    int32_t max_stack;
+} LlbProgram;
+
+typedef struct {
+    int32_t op;
+    int32_t arg;
+    int32_t index;
+    int32_t reserved;
+    union {
+        double number;          // OP_NUM, OP_AGG_NUM
+        int32_t cell[4];        // Row, column (references) or a CellRange
+    } u;
+} LlbInstr;
+
+typedef struct {
+    int32_t lookup_range[4];
+    int32_t return_range[4];
+    int32_t ranges_valid;
+    int32_t lookup_string;      // Program string number or -1
+} LlbLookup;
+
+static uint64_t align8(uint64_t size) {
+    return (size + 7) & ~(uint64_t)7;
+}
+
+// Offset of a block's byte columns. The int32 columns are padded so that
+// the byte columns, and the programs after them, stay 8-byte aligned.
+static uint64_t block_bytes_offset(uint64_t n) {
+    return n * (sizeof(double) + 2 * sizeof(uint32_t)) + align8(n * 3 * sizeof(int32_t));
+}
+
+// Bytes of a block's cell columns, before its programs
+static uint64_t block_columns_size(uint64_t n) {
+    return block_bytes_offset(n) + align8(n * 9);
+}
+
+static uint64_t program_size(const CompiledFormula* program) {
+    return sizeof(LlbProgram) + program->code_count * sizeof(LlbInstr) +
+           align8(program->string_count * sizeof(uint32_t)) + program->lookup_count * sizeof(LlbLookup);
+}
+
+static int has_program(const Cell* cell) {
+    return cell->type == CELL_FORMULA && cell->data.formula.compiled;
+}
+
+// ---------------------------------------------------------------------------
+// Saving
+
+// Distinct strings of the file, numbered in first-use order
+typedef struct {
+    const char** items;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t* slots;            // Open-addressed hash of index + 1 (0 = empty)
+    uint32_t slot_capacity;
+    uint64_t text_size;
+} LlbStrings;
+
+static uint32_t llb_hash(const char* str) {
+    uint32_t h = 2166136261u;
+    while (*str) {
+        h ^= (unsigned char)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int strings_grow(LlbStrings* strings) {
+    uint32_t new_capacity = strings->slot_capacity ? strings->slot_capacity * 2 : 1024;
+    uint32_t* slots = (uint32_t*)calloc(new_capacity, sizeof(uint32_t));
+    if (!slots) return 0;
+
+    for (uint32_t i = 0; i < strings->count; i++) {
+        uint32_t pos = llb_hash(strings->items[i]) & (new_capacity - 1);
+        while (slots[pos]) pos = (pos + 1) & (new_capacity - 1);
+        slots[pos] = i + 1;
+    }
+    free(strings->slots);
+    strings->slots = slots;
+    strings->slot_capacity = new_capacity;
+    return 1;
+}
+
+// Number of a string in the file, adding it on first use. LLB_NO_STRING
+// for NULL; sets *failed on allocation failure.
+static uint32_t string_id(LlbStrings* strings, const char* str, int* failed) {
+    if (!str) return LLB_NO_STRING;
+
+    if ((strings->count + 1) * 2 > strings->slot_capacity && !strings_grow(strings)) {
+        *failed = 1;
+        return LLB_NO_STRING;
+    }
+
+    uint32_t mask = strings->slot_capacity - 1;
+    uint32_t pos = llb_hash(str) & mask;
+    while (strings->slots[pos]) {
+        uint32_t index = strings->slots[pos] - 1;
+        if (strcmp(strings->items[index], str) == 0) return index;
+        pos = (pos + 1) & mask;
+    }
+
+    if (strings->count >= strings->capacity) {
+        uint32_t new_capacity = strings->capacity ? strings->capacity * 2 : 1024;
+        const char** items = (const char**)realloc((void*)strings->items, new_capacity * sizeof(const char*));
+        if (!items) {
+            *failed = 1;
+            return LLB_NO_STRING;
+        }
+        strings->items = items;
+        strings->capacity = new_capacity;
+    }
+
+    strings->items[strings->count] = str;
+    strings->slots[pos] = strings->count + 1;
+    strings->text_size += strlen(str) + 1;
+    return strings->count++;
+}
+
+static void strings_free(LlbStrings* strings) {
+    free((void*)strings->items);
+    free(strings->slots);
+}
+
+// Text a cell saves as its main string, if any
+static const char* cell_text(const Cell* cell) {
+    if (cell->type == CELL_STRING) return cell->data.string;
+    if (cell->type == CELL_FORMULA) return cell->data.formula.expression;
+    return NULL;
+}
+
+static const char* cell_result(const Cell* cell) {
+    if (cell->type == CELL_FORMULA && cell->data.formula.is_string_result) {
+        return cell->data.formula.cached_string;
+    }
+    return NULL;
+}
+
+static int register_strings(LlbStrings* strings, const CellChunk* chunk) {
+    int failed = 0;
+    for (int slot = 0; slot < LLB_CHUNK_SLOTS && !failed; slot++) {
+        const Cell* cell = chunk->slots[slot];
+        if (!cell) continue;
+
+        string_id(strings, cell_text(cell), &failed);
+        string_id(strings, cell_result(cell), &failed);
+        if (has_program(cell)) {
+            const CompiledFormula* program = cell->data.formula.compiled;
+            for (int i = 0; i < program->string_count; i++) {
+                string_id(strings, program->strings[i], &failed);
+            }
+        }
+    }
+    return !failed;
+}
+
+typedef struct {
+    FILE* file;
+    int failed;
+} LlbWriter;
+
+static void write_bytes(LlbWriter* writer, const void* data, size_t size) {
+    if (size > 0 && fwrite(data, 1, size, writer->file) != size) writer->failed = 1;
+}
+
+static void write_padding(LlbWriter* writer, uint64_t size) {
+    static const char zeros[8] = {0};
+    write_bytes(writer, zeros, (size_t)(align8(size) - size));
+}
+
+static void copy_range(int32_t* out, const CellRange* range) {
+    out[0] = range->start_row;
+    out[1] = range->start_col;
+    out[2] = range->end_row;
+    out[3] = range->end_col;
+}
+
+static void write_program(LlbWriter* writer, LlbStrings* strings, const CompiledFormula* program) {
+    LlbProgram header = { program->code_count, program->string_count,
+                          program->lookup_count, program->max_stack };
+    write_bytes(writer, &header, sizeof(header));
+
+    for (int pc = 0; pc < program->code_count; pc++) {
+        const FormulaInstr* instr = &program->code[pc];
+        LlbInstr out;
+        memset(&out, 0, sizeof(out));
+        out.op = instr->op;
+        out.arg = instr->arg;
+        out.index = instr->index;
+        switch (instr->op) {
+            case OP_NUM:
+            case OP_AGG_NUM:
+                out.u.number = instr->u.number;
+                break;
+            case OP_REF:
+            case OP_AGG_REF:
+            case OP_STR_CMP:
+            case OP_SHEET_REF:
+                out.u.cell[0] = instr->u.ref.row;
+                out.u.cell[1] = instr->u.ref.col;
+                break;
+            case OP_RANGE_SUM:
+            case OP_AGG_RANGE:
+                copy_range(out.u.cell, &instr->u.range);
+                out.index = -1;     // Shared range ids belong to this sheet only
+                break;
+            default:
+                break;
+        }
+        write_bytes(writer, &out, sizeof(out));
+    }
+
+    int failed = 0;
+    for (int i = 0; i < program->string_count; i++) {
+        uint32_t id = string_id(strings, program->strings[i], &failed);
+        write_bytes(writer, &id, sizeof(id));
+    }
+    write_padding(writer, program->string_count * sizeof(uint32_t));
+
+    for (int i = 0; i < program->lookup_count; i++) {
+        const FormulaLookup* lookup = &program->lookups[i];
+        LlbLookup out;
+        copy_range(out.lookup_range, &lookup->lookup_range);
+        copy_range(out.return_range, &lookup->return_range);
+        out.ranges_valid = lookup->ranges_valid;
+        out.lookup_string = lookup->lookup_string;
+        write_bytes(writer, &out, sizeof(out));
+    }
+}
+
+static void write_block(LlbWriter* writer, LlbStrings* strings, const CellChunk* chunk, char* scratch) {
+    const Cell* cells[LLB_CHUNK_SLOTS];
+    uint8_t slots[LLB_CHUNK_SLOTS];
+    uint32_t n = 0;
+    int failed = 0;
+
+    for (int slot = 0; slot < LLB_CHUNK_SLOTS; slot++) {
+        if (chunk->slots[slot]) {
+            cells[n] = chunk->slots[slot];
+            slots[n] = (uint8_t)slot;
+            n++;
+        }
+    }
+
+    // Columns are laid out back to back in the scratch buffer
+    double* value = (double*)scratch;
+    uint32_t* text = (uint32_t*)(value + n);
+    uint32_t* result = text + n;
+    int32_t* width = (int32_t*)(result + n);
+    int32_t* row_height = width + n;
+    int32_t* precision = row_height + n;
+    uint8_t* slot = (uint8_t*)scratch + block_bytes_offset(n);
+    uint8_t* type = slot + n;
+    uint8_t* flags = type + n;
+    uint8_t* error = flags + n;
+    uint8_t* format = error + n;
+    uint8_t* format_style = format + n;
+    uint8_t* align = format_style + n;
+    int8_t* text_color = (int8_t*)(align + n);
+    int8_t* background_color = text_color + n;
+
+    uint64_t size = block_columns_size(n);
+    memset(scratch, 0, (size_t)size);
+
+    for (uint32_t i = 0; i < n; i++) {
+        const Cell* cell = cells[i];
+        value[i] = cell->type == CELL_NUMBER ? cell->data.number :
+                   cell->type == CELL_FORMULA ? cell->data.formula.cached_value : 0.0;
+        text[i] = string_id(strings, cell_text(cell), &failed);
+        result[i] = string_id(strings, cell_result(cell), &failed);
+        width[i] = cell->width;
+        row_height[i] = cell->row_height;
+        precision[i] = cell->precision;
+        slot[i] = slots[i];
+        type[i] = (uint8_t)cell->type;
+        if (cell->type == CELL_FORMULA) {
+            flags[i] = (cell->data.formula.is_string_result ? LLB_FLAG_STRING_RESULT : 0) |
+                       (has_program(cell) ? LLB_FLAG_PROGRAM : 0);
+            error[i] = (uint8_t)cell->data.formula.error;
+        }
+        format[i] = (uint8_t)cell->format;
+        format_style[i] = (uint8_t)cell->format_style;
+        align[i] = (uint8_t)cell->align;
+        text_color[i] = (int8_t)cell->text_color;
+        background_color[i] = (int8_t)cell->background_color;
+    }
+    write_bytes(writer, scratch, (size_t)size);
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (has_program(cells[i])) {
+            write_program(writer, strings, cells[i]->data.formula.compiled);
+        }
+    }
+}
+
+int sheet_save_llb(Sheet* sheet, const char* filename) {
+    // Cached values are stored, and trusted on load
+    sheet_recalculate(sheet);
+
+    const CellStore* store = sheet->cells;
+    LlbStrings strings;
+    memset(&strings, 0, sizeof(strings));
+
+    LlbBlock* directory = NULL;
+    char* scratch = (char*)malloc((size_t)block_columns_size(LLB_CHUNK_SLOTS));
+    if (store->chunk_count > 0) {
+        directory = (LlbBlock*)calloc(store->chunk_count, sizeof(LlbBlock));
+    }
+    if (!scratch || (store->chunk_count > 0 && !directory)) {
+        free(scratch);
+        free(directory);
+        return 0;
+    }
+
+    // Number every string first; the string section precedes the blocks
+    int failed = 0;
+    uint32_t name = string_id(&strings, sheet->name, &failed);
+    for (int c = 0; c < store->chunk_count && !failed; c++) {
+        if (store->chunks[c]->count > 0 && !register_strings(&strings, store->chunks[c])) failed = 1;
+    }
+
+    LlbHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LLB_MAGIC, 4);
+    header.version = LLB_VERSION;
+    header.bytecode_version = FORMULA_BYTECODE_VERSION;
+    header.rows = sheet->rows;
+    header.cols = sheet->cols;
+    header.name = name;
+    header.string_count = strings.count;
+    header.layout_offset = sizeof(LlbHeader);
+    header.strings_offset = header.layout_offset + align8((uint64_t)(sheet->cols + sheet->rows) * sizeof(int32_t));
+    header.directory_offset = header.strings_offset +
+                              align8((strings.count + 1) * sizeof(uint64_t) + strings.text_size);
+
+    // Lay out the blocks
+    uint32_t block_count = 0;
+    for (int c = 0; c < store->chunk_count; c++) {
+        const CellChunk* chunk = store->chunks[c];
+        if (chunk->count > 0) block_count++;
+    }
+    uint64_t offset = header.directory_offset + block_count * sizeof(LlbBlock);
+    block_count = 0;
+    for (int c = 0; c < store->chunk_count; c++) {
+        const CellChunk* chunk = store->chunks[c];
+        if (chunk->count <= 0) continue;
+
+        LlbBlock* block = &directory[block_count++];
+        block->chunk_row = chunk->chunk_row;
+        block->chunk_col = chunk->chunk_col;
+        block->cell_count = (uint32_t)chunk->count;
+        block->offset = offset;
+        block->size = block_columns_size(block->cell_count);
+        for (int slot = 0; slot < LLB_CHUNK_SLOTS; slot++) {
+            const Cell* cell = chunk->slots[slot];
+            if (cell && has_program(cell)) block->size += program_size(cell->data.formula.compiled);
+        }
+        offset += block->size;
+    }
+    header.block_count = block_count;
+    header.file_size = offset;
+
+    LlbWriter writer = { NULL, failed };
+    if (!failed && fopen_s(&writer.file, filename, "wb") != 0) {
+        writer.file = NULL;
+        writer.failed = 1;
+    }
+
+    if (writer.file) {
+        write_bytes(&writer, &header, sizeof(header));
+
+        write_bytes(&writer, sheet->col_widths, sheet->cols * sizeof(int32_t));
+        write_bytes(&writer, sheet->row_heights, sheet->rows * sizeof(int32_t));
+        write_padding(&writer, (uint64_t)(sheet->cols + sheet->rows) * sizeof(int32_t));
+
+        uint64_t text_offset = 0;
+        for (uint32_t i = 0; i <= strings.count; i++) {
+            write_bytes(&writer, &text_offset, sizeof(text_offset));
+            if (i < strings.count) text_offset += strlen(strings.items[i]) + 1;
+        }
+        for (uint32_t i = 0; i < strings.count; i++) {
+            write_bytes(&writer, strings.items[i], strlen(strings.items[i]) + 1);
+        }
+        write_padding(&writer, (strings.count + 1) * sizeof(uint64_t) + strings.text_size);
+
+        write_bytes(&writer, directory, block_count * sizeof(LlbBlock));
+        for (int c = 0; c < store->chunk_count; c++) {
+            if (store->chunks[c]->count > 0) write_block(&writer, &strings, store->chunks[c], scratch);
+        }
+
+        if (fclose(writer.file) != 0) writer.failed = 1;
+    }
+
+    strings_free(&strings);
+    free(directory);
+    free(scratch);
+    return !writer.failed;
+}
+
+// ---------------------------------------------------------------------------
+// Loading
+
+typedef struct {
+    const unsigned char* base;
+    uint64_t size;
+    const LlbHeader* header;
+    const uint64_t* string_offsets;
+    const char* string_text;
+    int trust_programs;
+} LlbFile;
+
+// Pointer to size bytes at offset, or NULL if that runs past the file
+static const void* file_span(const LlbFile* file, uint64_t offset, uint64_t size) {
+    if (offset > file->size || size > file->size - offset) return NULL;
+    return file->base + offset;
+}
+
+static const char* file_string(const LlbFile* file, uint32_t index) {
+    if (index >= file->header->string_count) return NULL;
+    return file->string_text + file->string_offsets[index];
+}
+
+static int read_strings(LlbFile* file) {
+    uint32_t count = file->header->string_count;
+    uint64_t table_size = (uint64_t)(count + 1) * sizeof(uint64_t);
+
+    file->string_offsets = (const uint64_t*)file_span(file, file->header->strings_offset, table_size);
+    if (!file->string_offsets) return 0;
+
+    uint64_t text_size = file->string_offsets[count];
+    file->string_text = (const char*)file_span(file, file->header->strings_offset + table_size, text_size);
+    if (!file->string_text || file->string_offsets[0] != 0) return 0;
+
+    // Every string is non-overlapping and ends in its own terminator
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t start = file->string_offsets[i];
+        uint64_t end = file->string_offsets[i + 1];
+        if (end <= start || end > text_size || file->string_text[end - 1] != '\0') return 0;
+    }
+    return 1;
+}
+
+static void read_range(CellRange* range, const int32_t* in) {
+    range->start_row = in[0];
+    range->start_col = in[1];
+    range->end_row = in[2];
+    range->end_col = in[3];
+}
+
+// Decode the program at *offset and advance past it. Returns 0 if the file
+// is malformed; *program is NULL when the program cannot be used as is.
+static int read_program(const LlbFile* file, uint64_t* offset, uint64_t end, CompiledFormula** program) {
+    *program = NULL;
+
+    const LlbProgram* header = (const LlbProgram*)file_span(file, *offset, sizeof(LlbProgram));
+    if (!header || header->code_count < 0 || header->string_count < 0 || header->lookup_count < 0) return 0;
+
+    uint64_t code_offset = *offset + sizeof(LlbProgram);
+    uint64_t strings_offset = code_offset + (uint64_t)header->code_count * sizeof(LlbInstr);
+    uint64_t lookups_offset = strings_offset + align8((uint64_t)header->string_count * sizeof(uint32_t));
+    uint64_t next = lookups_offset + (uint64_t)header->lookup_count * sizeof(LlbLookup);
+    if (next > end) return 0;
+    *offset = next;
+
+    if (!file->trust_programs) return 1;
+
+    const unsigned char* code = file->base + code_offset;
+    const uint32_t* string_ids = (const uint32_t*)(file->base + strings_offset);
+    const LlbLookup* lookups = (const LlbLookup*)(file->base + lookups_offset);
+
+    CompiledFormula* p = (CompiledFormula*)calloc(1, sizeof(CompiledFormula));
+    if (!p) return 1;
+    p->code = (FormulaInstr*)calloc(header->code_count ? header->code_count : 1, sizeof(FormulaInstr));
+    p->strings = (char**)calloc(header->string_count ? header->string_count : 1, sizeof(char*));
+    p->lookups = (FormulaLookup*)calloc(header->lookup_count ? header->lookup_count : 1, sizeof(FormulaLookup));
+    if (!p->code || !p->strings || !p->lookups) {
+        formula_free(p);
+        return 1;
+    }
+    p->code_capacity = header->code_count;
+    p->string_capacity = header->string_count;
+    p->lookup_capacity = header->lookup_count;
+    p->max_stack = header->max_stack;
+
+    for (int pc = 0; pc < header->code_count; pc++) {
+        // Copied out rather than read in place: a hand-made or damaged file
+        // need not keep the instructions aligned for their double
+        LlbInstr in;
+        memcpy(&in, code + (size_t)pc * sizeof(LlbInstr), sizeof(in));
+
+        FormulaInstr* instr = &p->code[pc];
+        instr->op = (FormulaOp)in.op;
+        instr->arg = in.arg;
+        instr->index = in.index;
+        switch (instr->op) {
+            case OP_NUM:
+            case OP_AGG_NUM:
+                instr->u.number = in.u.number;
+                break;
+            case OP_REF:
+            case OP_AGG_REF:
+            case OP_STR_CMP:
+            case OP_SHEET_REF:
+                instr->u.ref.row = in.u.cell[0];
+                instr->u.ref.col = in.u.cell[1];
+                break;
+            case OP_RANGE_SUM:
+            case OP_AGG_RANGE:
+                read_range(&instr->u.range, in.u.cell);
+                break;
+            default:
+                break;
+        }
+    }
+    p->code_count = header->code_count;
+
+    for (int i = 0; i < header->string_count; i++) {
+        const char* str = file_string(file, string_ids[i]);
+        p->strings[i] = str ? _strdup(str) : NULL;
+        p->string_count++;
+    }
+
+    for (int i = 0; i < header->lookup_count; i++) {
+        FormulaLookup* lookup = &p->lookups[i];
+        read_range(&lookup->lookup_range, lookups[i].lookup_range);
+        read_range(&lookup->return_range, lookups[i].return_range);
+        lookup->ranges_valid = lookups[i].ranges_valid != 0;
+        lookup->lookup_string = lookups[i].lookup_string;
+    }
+    p->lookup_count = header->lookup_count;
+
+    // Anything suspicious is recompiled from the formula text instead
+    if (!formula_validate(p)) {
+        formula_free(p);
+        return 1;
+    }
+    *program = p;
+    return 1;
+}
+
+static int read_block(const LlbFile* file, const LlbBlock* block, Sheet* sheet) {
+    uint32_t n = block->cell_count;
+    if (n == 0 || n > LLB_CHUNK_SLOTS || block->chunk_row < 0 || block->chunk_col < 0) return 0;
+    if (!file_span(file, block->offset, block->size) || block->size < block_columns_size(n)) return 0;
+
+    const unsigned char* base = file->base + block->offset;
+    const double* value = (const double*)base;
+    const uint32_t* text = (const uint32_t*)(value + n);
+    const uint32_t* result = text + n;
+    const int32_t* width = (const int32_t*)(result + n);
+    const int32_t* row_height = width + n;
+    const int32_t* precision = row_height + n;
+    const uint8_t* slot = base + block_bytes_offset(n);
+    const uint8_t* type = slot + n;
+    const uint8_t* flags = type + n;
+    const uint8_t* error = flags + n;
+    const uint8_t* format = error + n;
+    const uint8_t* format_style = format + n;
+    const uint8_t* align = format_style + n;
+    const int8_t* text_color = (const int8_t*)(align + n);
+    const int8_t* background_color = text_color + n;
+
+    uint64_t program_offset = block->offset + block_columns_size(n);
+    uint64_t end = block->offset + block->size;
+
+    for (uint32_t i = 0; i < n; i++) {
+        CompiledFormula* program = NULL;
+        if (type[i] == CELL_FORMULA && (flags[i] & LLB_FLAG_PROGRAM) &&
+            !read_program(file, &program_offset, end, &program)) return 0;
+
+        int64_t row = (int64_t)block->chunk_row * CELL_CHUNK_ROWS + slot[i] / CELL_CHUNK_COLS;
+        int64_t col = (int64_t)block->chunk_col * CELL_CHUNK_COLS + slot[i] % CELL_CHUNK_COLS;
+        if (row >= sheet->rows || col >= sheet->cols) {
+            formula_free(program);
+            continue;
+        }
+        if (type[i] > CELL_ERROR || format[i] > FORMAT_DATETIME ||
+            format_style[i] > DATETIME_STYLE_ISO || error[i] > ERROR_CIRCULAR) {
+            formula_free(program);
+            return 0;
+        }
+
+        Cell* cell = sheet_get_or_create_cell(sheet, (int)row, (int)col);
+        if (!cell) {
+            formula_free(program);
+            return 0;
+        }
+
+        const char* str = file_string(file, text[i]);
+        switch (type[i]) {
+            case CELL_NUMBER:
+                cell_set_number(cell, value[i]);
+                break;
+            case CELL_STRING:
+                if (!str) return 0;
+                sheet_assign_string(sheet, cell, str);
+                break;
+            case CELL_FORMULA:
+                if (!str) {
+                    formula_free(program);
+                    return 0;
+                }
+                cell_set_formula_compiled(cell, str, program);
+                if (cell->type == CELL_FORMULA) {
+                    cell->data.formula.cached_value = value[i];
+                    cell->data.formula.error = (ErrorType)error[i];
+                    const char* cached = file_string(file, result[i]);
+                    if ((flags[i] & LLB_FLAG_STRING_RESULT) && cached) {
+                        cell->data.formula.cached_string = _strdup(cached);
+                        cell->data.formula.is_string_result = cell->data.formula.cached_string != NULL;
+                    }
+                }
+                break;
+            default:
+                cell_clear(cell);
+                cell->type = (CellType)type[i];
+                break;
+        }
+
+        cell->width = width[i];
+        cell->row_height = row_height[i];
+        cell->precision = precision[i];
+        cell->format = (DataFormat)format[i];
+        cell->format_style = (FormatStyle)format_style[i];
+        cell->align = align[i];
+        cell->text_color = text_color[i];
+        cell->background_color = background_color[i];
+    }
+    return 1;
+}
+
+// Read a mapped file into a new sheet the size of `like`
+static Sheet* read_sheet(LlbFile* file, const Sheet* like) {
+    const LlbHeader* header = file->header;
+    if (header->rows < 0 || header->cols < 0) return NULL;
+
+    const int32_t* layout = (const int32_t*)file_span(file, header->layout_offset,
+                                                      ((uint64_t)header->cols + header->rows) * sizeof(int32_t));
+    const LlbBlock* directory = (const LlbBlock*)file_span(file, header->directory_offset,
+                                                           (uint64_t)header->block_count * sizeof(LlbBlock));
+    if (!layout || !directory || !read_strings(file)) return NULL;
+
+    Sheet* sheet = sheet_new(like->rows, like->cols);
+    if (!sheet) return NULL;
+
+    const char* name = file_string(file, header->name);
+    char* name_copy = name ? _strdup(name) : NULL;
+    if (name_copy) {
+        free(sheet->name);
+        sheet->name = name_copy;
+    }
+
+    for (int col = 0; col < header->cols && col < sheet->cols; col++) {
+        sheet->col_widths[col] = layout[col];
+    }
+    for (int row = 0; row < header->rows && row < sheet->rows; row++) {
+        sheet->row_heights[row] = layout[header->cols + row];
+    }
+
+    for (uint32_t b = 0; b < header->block_count; b++) {
+        if (!read_block(file, &directory[b], sheet)) {
+            sheet_free(sheet);
+            return NULL;
+        }
+    }
+
+    // Cached values are current; edges are rebuilt by the next recalculation
+    sheet_recount_used_range(sheet);
+    sheet_invalidate_dependencies(sheet);
+    sheet->needs_recalc = 0;
+    return sheet;
+}
+
+int sheet_load_llb(Sheet* sheet, const char* filename) {
+    HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return 0;  // Failed to open file
+    }
+
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(handle, &size) && size.QuadPart >= (LONGLONG)sizeof(LlbHeader)) {
+        mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+    // The view stays valid once the handles are closed
+    if (mapping) CloseHandle(mapping);
+    CloseHandle(handle);
+    if (!view) {
+        return 0;
+    }
+
+    LlbFile file;
+    memset(&file, 0, sizeof(file));
+    file.base = (const unsigned char*)view;
+    file.size = (uint64_t)size.QuadPart;
+    file.header = (const LlbHeader*)view;
+
+    Sheet* loaded = NULL;
+    if (memcmp(file.header->magic, LLB_MAGIC, 4) == 0 && file.header->version == LLB_VERSION &&
+        file.header->file_size == file.size) {
+        file.trust_programs = file.header->bytecode_version == FORMULA_BYTECODE_VERSION;
+        loaded = read_sheet(&file, sheet);
+    }
+    UnmapViewOfFile(view);
+    if (!loaded) {
+        return 0;
+    }
+
+    // Take over the loaded contents; the selection, clipboard,
+    // recalculation threads and focus stay
+    Sheet previous = *sheet;
+    *sheet = *loaded;
+    *loaded = previous;
+    sheet->selection = previous.selection;
+    sheet->range_clipboard = previous.range_clipboard;
+    sheet->recalc_pool = previous.recalc_pool;
+    sheet->recalc_threads = previous.recalc_threads;
+    sheet->calc_focus = previous.calc_focus;
+    sheet->calc_focus_set = previous.calc_focus_set;
+    loaded->range_clipboard.cells = NULL;
+    loaded->range_clipboard.is_active = 0;
+    loaded->recalc_pool = NULL;
+    sheet_free(loaded);
+    return 1;
+}
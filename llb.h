@@ -0,0 +1,18 @@
+// llb.h - Native binary sheet format (.llb)
+#ifndef LLB_H
+#define LLB_H
+
+#include <windows.h>
+#include "sheet.h"
+
+// Save everything needed to reopen the sheet as it is: typed contents,
+// formatting, column widths and row heights, cached results and compiled
+// formulas. Returns 1 on success.
+int sheet_save_llb(Sheet* sheet, const char* filename);
+
+// Replace the sheet's contents with a .llb file, without parsing text,
+// compiling formulas or recalculating. Cells outside the sheet are skipped.
+// The sheet is left untouched unless the whole file is valid.
+int sheet_load_llb(Sheet* sheet, const char* filename);
+
+#endif // LLB_H
@@ -0,0 +1,325 @@
+// lookup.c - Shared XLOOKUP indexes over lookup ranges
+//
+// Rate tables are typically read by thousands of XLOOKUPs naming the same
+// range. Each distinct lookup range gets one index: a hash of its strings
+// for exact string matches, and its numbers sorted for the epsilon-tolerant
+// exact match and the approximate (largest value <= key) match.
+// Numbers cannot be hashed because exact matches allow FLOAT_COMPARISON_EPSILON.
+#include "lookup.h"
+#include "ranges.h"
+
+static unsigned int lookup_hash(const char* str) {
+    unsigned int h = 2166136261u;
+    while (*str) {
+        h ^= (unsigned char)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int compare_lookup_number(const void* a, const void* b) {
+    const LookupNumber* x = (const LookupNumber*)a;
+    const LookupNumber* y = (const LookupNumber*)b;
+    if (x->value < y->value) return -1;
+    if (x->value > y->value) return 1;
+    return x->position - y->position;
+}
+
+static void lookup_index_clear(LookupIndex* index) {
+    free(index->numbers);
+    free(index->keys);
+    free(index->string_positions);
+    free(index->string_next);
+    index->numbers = NULL;
+    index->keys = NULL;
+    index->string_positions = NULL;
+    index->string_next = NULL;
+    index->number_count = 0;
+    index->key_capacity = 0;
+    index->string_count = 0;
+    index->valid = 0;
+}
+
+// Text a lookup cell matches against, as func_xlookup defines it
+static const char* lookup_cell_string(const Cell* cell) {
+    if (cell->type == CELL_STRING) return cell->data.string;
+    if (cell->type == CELL_FORMULA && cell->data.formula.is_string_result) {
+        return cell->data.formula.cached_string;
+    }
+    return NULL;
+}
+
+typedef struct {
+    Sheet* sheet;
+    LookupIndex* index;
+    int position;           // Offset within the range of the run's first value
+} LookupGather;
+
+// Numbers come straight from the store's value arrays; only cells that may
+// carry text are looked up
+static void lookup_gather_run(void* context, int row, const double* values, const unsigned char* kinds, int count) {
+    LookupGather* gather = (LookupGather*)context;
+    LookupIndex* index = gather->index;
+    const CellRange* range = &index->range;
+
+    for (int n = 0; values && n < count; n++) {
+        int i = gather->position + n;
+        CellValueKind kind = (CellValueKind)kinds[n];
+
+        // NaN never compares equal or <=, so it can never match
+        if ((kind == CELL_VALUE_NUMBER || kind == CELL_VALUE_TEXT_RESULT) && values[n] == values[n]) {
+            index->numbers[index->number_count].value = values[n];
+            index->numbers[index->number_count].position = i;
+            index->number_count++;
+        }
+
+        if (kind == CELL_VALUE_TEXT || kind == CELL_VALUE_TEXT_RESULT || kind == CELL_VALUE_ERROR) {
+            int cell_row = index->is_vertical ? row + n : range->start_row;
+            int cell_col = index->is_vertical ? range->start_col : range->start_col + i;
+            if (lookup_cell_string(sheet_get_cell(gather->sheet, cell_row, cell_col))) {
+                index->string_positions[index->string_count] = i;
+                index->string_next[index->string_count] = -1;
+                index->string_count++;
+            }
+        }
+    }
+    gather->position += count;
+}
+
+static int lookup_index_build(Sheet* sheet, LookupIndex* index) {
+    const CellRange* range = &index->range;
+    int count = index->is_vertical ? range->end_row - range->start_row + 1
+                                   : range->end_col - range->start_col + 1;
+
+    index->numbers = (LookupNumber*)malloc(count * sizeof(LookupNumber));
+    index->string_positions = (int*)malloc(count * sizeof(int));
+    index->string_next = (int*)malloc(count * sizeof(int));
+    if (!index->numbers || !index->string_positions || !index->string_next) {
+        lookup_index_clear(index);
+        return 0;
+    }
+
+    // Gather numbers and string occurrences in position order
+    LookupGather gather = { sheet, index, 0 };
+    if (index->is_vertical) {
+        sheet_visit_column(sheet, range->start_col, range->start_row, range->end_row, lookup_gather_run, &gather);
+    } else {
+        for (int col = range->start_col; col <= range->end_col; col++) {
+            sheet_visit_column(sheet, col, range->start_row, range->start_row, lookup_gather_run, &gather);
+        }
+    }
+    qsort(index->numbers, index->number_count, sizeof(LookupNumber), compare_lookup_number);
+
+    // Hash the distinct strings, chaining repeats in position order
+    int capacity = 16;
+    while (capacity < index->string_count * 2) capacity *= 2;
+    index->keys = (LookupKey*)malloc(capacity * sizeof(LookupKey));
+    if (!index->keys) {
+        lookup_index_clear(index);
+        return 0;
+    }
+    for (int k = 0; k < capacity; k++) {
+        index->keys[k].head = -1;
+    }
+    index->key_capacity = capacity;
+
+    for (int e = 0; e < index->string_count; e++) {
+        int i = index->string_positions[e];
+        int row = index->is_vertical ? range->start_row + i : range->start_row;
+        int col = index->is_vertical ? range->start_col : range->start_col + i;
+        const char* str = lookup_cell_string(sheet_get_cell(sheet, row, col));
+        unsigned int hash = lookup_hash(str);
+        unsigned int pos = hash & (unsigned int)(capacity - 1);
+
+        while (index->keys[pos].head >= 0 &&
+               (index->keys[pos].hash != hash || strcmp(index->keys[pos].str, str) != 0)) {
+            pos = (pos + 1) & (unsigned int)(capacity - 1);
+        }
+
+        LookupKey* key = &index->keys[pos];
+        if (key->head < 0) {
+            key->str = str;
+            key->hash = hash;
+            key->head = e;
+        } else {
+            index->string_next[key->tail] = e;
+        }
+        key->tail = e;
+    }
+
+    index->valid = 1;
+    return 1;
+}
+
+// List a new index under each column of its range, so a changed cell only
+// looks at the indexes that may hold it. Room is made in every column
+// first, so an index is either listed everywhere or nowhere.
+static int lookup_register(Sheet* sheet, int position, const CellRange* range) {
+    if (!sheet->lookup_columns) {
+        sheet->lookup_columns = (int**)calloc(sheet->cols, sizeof(int*));
+        sheet->lookup_column_count = (int*)calloc(sheet->cols, sizeof(int));
+        sheet->lookup_column_capacity = (int*)calloc(sheet->cols, sizeof(int));
+        if (!sheet->lookup_columns || !sheet->lookup_column_count || !sheet->lookup_column_capacity) {
+            free(sheet->lookup_columns);
+            free(sheet->lookup_column_count);
+            free(sheet->lookup_column_capacity);
+            sheet->lookup_columns = NULL;
+            sheet->lookup_column_count = NULL;
+            sheet->lookup_column_capacity = NULL;
+            return 0;
+        }
+    }
+
+    int first = range->start_col < 0 ? 0 : range->start_col;
+    int last = range->end_col >= sheet->cols ? sheet->cols - 1 : range->end_col;
+    for (int col = first; col <= last; col++) {
+        if (sheet->lookup_column_count[col] < sheet->lookup_column_capacity[col]) continue;
+
+        int new_capacity = sheet->lookup_column_capacity[col] ? sheet->lookup_column_capacity[col] * 2 : 4;
+        int* grown = (int*)realloc(sheet->lookup_columns[col], new_capacity * sizeof(int));
+        if (!grown) return 0;
+        sheet->lookup_columns[col] = grown;
+        sheet->lookup_column_capacity[col] = new_capacity;
+    }
+    for (int col = first; col <= last; col++) {
+        sheet->lookup_columns[col][sheet->lookup_column_count[col]++] = position;
+    }
+    return 1;
+}
+
+LookupIndex* lookup_index_get(Sheet* sheet, const CellRange* range) {
+    // Every XLOOKUP naming the range finds its index on the shared descriptor
+    int id = shared_range_find(sheet, range);
+    LookupIndex* index = id >= 0 ? sheet->shared_ranges[id].lookup : NULL;
+
+    // Evaluating in parallel: use what prepare_lookups built, else scan
+    if (sheet->lookup_read_only) {
+        return index && index->valid ? index : NULL;
+    }
+
+    if (!index) {
+        if (id < 0) id = shared_range_intern(sheet, range);
+        if (id < 0) return NULL;
+        if (sheet->lookup_index_count >= sheet->lookup_index_capacity) {
+            int new_capacity = sheet->lookup_index_capacity ? sheet->lookup_index_capacity * 2 : 8;
+            LookupIndex** grown = (LookupIndex**)realloc(sheet->lookup_indexes, new_capacity * sizeof(LookupIndex*));
+            if (!grown) return NULL;
+            sheet->lookup_indexes = grown;
+            sheet->lookup_index_capacity = new_capacity;
+        }
+        index = (LookupIndex*)calloc(1, sizeof(LookupIndex));
+        if (!index) return NULL;
+        if (!lookup_register(sheet, sheet->lookup_index_count, range)) {
+            free(index);
+            return NULL;
+        }
+        index->range = *range;
+        index->is_vertical = range->end_row > range->start_row;
+        sheet->lookup_indexes[sheet->lookup_index_count++] = index;
+        sheet->shared_ranges[id].lookup = index;
+    }
+
+    if (!index->valid && !lookup_index_build(sheet, index)) {
+        return NULL;
+    }
+    return index;
+}
+
+int lookup_string_first(const LookupIndex* index, const char* str) {
+    unsigned int hash = lookup_hash(str);
+    unsigned int mask = (unsigned int)(index->key_capacity - 1);
+
+    for (unsigned int pos = hash & mask; index->keys[pos].head >= 0; pos = (pos + 1) & mask) {
+        const LookupKey* key = &index->keys[pos];
+        if (key->hash == hash && strcmp(key->str, str) == 0) {
+            return key->head;
+        }
+    }
+    return -1;
+}
+
+int lookup_string_next(const LookupIndex* index, int entry) {
+    return index->string_next[entry];
+}
+
+static int numbers_match(double a, double b) {
+    return fabs(a - b) < FLOAT_COMPARISON_EPSILON;
+}
+
+// Values within epsilon of a finite key form one run of the sorted array
+void lookup_exact_window(const LookupIndex* index, double value, int* start, int* end) {
+    const LookupNumber* numbers = index->numbers;
+    int lo = 0, hi = index->number_count;
+
+    *start = *end = 0;
+    if (!isfinite(value)) return;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (numbers[mid].value >= value || numbers_match(value, numbers[mid].value)) hi = mid;
+        else lo = mid + 1;
+    }
+    *start = lo;
+
+    hi = index->number_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (numbers[mid].value <= value || numbers_match(value, numbers[mid].value)) lo = mid + 1;
+        else hi = mid;
+    }
+    *end = lo;
+}
+
+int lookup_floor_count(const LookupIndex* index, double value) {
+    const LookupNumber* numbers = index->numbers;
+    int lo = 0, hi = index->number_count;
+
+    if (value != value) return 0;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (numbers[mid].value <= value) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void lookup_cell_changed(Sheet* sheet, int row, int col) {
+    if (!sheet->lookup_columns || col < 0 || col >= sheet->cols) return;
+
+    const int* positions = sheet->lookup_columns[col];
+    for (int i = 0; i < sheet->lookup_column_count[col]; i++) {
+        LookupIndex* index = sheet->lookup_indexes[positions[i]];
+        if (index->valid && row >= index->range.start_row && row <= index->range.end_row) {
+            lookup_index_clear(index);
+        }
+    }
+}
+
+void lookup_invalidate_all(Sheet* sheet) {
+    for (int i = 0; i < sheet->lookup_index_count; i++) {
+        lookup_index_clear(sheet->lookup_indexes[i]);
+    }
+}
+
+void lookup_free_all(Sheet* sheet) {
+    for (int i = 0; i < sheet->lookup_index_count; i++) {
+        lookup_index_clear(sheet->lookup_indexes[i]);
+        free(sheet->lookup_indexes[i]);
+    }
+    free(sheet->lookup_indexes);
+    sheet->lookup_indexes = NULL;
+    if (sheet->lookup_columns) {
+        for (int col = 0; col < sheet->cols; col++) {
+            free(sheet->lookup_columns[col]);
+        }
+    }
+    free(sheet->lookup_columns);
+    free(sheet->lookup_column_count);
+    free(sheet->lookup_column_capacity);
+    sheet->lookup_columns = NULL;
+    sheet->lookup_column_count = NULL;
+    sheet->lookup_column_capacity = NULL;
+    sheet->lookup_index_count = 0;
+    sheet->lookup_index_capacity = 0;
+}
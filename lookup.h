@@ -0,0 +1,58 @@
+// lookup.h - Shared XLOOKUP indexes over lookup ranges
+#ifndef LOOKUP_H
+#define LOOKUP_H
+
+#include "sheet.h"
+
+// Numeric lookup cell: its value and offset within the range
+typedef struct {
+    double value;
+    int position;
+} LookupNumber;
+
+// Distinct string key with its occurrences chained in position order
+typedef struct {
+    const char* str;        // Borrowed from the cell; the index is dropped when it changes
+    unsigned int hash;
+    int head, tail;         // Entries in string_positions / string_next (-1 = unused slot)
+} LookupKey;
+
+// Index over one lookup range, shared by every XLOOKUP that names it.
+// Built on first use and dropped whenever a cell inside the range changes.
+typedef struct LookupIndex {
+    CellRange range;
+    int is_vertical;        // Search down the column, else across the row
+    int valid;
+
+    LookupNumber* numbers;  // Sorted by value, then position
+    int number_count;
+
+    LookupKey* keys;        // Open-addressed hash, power-of-two capacity
+    int key_capacity;
+    int* string_positions;
+    int* string_next;
+    int string_count;
+} LookupIndex;
+
+// Index for the range, built if needed. NULL on allocation failure, or if
+// it would have to be built while sheet->lookup_read_only is set.
+LookupIndex* lookup_index_get(Sheet* sheet, const CellRange* range);
+
+// Positions whose string equals str: iterate with lookup_string_next(index, entry) until -1
+int lookup_string_first(const LookupIndex* index, const char* str);
+int lookup_string_next(const LookupIndex* index, int entry);
+
+// Numbers within FLOAT_COMPARISON_EPSILON of value, as a [start, end) slice of numbers
+void lookup_exact_window(const LookupIndex* index, double value, int* start, int* end);
+
+// Number of sorted numbers <= value, i.e. numbers[0 .. count) qualify for an approximate match
+int lookup_floor_count(const LookupIndex* index, double value);
+
+// Invalidation hooks. lookup_cell_changed finds the indexes over a cell
+// through sheet->lookup_columns, so it costs nothing in columns no
+// XLOOKUP searches.
+void lookup_cell_changed(Sheet* sheet, int row, int col);
+void lookup_invalidate_all(Sheet* sheet);
+void lookup_free_all(Sheet* sheet);
+
+#endif // LOOKUP_H
@@ -8,6 +8,12 @@
 #include "console.h"
 #include "sheet.h"
 #include "charts.h"
+#include "autosave.h"
+#include "journal.h"
+#include "llb.h"
+#include "undo.h"
+#include "stats.h"
+#include "workbook.h"
 #include "constants.h"
 
 // Application state
@@ -21,86 +27,9 @@ typedef enum {
     MODE_EDIT          // Edit existing cell mode
 } AppMode;
 
-// Undo/Redo system
-typedef enum {
-    UNDO_CELL_CHANGE,
-    UNDO_RANGE_CHANGE,
-    UNDO_CLEAR_CELL,
-    UNDO_FORMAT_CHANGE,
-    UNDO_RESIZE_COLUMN,
-    UNDO_RESIZE_ROW
-} UndoType;
-
-typedef struct {
-    int row, col;
-    CellType old_type;
-    CellType new_type;
-    union {
-        double number;
-        char* string;
-        struct {
-            char* expression;
-            double cached_value;
-            char* cached_string;
-            int is_string_result;
-            ErrorType error;
-        } formula;
-    } old_data;
-    union {
-        double number;
-        char* string;
-        struct {
-            char* expression;
-            double cached_value;
-            char* cached_string;
-            int is_string_result;
-            ErrorType error;
-        } formula;
-    } new_data;
-    // Formatting data
-    DataFormat old_format;
-    FormatStyle old_format_style;
-    DataFormat new_format;
-    FormatStyle new_format_style;
-    int old_text_color;
-    int old_background_color;
-    int new_text_color;
-    int new_background_color;
-} CellUndoData;
-
-typedef struct {
-    int start_row, start_col;
-    int end_row, end_col;
-    CellUndoData* cell_data;
-    int cell_count;
-} RangeUndoData;
-
 typedef struct {
-    int index;  // Column or row index
-    int old_size;
-    int new_size;
-} ResizeUndoData;
-
-typedef struct UndoAction {
-    UndoType type;
-    union {
-        CellUndoData cell;
-        RangeUndoData range;
-        ResizeUndoData resize;
-    } data;
-    char description[DESCRIPTION_BUFFER_SIZE];
-} UndoAction;
-
-#define MAX_UNDO_ACTIONS 100
-
-typedef struct {
-    UndoAction actions[MAX_UNDO_ACTIONS];
-    int current_index;  // Points to the next action to be added
-    int count;          // Number of actions in the buffer
-} UndoBuffer;
-
-typedef struct {
-    Sheet* sheet;
+    Workbook workbook;
+    Sheet* sheet;             // The workbook's active sheet
     Console* console;
     AppMode mode;
     int cursor_row;
@@ -117,17 +46,26 @@ typedef struct {
     BOOL cursor_visible;
     DWORD cursor_blink_rate;
     
+    // Set whenever something visible may have changed since the last frame
+    BOOL needs_render;
+    BOOL stats_overlay;       // Frame and recalc times shown in the status bar
+    
     // Range selection state
     BOOL range_selection_active;
     int range_start_row;
     int range_start_col;
     
-    // Undo/Redo system
-    UndoBuffer undo_buffer;
+    // Undo/Redo history; also queues undone positions for the journal
+    UndoHistory undo;
     
     // Autosave system
     DWORD last_autosave_time;
     DWORD autosave_interval;  // 3 minutes in milliseconds
+    AutosaveJob autosave;     // Save running on a worker thread, if any
+    Journal journal;          // Every edit of the shown sheet, appended for crash recovery
+    JournalShelf parked_journals; // The other sheets' journals
+    
+    Chart* chart;             // Last chart shown, reopened as is while its range is unchanged
 } AppState;
 
 // Function prototypes
@@ -136,11 +74,13 @@ void app_cleanup(AppState* state);
 void app_render(AppState* state);
 void app_handle_input(AppState* state, KeyEvent* key);
 void app_execute_command(AppState* state, const char* command);
+void app_switch_sheet(AppState* state, int index);
 void app_start_input(AppState* state, AppMode mode);
 void app_start_edit(AppState* state);
 void app_finish_input(AppState* state);
 void app_cancel_input(AppState* state);
 void app_update_cursor_blink(AppState* state);
+DWORD app_time_until_next_event(AppState* state);
 void app_show_chart(AppState* state, ChartType type, const char* x_label, const char* y_label);
 
 // Range selection functions
@@ -168,33 +108,27 @@ void app_cycle_date_format(AppState* state);
 void app_cycle_datetime_format(AppState* state);
 
 // Undo/Redo system functions
-void undo_buffer_init(UndoBuffer* buffer);
-void undo_buffer_cleanup(UndoBuffer* buffer);
-void undo_save_cell_state(AppState* state, int row, int col, const char* description);
-void undo_save_range_state(AppState* state, int start_row, int start_col, int end_row, int end_col, const char* description);
-void undo_save_resize_state(AppState* state, int index, int old_size, int new_size, UndoType type, const char* description);
 void undo_perform(AppState* state);
 void redo_perform(AppState* state);
-void undo_copy_cell_data(Cell* src, CellUndoData* dest);
-void undo_restore_cell_data(AppState* state, CellUndoData* src, int row, int col);
-void undo_free_cell_data(CellUndoData* data);
 
 // System clipboard functions
 BOOL set_system_clipboard_text(const char* text);
-char* get_system_clipboard_text(void);
 
 // Autosave functions
 void app_create_autosave_directory(void);
 void app_perform_autosave(AppState* state);
-void app_get_timestamp_filename(char* filename, size_t size);
+void app_finish_autosave(AppState* state);
 
 // Initialize application
 void app_init(AppState* state) {
-    state->sheet = sheet_new(1000, 100);
+    workbook_init(&state->workbook, WORKBOOK_MEMORY_BUDGET);
+    int first = workbook_add_sheet(&state->workbook, "Sheet1", 1000, 100);
+    state->sheet = first >= 0 ? workbook_activate(&state->workbook, first) : NULL;
     state->console = console_init();
     
     if (!state->sheet || !state->console) {
-        if (state->sheet) sheet_free(state->sheet);
+        workbook_free(&state->workbook);
+        state->sheet = NULL;
         if (state->console) console_cleanup(state->console);
         state->running = FALSE;
         return;
@@ -214,31 +148,56 @@ void app_init(AppState* state) {
     state->range_start_row = 0;
     state->range_start_col = 0;
     
-    // Initialize undo buffer
-    undo_buffer_init(&state->undo_buffer);
+    // Initialize undo history
+    undo_history_init(&state->undo, UNDO_MEMORY_BUDGET, &state->journal);
     
     state->cursor_blink_time = GetTickCount();
     state->cursor_visible = TRUE;
     state->cursor_blink_rate = CURSOR_BLINK_RATE_MS;
+    state->needs_render = TRUE;
+    state->stats_overlay = FALSE;
+    state->chart = NULL;
     
     // Initialize autosave system
     state->last_autosave_time = GetTickCount();
     state->autosave_interval = AUTOSAVE_INTERVAL_MS;
+    autosave_init(&state->autosave);
     app_create_autosave_directory();
     
+    // A journal left behind means the last session did not exit cleanly.
+    // Other sheets' journals are replayed when those sheets are first shown.
+    char journal_path[MAX_PATH];
+    int recovered = 0;
+    state->parked_journals.journals = NULL;
+    state->parked_journals.capacity = 0;
+    journal_sheet_path(state->sheet->name, journal_path, sizeof(journal_path));
+    journal_open(&state->journal, journal_path, state->sheet, &recovered);
+    if (recovered > 0) {
+        sprintf_s(state->status_message, sizeof(state->status_message), 
+                  "Recovered %d changes from %s", recovered, journal_path);
+    }
+    
     console_hide_cursor(state->console);
     
-    sheet_recalculate(state->sheet);
+    // The main loop recalculates the loaded sheet in slices
 }
 
 void app_cleanup(AppState* state) {
-    // Cleanup undo buffer
-    undo_buffer_cleanup(&state->undo_buffer);
+    // Let an in-flight autosave finish writing its snapshot
+    autosave_cleanup(&state->autosave);
     
-    if (state->sheet) {
-        sheet_free(state->sheet);
-        state->sheet = NULL;
-    }
+    // A clean exit leaves nothing to recover
+    journal_close(&state->journal, 1);
+    journal_shelf_close(&state->parked_journals, 1);
+    
+    // Cleanup undo history
+    undo_history_free(&state->undo);
+    
+    chart_free(state->chart);
+    state->chart = NULL;
+    
+    workbook_free(&state->workbook);
+    state->sheet = NULL;
     if (state->console) {
         console_cleanup(state->console);
         state->console = NULL;
@@ -250,9 +209,23 @@ void app_update_cursor_blink(AppState* state) {
     if (current_time - state->cursor_blink_time > state->cursor_blink_rate) {
         state->cursor_visible = !state->cursor_visible;
         state->cursor_blink_time = current_time;
+        state->needs_render = TRUE;
     }
 }
 
+// Milliseconds until the next cursor blink or autosave is due
+DWORD app_time_until_next_event(AppState* state) {
+    DWORD current_time = GetTickCount();
+    DWORD blink_elapsed = current_time - state->cursor_blink_time;
+    DWORD autosave_elapsed = current_time - state->last_autosave_time;
+    
+    // The blink toggles once strictly more than cursor_blink_rate has passed
+    DWORD blink_wait = blink_elapsed > state->cursor_blink_rate ? 0 : state->cursor_blink_rate - blink_elapsed + 1;
+    DWORD autosave_wait = autosave_elapsed >= state->autosave_interval ? 0 : state->autosave_interval - autosave_elapsed;
+    
+    return blink_wait < autosave_wait ? blink_wait : autosave_wait;
+}
+
 // Start range selection
 void app_start_range_selection(AppState* state) {
     state->range_selection_active = TRUE;
@@ -296,6 +269,7 @@ void app_render(AppState* state) {
     if (!con || !con->backBuffer) {
         return;
     }
+    long long render_start = stats_now();
     
     // Colors
     WORD headerColor = MAKE_COLOR(COLOR_BLACK, COLOR_WHITE);
@@ -303,6 +277,7 @@ void app_render(AppState* state) {
     WORD selectedColor = MAKE_COLOR(COLOR_BLACK, COLOR_CYAN);
     WORD gridColor = MAKE_COLOR(COLOR_WHITE | COLOR_BRIGHT, COLOR_BLACK);
     WORD rangeColor = MAKE_COLOR(COLOR_BLACK, COLOR_YELLOW);  // Range selection color
+    WORD staleColor = MAKE_COLOR(COLOR_BLACK | COLOR_BRIGHT, COLOR_BLACK);  // Value awaiting recalculation
     
     // Clear back buffer
     for (int i = 0; i < con->width * con->height; i++) {
@@ -331,6 +306,11 @@ void app_render(AppState* state) {
         return;
     }
     
+    // Formulas on screen are recalculated ahead of the rest
+    CellRange visible = { state->view_top, state->view_left,
+                          state->view_top + visible_rows - 1, state->view_left + visible_cols - 1 };
+    sheet_set_recalc_focus(state->sheet, &visible);
+    
     // Draw column headers (with dynamic widths)
     int current_x = col_header_width;
     for (int i = 0; i < visible_cols && state->view_left + i < state->sheet->cols; i++) {
@@ -402,6 +382,10 @@ void app_render(AppState* state) {
                     
                     // Get cell for color formatting
                     Cell* cell = sheet_get_cell(state->sheet, sheet_row, sheet_col);
+                    BOOL is_stale = sheet_cell_is_stale(state->sheet, cell);
+                    if (is_stale) {
+                        color = staleColor;
+                    }
                     if (cell && (cell->text_color >= 0 || cell->background_color >= 0)) {
                         // Apply custom colors
                         int fg = (cell->text_color >= 0) ? cell->text_color : COLOR_WHITE;
@@ -427,6 +411,11 @@ void app_render(AppState* state) {
                     // Draw cell content
                     console_write_string(con, current_x + 1, y, display, color);
                     
+                    // Mark a value still waiting on recalculation
+                    if (is_stale && col_width > 1) {
+                        console_write_char(con, current_x + col_width - 1, y, '~', staleColor);
+                    }
+                    
                     // Draw blinking cursor indicator in the current cell
                     if (is_current_cell && state->cursor_visible) {
                         int cursor_x = current_x + 1 + (int)strlen(display);
@@ -502,9 +491,33 @@ void app_render(AppState* state) {
         sprintf_s(status, sizeof(status), "[%s] %s > %s", 
                 state->sheet->name, cellRef, input_with_cursor);
     }
+    
+    // Progress of a recalculation that is still running
+    int calc_done, calc_total;
+    if (sheet_recalc_progress(state->sheet, &calc_done, &calc_total) && calc_total > 0) {
+        char progress[64];
+        sprintf_s(progress, sizeof(progress), " | Calculating %d%%",
+                  (int)((long long)calc_done * 100 / calc_total));
+        if (strlen(status) + strlen(progress) < sizeof(status)) {
+            strcat_s(status, sizeof(status), progress);
+        }
+    }
+    
+    // Timings of the previous frame and recalculation slice
+    if (state->stats_overlay) {
+        char overlay[96];
+        strcpy_s(overlay, sizeof(overlay), " | ");
+        stats_format_overlay(overlay + 3, sizeof(overlay) - 3);
+        if (strlen(status) + strlen(overlay) < sizeof(status)) {
+            strcat_s(status, sizeof(status), overlay);
+        }
+    }
     console_write_string(con, 0, status_y + 1, status, headerColor);
+    stats_phase_add(STATS_RENDER, render_start);
     
+    long long flip_start = stats_now();
     console_flip(con);
+    stats_phase_add(STATS_FLIP, flip_start);
 }
 
 // Start input mode
@@ -589,7 +602,8 @@ void app_finish_input(AppState* state) {
     }
     
     if (state->mode != MODE_COMMAND) {
-        undo_save_cell_state(state, state->cursor_row, state->cursor_col, action_desc);
+        undo_begin(&state->undo, state->sheet, action_desc, 1);
+        undo_note_cell(&state->undo, state->sheet, state->cursor_row, state->cursor_col);
     }
     
     switch (state->mode) {
@@ -610,7 +624,6 @@ void app_finish_input(AppState* state) {
                                      state->cursor_col, state->input_buffer);
                 }
             }
-            sheet_recalculate(state->sheet);
             break;
             
         case MODE_INSERT_STRING:
@@ -622,6 +635,7 @@ void app_finish_input(AppState* state) {
             app_execute_command(state, state->input_buffer);
             break;
     }
+    undo_commit(&state->undo, state->sheet);
     
     state->mode = MODE_NORMAL;
     state->cursor_blink_rate = CURSOR_BLINK_RATE_MS;
@@ -639,7 +653,8 @@ void app_cancel_input(AppState* state) {
 
 // Set cell formatting
 void app_set_cell_format(AppState* state, DataFormat format, FormatStyle style) {
-    undo_save_cell_state(state, state->cursor_row, state->cursor_col, "Format cell");
+    undo_begin(&state->undo, state->sheet, "Format cell", 0);
+    undo_note_cell(&state->undo, state->sheet, state->cursor_row, state->cursor_col);
     
     Cell* cell = sheet_get_or_create_cell(state->sheet, state->cursor_row, state->cursor_col);
     if (cell) {
@@ -669,11 +684,13 @@ void app_set_cell_format(AppState* state, DataFormat format, FormatStyle style)
         }    } else {
         strcpy_s(state->status_message, sizeof(state->status_message), "Failed to format cell");
     }
+    undo_commit(&state->undo, state->sheet);
 }
 
 // Enhanced function to cycle through comprehensive date/time formats
 void app_cycle_datetime_format(AppState* state) {
-    undo_save_cell_state(state, state->cursor_row, state->cursor_col, "Cycle datetime format");
+    undo_begin(&state->undo, state->sheet, "Cycle datetime format", 0);
+    undo_note_cell(&state->undo, state->sheet, state->cursor_row, state->cursor_col);
     
     Cell* cell = sheet_get_or_create_cell(state->sheet, state->cursor_row, state->cursor_col);
     if (cell) {
@@ -726,11 +743,13 @@ void app_cycle_datetime_format(AppState* state) {
     } else {
         strcpy_s(state->status_message, sizeof(state->status_message), "Failed to format cell");
     }
+    undo_commit(&state->undo, state->sheet);
 }
 
 // Function to cycle through date formats
 void app_cycle_date_format(AppState* state) {
-    undo_save_cell_state(state, state->cursor_row, state->cursor_col, "Cycle date format");
+    undo_begin(&state->undo, state->sheet, "Cycle date format", 0);
+    undo_note_cell(&state->undo, state->sheet, state->cursor_row, state->cursor_col);
     
     Cell* cell = sheet_get_or_create_cell(state->sheet, state->cursor_row, state->cursor_col);
     if (cell) {
@@ -778,6 +797,7 @@ void app_cycle_date_format(AppState* state) {
     } else {
         strcpy_s(state->status_message, sizeof(state->status_message), "Failed to format cell");
     }
+    undo_commit(&state->undo, state->sheet);
 }
 
 int ask_preserve_formulas(AppState* state, const char* operation) {
@@ -816,7 +836,7 @@ int ask_preserve_formulas(AppState* state, const char* operation) {
                 }
             }
         }
-        Sleep(DEFAULT_SLEEP_MS);
+        console_wait_input(state->console, INFINITE);
     }
     
     state->mode = old_mode;
@@ -833,6 +853,49 @@ int ask_preserve_formulas(AppState* state, const char* operation) {
     return result;
 }
 
+// Show another sheet of the workbook. Undo starts over; the shown sheet's
+// journal is shelved and the new sheet's own journal takes its place.
+void app_switch_sheet(AppState* state, int index) {
+    int previous = state->workbook.active;
+    if (index == previous) return;
+    
+    if (!journal_shelf_reserve(&state->parked_journals, state->workbook.count)) {
+        strcpy_s(state->status_message, sizeof(state->status_message), "Out of memory");
+        return;
+    }
+    
+    // Activating may unload the old sheet, so its journal is written out first.
+    // A compaction in flight rewrites that journal; let it land as well.
+    journal_flush(&state->journal, state->sheet);
+    if (state->autosave.busy) app_finish_autosave(state);
+    Sheet* sheet = workbook_activate(&state->workbook, index);
+    if (!sheet) {
+        sprintf_s(state->status_message, sizeof(state->status_message), 
+                 "Failed to load sheet %s", state->workbook.sheets[index].name);
+        return;
+    }
+    
+    int recovered;
+    state->sheet = sheet;
+    journal_switch(&state->journal, &state->parked_journals, previous, index, sheet, &recovered);
+    undo_history_clear(&state->undo);
+    chart_free(state->chart);
+    state->chart = NULL;
+    
+    state->cursor_row = 0;
+    state->cursor_col = 0;
+    state->view_top = 0;
+    state->view_left = 0;
+    state->range_selection_active = FALSE;
+    state->needs_render = TRUE;
+    if (recovered > 0) {
+        sprintf_s(state->status_message, sizeof(state->status_message), 
+                  "Sheet %s: recovered %d changes", state->sheet->name, recovered);
+    } else {
+        sprintf_s(state->status_message, sizeof(state->status_message), "Sheet %s", state->sheet->name);
+    }
+}
+
 // Execute command
 void app_execute_command(AppState* state, const char* command) {
     if (strcmp(command, "q") == 0 || strcmp(command, "quit") == 0) {
@@ -865,12 +928,135 @@ void app_execute_command(AppState* state, const char* command) {
         if (preserve == -1) return;
         
         if (sheet_load_csv(state->sheet, filename, preserve)) {
+            journal_log_reset(&state->journal, state->sheet);
+            undo_history_clear(&state->undo);
             sprintf_s(state->status_message, sizeof(state->status_message), 
                      "Loaded from %s (%s)", filename, preserve ? "formulas preserved" : "values only");
         } else {
             sprintf_s(state->status_message, sizeof(state->status_message), 
                      "Failed to load %s", filename);
         }
+    } else if (strncmp(command, "savellb ", 8) == 0) {
+        const char* filename = command + 8;
+        if (strlen(filename) == 0) {
+            strcpy_s(state->status_message, sizeof(state->status_message), "Usage: savellb <filename>");
+            return;
+        }
+        
+        if (sheet_save_llb(state->sheet, filename)) {
+            sprintf_s(state->status_message, sizeof(state->status_message), "Saved to %s", filename);
+        } else {
+            sprintf_s(state->status_message, sizeof(state->status_message), 
+                     "Failed to save %s", filename);
+        }
+    } else if (strncmp(command, "loadllb ", 8) == 0) {
+        const char* filename = command + 8;
+        if (strlen(filename) == 0) {
+            strcpy_s(state->status_message, sizeof(state->status_message), "Usage: loadllb <filename>");
+            return;
+        }
+        
+        if (sheet_load_llb(state->sheet, filename)) {
+            // Widths and heights come from the file too
+            journal_log_reset(&state->journal, state->sheet);
+            journal_touch_columns(&state->journal, 0, state->sheet->cols - 1);
+            journal_touch_rows(&state->journal, 0, state->sheet->rows - 1);
+            undo_history_clear(&state->undo);
+            sprintf_s(state->status_message, sizeof(state->status_message), "Loaded from %s", filename);
+        } else {
+            sprintf_s(state->status_message, sizeof(state->status_message), 
+                     "Failed to load %s", filename);
+        }
+    } else if (strncmp(command, "undomem ", 8) == 0) {
+        int megabytes = atoi(command + 8);
+        if (megabytes < 0) {
+            strcpy_s(state->status_message, sizeof(state->status_message), "Usage: undomem <megabytes>");
+            return;
+        }
+        
+        undo_set_budget(&state->undo, (size_t)megabytes * 1024 * 1024);
+        sprintf_s(state->status_message, sizeof(state->status_message), 
+                 "Undo history limited to %d MB", megabytes);
+    } else if (strncmp(command, "threads ", 8) == 0) {
+        int threads = atoi(command + 8);
+        if (threads < 0 || threads > THREAD_POOL_MAX_THREADS) {
+            sprintf_s(state->status_message, sizeof(state->status_message), 
+                     "Usage: threads <0-%d> (0 = all processors)", THREAD_POOL_MAX_THREADS);
+            return;
+        }
+        
+        sheet_set_recalc_threads(state->sheet, threads);
+        if (threads == 0) {
+            strcpy_s(state->status_message, sizeof(state->status_message), "Recalculation uses all processors");
+        } else {
+            sprintf_s(state->status_message, sizeof(state->status_message), 
+                     "Recalculation uses %d thread%s", threads, threads == 1 ? "" : "s");
+        }
+    } else if (strcmp(command, "stats") == 0) {
+        stats_format_summary(state->status_message, sizeof(state->status_message));
+    } else if (strcmp(command, "stats on") == 0 || strcmp(command, "stats off") == 0) {
+        state->stats_overlay = strcmp(command, "stats on") == 0;
+        strcpy_s(state->status_message, sizeof(state->status_message), 
+                 state->stats_overlay ? "Timings shown in the status bar" : "Timings hidden");
+    } else if (strcmp(command, "stats profile on") == 0 || strcmp(command, "stats profile off") == 0) {
+        stats_set_profiling(strcmp(command, "stats profile on") == 0);
+        strcpy_s(state->status_message, sizeof(state->status_message), 
+                 stats_profiling() ? "Profiling formulas (use :stats dump <file> for the ranking)" : "Profiling off");
+    } else if (strcmp(command, "stats reset") == 0) {
+        stats_reset(state->sheet);
+        strcpy_s(state->status_message, sizeof(state->status_message), "Statistics cleared");
+    } else if (strncmp(command, "stats dump ", 11) == 0) {
+        const char* filename = command + 11;
+        if (stats_write_report(state->sheet, filename)) {
+            sprintf_s(state->status_message, sizeof(state->status_message), "Statistics written to %s", filename);
+        } else {
+            sprintf_s(state->status_message, sizeof(state->status_message), 
+                     "Failed to write %s", filename);
+        }
+    } else if (strncmp(command, "sheet ", 6) == 0) {
+        const char* name = command + 6;
+        int index = workbook_find(&state->workbook, name);
+        if (index < 0) {
+            index = workbook_add_sheet(&state->workbook, name, state->sheet->rows, state->sheet->cols);
+        }
+        if (index < 0) {
+            sprintf_s(state->status_message, sizeof(state->status_message), 
+                     "Invalid sheet name %s", name);
+            return;
+        }
+        app_switch_sheet(state, index);
+    } else if (strncmp(command, "opensheet ", 10) == 0) {
+        char name[MAX_SHEET_NAME_LENGTH];
+        const char* filename = strchr(command + 10, ' ');
+        size_t length = filename ? (size_t)(filename - (command + 10)) : 0;
+        if (length == 0 || length >= sizeof(name) || strlen(filename + 1) == 0) {
+            strcpy_s(state->status_message, sizeof(state->status_message), "Usage: opensheet <name> <filename>");
+            return;
+        }
+        memcpy(name, command + 10, length);
+        name[length] = '\0';
+        filename++;
+        
+        // Read in when first shown or referred to
+        if (workbook_add_file(&state->workbook, name, filename, state->sheet->rows, state->sheet->cols) >= 0) {
+            sprintf_s(state->status_message, sizeof(state->status_message), 
+                     "Sheet %s opens %s when used", name, filename);
+        } else {
+            sprintf_s(state->status_message, sizeof(state->status_message), 
+                     "Cannot add sheet %s", name);
+        }
+    } else if (strcmp(command, "sheets") == 0) {
+        size_t used = 0;
+        state->status_message[0] = '\0';
+        for (int i = 0; i < state->workbook.count; i++) {
+            const WorkbookSheet* entry = &state->workbook.sheets[i];
+            size_t room = sizeof(state->status_message) - used;
+            int written = snprintf(state->status_message + used, room, "%s%s%s%s", 
+                                   i > 0 ? "  " : "", i == state->workbook.active ? "*" : "",
+                                   entry->name, entry->sheet ? "" : " (not loaded)");
+            if (written < 0 || (size_t)written >= room) break;  // Cut short at the buffer's end
+            used += written;
+        }
     } 
     // Formatting commands
     else if (strcmp(command, "format percentage") == 0) {
@@ -931,6 +1117,7 @@ void app_execute_command(AppState* state, const char* command) {
         
         for (int row = min_row; row <= max_row; row++) {
             for (int col = min_col; col <= max_col; col++) {
+                journal_touch_cell(&state->journal, row, col);
                 Cell* cell = sheet_get_or_create_cell(state->sheet, row, col);
                 if (cell) {
                     cell_set_format(cell, format, style);
@@ -958,6 +1145,7 @@ void app_execute_command(AppState* state, const char* command) {
                 
                 for (int row = min_row; row <= max_row; row++) {
                     for (int col = min_col; col <= max_col; col++) {
+                        journal_touch_cell(&state->journal, row, col);
                         Cell* cell = sheet_get_or_create_cell(state->sheet, row, col);
                         if (cell) {
                             cell_set_text_color(cell, color);
@@ -968,6 +1156,7 @@ void app_execute_command(AppState* state, const char* command) {
                          "Range text color set to %s", color_str);
             } else {
                 // Apply to current cell
+                journal_touch_cell(&state->journal, state->cursor_row, state->cursor_col);
                 Cell* cell = sheet_get_or_create_cell(state->sheet, state->cursor_row, state->cursor_col);
                 if (cell) {
                     cell_set_text_color(cell, color);
@@ -1051,6 +1240,7 @@ void app_execute_command(AppState* state, const char* command) {
                 
                 for (int row = min_row; row <= max_row; row++) {
                     for (int col = min_col; col <= max_col; col++) {
+                        journal_touch_cell(&state->journal, row, col);
                         Cell* cell = sheet_get_or_create_cell(state->sheet, row, col);
                         if (cell) {
                             cell_set_background_color(cell, color);
@@ -1061,6 +1251,7 @@ void app_execute_command(AppState* state, const char* command) {
                          "Range background color set to %s", color_str);
             } else {
                 // Apply to current cell
+                journal_touch_cell(&state->journal, state->cursor_row, state->cursor_col);
                 Cell* cell = sheet_get_or_create_cell(state->sheet, state->cursor_row, state->cursor_col);
                 if (cell) {
                     cell_set_background_color(cell, color);
@@ -1088,9 +1279,11 @@ void app_copy_cell(AppState* state) {
 void app_paste_cell(AppState* state) {
     Cell* clipboard = sheet_get_clipboard_cell();
     if (clipboard) {
-        undo_save_cell_state(state, state->cursor_row, state->cursor_col, "Paste cell");
+        undo_begin(&state->undo, state->sheet, "Paste cell", 0);
+        undo_note_cell(&state->undo, state->sheet, state->cursor_row, state->cursor_col);
         sheet_copy_cell(state->sheet, clipboard->row, clipboard->col, 
                        state->cursor_row, state->cursor_col);
+        undo_commit(&state->undo, state->sheet);
         strcpy_s(state->status_message, sizeof(state->status_message), "Cell pasted");
     } else {
         strcpy_s(state->status_message, sizeof(state->status_message), "Nothing to paste");
@@ -1117,10 +1310,15 @@ void app_paste_range(AppState* state) {
         int end_col = state->cursor_col + paste_cols - 1;
         
         // Save undo state for the affected range
-        undo_save_range_state(state, state->cursor_row, state->cursor_col, end_row, end_col, "Paste range");
+        undo_begin(&state->undo, state->sheet, "Paste range", 0);
+        undo_note_range(&state->undo, state->sheet, state->cursor_row, state->cursor_col, end_row, end_col);
         
         sheet_paste_range(state->sheet, state->cursor_row, state->cursor_col);
-        strcpy_s(state->status_message, sizeof(state->status_message), "Range pasted");
+        if (undo_commit(&state->undo, state->sheet)) {
+            strcpy_s(state->status_message, sizeof(state->status_message), "Range pasted");
+        } else {
+            strcpy_s(state->status_message, sizeof(state->status_message), "Range pasted (too large to undo)");
+        }
     } else {
         app_paste_cell(state);
     }
@@ -1130,6 +1328,9 @@ void app_paste_range(AppState* state) {
 void app_copy_to_system_clipboard(AppState* state) {
     Cell* cell = sheet_get_cell(state->sheet, state->cursor_row, state->cursor_col);
     if (cell) {
+        // Copy the current value, not a stale one
+        CellRange range = { state->cursor_row, state->cursor_col, state->cursor_row, state->cursor_col };
+        sheet_recalculate_range(state->sheet, &range);
         char* text = sheet_get_display_value(state->sheet, state->cursor_row, state->cursor_col);
         if (text) {
             set_system_clipboard_text(text);
@@ -1143,35 +1344,48 @@ void app_copy_to_system_clipboard(AppState* state) {
     }
 }
 
-// Paste from system clipboard to current cell
+// Paste from system clipboard at the cursor; tab-separated rows, as
+// spreadsheets copy them, fill the range below and to the right
 void app_paste_from_system_clipboard(AppState* state) {
-    char* text = get_system_clipboard_text();
-    if (text) {
-        if (strlen(text) == 0) {
-            sheet_clear_cell(state->sheet, state->cursor_row, state->cursor_col);
-            strcpy_s(state->status_message, sizeof(state->status_message), "Cell cleared from system clipboard");
-        } else if (text[0] == '=') {
-            sheet_set_formula(state->sheet, state->cursor_row, state->cursor_col, text);
-            sheet_recalculate(state->sheet);
-            strcpy_s(state->status_message, sizeof(state->status_message), "Formula pasted from system clipboard");
-        } else {
-            char* endptr;
-            double num = strtod(text, &endptr);
-            if (*endptr == '\0' || (*endptr == '\n' && *(endptr+1) == '\0')) {
-                sheet_set_number(state->sheet, state->cursor_row, state->cursor_col, num);
-                strcpy_s(state->status_message, sizeof(state->status_message), "Number pasted from system clipboard");
-            } else {
-                size_t len = strlen(text);
-                if (len > 0 && text[len-1] == '\n') {
-                    text[len-1] = '\0';
-                }
-                sheet_set_string(state->sheet, state->cursor_row, state->cursor_col, text);
-                strcpy_s(state->status_message, sizeof(state->status_message), "Text pasted from system clipboard");
-            }
-        }
-        free(text);
-    } else {
+    if (!OpenClipboard(NULL)) {
+        strcpy_s(state->status_message, sizeof(state->status_message), "Failed to get system clipboard content");
+        return;
+    }
+    HANDLE hData = GetClipboardData(CF_TEXT);
+    const char* text = hData ? (const char*)GlobalLock(hData) : NULL;
+    if (!text) {
+        CloseClipboard();
         strcpy_s(state->status_message, sizeof(state->status_message), "Failed to get system clipboard content");
+        return;
+    }
+    
+    // Parsed straight from the clipboard's memory, which is only locked
+    // until the paste is done
+    size_t length = strnlen(text, GlobalSize(hData));
+    int rows, cols;
+    sheet_measure_text(text, length, &rows, &cols);
+    
+    undo_begin(&state->undo, state->sheet, "Paste from clipboard", 0);
+    int pasted = 1;
+    if (rows == 0) {
+        undo_note_cell(&state->undo, state->sheet, state->cursor_row, state->cursor_col);
+        sheet_clear_cell(state->sheet, state->cursor_row, state->cursor_col);
+    } else {
+        undo_note_range(&state->undo, state->sheet, state->cursor_row, state->cursor_col,
+                        state->cursor_row + rows - 1, state->cursor_col + cols - 1);
+        pasted = sheet_paste_text(state->sheet, state->cursor_row, state->cursor_col, text, length);
+    }
+    GlobalUnlock(hData);
+    CloseClipboard();
+    int kept = undo_commit(&state->undo, state->sheet);
+    
+    if (!pasted) {
+        strcpy_s(state->status_message, sizeof(state->status_message), "Out of memory; clipboard only partly pasted");
+    } else if (rows == 0) {
+        strcpy_s(state->status_message, sizeof(state->status_message), "Cell cleared from system clipboard");
+    } else {
+        sprintf_s(state->status_message, sizeof(state->status_message), "Pasted %dx%d from system clipboard%s",
+                  rows, cols, kept ? "" : " (too large to undo)");
     }
 }
 
@@ -1199,32 +1413,6 @@ BOOL set_system_clipboard_text(const char* text) {
     return TRUE;
 }
 
-char* get_system_clipboard_text(void) {
-    if (!OpenClipboard(NULL)) return NULL;
-    
-    HANDLE hData = GetClipboardData(CF_TEXT);
-    if (!hData) {
-        CloseClipboard();
-        return NULL;
-    }
-    
-    char* pData = (char*)GlobalLock(hData);
-    if (!pData) {
-        CloseClipboard();
-        return NULL;
-    }
-    
-    size_t len = strlen(pData) + 1;
-    char* result = (char*)malloc(len);
-    if (result) {
-        strcpy_s(result, len, pData);
-    }
-    
-    GlobalUnlock(hData);
-    CloseClipboard();
-    return result;
-}
-
 // Autosave functions
 void app_create_autosave_directory(void) {
     // Create AS directory if it doesn't exist
@@ -1232,31 +1420,43 @@ void app_create_autosave_directory(void) {
     // Ignore errors - directory may already exist
 }
 
-void app_get_timestamp_filename(char* filename, size_t size) {
-    SYSTEMTIME st;
-    GetLocalTime(&st);
-    
-    // Format: YYYY-MM-DD HH-MM-SS.csv
-    sprintf_s(filename, size, "AS\\%04d-%02d-%02d %02d-%02d-%02d.csv",
-              st.wYear, st.wMonth, st.wDay,
-              st.wHour, st.wMinute, st.wSecond);
-}
-
+// Every edit already reaches the journal as it happens, so the periodic
+// autosave only rewrites it once it is mostly overwritten history. The
+// compacted copy is written on a worker thread and reported by
+// app_finish_autosave.
 void app_perform_autosave(AppState* state) {
-    char filename[MAX_PATH];
-    app_get_timestamp_filename(filename, sizeof(filename));
+    journal_flush(&state->journal, state->sheet);
     
-    // Save with formulas preserved (preserve mode = 1)
-    if (sheet_save_csv(state->sheet, filename, 1)) {
-        // Update status message briefly (will be overwritten on next render)
-        sprintf_s(state->status_message, sizeof(state->status_message), 
-                  "Auto-saved to %s", filename);
+    // Still writing the previous copy; try again next interval
+    if (state->autosave.busy || !journal_should_compact(&state->journal, state->sheet)) return;
+    
+    size_t size;
+    int records;
+    char* snapshot = journal_snapshot(state->sheet, &size, &records);
+    if (snapshot && autosave_start_buffer(&state->autosave, snapshot, size, state->journal.path)) {
+        journal_begin_compaction(&state->journal, records);
     } else {
         sprintf_s(state->status_message, sizeof(state->status_message), 
                   "Auto-save failed");
     }
 }
 
+void app_finish_autosave(AppState* state) {
+    BOOL succeeded = autosave_finish(&state->autosave);
+    
+    // Records held back during the rewrite are appended to the surviving file
+    journal_end_compaction(&state->journal, succeeded);
+    
+    if (succeeded) {
+        // Update status message briefly (will be overwritten on next render)
+        strcpy_s(state->status_message, sizeof(state->status_message), 
+                 "Auto-save journal compacted");
+    } else {
+        strcpy_s(state->status_message, sizeof(state->status_message), 
+                 "Auto-save failed");
+    }
+}
+
 // Handle keyboard input
 void app_handle_input(AppState* state, KeyEvent* key) {
     if (state->mode == MODE_NORMAL) {
@@ -1336,9 +1536,10 @@ void app_handle_input(AppState* state, KeyEvent* key) {
                 case 'e':
                     app_start_edit(state);
                     break;                case 'x':
-                    undo_save_cell_state(state, state->cursor_row, state->cursor_col, "Clear cell");
+                    undo_begin(&state->undo, state->sheet, "Clear cell", 0);
+                    undo_note_cell(&state->undo, state->sheet, state->cursor_row, state->cursor_col);
                     sheet_clear_cell(state->sheet, state->cursor_row, state->cursor_col);
-                    sheet_recalculate(state->sheet);
+                    undo_commit(&state->undo, state->sheet);
                     strcpy_s(state->status_message, sizeof(state->status_message), "Cell cleared");
                     break;
                 case 'c':
@@ -1397,11 +1598,15 @@ void app_handle_input(AppState* state, KeyEvent* key) {
                 case 'I':
                     if (key->ctrl && key->shift && key->alt) {
                         // Delete row with Ctrl+Shift+Alt+I
+                        journal_log_structure(&state->journal, state->sheet, JOURNAL_DELETE_ROW, state->cursor_row);
                         sheet_delete_row(state->sheet, state->cursor_row);
+                        undo_history_clear(&state->undo);  // Recorded positions no longer line up
                         strcpy_s(state->status_message, sizeof(state->status_message), "Row deleted");
                     } else if (key->ctrl && key->shift) {
                         // Insert row with Ctrl+Shift+I
+                        journal_log_structure(&state->journal, state->sheet, JOURNAL_INSERT_ROW, state->cursor_row);
                         sheet_insert_row(state->sheet, state->cursor_row);
+                        undo_history_clear(&state->undo);  // Recorded positions no longer line up
                         strcpy_s(state->status_message, sizeof(state->status_message), "Row inserted");
                     }
                     break;
@@ -1410,11 +1615,15 @@ void app_handle_input(AppState* state, KeyEvent* key) {
                 case 'O':
                     if (key->ctrl && key->shift && key->alt) {
                         // Delete column with Ctrl+Shift+Alt+O
+                        journal_log_structure(&state->journal, state->sheet, JOURNAL_DELETE_COLUMN, state->cursor_col);
                         sheet_delete_column(state->sheet, state->cursor_col);
+                        undo_history_clear(&state->undo);  // Recorded positions no longer line up
                         strcpy_s(state->status_message, sizeof(state->status_message), "Column deleted");
                     } else if (key->ctrl && key->shift) {
                         // Insert column with Ctrl+Shift+O
+                        journal_log_structure(&state->journal, state->sheet, JOURNAL_INSERT_COLUMN, state->cursor_col);
                         sheet_insert_column(state->sheet, state->cursor_col);
+                        undo_history_clear(&state->undo);  // Recorded positions no longer line up
                         strcpy_s(state->status_message, sizeof(state->status_message), "Column inserted");
                     }
                     break;
@@ -1435,11 +1644,17 @@ void app_handle_input(AppState* state, KeyEvent* key) {
                                           state->sheet->selection.start_col : state->sheet->selection.end_col;
                             int max_col = state->sheet->selection.start_col > state->sheet->selection.end_col ? 
                                           state->sheet->selection.start_col : state->sheet->selection.end_col;
+                            undo_begin(&state->undo, state->sheet, "Resize columns", 0);
+                            undo_note_columns(&state->undo, state->sheet, min_col, max_col);
                             sheet_resize_columns_in_range(state->sheet, min_col, max_col, -1);
+                            undo_commit(&state->undo, state->sheet);
                             strcpy_s(state->status_message, sizeof(state->status_message), "Columns resized");
                         } else {
                             // Resize current column
+                            undo_begin(&state->undo, state->sheet, "Resize columns", 0);
+                            undo_note_columns(&state->undo, state->sheet, state->cursor_col, state->cursor_col);
                             sheet_resize_columns_in_range(state->sheet, state->cursor_col, state->cursor_col, -1);
+                            undo_commit(&state->undo, state->sheet);
                             strcpy_s(state->status_message, sizeof(state->status_message), "Column resized");
                         }                    } else if (state->cursor_col > 0) {
                         if (key->shift) {
@@ -1464,11 +1679,17 @@ void app_handle_input(AppState* state, KeyEvent* key) {
                                           state->sheet->selection.start_col : state->sheet->selection.end_col;
                             int max_col = state->sheet->selection.start_col > state->sheet->selection.end_col ? 
                                           state->sheet->selection.start_col : state->sheet->selection.end_col;
+                            undo_begin(&state->undo, state->sheet, "Resize columns", 0);
+                            undo_note_columns(&state->undo, state->sheet, min_col, max_col);
                             sheet_resize_columns_in_range(state->sheet, min_col, max_col, 1);
+                            undo_commit(&state->undo, state->sheet);
                             strcpy_s(state->status_message, sizeof(state->status_message), "Columns resized");
                         } else {
                             // Resize current column
+                            undo_begin(&state->undo, state->sheet, "Resize columns", 0);
+                            undo_note_columns(&state->undo, state->sheet, state->cursor_col, state->cursor_col);
                             sheet_resize_columns_in_range(state->sheet, state->cursor_col, state->cursor_col, 1);
+                            undo_commit(&state->undo, state->sheet);
                             strcpy_s(state->status_message, sizeof(state->status_message), "Column resized");
                         }                    } else if (state->cursor_col < state->sheet->cols - 1) {
                         if (key->shift) {
@@ -1493,11 +1714,17 @@ void app_handle_input(AppState* state, KeyEvent* key) {
                                           state->sheet->selection.start_row : state->sheet->selection.end_row;
                             int max_row = state->sheet->selection.start_row > state->sheet->selection.end_row ? 
                                           state->sheet->selection.start_row : state->sheet->selection.end_row;
+                            undo_begin(&state->undo, state->sheet, "Resize rows", 0);
+                            undo_note_rows(&state->undo, state->sheet, min_row, max_row);
                             sheet_resize_rows_in_range(state->sheet, min_row, max_row, -1);
+                            undo_commit(&state->undo, state->sheet);
                             strcpy_s(state->status_message, sizeof(state->status_message), "Rows resized");
                         } else {
                             // Resize current row
+                            undo_begin(&state->undo, state->sheet, "Resize rows", 0);
+                            undo_note_rows(&state->undo, state->sheet, state->cursor_row, state->cursor_row);
                             sheet_resize_rows_in_range(state->sheet, state->cursor_row, state->cursor_row, -1);
+                            undo_commit(&state->undo, state->sheet);
                             strcpy_s(state->status_message, sizeof(state->status_message), "Row resized");
                         }                    } else if (state->cursor_row > 0) {
                         if (key->shift) {
@@ -1522,11 +1749,17 @@ void app_handle_input(AppState* state, KeyEvent* key) {
                                           state->sheet->selection.start_row : state->sheet->selection.end_row;
                             int max_row = state->sheet->selection.start_row > state->sheet->selection.end_row ? 
                                           state->sheet->selection.start_row : state->sheet->selection.end_row;
+                            undo_begin(&state->undo, state->sheet, "Resize rows", 0);
+                            undo_note_rows(&state->undo, state->sheet, min_row, max_row);
                             sheet_resize_rows_in_range(state->sheet, min_row, max_row, 1);
+                            undo_commit(&state->undo, state->sheet);
                             strcpy_s(state->status_message, sizeof(state->status_message), "Rows resized");
                         } else {
                             // Resize current row
+                            undo_begin(&state->undo, state->sheet, "Resize rows", 0);
+                            undo_note_rows(&state->undo, state->sheet, state->cursor_row, state->cursor_row);
                             sheet_resize_rows_in_range(state->sheet, state->cursor_row, state->cursor_row, 1);
+                            undo_commit(&state->undo, state->sheet);
                             strcpy_s(state->status_message, sizeof(state->status_message), "Row resized");
                         }                    } else if (state->cursor_row < state->sheet->rows - 1) {
                         if (key->shift) {
@@ -1643,470 +1876,22 @@ void app_handle_input(AppState* state, KeyEvent* key) {
 }
 
 // Undo/Redo system implementation
-void undo_buffer_init(UndoBuffer* buffer) {
-    buffer->current_index = 0;
-    buffer->count = 0;
-    memset(buffer->actions, 0, sizeof(buffer->actions));
-}
-
-void undo_buffer_cleanup(UndoBuffer* buffer) {
-    for (int i = 0; i < buffer->count; i++) {
-        if (buffer->actions[i].type == UNDO_CELL_CHANGE) {
-            undo_free_cell_data(&buffer->actions[i].data.cell);
-        } else if (buffer->actions[i].type == UNDO_RANGE_CHANGE) {
-            if (buffer->actions[i].data.range.cell_data) {
-                for (int j = 0; j < buffer->actions[i].data.range.cell_count; j++) {
-                    undo_free_cell_data(&buffer->actions[i].data.range.cell_data[j]);
-                }
-                free(buffer->actions[i].data.range.cell_data);
-            }
-        }
-    }
-    buffer->current_index = 0;
-    buffer->count = 0;
-}
-
-void undo_free_cell_data(CellUndoData* data) {
-    // Only free old_data if the type wasn't changed (to prevent use-after-free)
-    // If old_type == new_type and pointers are the same, the data is still in use
-    int types_match = (data->old_type == data->new_type);
-    
-    if (data->old_type == CELL_STRING && data->old_data.string) {
-        // Only free if the pointer is different from new_data (wasn't reused)
-        if (!types_match || data->old_data.string != data->new_data.string) {
-            free(data->old_data.string);
-            data->old_data.string = NULL;
-        }
-    }
-    if (data->old_type == CELL_FORMULA) {
-        if (data->old_data.formula.expression) {
-            if (!types_match || data->old_data.formula.expression != data->new_data.formula.expression) {
-                free(data->old_data.formula.expression);
-                data->old_data.formula.expression = NULL;
-            }
-        }
-        if (data->old_data.formula.cached_string) {
-            if (!types_match || data->old_data.formula.cached_string != data->new_data.formula.cached_string) {
-                free(data->old_data.formula.cached_string);
-                data->old_data.formula.cached_string = NULL;
-            }
-        }
-    }
-    if (data->new_type == CELL_STRING && data->new_data.string) {
-        free(data->new_data.string);
-        data->new_data.string = NULL;
-    }
-    if (data->new_type == CELL_FORMULA) {
-        if (data->new_data.formula.expression) {
-            free(data->new_data.formula.expression);
-            data->new_data.formula.expression = NULL;
-        }
-        if (data->new_data.formula.cached_string) {
-            free(data->new_data.formula.cached_string);
-            data->new_data.formula.cached_string = NULL;
-        }
-    }
-}
-
-void undo_copy_cell_data(Cell* src, CellUndoData* dest) {
-    if (!src) {
-        dest->old_type = CELL_EMPTY;
-        memset(&dest->old_data, 0, sizeof(dest->old_data));
-        dest->old_format = FORMAT_GENERAL;
-        dest->old_format_style = 0;
-        dest->old_text_color = -1;
-        dest->old_background_color = -1;
-        return;
-    }
-    
-    dest->old_type = src->type;
-    dest->old_format = src->format;
-    dest->old_format_style = src->format_style;
-    dest->old_text_color = src->text_color;
-    dest->old_background_color = src->background_color;
-    
-    switch (src->type) {
-        case CELL_EMPTY:
-            memset(&dest->old_data, 0, sizeof(dest->old_data));
-            break;
-        case CELL_NUMBER:
-            dest->old_data.number = src->data.number;
-            break;
-        case CELL_STRING:
-            if (src->data.string) {
-                dest->old_data.string = _strdup(src->data.string);
-                if (!dest->old_data.string) {
-                    // Allocation failed, mark as empty
-                    dest->old_type = CELL_EMPTY;
-                }
-            } else {
-                dest->old_data.string = NULL;
-            }
-            break;
-        case CELL_FORMULA:
-            if (src->data.formula.expression) {
-                dest->old_data.formula.expression = _strdup(src->data.formula.expression);
-                if (!dest->old_data.formula.expression) {
-                    // Allocation failed, mark as empty
-                    dest->old_type = CELL_EMPTY;
-                    memset(&dest->old_data, 0, sizeof(dest->old_data));
-                    break;
-                }
-            } else {
-                dest->old_data.formula.expression = NULL;
-            }
-            dest->old_data.formula.cached_value = src->data.formula.cached_value;
-            if (src->data.formula.cached_string) {
-                dest->old_data.formula.cached_string = _strdup(src->data.formula.cached_string);
-                // If this fails, just leave it NULL - not critical
-            } else {
-                dest->old_data.formula.cached_string = NULL;
-            }
-            dest->old_data.formula.is_string_result = src->data.formula.is_string_result;
-            dest->old_data.formula.error = src->data.formula.error;
-            break;
-        default:
-            memset(&dest->old_data, 0, sizeof(dest->old_data));
-            break;
-    }
-}
-
-void undo_save_cell_state(AppState* state, int row, int col, const char* description) {
-    UndoBuffer* buffer = &state->undo_buffer;
-    
-    // If we're not at the end of the buffer, we need to discard future actions
-    if (buffer->current_index < buffer->count) {
-        // Free memory for discarded actions
-        for (int i = buffer->current_index; i < buffer->count; i++) {
-            if (buffer->actions[i].type == UNDO_CELL_CHANGE) {
-                undo_free_cell_data(&buffer->actions[i].data.cell);
-            } else if (buffer->actions[i].type == UNDO_RANGE_CHANGE) {
-                if (buffer->actions[i].data.range.cell_data) {
-                    for (int j = 0; j < buffer->actions[i].data.range.cell_count; j++) {
-                        undo_free_cell_data(&buffer->actions[i].data.range.cell_data[j]);
-                    }
-                    free(buffer->actions[i].data.range.cell_data);
-                }
-            }
-        }
-        buffer->count = buffer->current_index;
-    }
-    
-    // Check if buffer is full
-    if (buffer->count >= MAX_UNDO_ACTIONS) {
-        // Free the oldest action
-        if (buffer->actions[0].type == UNDO_CELL_CHANGE) {
-            undo_free_cell_data(&buffer->actions[0].data.cell);
-        } else if (buffer->actions[0].type == UNDO_RANGE_CHANGE) {
-            if (buffer->actions[0].data.range.cell_data) {
-                for (int j = 0; j < buffer->actions[0].data.range.cell_count; j++) {
-                    undo_free_cell_data(&buffer->actions[0].data.range.cell_data[j]);
-                }
-                free(buffer->actions[0].data.range.cell_data);
-            }
-        }
-        // Shift all actions down
-        memmove(&buffer->actions[0], &buffer->actions[1], 
-                sizeof(UndoAction) * (MAX_UNDO_ACTIONS - 1));
-        buffer->count--;
-        buffer->current_index--;
-    }
-    
-    // Create new undo action
-    UndoAction* action = &buffer->actions[buffer->count];
-    action->type = UNDO_CELL_CHANGE;
-    action->data.cell.row = row;
-    action->data.cell.col = col;
-    
-    // Save current cell state
-    Cell* cell = sheet_get_cell(state->sheet, row, col);
-    undo_copy_cell_data(cell, &action->data.cell);
-    
-    // Copy description
-    strncpy_s(action->description, sizeof(action->description), description, _TRUNCATE);
-      buffer->count++;
-    buffer->current_index = buffer->count;
-}
-
-void undo_save_range_state(AppState* state, int start_row, int start_col, int end_row, int end_col, const char* description) {
-    UndoBuffer* buffer = &state->undo_buffer;
-    
-    // Calculate the number of cells in the range
-    int cell_count = (end_row - start_row + 1) * (end_col - start_col + 1);
-    
-    // If we're not at the end of the buffer, discard future actions
-    if (buffer->current_index < buffer->count) {
-        for (int i = buffer->current_index; i < buffer->count; i++) {
-            if (buffer->actions[i].type == UNDO_CELL_CHANGE) {
-                undo_free_cell_data(&buffer->actions[i].data.cell);
-            } else if (buffer->actions[i].type == UNDO_RANGE_CHANGE) {
-                if (buffer->actions[i].data.range.cell_data) {
-                    for (int j = 0; j < buffer->actions[i].data.range.cell_count; j++) {
-                        undo_free_cell_data(&buffer->actions[i].data.range.cell_data[j]);
-                    }
-                    free(buffer->actions[i].data.range.cell_data);
-                }
-            }
-        }
-        buffer->count = buffer->current_index;
-    }
-    
-    // Check if buffer is full
-    if (buffer->count >= MAX_UNDO_ACTIONS) {
-        if (buffer->actions[0].type == UNDO_CELL_CHANGE) {
-            undo_free_cell_data(&buffer->actions[0].data.cell);
-        } else if (buffer->actions[0].type == UNDO_RANGE_CHANGE) {
-            if (buffer->actions[0].data.range.cell_data) {
-                for (int j = 0; j < buffer->actions[0].data.range.cell_count; j++) {
-                    undo_free_cell_data(&buffer->actions[0].data.range.cell_data[j]);
-                }
-                free(buffer->actions[0].data.range.cell_data);
-            }
-        }
-        memmove(&buffer->actions[0], &buffer->actions[1], 
-                sizeof(UndoAction) * (MAX_UNDO_ACTIONS - 1));
-        buffer->count--;
-        buffer->current_index--;
-    }
-    
-    // Create new undo action
-    UndoAction* action = &buffer->actions[buffer->count];
-    action->type = UNDO_RANGE_CHANGE;
-    action->data.range.start_row = start_row;
-    action->data.range.start_col = start_col;
-    action->data.range.end_row = end_row;
-    action->data.range.end_col = end_col;
-    action->data.range.cell_count = cell_count;
-    
-    // Allocate memory for cell data
-    action->data.range.cell_data = (CellUndoData*)malloc(sizeof(CellUndoData) * cell_count);
-    if (!action->data.range.cell_data) {
-        return; // Failed to allocate memory
-    }
-    
-    // Save state for each cell in the range
-    int index = 0;
-    for (int row = start_row; row <= end_row; row++) {
-        for (int col = start_col; col <= end_col; col++) {
-            action->data.range.cell_data[index].row = row;
-            action->data.range.cell_data[index].col = col;
-            
-            Cell* cell = sheet_get_cell(state->sheet, row, col);
-            undo_copy_cell_data(cell, &action->data.range.cell_data[index]);
-            index++;
-        }
-    }
-    
-    // Copy description
-    strncpy_s(action->description, sizeof(action->description), description, _TRUNCATE);
-    
-    buffer->count++;
-    buffer->current_index = buffer->count;
-}
-
-void undo_restore_cell_data(AppState* state, CellUndoData* src, int row, int col) {
-    // Clear the current cell first
-    sheet_clear_cell(state->sheet, row, col);
-    
-    if (src->old_type == CELL_EMPTY) {
-        return;  // Cell should remain empty
-    }
-    
-    // Get or create cell
-    Cell* cell = sheet_get_or_create_cell(state->sheet, row, col);
-    if (!cell) return;
-    
-    // Restore cell data
-    switch (src->old_type) {
-        case CELL_NUMBER:
-            cell_set_number(cell, src->old_data.number);
-            break;
-        case CELL_STRING:
-            if (src->old_data.string) {
-                cell_set_string(cell, src->old_data.string);
-            }
-            break;
-        case CELL_FORMULA:
-            if (src->old_data.formula.expression) {
-                cell_set_formula(cell, src->old_data.formula.expression);
-            }
-            break;
-        default:
-            break;
-    }
-    
-    // Restore formatting
-    cell_set_format(cell, src->old_format, src->old_format_style);
-    cell_set_text_color(cell, src->old_text_color);
-    cell_set_background_color(cell, src->old_background_color);
-}
-
 void undo_perform(AppState* state) {
-    UndoBuffer* buffer = &state->undo_buffer;
-    
-    if (buffer->current_index == 0) {
+    const char* description = undo_undo(&state->undo, state->sheet);
+    if (!description) {
         strcpy_s(state->status_message, sizeof(state->status_message), "Nothing to undo");
         return;
     }
-    
-    buffer->current_index--;
-    UndoAction* action = &buffer->actions[buffer->current_index];
-    
-    switch (action->type) {
-        case UNDO_CELL_CHANGE: {
-            // Save current state for redo before restoring old state
-            Cell* cell = sheet_get_cell(state->sheet, action->data.cell.row, action->data.cell.col);
-            
-            // Save current state as new state for potential redo
-            if (cell) {
-                action->data.cell.new_type = cell->type;
-                action->data.cell.new_format = cell->format;
-                action->data.cell.new_format_style = cell->format_style;
-                action->data.cell.new_text_color = cell->text_color;
-                action->data.cell.new_background_color = cell->background_color;
-                
-                switch (cell->type) {
-                    case CELL_NUMBER:
-                        action->data.cell.new_data.number = cell->data.number;
-                        break;
-                    case CELL_STRING:
-                        if (action->data.cell.new_data.string) {
-                            free(action->data.cell.new_data.string);
-                        }
-                        action->data.cell.new_data.string = cell->data.string ? _strdup(cell->data.string) : NULL;
-                        break;
-                    case CELL_FORMULA:
-                        if (action->data.cell.new_data.formula.expression) {
-                            free(action->data.cell.new_data.formula.expression);
-                        }
-                        if (action->data.cell.new_data.formula.cached_string) {
-                            free(action->data.cell.new_data.formula.cached_string);
-                        }
-                        action->data.cell.new_data.formula.expression = cell->data.formula.expression ? _strdup(cell->data.formula.expression) : NULL;
-                        action->data.cell.new_data.formula.cached_value = cell->data.formula.cached_value;
-                        action->data.cell.new_data.formula.cached_string = cell->data.formula.cached_string ? _strdup(cell->data.formula.cached_string) : NULL;
-                        action->data.cell.new_data.formula.is_string_result = cell->data.formula.is_string_result;
-                        action->data.cell.new_data.formula.error = cell->data.formula.error;
-                        break;
-                    default:
-                        memset(&action->data.cell.new_data, 0, sizeof(action->data.cell.new_data));
-                        break;
-                }
-            } else {
-                action->data.cell.new_type = CELL_EMPTY;
-                action->data.cell.new_format = FORMAT_GENERAL;
-                action->data.cell.new_format_style = 0;
-                action->data.cell.new_text_color = -1;
-                action->data.cell.new_background_color = -1;
-                memset(&action->data.cell.new_data, 0, sizeof(action->data.cell.new_data));
-            }
-            
-            // Restore the old state
-            undo_restore_cell_data(state, &action->data.cell, action->data.cell.row, action->data.cell.col);
-            break;
-        }
-            
-        case UNDO_RANGE_CHANGE:
-            // Similar logic for range changes - restore all cells in the range
-            for (int i = 0; i < action->data.range.cell_count; i++) {
-                CellUndoData* cell_data = &action->data.range.cell_data[i];
-                undo_restore_cell_data(state, cell_data, cell_data->row, cell_data->col);
-            }
-            break;
-            
-        case UNDO_RESIZE_COLUMN:
-            sheet_set_column_width(state->sheet, action->data.resize.index, action->data.resize.old_size);
-            break;
-            
-        case UNDO_RESIZE_ROW:
-            sheet_set_row_height(state->sheet, action->data.resize.index, action->data.resize.old_size);
-            break;
-            
-        default:
-            break;
-    }
-    
-    sheet_recalculate(state->sheet);
-    
-    char msg[256];
-    snprintf(msg, sizeof(msg), "Undid: %s", action->description);
-    strcpy_s(state->status_message, sizeof(state->status_message), msg);
+    sprintf_s(state->status_message, sizeof(state->status_message), "Undid: %s", description);
 }
 
 void redo_perform(AppState* state) {
-    UndoBuffer* buffer = &state->undo_buffer;
-    
-    if (buffer->current_index >= buffer->count) {
+    const char* description = undo_redo(&state->undo, state->sheet);
+    if (!description) {
         strcpy_s(state->status_message, sizeof(state->status_message), "Nothing to redo");
         return;
     }
-    
-    UndoAction* action = &buffer->actions[buffer->current_index];
-    
-    switch (action->type) {
-        case UNDO_CELL_CHANGE:
-            // Clear the cell first
-            sheet_clear_cell(state->sheet, action->data.cell.row, action->data.cell.col);
-            
-            if (action->data.cell.new_type != CELL_EMPTY) {
-                // Get or create cell for redo
-                Cell* cell = sheet_get_or_create_cell(state->sheet, action->data.cell.row, action->data.cell.col);
-                if (cell) {
-                    // Restore the "new" state that was undone
-                    switch (action->data.cell.new_type) {
-                        case CELL_NUMBER:
-                            cell_set_number(cell, action->data.cell.new_data.number);
-                            break;
-                        case CELL_STRING:
-                            if (action->data.cell.new_data.string) {
-                                cell_set_string(cell, action->data.cell.new_data.string);
-                            }
-                            break;
-                        case CELL_FORMULA:
-                            if (action->data.cell.new_data.formula.expression) {
-                                cell_set_formula(cell, action->data.cell.new_data.formula.expression);
-                            }
-                            break;
-                        default:
-                            break;
-                    }
-                    
-                    // Restore formatting
-                    cell_set_format(cell, action->data.cell.new_format, action->data.cell.new_format_style);
-                    cell_set_text_color(cell, action->data.cell.new_text_color);
-                    cell_set_background_color(cell, action->data.cell.new_background_color);
-                }
-            }
-            break;
-            
-        case UNDO_RANGE_CHANGE:
-            // Restore new state for all cells in range
-            for (int i = 0; i < action->data.range.cell_count; i++) {
-                CellUndoData* cell_data = &action->data.range.cell_data[i];
-                // This would need similar logic as above for each cell
-                // For now, keeping it simple
-                undo_restore_cell_data(state, cell_data, cell_data->row, cell_data->col);
-            }
-            break;
-            
-        case UNDO_RESIZE_COLUMN:
-            sheet_set_column_width(state->sheet, action->data.resize.index, action->data.resize.new_size);
-            break;
-            
-        case UNDO_RESIZE_ROW:
-            sheet_set_row_height(state->sheet, action->data.resize.index, action->data.resize.new_size);
-            break;
-            
-        default:
-            break;
-    }
-    
-    buffer->current_index++;
-    sheet_recalculate(state->sheet);
-    
-    char msg[256];
-    snprintf(msg, sizeof(msg), "Redid: %s", action->description);
-    strcpy_s(state->status_message, sizeof(state->status_message), msg);
+    sprintf_s(state->status_message, sizeof(state->status_message), "Redid: %s", description);
 }
 
 void app_show_chart(AppState* state, ChartType type, const char* x_label, const char* y_label) {
@@ -2120,24 +1905,45 @@ void app_show_chart(AppState* state, ChartType type, const char* x_label, const
     int chart_width = state->console->width - 25;  // Leave more room for legend
     int chart_height = state->console->height - 8; // Leave space for title and borders
     
-    Chart* chart = chart_create_sized(type, x_label, y_label, chart_width, chart_height);
-    if (!chart) {
-        strcpy_s(state->status_message, sizeof(state->status_message), 
-                "Failed to create chart");
-        return;
+    // Add data from selected range, once its values are current
+    RangeSelection* selection = &state->sheet->selection;
+    CellRange range = {
+        min(selection->start_row, selection->end_row), min(selection->start_col, selection->end_col),
+        max(selection->start_row, selection->end_row), max(selection->start_col, selection->end_col)
+    };
+    sheet_recalculate_range(state->sheet, &range);
+    
+    // The same chart is reused; it is only drawn again if its data changed
+    Chart* chart = state->chart;
+    if (!chart_matches(chart, state->sheet, &state->sheet->selection, type, x_label, y_label,
+                       chart_width, chart_height)) {
+        chart_free(state->chart);
+        state->chart = NULL;
+        
+        chart = chart_create_sized(type, x_label, y_label, chart_width, chart_height);
+        if (!chart) {
+            strcpy_s(state->status_message, sizeof(state->status_message), 
+                    "Failed to create chart");
+            return;
+        }
+        if (!chart_add_data_from_range(chart, state->sheet, &state->sheet->selection)) {
+            chart_free(chart);
+            strcpy_s(state->status_message, sizeof(state->status_message), 
+                    "Failed to add data to chart (need at least 2 columns)");
+            return;
+        }
+        state->chart = chart;
     }
     
-    // Add data from selected range
-    if (!chart_add_data_from_range(chart, state->sheet, &state->sheet->selection)) {
-        chart_free(chart);
+    // Render the chart
+    if (!chart_refresh(chart, state->sheet)) {
+        chart_free(state->chart);
+        state->chart = NULL;
         strcpy_s(state->status_message, sizeof(state->status_message), 
                 "Failed to add data to chart (need at least 2 columns)");
         return;
     }
     
-    // Render the chart
-    chart_render(chart);
-    
     // Create title for the chart
     char title[TITLE_BUFFER_SIZE];
     const char* type_name = "Chart";
@@ -2158,12 +1964,9 @@ void app_show_chart(AppState* state, ChartType type, const char* x_label, const
         if (console_get_key(state->console, &key)) {
             break;  // Any key closes the chart
         }
-        Sleep(CHART_POPUP_SLEEP_MS);
+        console_wait_input(state->console, INFINITE);
     }
     
-    // Clean up
-    chart_free(chart);
-    
     // Clear the range selection
     sheet_clear_range_selection(state->sheet);
     state->range_selection_active = FALSE;
@@ -2185,24 +1988,64 @@ int main() {
     // Main loop
     while (state.running) {
         app_update_cursor_blink(&state);
-        app_render(&state);
+        
+        // A freshly loaded sheet is drawn before its pass begins, since
+        // finding what to evaluate in a large one takes a while
+        if (state.needs_render && state.sheet->calc_deferred) {
+            app_render(&state);
+            state.needs_render = FALSE;
+        }
+        
+        // Recalculate a slice at a time so keys are read in between; an
+        // edit cancels the pass and the next slice picks up what is left
+        if (workbook_recalc_pending(&state.workbook)) {
+            if (workbook_recalculate_step(&state.workbook, RECALC_STEP_MS) == LL_ERR_CIRCULAR_REF) {
+                strcpy_s(state.status_message, sizeof(state.status_message), "Circular reference");
+            }
+            state.needs_render = TRUE;
+        }
+        
+        // Nothing on screen changes between input, blink and autosave events
+        if (state.needs_render) {
+            app_render(&state);
+            state.needs_render = FALSE;
+        }
         
         // Check if autosave is needed
         DWORD current_time = GetTickCount();
         if (current_time - state.last_autosave_time >= state.autosave_interval) {
             app_perform_autosave(&state);
             state.last_autosave_time = current_time;
+            state.needs_render = TRUE;  // A failed start reports in the status line
         }
         
-        KeyEvent key;
-        if (console_get_key(state.console, &key)) {
-            app_handle_input(&state, &key);
+        // Sleep until a key arrives, an autosave completes or the next timer
+        // is due; only poll while a recalculation is unfinished
+        HANDLE handles[2] = { state.console->hIn, state.autosave.done_event };
+        DWORD handle_count = state.autosave.done_event ? 2 : 1;
+        DWORD timeout = workbook_recalc_pending(&state.workbook) ? 0 : app_time_until_next_event(&state);
+        DWORD wait_result = WaitForMultipleObjects(handle_count, handles, FALSE, timeout);
+        
+        if (wait_result == WAIT_OBJECT_0 + 1) {
+            app_finish_autosave(&state);
+            state.needs_render = TRUE;
+        } else if (wait_result == WAIT_OBJECT_0) {
+            KeyEvent key;
             
-            state.cursor_visible = TRUE;
-            state.cursor_blink_time = GetTickCount();
+            // Drain everything queued so a burst of typing costs one render
+            while (state.running && console_wait_input(state.console, 0)) {
+                if (console_get_key(state.console, &key)) {
+                    app_handle_input(&state, &key);
+                    
+                    state.cursor_visible = TRUE;
+                    state.cursor_blink_time = GetTickCount();
+                    state.needs_render = TRUE;
+                }
+            }
+            
+            // Append this batch's edits before waiting again
+            journal_flush(&state.journal, state.sheet);
         }
-        
-        Sleep(FRAME_SLEEP_MS);  // ~60 FPS
     }
     
     app_cleanup(&state);
@@ -0,0 +1,167 @@
+// pool.c - Slab allocation for fixed-size objects and interned strings
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+#define STRING_BLOCK_SIZE       65536
+#define INITIAL_STRING_ENTRIES  256
+
+// Grow a pointer array to hold at least one more element
+static int reserve_pointer(void*** array, int count, int* capacity, int initial) {
+    if (count < *capacity) return 1;
+
+    int new_capacity = *capacity ? *capacity * 2 : initial;
+    void** grown = (void**)realloc(*array, new_capacity * sizeof(void*));
+    if (!grown) return 0;
+
+    *array = grown;
+    *capacity = new_capacity;
+    return 1;
+}
+
+void pool_init(ObjectPool* pool, size_t object_size, int objects_per_slab) {
+    memset(pool, 0, sizeof(ObjectPool));
+    // Keep every object suitably aligned for doubles and pointers
+    pool->object_size = (object_size + sizeof(double) - 1) & ~(sizeof(double) - 1);
+    pool->objects_per_slab = objects_per_slab;
+}
+
+void* pool_alloc(ObjectPool* pool) {
+    void* object;
+
+    if (pool->free_count > 0) {
+        object = pool->free_list[--pool->free_count];
+        memset(object, 0, pool->object_size);
+        return object;
+    }
+
+    if (pool->slab_count == 0 || pool->slab_used >= pool->objects_per_slab) {
+        if (!reserve_pointer((void***)&pool->slabs, pool->slab_count, &pool->slab_capacity, 16)) {
+            return NULL;
+        }
+        char* slab = (char*)calloc(pool->objects_per_slab, pool->object_size);
+        if (!slab) return NULL;
+        pool->slabs[pool->slab_count++] = slab;
+        pool->slab_used = 0;
+    }
+
+    // Fresh slab memory is already zeroed by calloc
+    object = pool->slabs[pool->slab_count - 1] + (size_t)pool->slab_used * pool->object_size;
+    pool->slab_used++;
+    return object;
+}
+
+void pool_release(ObjectPool* pool, void* object) {
+    if (!object) return;
+
+    // If the free list cannot grow the object simply stays unused until teardown
+    if (reserve_pointer(&pool->free_list, pool->free_count, &pool->free_capacity, 64)) {
+        pool->free_list[pool->free_count++] = object;
+    }
+}
+
+void pool_destroy(ObjectPool* pool) {
+    for (int i = 0; i < pool->slab_count; i++) {
+        free(pool->slabs[i]);
+    }
+    free(pool->slabs);
+    free(pool->free_list);
+    memset(pool, 0, sizeof(ObjectPool));
+}
+
+// FNV-1a
+static unsigned int string_hash(const char* str) {
+    unsigned int h = 2166136261u;
+    while (*str) {
+        h ^= (unsigned char)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void string_table_init(StringTable* table) {
+    memset(table, 0, sizeof(StringTable));
+}
+
+static int string_table_grow(StringTable* table) {
+    int new_capacity = table->entry_capacity ? table->entry_capacity * 2 : INITIAL_STRING_ENTRIES;
+    char** entries = (char**)calloc(new_capacity, sizeof(char*));
+    if (!entries) return 0;
+
+    unsigned int mask = (unsigned int)new_capacity - 1;
+    for (int i = 0; i < table->entry_capacity; i++) {
+        char* str = table->entries[i];
+        if (!str) continue;
+        unsigned int pos = string_hash(str) & mask;
+        while (entries[pos]) pos = (pos + 1) & mask;
+        entries[pos] = str;
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->entry_capacity = new_capacity;
+    return 1;
+}
+
+// Copy a string into block storage. Long strings get a block of their own
+// so they do not waste the remainder of the shared block.
+static char* string_table_store(StringTable* table, const char* str, size_t size) {
+    char* dest;
+
+    if (!reserve_pointer((void***)&table->blocks, table->block_count, &table->block_capacity, 16)) {
+        return NULL;
+    }
+
+    if (size > STRING_BLOCK_SIZE / 4) {
+        dest = (char*)malloc(size);
+        if (!dest) return NULL;
+        table->blocks[table->block_count++] = dest;
+    } else {
+        if (!table->current || table->current_used + size > table->current_size) {
+            char* block = (char*)malloc(STRING_BLOCK_SIZE);
+            if (!block) return NULL;
+            table->blocks[table->block_count++] = block;
+            table->current = block;
+            table->current_used = 0;
+            table->current_size = STRING_BLOCK_SIZE;
+        }
+        dest = table->current + table->current_used;
+        table->current_used += size;
+    }
+
+    memcpy(dest, str, size);
+    return dest;
+}
+
+char* string_table_intern(StringTable* table, const char* str) {
+    if (!str) return NULL;
+
+    if ((table->entry_count + 1) * 2 > table->entry_capacity) {
+        if (!string_table_grow(table)) return NULL;
+    }
+
+    unsigned int mask = (unsigned int)table->entry_capacity - 1;
+    unsigned int pos = string_hash(str) & mask;
+    while (table->entries[pos]) {
+        if (strcmp(table->entries[pos], str) == 0) {
+            return table->entries[pos];
+        }
+        pos = (pos + 1) & mask;
+    }
+
+    char* stored = string_table_store(table, str, strlen(str) + 1);
+    if (!stored) return NULL;
+
+    table->entries[pos] = stored;
+    table->entry_count++;
+    return stored;
+}
+
+void string_table_destroy(StringTable* table) {
+    for (int i = 0; i < table->block_count; i++) {
+        free(table->blocks[i]);
+    }
+    free(table->blocks);
+    free(table->entries);
+    memset(table, 0, sizeof(StringTable));
+}
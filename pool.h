@@ -0,0 +1,44 @@
+// pool.h - Slab allocation for fixed-size objects and interned strings
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Fixed-size objects carved out of large slabs. Released objects are kept
+// on a free list for reuse; everything is returned in one pass by pool_destroy.
+typedef struct {
+    size_t object_size;
+    int objects_per_slab;
+    char** slabs;
+    int slab_count;
+    int slab_capacity;
+    int slab_used;          // Objects handed out from the newest slab
+    void** free_list;       // Released objects awaiting reuse
+    int free_count;
+    int free_capacity;
+} ObjectPool;
+
+void pool_init(ObjectPool* pool, size_t object_size, int objects_per_slab);
+void* pool_alloc(ObjectPool* pool);             // Zeroed object or NULL
+void pool_release(ObjectPool* pool, void* object);
+void pool_destroy(ObjectPool* pool);
+
+// Deduplicated, immutable strings stored in bump-allocated blocks. Strings
+// live until string_table_destroy; callers must never free or modify them.
+typedef struct {
+    char** entries;         // Open-addressed hash of interned strings
+    int entry_count;
+    int entry_capacity;     // Power of two, kept at most half full
+    char** blocks;          // Every block, for teardown
+    int block_count;
+    int block_capacity;
+    char* current;          // Block new strings are appended to
+    size_t current_used;
+    size_t current_size;
+} StringTable;
+
+void string_table_init(StringTable* table);
+char* string_table_intern(StringTable* table, const char* str);  // NULL on allocation failure
+void string_table_destroy(StringTable* table);
+
+#endif // POOL_H
@@ -0,0 +1,295 @@
+// ranges.c - Range descriptors shared by every formula that names a range
+//
+// Ranges are resolved to coordinates when a formula is compiled. A model
+// tends to name the same few ranges from thousands of formulas (a rate
+// table, a column total), so each distinct range gets one descriptor per
+// sheet and compiled programs are linked to it by id. Ids index
+// sheet->shared_ranges and stay valid until sheet_free; the array only
+// grows, and only outside parallel evaluation.
+//
+// Descriptors also memoize SUM/AVG/MIN/MAX. Every value a cell publishes
+// (sheet_store_value) is applied to the memos of the ranges holding it as a
+// delta, so one edit under a large total costs O(1) rather than a rescan.
+// MIN and MAX can only be kept this way while the old value was not the
+// extreme; otherwise they are recomputed the next time they are read.
+#include "ranges.h"
+
+#define INITIAL_RANGE_SLOTS     64
+
+static unsigned int range_hash(const CellRange* range) {
+    unsigned int h = 2166136261u;
+    h = (h ^ (unsigned int)range->start_row) * 16777619u;
+    h = (h ^ (unsigned int)range->start_col) * 16777619u;
+    h = (h ^ (unsigned int)range->end_row) * 16777619u;
+    h = (h ^ (unsigned int)range->end_col) * 16777619u;
+    return h;
+}
+
+static int range_equal(const CellRange* a, const CellRange* b) {
+    return a->start_row == b->start_row && a->start_col == b->start_col &&
+           a->end_row == b->end_row && a->end_col == b->end_col;
+}
+
+// Slot holding the range's id + 1, or the empty slot where it would go
+static int range_slot(const Sheet* sheet, const CellRange* range, unsigned int hash) {
+    unsigned int mask = (unsigned int)(sheet->shared_range_slot_capacity - 1);
+    unsigned int pos = hash & mask;
+
+    while (sheet->shared_range_slots[pos]) {
+        const SharedRange* shared = &sheet->shared_ranges[sheet->shared_range_slots[pos] - 1];
+        if (shared->hash == hash && range_equal(&shared->range, range)) break;
+        pos = (pos + 1) & mask;
+    }
+    return (int)pos;
+}
+
+// Keep the slots at most half full
+static int range_slots_grow(Sheet* sheet) {
+    int new_capacity = sheet->shared_range_slot_capacity ? sheet->shared_range_slot_capacity * 2 : INITIAL_RANGE_SLOTS;
+    int* slots = (int*)calloc(new_capacity, sizeof(int));
+    if (!slots) return 0;
+
+    unsigned int mask = (unsigned int)(new_capacity - 1);
+    for (int id = 0; id < sheet->shared_range_count; id++) {
+        unsigned int pos = sheet->shared_ranges[id].hash & mask;
+        while (slots[pos]) pos = (pos + 1) & mask;
+        slots[pos] = id + 1;
+    }
+
+    free(sheet->shared_range_slots);
+    sheet->shared_range_slots = slots;
+    sheet->shared_range_slot_capacity = new_capacity;
+    return 1;
+}
+
+int shared_range_find(const Sheet* sheet, const CellRange* range) {
+    if (!sheet->shared_range_slots) return -1;
+    int pos = range_slot(sheet, range, range_hash(range));
+    return sheet->shared_range_slots[pos] - 1;
+}
+
+int shared_range_intern(Sheet* sheet, const CellRange* range) {
+    int id = shared_range_find(sheet, range);
+    if (id >= 0) return id;
+
+    if ((sheet->shared_range_count + 1) * 2 > sheet->shared_range_slot_capacity) {
+        if (!range_slots_grow(sheet)) return -1;
+    }
+    if (sheet->shared_range_count >= sheet->shared_range_capacity) {
+        int new_capacity = sheet->shared_range_capacity ? sheet->shared_range_capacity * 2 : 16;
+        SharedRange* grown = (SharedRange*)realloc(sheet->shared_ranges, new_capacity * sizeof(SharedRange));
+        if (!grown) return -1;
+        sheet->shared_ranges = grown;
+        sheet->shared_range_capacity = new_capacity;
+    }
+
+    unsigned int hash = range_hash(range);
+    id = sheet->shared_range_count++;
+    SharedRange* shared = &sheet->shared_ranges[id];
+    memset(shared, 0, sizeof(*shared));
+    shared->range = *range;
+    shared->hash = hash;
+    sheet->shared_range_slots[range_slot(sheet, range, hash)] = id + 1;
+    return id;
+}
+
+SharedRange* shared_range_get(Sheet* sheet, int id, const CellRange* range) {
+    if (id < 0 || id >= sheet->shared_range_count) return NULL;
+    SharedRange* shared = &sheet->shared_ranges[id];
+    return range_equal(&shared->range, range) ? shared : NULL;
+}
+
+void shared_range_link(Sheet* sheet, CompiledFormula* program) {
+    for (int pc = 0; pc < program->code_count; pc++) {
+        FormulaInstr* instr = &program->code[pc];
+        if (instr->op != OP_AGG_RANGE && instr->op != OP_RANGE_SUM) continue;
+
+        // Unlinked instructions still evaluate, just without sharing
+        instr->index = shared_range_intern(sheet, &instr->u.range);
+        if (instr->index >= 0) sheet->shared_ranges[instr->index].users++;
+    }
+
+    for (int i = 0; i < program->lookup_count; i++) {
+        const FormulaLookup* lookup = &program->lookups[i];
+        if (!lookup->ranges_valid) continue;
+
+        int id = shared_range_intern(sheet, &lookup->lookup_range);
+        if (id >= 0) sheet->shared_ranges[id].users++;
+    }
+}
+
+void shared_range_reset_users(Sheet* sheet) {
+    for (int id = 0; id < sheet->shared_range_count; id++) {
+        sheet->shared_ranges[id].users = 0;
+    }
+}
+
+void shared_range_free_all(Sheet* sheet) {
+    if (sheet->memo_columns) {
+        for (int col = 0; col < sheet->cols; col++) {
+            free(sheet->memo_columns[col]);
+        }
+    }
+    free(sheet->memo_columns);
+    free(sheet->memo_column_count);
+    free(sheet->memo_column_capacity);
+    sheet->memo_columns = NULL;
+    sheet->memo_column_count = NULL;
+    sheet->memo_column_capacity = NULL;
+    free(sheet->shared_ranges);
+    free(sheet->shared_range_slots);
+    sheet->shared_ranges = NULL;
+    sheet->shared_range_slots = NULL;
+    sheet->shared_range_count = 0;
+    sheet->shared_range_capacity = 0;
+    sheet->shared_range_slot_capacity = 0;
+}
+
+// Columns of the range that lie inside the sheet
+static void memo_columns_of(const Sheet* sheet, const CellRange* range, int* first, int* last) {
+    *first = range->start_col < 0 ? 0 : range->start_col;
+    *last = range->end_col >= sheet->cols ? sheet->cols - 1 : range->end_col;
+}
+
+// List a freshly memoized range under each of its columns. Room is made in
+// every column first, so a range is either listed everywhere or nowhere.
+static int memo_register(Sheet* sheet, int id) {
+    SharedRange* shared = &sheet->shared_ranges[id];
+    if (shared->memo_registered) return 1;
+
+    if (!sheet->memo_columns) {
+        sheet->memo_columns = (int**)calloc(sheet->cols, sizeof(int*));
+        sheet->memo_column_count = (int*)calloc(sheet->cols, sizeof(int));
+        sheet->memo_column_capacity = (int*)calloc(sheet->cols, sizeof(int));
+        if (!sheet->memo_columns || !sheet->memo_column_count || !sheet->memo_column_capacity) {
+            free(sheet->memo_columns);
+            free(sheet->memo_column_count);
+            free(sheet->memo_column_capacity);
+            sheet->memo_columns = NULL;
+            sheet->memo_column_count = NULL;
+            sheet->memo_column_capacity = NULL;
+            return 0;
+        }
+    }
+
+    int first, last;
+    memo_columns_of(sheet, &shared->range, &first, &last);
+    for (int col = first; col <= last; col++) {
+        if (sheet->memo_column_count[col] < sheet->memo_column_capacity[col]) continue;
+
+        int new_capacity = sheet->memo_column_capacity[col] ? sheet->memo_column_capacity[col] * 2 : 4;
+        int* grown = (int*)realloc(sheet->memo_columns[col], new_capacity * sizeof(int));
+        if (!grown) return 0;
+        sheet->memo_columns[col] = grown;
+        sheet->memo_column_capacity[col] = new_capacity;
+    }
+    for (int col = first; col <= last; col++) {
+        sheet->memo_columns[col][sheet->memo_column_count[col]++] = id;
+    }
+    shared->memo_registered = 1;
+    return 1;
+}
+
+int shared_range_aggregate(Sheet* sheet, int id, const CellRange* range, int need_extremes, RangeAggregate* agg) {
+    SharedRange* shared = shared_range_get(sheet, id, range);
+    if (!shared) return 0;
+
+    if (!shared->memo_valid || (need_extremes && !shared->extremes_valid)) {
+        // Memos are only filled in on the main thread
+        if (sheet->lookup_read_only || !memo_register(sheet, id)) return 0;
+
+        sheet_aggregate_range(sheet, range, &shared->memo);
+        shared->memo_valid = 1;
+        shared->extremes_valid = 1;
+        shared->memo_updates = 0;
+    }
+
+    *agg = shared->memo;
+    agg->sum += agg->compensation;
+    agg->compensation = 0.0;
+    return 1;
+}
+
+// Neumaier step, as range_aggregate_add carries it across batches
+static void memo_add(RangeAggregate* memo, double value) {
+    double total = memo->sum + value;
+    if (fabs(memo->sum) >= fabs(value)) {
+        memo->compensation += (memo->sum - total) + value;
+    } else {
+        memo->compensation += (value - total) + memo->sum;
+    }
+    memo->sum = total;
+}
+
+static void memo_apply(SharedRange* shared, CellValueKind old_kind, double old_value, CellValueKind kind, double value) {
+    RangeAggregate* memo = &shared->memo;
+    int removed = CELL_VALUE_IN_RANGE(old_kind);
+    int added = CELL_VALUE_IN_RANGE(kind);
+
+    // Infinities and NaN cannot be subtracted back out
+    if ((removed && !isfinite(old_value)) || (added && !isfinite(value))) {
+        shared->memo_valid = 0;
+        return;
+    }
+
+    // Rounding errors build up slowly; rescanning once per range size of
+    // edits keeps them bounded at O(1) amortized cost
+    long long cells = (long long)(shared->range.end_row - shared->range.start_row + 1) *
+                      (shared->range.end_col - shared->range.start_col + 1);
+    if (++shared->memo_updates > cells) {
+        shared->memo_valid = 0;
+        return;
+    }
+
+    if (removed) {
+        memo_add(memo, -old_value);
+        memo->count--;
+        if (memo->count == 0) {
+            memo->min = memo->max = 0.0;
+            shared->extremes_valid = 1;
+        } else if (old_value == memo->min || old_value == memo->max) {
+            shared->extremes_valid = 0;
+        }
+    }
+
+    if (added) {
+        memo_add(memo, value);
+        if (memo->count == 0 || value < memo->min) memo->min = value;
+        if (memo->count == 0 || value > memo->max) memo->max = value;
+        memo->count++;
+    }
+}
+
+void shared_range_value_changed(Sheet* sheet, int row, int col, CellValueKind old_kind, double old_value,
+                                CellValueKind kind, double value) {
+    if (!sheet->memo_columns || col < 0 || col >= sheet->cols) return;
+
+    const int* ids = sheet->memo_columns[col];
+    for (int i = 0; i < sheet->memo_column_count[col]; i++) {
+        SharedRange* shared = &sheet->shared_ranges[ids[i]];
+        if (!shared->memo_valid || row < shared->range.start_row || row > shared->range.end_row) continue;
+        memo_apply(shared, old_kind, old_value, kind, value);
+    }
+}
+
+void shared_range_invalidate_cell(Sheet* sheet, int row, int col) {
+    if (!sheet->memo_columns || col < 0 || col >= sheet->cols) return;
+
+    const int* ids = sheet->memo_columns[col];
+    for (int i = 0; i < sheet->memo_column_count[col]; i++) {
+        SharedRange* shared = &sheet->shared_ranges[ids[i]];
+        if (row >= shared->range.start_row && row <= shared->range.end_row) shared->memo_valid = 0;
+    }
+}
+
+void shared_range_invalidate_all(Sheet* sheet) {
+    for (int id = 0; id < sheet->shared_range_count; id++) {
+        sheet->shared_ranges[id].memo_valid = 0;
+        sheet->shared_ranges[id].memo_registered = 0;
+    }
+    if (sheet->memo_columns) {
+        for (int col = 0; col < sheet->cols; col++) {
+            sheet->memo_column_count[col] = 0;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+// ranges.h - Range descriptors shared by every formula that names a range
+#ifndef RANGES_H
+#define RANGES_H
+
+#include "sheet.h"
+#include "formula.h"
+
+// One distinct range read by formulas. Formulas naming the same cells link
+// to the same descriptor, so work done for one of them (an XLOOKUP index,
+// an aggregate) is found by all of them.
+typedef struct SharedRange {
+    CellRange range;
+    unsigned int hash;
+    int users;                      // References linked since the last rebuild
+    struct LookupIndex* lookup;     // XLOOKUP index over the range, once built
+
+    // SUM/AVG/MIN/MAX of the range, kept current as its cells change
+    RangeAggregate memo;
+    int memo_valid;
+    int extremes_valid;             // memo.min/max are exact (an extreme may have left)
+    int memo_updates;               // Edits applied since computed; recomputed past the range size
+    int memo_registered;            // Listed in sheet->memo_columns
+} SharedRange;
+
+// Descriptor id for the range, added if new; -1 on allocation failure
+int shared_range_intern(Sheet* sheet, const CellRange* range);
+
+// Descriptor id for the range, or -1 if no formula has named it. Never
+// allocates, so it is safe while formulas evaluate in parallel.
+int shared_range_find(const Sheet* sheet, const CellRange* range);
+
+// The descriptor behind an id linked into a program, or NULL if the id no
+// longer names that range (the program was compiled or moved since)
+SharedRange* shared_range_get(Sheet* sheet, int id, const CellRange* range);
+
+// Point each range a program reads at its shared descriptor: the id goes
+// in FormulaInstr.index of its OP_AGG_RANGE and OP_RANGE_SUM instructions.
+// XLOOKUP ranges are interned too and found again by shared_range_find.
+void shared_range_link(Sheet* sheet, CompiledFormula* program);
+
+// Forget who uses which range before every formula is linked again.
+// Descriptors and their ids stay valid.
+void shared_range_reset_users(Sheet* sheet);
+void shared_range_free_all(Sheet* sheet);
+
+// Aggregate of a linked range from its memo, computed on first use: 1 with
+// *agg filled, or 0 if the caller must aggregate the range itself (not
+// linked, or not memoized yet while formulas evaluate in parallel). MIN and
+// MAX are only recomputed if need_extremes and an extreme has since gone.
+int shared_range_aggregate(Sheet* sheet, int id, const CellRange* range, int need_extremes, RangeAggregate* agg);
+
+// Apply a cell's new value to the memos of every range holding it, in O(1)
+// per range for SUM/AVG
+void shared_range_value_changed(Sheet* sheet, int row, int col, CellValueKind old_kind, double old_value,
+                                CellValueKind kind, double value);
+// Drop the memos over a cell whose change was not applied, or all of them
+void shared_range_invalidate_cell(Sheet* sheet, int row, int col);
+void shared_range_invalidate_all(Sheet* sheet);
+
+#endif // RANGES_H
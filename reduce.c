@@ -0,0 +1,280 @@
+// reduce.c - Vectorized reductions over double arrays
+//
+// SUM/AVG/MIN/MAX feed batches of range values through these kernels. The
+// SSE2 and AVX2 paths are compiled unconditionally on x86 and picked at
+// runtime; other targets, and CPUs without AVX2, use the portable code.
+#include <math.h>
+#include "reduce.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define REDUCE_HAVE_SSE2 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define REDUCE_TARGET_AVX2
+#else
+#define REDUCE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define REDUCE_HAVE_SSE2 0
+#endif
+
+#define REDUCE_LANES 4
+
+// Neumaier step: add x to the running sum s, keeping the lost low-order bits in c
+static void compensated_add(double* s, double* c, double x) {
+    double t = *s + x;
+    if (fabs(*s) >= fabs(x)) {
+        *c += (*s - t) + x;
+    } else {
+        *c += (x - t) + *s;
+    }
+    *s = t;
+}
+
+// Fold the per-lane sums and the tail that did not fill a full set of lanes.
+// Shared by every kernel so they all round identically.
+static double finish_sum(const double* lane_sum, const double* lane_comp,
+                         const double* tail, int tail_count) {
+    double s = lane_sum[0];
+    double c = lane_comp[0];
+    for (int k = 1; k < REDUCE_LANES; k++) {
+        compensated_add(&s, &c, lane_sum[k]);
+        c += lane_comp[k];
+    }
+    for (int i = 0; i < tail_count; i++) {
+        compensated_add(&s, &c, tail[i]);
+    }
+    return s + c;
+}
+
+static double sum_scalar(const double* values, int count) {
+    double s[REDUCE_LANES] = {0.0, 0.0, 0.0, 0.0};
+    double c[REDUCE_LANES] = {0.0, 0.0, 0.0, 0.0};
+    int full = count - count % REDUCE_LANES;
+
+    for (int i = 0; i < full; i += REDUCE_LANES) {
+        for (int k = 0; k < REDUCE_LANES; k++) {
+            compensated_add(&s[k], &c[k], values[i + k]);
+        }
+    }
+    return finish_sum(s, c, values + full, count - full);
+}
+
+static double min_scalar(const double* values, int count) {
+    double min = values[0];
+    for (int i = 1; i < count; i++) {
+        if (values[i] < min) min = values[i];
+    }
+    return min;
+}
+
+static double max_scalar(const double* values, int count) {
+    double max = values[0];
+    for (int i = 1; i < count; i++) {
+        if (values[i] > max) max = values[i];
+    }
+    return max;
+}
+
+#if REDUCE_HAVE_SSE2
+
+// One Neumaier step on two lanes, branch replaced by a select
+static void sse2_compensated_add(__m128d* s, __m128d* c, __m128d x) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    __m128d t = _mm_add_pd(*s, x);
+    __m128d s_bigger = _mm_cmpge_pd(_mm_andnot_pd(sign, *s), _mm_andnot_pd(sign, x));
+    __m128d when_s = _mm_add_pd(_mm_sub_pd(*s, t), x);
+    __m128d when_x = _mm_add_pd(_mm_sub_pd(x, t), *s);
+    *c = _mm_add_pd(*c, _mm_or_pd(_mm_and_pd(s_bigger, when_s), _mm_andnot_pd(s_bigger, when_x)));
+    *s = t;
+}
+
+static double sum_sse2(const double* values, int count) {
+    __m128d s_lo = _mm_setzero_pd(), s_hi = _mm_setzero_pd();
+    __m128d c_lo = _mm_setzero_pd(), c_hi = _mm_setzero_pd();
+    double s[REDUCE_LANES], c[REDUCE_LANES];
+    int full = count - count % REDUCE_LANES;
+
+    for (int i = 0; i < full; i += REDUCE_LANES) {
+        sse2_compensated_add(&s_lo, &c_lo, _mm_loadu_pd(values + i));
+        sse2_compensated_add(&s_hi, &c_hi, _mm_loadu_pd(values + i + 2));
+    }
+    _mm_storeu_pd(s, s_lo);
+    _mm_storeu_pd(s + 2, s_hi);
+    _mm_storeu_pd(c, c_lo);
+    _mm_storeu_pd(c + 2, c_hi);
+    return finish_sum(s, c, values + full, count - full);
+}
+
+static double min_sse2(const double* values, int count) {
+    if (count < REDUCE_LANES) return min_scalar(values, count);
+
+    __m128d lo = _mm_loadu_pd(values), hi = _mm_loadu_pd(values + 2);
+    int full = count - count % REDUCE_LANES;
+    for (int i = REDUCE_LANES; i < full; i += REDUCE_LANES) {
+        lo = _mm_min_pd(_mm_loadu_pd(values + i), lo);
+        hi = _mm_min_pd(_mm_loadu_pd(values + i + 2), hi);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_min_pd(lo, hi));
+    double min = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    for (int i = full; i < count; i++) {
+        if (values[i] < min) min = values[i];
+    }
+    return min;
+}
+
+static double max_sse2(const double* values, int count) {
+    if (count < REDUCE_LANES) return max_scalar(values, count);
+
+    __m128d lo = _mm_loadu_pd(values), hi = _mm_loadu_pd(values + 2);
+    int full = count - count % REDUCE_LANES;
+    for (int i = REDUCE_LANES; i < full; i += REDUCE_LANES) {
+        lo = _mm_max_pd(_mm_loadu_pd(values + i), lo);
+        hi = _mm_max_pd(_mm_loadu_pd(values + i + 2), hi);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_max_pd(lo, hi));
+    double max = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+    for (int i = full; i < count; i++) {
+        if (values[i] > max) max = values[i];
+    }
+    return max;
+}
+
+REDUCE_TARGET_AVX2
+static double sum_avx2(const double* values, int count) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d s = _mm256_setzero_pd();
+    __m256d c = _mm256_setzero_pd();
+    double lane_sum[REDUCE_LANES], lane_comp[REDUCE_LANES];
+    int full = count - count % REDUCE_LANES;
+
+    for (int i = 0; i < full; i += REDUCE_LANES) {
+        __m256d x = _mm256_loadu_pd(values + i);
+        __m256d t = _mm256_add_pd(s, x);
+        __m256d s_bigger = _mm256_cmp_pd(_mm256_andnot_pd(sign, s), _mm256_andnot_pd(sign, x), _CMP_GE_OQ);
+        __m256d when_s = _mm256_add_pd(_mm256_sub_pd(s, t), x);
+        __m256d when_x = _mm256_add_pd(_mm256_sub_pd(x, t), s);
+        c = _mm256_add_pd(c, _mm256_blendv_pd(when_x, when_s, s_bigger));
+        s = t;
+    }
+    _mm256_storeu_pd(lane_sum, s);
+    _mm256_storeu_pd(lane_comp, c);
+    return finish_sum(lane_sum, lane_comp, values + full, count - full);
+}
+
+REDUCE_TARGET_AVX2
+static double min_avx2(const double* values, int count) {
+    if (count < REDUCE_LANES) return min_scalar(values, count);
+
+    __m256d acc = _mm256_loadu_pd(values);
+    int full = count - count % REDUCE_LANES;
+    for (int i = REDUCE_LANES; i < full; i += REDUCE_LANES) {
+        acc = _mm256_min_pd(_mm256_loadu_pd(values + i), acc);
+    }
+    double lanes[REDUCE_LANES];
+    _mm256_storeu_pd(lanes, acc);
+    double min = lanes[0];
+    for (int k = 1; k < REDUCE_LANES; k++) {
+        if (lanes[k] < min) min = lanes[k];
+    }
+    for (int i = full; i < count; i++) {
+        if (values[i] < min) min = values[i];
+    }
+    return min;
+}
+
+REDUCE_TARGET_AVX2
+static double max_avx2(const double* values, int count) {
+    if (count < REDUCE_LANES) return max_scalar(values, count);
+
+    __m256d acc = _mm256_loadu_pd(values);
+    int full = count - count % REDUCE_LANES;
+    for (int i = REDUCE_LANES; i < full; i += REDUCE_LANES) {
+        acc = _mm256_max_pd(_mm256_loadu_pd(values + i), acc);
+    }
+    double lanes[REDUCE_LANES];
+    _mm256_storeu_pd(lanes, acc);
+    double max = lanes[0];
+    for (int k = 1; k < REDUCE_LANES; k++) {
+        if (lanes[k] > max) max = lanes[k];
+    }
+    for (int i = full; i < count; i++) {
+        if (values[i] > max) max = values[i];
+    }
+    return max;
+}
+
+// AVX2 needs both CPU support and the OS saving the YMM registers
+static int cpu_has_avx2(void) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return 0;
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28))) return 0;  // OSXSAVE, AVX
+    if ((_xgetbv(0) & 6) != 6) return 0;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // REDUCE_HAVE_SSE2
+
+typedef struct {
+    double (*sum_fn)(const double* values, int count);
+    double (*min_fn)(const double* values, int count);
+    double (*max_fn)(const double* values, int count);
+} ReduceTable;
+
+static const ReduceTable reduce_tables[] = {
+    { sum_scalar, min_scalar, max_scalar },
+#if REDUCE_HAVE_SSE2
+    { sum_sse2, min_sse2, max_sse2 },
+    { sum_avx2, min_avx2, max_avx2 },
+#endif
+};
+
+// Selected on first use. Concurrent first calls all store the same value.
+static volatile int g_reduce_kernel = -1;
+
+static ReduceKernel best_kernel(void) {
+#if REDUCE_HAVE_SSE2
+    return cpu_has_avx2() ? REDUCE_AVX2 : REDUCE_SSE2;
+#else
+    return REDUCE_SCALAR;
+#endif
+}
+
+ReduceKernel reduce_active_kernel(void) {
+    if (g_reduce_kernel < 0) {
+        g_reduce_kernel = (int)best_kernel();
+    }
+    return (ReduceKernel)g_reduce_kernel;
+}
+
+void reduce_force_kernel(ReduceKernel kernel) {
+    ReduceKernel best = best_kernel();
+    g_reduce_kernel = (int)(kernel > best ? best : kernel);
+}
+
+double reduce_sum(const double* values, int count) {
+    if (count <= 0) return 0.0;
+    return reduce_tables[reduce_active_kernel()].sum_fn(values, count);
+}
+
+double reduce_min(const double* values, int count) {
+    if (count <= 0) return 0.0;
+    return reduce_tables[reduce_active_kernel()].min_fn(values, count);
+}
+
+double reduce_max(const double* values, int count) {
+    if (count <= 0) return 0.0;
+    return reduce_tables[reduce_active_kernel()].max_fn(values, count);
+}
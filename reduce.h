@@ -0,0 +1,21 @@
+// reduce.h - Vectorized reductions over double arrays
+#ifndef REDUCE_H
+#define REDUCE_H
+
+// Kernel selected at runtime from what the CPU supports
+typedef enum {
+    REDUCE_SCALAR,
+    REDUCE_SSE2,
+    REDUCE_AVX2
+} ReduceKernel;
+
+// Compensated (Neumaier) sum. Every kernel accumulates in the same four
+// lanes in the same order, so the result is identical whichever is used.
+double reduce_sum(const double* values, int count);
+double reduce_min(const double* values, int count);   // 0 for an empty array
+double reduce_max(const double* values, int count);   // 0 for an empty array
+
+ReduceKernel reduce_active_kernel(void);
+void reduce_force_kernel(ReduceKernel kernel);         // Testing: clamps to what the CPU supports
+
+#endif // REDUCE_H
@@ -1,25 +1,15 @@
 // sheet.c - Spreadsheet implementation
 #include "sheet.h"
+#include "formula.h"
+#include "reduce.h"
+#include "lookup.h"
+#include "ranges.h"
 #include "console.h"
+#include "threadpool.h"
+#include "stats.h"
 #include "constants.h"
 
-// Global variables for IF function string results
-char g_if_result_string[MAX_CELL_DISPLAY_LENGTH] = {0};
-int g_if_result_is_string = 0;
-static Cell* g_current_evaluating_cell = NULL;
-
-// Forward declarations for expression parsing
-double parse_arithmetic_expression(Sheet* sheet, const char** expr, ErrorType* error);
-double parse_term(Sheet* sheet, const char** expr, ErrorType* error);
-double parse_factor(Sheet* sheet, const char** expr, ErrorType* error);
-double parse_function(Sheet* sheet, const char** expr, ErrorType* error);
-
 // Range parsing structures
-typedef struct {
-    int start_row, start_col;
-    int end_row, end_col;
-} CellRange;
-
 typedef struct {
     int min_row, max_row, min_col, max_col;
 } NormalizedRange;
@@ -33,26 +23,8 @@ NormalizedRange normalize_range(const RangeSelection* sel) {
     return r;
 }
 
-int parse_range(const char* range_str, CellRange* range);
-int get_range_values(Sheet* sheet, const CellRange* range, double* values, int max_values);
-
-// Function implementations
-double func_sum(const double* values, int count);
-double func_avg(const double* values, int count);
-double func_max(const double* values, int count);
-double func_min(const double* values, int count);
-double func_median(double* values, int count);
-double func_mode(const double* values, int count);
-double func_if(double condition, double true_val, double false_val);
-double func_if_enhanced(double condition, double true_val, double false_val, 
-                       const char* true_str, const char* false_str);
-double func_power(double base, double exponent);
-double func_xlookup(Sheet* sheet, double lookup_value, const char* lookup_str,
-                   const char* lookup_array, const char* return_array, int exact_match, ErrorType* error);
 int compare_double(const void* a, const void* b);
-char* escape_csv_string(const char* str);
-char* parse_csv_field(const char** csv_line, int* is_end);
-char* get_cell_string_value(Sheet* sheet, const char* ref);
+static void cell_init(Cell* cell, int row, int col);
 
 // Implementation
 
@@ -68,25 +40,18 @@ Sheet* sheet_new(int rows, int cols) {
         return NULL;
     }
     
-    // Allocate cell array
-    sheet->cells = (Cell***)calloc(rows, sizeof(Cell**));
+    // Cells live in sparse chunks allocated on first use
+    sheet->cells = cell_store_new();
     if (!sheet->cells) {
+        free(sheet->name);
         free(sheet);
         return NULL;
     }
+    pool_init(&sheet->cell_pool, sizeof(Cell), CELL_POOL_SLAB_SIZE);
+    string_table_init(&sheet->strings);
+    sheet->string_pool = &sheet->strings;
     
-    for (int i = 0; i < rows; i++) {
-        sheet->cells[i] = (Cell**)calloc(cols, sizeof(Cell*));
-        if (!sheet->cells[i]) {
-            // Cleanup on failure
-            for (int j = 0; j < i; j++) {
-                free(sheet->cells[j]);
-            }
-            free(sheet->cells);
-            free(sheet);
-            return NULL;
-        }
-    }    // Initialize column widths
+    // Initialize column widths
     sheet->col_widths = (int*)calloc(cols, sizeof(int));
     for (int i = 0; i < cols; i++) {
         sheet->col_widths[i] = DEFAULT_COLUMN_WIDTH;
@@ -98,6 +63,21 @@ Sheet* sheet_new(int rows, int cols) {
         sheet->row_heights[i] = 1;  // Default height
     }
     
+    // Used range starts empty
+    sheet->row_used = (int*)calloc(rows, sizeof(int));
+    sheet->col_used = (int*)calloc(cols, sizeof(int));
+    sheet->column_versions = (unsigned int*)calloc(cols, sizeof(unsigned int));
+    
+    // Range listeners are bucketed by column
+    sheet->dep_graph.column_listeners = (RangeListener**)calloc(cols, sizeof(RangeListener*));
+    sheet->dep_graph.listener_count = (int*)calloc(cols, sizeof(int));
+    sheet->dep_graph.listener_capacity = (int*)calloc(cols, sizeof(int));
+    if (!sheet->row_used || !sheet->col_used || !sheet->column_versions || !sheet->dep_graph.column_listeners ||
+        !sheet->dep_graph.listener_count || !sheet->dep_graph.listener_capacity) {
+        sheet_free(sheet);
+        return NULL;
+    }
+    
     // Initialize range selection and clipboard
     sheet->selection.is_active = 0;
     sheet->range_clipboard.is_active = 0;
@@ -109,15 +89,26 @@ Sheet* sheet_new(int rows, int cols) {
 void sheet_free(Sheet* sheet) {
     if (!sheet) return;
     
-    // Free all cells
-    for (int i = 0; i < sheet->rows; i++) {
-        for (int j = 0; j < sheet->cols; j++) {
-            if (sheet->cells[i][j]) {
-                cell_free(sheet->cells[i][j]);
+    // Free all cells. Cell memory and interned strings go with their slabs,
+    // so only formulas, dependency lists and display text need freeing one
+    // by one.
+    if (sheet->cells) {
+        CellIterator it;
+        Cell* cell;
+        cell_store_iter_begin(sheet->cells, &it);
+        while ((cell = cell_store_iter_next(&it)) != NULL) {
+            if (cell->type == CELL_FORMULA || (cell->type == CELL_STRING && !cell->is_interned) ||
+                cell->depends_on || cell->dependents || cell->display) {
+                cell_free(cell);
             }
         }
-        free(sheet->cells[i]);    }
-    free(sheet->cells);
+        cell_store_free(sheet->cells);
+    }
+    lookup_free_all(sheet);
+    shared_range_free_all(sheet);
+    thread_pool_destroy(sheet->recalc_pool);
+    pool_destroy(&sheet->cell_pool);
+    string_table_destroy(&sheet->strings);
     
     // Free range clipboard
     if (sheet->range_clipboard.cells) {
@@ -133,8 +124,27 @@ void sheet_free(Sheet* sheet) {
     }
       free(sheet->col_widths);
     free(sheet->row_heights);  // Free row heights
+    free(sheet->row_used);
+    free(sheet->col_used);
+    free(sheet->column_versions);
+    free(sheet->external_readers);
     free(sheet->name);
     free(sheet->calc_order);
+    free(sheet->calc_affected);
+    free(sheet->calc_ready);
+    free(sheet->calc_urgent);
+    free(sheet->calc_scratch);
+    
+    // Free dependency graph
+    if (sheet->dep_graph.column_listeners) {
+        for (int c = 0; c < sheet->cols; c++) {
+            free(sheet->dep_graph.column_listeners[c]);
+        }
+        free(sheet->dep_graph.column_listeners);
+    }
+    free(sheet->dep_graph.listener_count);
+    free(sheet->dep_graph.listener_capacity);
+    free(sheet->dep_graph.dirty);
     free(sheet);
 }
 
@@ -142,7 +152,117 @@ Cell* sheet_get_cell(Sheet* sheet, int row, int col) {
     if (row < 0 || row >= sheet->rows || col < 0 || col >= sheet->cols) {
         return NULL;
     }
-    return sheet->cells[row][col];
+    return cell_store_get(sheet->cells, row, col);
+}
+
+void sheet_iter_begin(Sheet* sheet, CellIterator* it) {
+    cell_store_iter_begin(sheet->cells, it);
+}
+
+Cell* sheet_iter_next(CellIterator* it) {
+    return cell_store_iter_next(it);
+}
+
+// Copy a cell's value into the store's flat arrays, where range scans read
+// it, and bring the memoized aggregates and lookup indexes over it up to
+// date. Cells evaluated in parallel leave that to evaluate_level.
+static void sheet_store_value(Sheet* sheet, const Cell* cell) {
+    CellValueKind kind = CELL_VALUE_EMPTY;
+    double value = 0.0;
+    
+    switch (cell->type) {
+        case CELL_NUMBER:
+            kind = CELL_VALUE_NUMBER;
+            value = cell->data.number;
+            break;
+        case CELL_STRING:
+            kind = CELL_VALUE_TEXT;
+            break;
+        case CELL_FORMULA:
+            if (cell->data.formula.error != ERROR_NONE) {
+                kind = CELL_VALUE_ERROR;
+                value = (double)cell->data.formula.error;  // So a new error code counts as a change
+            } else {
+                kind = cell->data.formula.is_string_result ? CELL_VALUE_TEXT_RESULT : CELL_VALUE_NUMBER;
+                value = cell->data.formula.cached_value;
+            }
+            break;
+        default:
+            break;
+    }
+    
+    const CellChunk* chunk = cell_store_chunk(sheet->cells, cell->row, cell->col);
+    if (!chunk) return;
+    int index = CELL_CHUNK_VALUE(cell->row, cell->col);
+    CellValueKind old_kind = (CellValueKind)chunk->kinds[index];
+    double old_value = chunk->values[index];
+    if (old_kind == kind && memcmp(&old_value, &value, sizeof(double)) == 0) {
+        // Text is not in the arrays and may have changed under the same kind
+        if ((kind == CELL_VALUE_TEXT || kind == CELL_VALUE_TEXT_RESULT) && !sheet->lookup_read_only) {
+            lookup_cell_changed(sheet, cell->row, cell->col);
+            sheet->column_versions[cell->col]++;
+        }
+        return;
+    }
+    
+    cell_store_set_value(sheet->cells, cell->row, cell->col, kind, value);
+    if (!sheet->lookup_read_only) {
+        shared_range_value_changed(sheet, cell->row, cell->col, old_kind, old_value, kind, value);
+        lookup_cell_changed(sheet, cell->row, cell->col);
+        sheet->column_versions[cell->col]++;
+    }
+}
+
+// Every value may have moved or been replaced
+static void sheet_touch_all_columns(Sheet* sheet) {
+    for (int col = 0; col < sheet->cols; col++) {
+        sheet->column_versions[col]++;
+    }
+}
+
+unsigned long long sheet_columns_version(const Sheet* sheet, int first_col, int last_col) {
+    unsigned long long version = 0;
+    if (first_col < 0) first_col = 0;
+    if (last_col >= sheet->cols) last_col = sheet->cols - 1;
+    for (int col = first_col; col <= last_col; col++) {
+        version += sheet->column_versions[col];
+    }
+    return version;
+}
+
+// Count a cell into or out of the used range after its contents changed,
+// and publish its new value
+static void sheet_track_used(Sheet* sheet, const Cell* cell, CellType old_type) {
+    sheet_store_value(sheet, cell);
+    sheet->content_edits++;
+    sheet->column_versions[cell->col]++;  // Even if the stored value is the same
+    
+    int delta = (cell->type != CELL_EMPTY) - (old_type != CELL_EMPTY);
+    if (delta == 0) return;
+    
+    sheet->row_used[cell->row] += delta;
+    sheet->col_used[cell->col] += delta;
+    if (delta > 0) {
+        if (cell->row >= sheet->used_rows) sheet->used_rows = cell->row + 1;
+        if (cell->col >= sheet->used_cols) sheet->used_cols = cell->col + 1;
+    } else {
+        while (sheet->used_rows > 0 && sheet->row_used[sheet->used_rows - 1] == 0) sheet->used_rows--;
+        while (sheet->used_cols > 0 && sheet->col_used[sheet->used_cols - 1] == 0) sheet->used_cols--;
+    }
+}
+
+void sheet_recount_used_range(Sheet* sheet) {
+    memset(sheet->row_used, 0, sheet->rows * sizeof(int));
+    memset(sheet->col_used, 0, sheet->cols * sizeof(int));
+    sheet->used_rows = 0;
+    sheet->used_cols = 0;
+    
+    CellIterator it;
+    Cell* cell;
+    sheet_iter_begin(sheet, &it);
+    while ((cell = sheet_iter_next(&it)) != NULL) {
+        sheet_track_used(sheet, cell, CELL_EMPTY);
+    }
 }
 
 Cell* sheet_get_or_create_cell(Sheet* sheet, int row, int col) {
@@ -150,16 +270,37 @@ Cell* sheet_get_or_create_cell(Sheet* sheet, int row, int col) {
         return NULL;
     }
     
-    if (!sheet->cells[row][col]) {
-        sheet->cells[row][col] = cell_new(row, col);
+    Cell* cell = cell_store_get(sheet->cells, row, col);
+    if (!cell) {
+        cell = (Cell*)pool_alloc(&sheet->cell_pool);
+        if (!cell) return NULL;
+        cell_init(cell, row, col);
+        cell->is_pooled = 1;
+        if (!cell_store_put(sheet->cells, row, col, cell)) {
+            pool_release(&sheet->cell_pool, cell);
+            cell = NULL;
+        }
     }
     
-    return sheet->cells[row][col];
+    return cell;
+}
+
+// Free a cell created by sheet_get_or_create_cell
+static void sheet_release_cell(Sheet* sheet, Cell* cell) {
+    cell_free(cell);
+    pool_release(&sheet->cell_pool, cell);
 }
 
 Cell* cell_new(int row, int col) {
     Cell* cell = (Cell*)calloc(1, sizeof(Cell));
-    if (!cell) return NULL;    cell->type = CELL_EMPTY;
+    if (!cell) return NULL;
+    cell_init(cell, row, col);
+    return cell;
+}
+
+// Set defaults on zeroed cell memory
+static void cell_init(Cell* cell, int row, int col) {
+    cell->type = CELL_EMPTY;
     cell->row = row;
     cell->col = col;
     cell->width = 10;
@@ -174,14 +315,14 @@ Cell* cell_new(int row, int col) {
     cell->text_color = -1;        // Default text color
     cell->background_color = -1;  // Default background color
     cell->row_height = -1;        // Default row height
-    
-    return cell;
 }
 
+// Pooled cells only have their contents freed; the memory itself is
+// returned with the sheet's cell pool.
 void cell_free(Cell* cell) {
     if (!cell) return;
       // Free string data
-    if (cell->type == CELL_STRING && cell->data.string) {
+    if (cell->type == CELL_STRING && cell->data.string && !cell->is_interned) {
         free(cell->data.string);
     } else if (cell->type == CELL_FORMULA) {
         if (cell->data.formula.expression) {
@@ -190,13 +331,17 @@ void cell_free(Cell* cell) {
         if (cell->data.formula.cached_string) {
             free(cell->data.formula.cached_string);
         }
+        formula_free(cell->data.formula.compiled);
     }
     
     // Free dependency arrays
     free(cell->depends_on);
     free(cell->dependents);
+    free(cell->display);
     
-    free(cell);
+    if (!cell->is_pooled) {
+        free(cell);
+    }
 }
 
 void cell_clear(Cell* cell) {
@@ -204,11 +349,15 @@ void cell_clear(Cell* cell) {
       // Save the type and set to CELL_EMPTY first to prevent double-free on re-entry
     CellType old_type = cell->type;
     cell->type = CELL_EMPTY;
+    cell->display_valid = 0;
     
     // Free existing data
     if (old_type == CELL_STRING && cell->data.string) {
-        free(cell->data.string);
+        if (!cell->is_interned) {
+            free(cell->data.string);
+        }
         cell->data.string = NULL;
+        cell->is_interned = 0;
     } else if (old_type == CELL_FORMULA) {
         if (cell->data.formula.expression) {
             free(cell->data.formula.expression);
@@ -217,7 +366,10 @@ void cell_clear(Cell* cell) {
         if (cell->data.formula.cached_string) {
             free(cell->data.formula.cached_string);
             cell->data.formula.cached_string = NULL;
-        }    }
+        }
+        formula_free(cell->data.formula.compiled);
+        cell->data.formula.compiled = NULL;
+    }
 
     // Keep formatting when clearing
 }
@@ -244,39 +396,84 @@ void cell_set_string(Cell* cell, const char* str) {
 }
 
 void cell_set_formula(Cell* cell, const char* formula) {
-    if (!cell) return;
+    cell_set_formula_compiled(cell, formula, NULL);
+}
+
+// Takes ownership of program, which was compiled from formula earlier (a
+// saved .llb program); NULL compiles the text here
+void cell_set_formula_compiled(Cell* cell, const char* formula, struct CompiledFormula* program) {
+    if (!cell) {
+        formula_free(program);
+        return;
+    }
       cell_clear(cell);
     cell->type = CELL_FORMULA;
     cell->data.formula.expression = _strdup(formula);
     if (!cell->data.formula.expression) {
         cell->type = CELL_EMPTY;  // Revert on allocation failure
+        formula_free(program);
         return;
     }
     cell->data.formula.cached_value = 0.0;
     cell->data.formula.cached_string = NULL;
     cell->data.formula.is_string_result = 0;
     cell->data.formula.error = ERROR_NONE;
+    
+    // Compile once; recalculation runs the bytecode instead of re-parsing.
+    // On allocation failure evaluation falls back to the formula text.
+    cell->data.formula.compiled = program ? program : formula_compile(formula);
 }
 
+static void dependency_detach(Cell* cell);
+static void dependency_attach(Sheet* sheet, Cell* cell);
+
 void sheet_set_number(Sheet* sheet, int row, int col, double value) {
     Cell* cell = sheet_get_or_create_cell(sheet, row, col);
     if (cell) {
+        CellType old_type = cell->type;
+        dependency_detach(cell);
         cell_set_number(cell, value);
+        sheet_track_used(sheet, cell, old_type);
+        sheet_mark_dirty(sheet, cell);
         sheet->needs_recalc = 1;
     }
 }
 
+// Repeated labels share one interned copy; fall back to a private one
+void sheet_assign_string(Sheet* sheet, Cell* cell, const char* str) {
+    char* interned = string_table_intern(sheet->string_pool, str);
+    if (interned) {
+        cell_clear(cell);
+        cell->type = CELL_STRING;
+        cell->data.string = interned;
+        cell->is_interned = 1;
+        cell->align = 0;  // Left align for strings
+    } else {
+        cell_set_string(cell, str);
+    }
+}
+
 void sheet_set_string(Sheet* sheet, int row, int col, const char* str) {
     Cell* cell = sheet_get_or_create_cell(sheet, row, col);
     if (cell) {
-        cell_set_string(cell, str);
+        CellType old_type = cell->type;
+        dependency_detach(cell);
+        sheet_assign_string(sheet, cell, str);
+        sheet_track_used(sheet, cell, old_type);
+        sheet_mark_dirty(sheet, cell);
+        sheet->needs_recalc = 1;
     }
 }
 
 void sheet_set_formula(Sheet* sheet, int row, int col, const char* formula) {
     Cell* cell = sheet_get_or_create_cell(sheet, row, col);
     if (cell) {
+        CellType old_type = cell->type;
+        dependency_detach(cell);
         cell_set_formula(cell, formula);
+        sheet_track_used(sheet, cell, old_type);
+        dependency_attach(sheet, cell);
+        sheet_mark_dirty(sheet, cell);
         sheet->needs_recalc = 1;
     }
 }
@@ -284,7 +481,11 @@ void sheet_set_formula(Sheet* sheet, int row, int col, const char* formula) {
 void sheet_clear_cell(Sheet* sheet, int row, int col) {
     Cell* cell = sheet_get_cell(sheet, row, col);
     if (cell) {
+        CellType old_type = cell->type;
+        dependency_detach(cell);
         cell_clear(cell);
+        sheet_track_used(sheet, cell, old_type);
+        sheet_mark_dirty(sheet, cell);
         sheet->needs_recalc = 1;
     }
 }
@@ -362,14 +563,6 @@ int parse_cell_reference(const char* ref, int* row, int* col) {
     return 1;
 }
 
-// Forward declarations for expression parsing
-double parse_arithmetic_expression(Sheet* sheet, const char** expr, ErrorType* error);
-double parse_arithmetic_expression_old(Sheet* sheet, const char* expr, ErrorType* error);
-double parse_term(Sheet* sheet, const char** expr, ErrorType* error);
-double parse_factor(Sheet* sheet, const char** expr, ErrorType* error);
-double parse_function(Sheet* sheet, const char** expr, ErrorType* error);
-void skip_whitespace(const char** expr);
-
 // Parse range notation like "A1:A3" or "B2:D5"
 int parse_range(const char* range_str, CellRange* range) {
     if (!range_str || !range) return 0;
@@ -410,55 +603,238 @@ int parse_range(const char* range_str, CellRange* range) {
     return 1;
 }
 
-// Get values from a range of cells
-int get_range_values(Sheet* sheet, const CellRange* range, double* values, int max_values) {
-    // Optimized: Pass pre-allocated buffer or use iterator pattern
-    // Avoid creating temporary array every time
-    int count = 0;
+void sheet_visit_column(Sheet* sheet, int col, int start_row, int end_row, ColumnRunVisitor visit, void* context) {
+    int in_sheet = col >= 0 && col < sheet->cols;
+    int row = start_row;
     
-    // Early exit if invalid range
-    if (!range || max_values <= 0) return 0;
+    while (row <= end_row) {
+        // Rows above or below the sheet have no cells
+        if (!in_sheet || row >= sheet->rows) {
+            visit(context, row, NULL, NULL, end_row - row + 1);
+            return;
+        }
+        if (row < 0) {
+            int last = end_row < 0 ? end_row : -1;
+            visit(context, row, NULL, NULL, last - row + 1);
+            row = last + 1;
+            continue;
+        }
+        
+        int last = row - row % CELL_CHUNK_ROWS + CELL_CHUNK_ROWS - 1;
+        if (last > end_row) last = end_row;
+        if (last >= sheet->rows) last = sheet->rows - 1;
+        
+        const CellChunk* chunk = cell_store_chunk(sheet->cells, row, col);
+        if (chunk) {
+            int first = CELL_CHUNK_VALUE(row, col);
+            visit(context, row, &chunk->values[first], &chunk->kinds[first], last - row + 1);
+        } else {
+            visit(context, row, NULL, NULL, last - row + 1);
+        }
+        row = last + 1;
+    }
+}
+
+typedef struct {
+    double* values;
+    unsigned char* kinds;
+    int start_row;
+} ColumnReader;
+
+static void column_read_run(void* context, int row, const double* values, const unsigned char* kinds, int count) {
+    ColumnReader* reader = (ColumnReader*)context;
+    int offset = row - reader->start_row;
+    if (values) {
+        memcpy(reader->values + offset, values, count * sizeof(double));
+        memcpy(reader->kinds + offset, kinds, count);
+    } else {
+        memset(reader->values + offset, 0, count * sizeof(double));
+        memset(reader->kinds + offset, CELL_VALUE_EMPTY, count);
+    }
+}
+
+void sheet_read_column(Sheet* sheet, int col, int start_row, int end_row, double* values, unsigned char* kinds) {
+    ColumnReader reader = { values, kinds, start_row };
+    sheet_visit_column(sheet, col, start_row, end_row, column_read_run, &reader);
+}
+
+static const double zero_values[CELL_CHUNK_ROWS];
+
+typedef struct {
+    RangeValueVisitor visit;
+    void* context;
+    int total;
+} ColumnValueVisit;
+
+// Hand over each run of values a range reads, in place
+static void column_value_run(void* context, int row, const double* values, const unsigned char* kinds, int count) {
+    ColumnValueVisit* column = (ColumnValueVisit*)context;
+    (void)row;
+    
+    if (!values) {
+        for (int done = 0; done < count; done += CELL_CHUNK_ROWS) {
+            int n = count - done < CELL_CHUNK_ROWS ? count - done : CELL_CHUNK_ROWS;
+            column->visit(column->context, zero_values, n);
+        }
+        column->total += count;
+        return;
+    }
+    
+    int i = 0;
+    while (i < count) {
+        while (i < count && !CELL_VALUE_IN_RANGE(kinds[i])) i++;
+        int start = i;
+        while (i < count && CELL_VALUE_IN_RANGE(kinds[i])) i++;
+        if (i > start) {
+            column->visit(column->context, values + start, i - start);
+            column->total += i - start;
+        }
+    }
+}
+
+static int visit_column_values(Sheet* sheet, int col, int start_row, int end_row, RangeValueVisitor visit, void* context) {
+    ColumnValueVisit column = { visit, context, 0 };
+    sheet_visit_column(sheet, col, start_row, end_row, column_value_run, &column);
+    return column.total;
+}
+
+// A single column is handed over in place, straight from the store. Wider
+// ranges walk one band of CELL_CHUNK_ROWS at a time, resolving each chunk
+// once per band so sequential cells cost an array read, not a lookup.
+// Cells outside the sheet read as empty, like sheet_get_cell.
+int sheet_visit_range_values(Sheet* sheet, const CellRange* range, RangeValueVisitor visit, void* context) {
+    double batch[RANGE_VALUE_BATCH];
+    const CellChunk* local_chunks[64];
+    const CellChunk** chunks = local_chunks;
+    int pending = 0, total = 0;
+    
+    if (!sheet || !range || !visit) return 0;
+    if (range->start_col == range->end_col) {
+        return visit_column_values(sheet, range->start_col, range->start_row, range->end_row, visit, context);
+    }
+    
+    // Columns inside the sheet, and the chunk columns they span
+    int first_col = range->start_col < 0 ? 0 : range->start_col;
+    int last_col = range->end_col >= sheet->cols ? sheet->cols - 1 : range->end_col;
+    int first_chunk = first_col / CELL_CHUNK_COLS;
+    int chunk_span = last_col >= first_col ? last_col / CELL_CHUNK_COLS - first_chunk + 1 : 0;
     
+    if (chunk_span > 64) {
+        chunks = (const CellChunk**)malloc(chunk_span * sizeof(CellChunk*));
+        if (!chunks) return 0;
+    }
+    
+    int band = -1;
     for (int row = range->start_row; row <= range->end_row; row++) {
-        if (count >= max_values) break;
+        int in_sheet = row >= 0 && row < sheet->rows;
+        
+        if (in_sheet && row / CELL_CHUNK_ROWS != band) {
+            band = row / CELL_CHUNK_ROWS;
+            for (int i = 0; i < chunk_span; i++) {
+                chunks[i] = cell_store_chunk(sheet->cells, row, (first_chunk + i) * CELL_CHUNK_COLS);
+            }
+        }
         
         for (int col = range->start_col; col <= range->end_col; col++) {
-            if (count >= max_values) break;
+            const CellChunk* chunk = NULL;
+            if (in_sheet && col >= first_col && col <= last_col) {
+                chunk = chunks[col / CELL_CHUNK_COLS - first_chunk];
+            }
             
-            Cell* cell = sheet_get_cell(sheet, row, col);
-            if (cell) {
-                switch (cell->type) {
-                    case CELL_NUMBER:
-                        values[count++] = cell->data.number;
-                        break;
-                    case CELL_FORMULA:
-                        if (cell->data.formula.error == ERROR_NONE) {
-                            values[count++] = cell->data.formula.cached_value;
-                        }
-                        break;
-                    case CELL_EMPTY:
-                        values[count++] = 0.0;
-                        break;
-                    default:
-                        // Skip strings and errors
-                        break;
-                }
+            if (chunk) {
+                int index = CELL_CHUNK_VALUE(row, col);
+                if (!CELL_VALUE_IN_RANGE(chunk->kinds[index])) continue;
+                batch[pending] = chunk->values[index];
             } else {
-                values[count++] = 0.0;
+                batch[pending] = 0.0;
+            }
+            if (++pending == RANGE_VALUE_BATCH) {
+                visit(context, batch, pending);
+                total += pending;
+                pending = 0;
             }
         }
     }
     
-    return count;
+    if (pending > 0) {
+        visit(context, batch, pending);
+        total += pending;
+    }
+    if (chunks != local_chunks) free(chunks);
+    return total;
+}
+
+typedef struct {
+    double* values;
+    int count;
+    int max_values;
+} RangeCollector;
+
+static void range_collect(void* context, const double* values, int count) {
+    RangeCollector* collector = (RangeCollector*)context;
+    int room = collector->max_values - collector->count;
+    if (count > room) count = room;
+    memcpy(collector->values + collector->count, values, count * sizeof(double));
+    collector->count += count;
+}
+
+// Copy up to max_values values of a range into a caller buffer
+int get_range_values(Sheet* sheet, const CellRange* range, double* values, int max_values) {
+    RangeCollector collector;
+    
+    // Early exit if invalid range
+    if (!range || max_values <= 0) return 0;
+    
+    collector.values = values;
+    collector.count = 0;
+    collector.max_values = max_values;
+    sheet_visit_range_values(sheet, range, range_collect, &collector);
+    return collector.count;
+}
+
+void range_aggregate_init(RangeAggregate* agg) {
+    agg->sum = 0.0;
+    agg->compensation = 0.0;
+    agg->min = 0.0;
+    agg->max = 0.0;
+    agg->count = 0;
+}
+
+void range_aggregate_add(void* context, const double* values, int count) {
+    RangeAggregate* agg = (RangeAggregate*)context;
+    if (count <= 0) return;
+    
+    double batch_min = func_min(values, count);
+    double batch_max = func_max(values, count);
+    if (agg->count == 0 || batch_min < agg->min) agg->min = batch_min;
+    if (agg->count == 0 || batch_max > agg->max) agg->max = batch_max;
+    agg->count += count;
+    
+    // Carry the compensation across batches so long ranges stay exact
+    double batch_sum = func_sum(values, count);
+    double total = agg->sum + batch_sum;
+    if (fabs(agg->sum) >= fabs(batch_sum)) {
+        agg->compensation += (agg->sum - total) + batch_sum;
+    } else {
+        agg->compensation += (batch_sum - total) + agg->sum;
+    }
+    agg->sum = total;
+}
+
+// Order does not matter here, so every column is read in place
+void sheet_aggregate_range(Sheet* sheet, const CellRange* range, RangeAggregate* agg) {
+    range_aggregate_init(agg);
+    for (int col = range->start_col; col <= range->end_col; col++) {
+        visit_column_values(sheet, col, range->start_row, range->end_row, range_aggregate_add, agg);
+    }
+    agg->sum += agg->compensation;
+    agg->compensation = 0.0;
 }
 
 // Function implementations
+// SUM/MIN/MAX run on the vector kernels in reduce.c
 double func_sum(const double* values, int count) {
-    double sum = 0.0;
-    for (int i = 0; i < count; i++) {
-        sum += values[i];
-    }
-    return sum;
+    return reduce_sum(values, count);
 }
 
 double func_avg(const double* values, int count) {
@@ -467,21 +843,11 @@ double func_avg(const double* values, int count) {
 }
 
 double func_max(const double* values, int count) {
-    if (count == 0) return 0.0;
-    double max = values[0];
-    for (int i = 1; i < count; i++) {
-        if (values[i] > max) max = values[i];
-    }
-    return max;
+    return reduce_max(values, count);
 }
 
 double func_min(const double* values, int count) {
-    if (count == 0) return 0.0;
-    double min = values[0];
-    for (int i = 1; i < count; i++) {
-        if (values[i] < min) min = values[i];
-    }
-    return min;
+    return reduce_min(values, count);
 }
 
 // Helper function for median calculation
@@ -493,25 +859,73 @@ int compare_double(const void* a, const void* b) {
     return 0;
 }
 
+static void swap_double(double* a, double* b) {
+    double t = *a;
+    *a = *b;
+    *b = t;
+}
+
+// Reorder values so values[k] is the k-th smallest, with nothing larger
+// before it and nothing smaller after it. Quickselect with a median-of-three
+// pivot; falls back to sorting the remaining span if partitioning degrades.
+static void select_kth(double* values, int count, int k) {
+    int left = 0, right = count - 1;
+    int depth_limit = 2;
+    for (int n = count; n > 1; n >>= 1) depth_limit += 2;
+    
+    while (right > left) {
+        if (--depth_limit < 0) {
+            qsort(values + left, right - left + 1, sizeof(double), compare_double);
+            return;
+        }
+        
+        int mid = left + (right - left) / 2;
+        if (values[mid] < values[left]) swap_double(&values[mid], &values[left]);
+        if (values[right] < values[left]) swap_double(&values[right], &values[left]);
+        if (values[right] < values[mid]) swap_double(&values[right], &values[mid]);
+        double pivot = values[mid];
+        
+        // Hoare partition
+        int i = left, j = right;
+        while (i <= j) {
+            while (values[i] < pivot) i++;
+            while (values[j] > pivot) j--;
+            if (i <= j) {
+                swap_double(&values[i], &values[j]);
+                i++;
+                j--;
+            }
+        }
+        
+        if (k <= j) right = j;
+        else if (k >= i) left = i;
+        else return;  // values[j+1..i-1] all equal the pivot
+    }
+}
+
 double func_median(double* values, int count) {
     if (count == 0) return 0.0;
     
-    // Sort the values
-    qsort(values, count, sizeof(double), compare_double);
+    // Select the upper middle value; the lower middle is then the
+    // largest of the values left of it
+    int k = count / 2;
+    select_kth(values, count, k);
     
     if (count % 2 == 0) {
         // Even number of values - return average of middle two
-        return (values[count/2 - 1] + values[count/2]) / 2.0;
+        double lower = values[0];
+        for (int i = 1; i < k; i++) {
+            if (values[i] > lower) lower = values[i];
+        }
+        return (lower + values[k]) / 2.0;
     } else {
         // Odd number of values - return middle value
-        return values[count/2];
+        return values[k];
     }
 }
 
-double func_mode(const double* values, int count) {
-    if (count == 0) return 0.0;
-    
-    // Simple mode calculation - find most frequent value
+// Pairwise MODE, kept for small inputs and allocation failure
+static double mode_quadratic(const double* values, int count) {
     double mode = values[0];
     int max_count = 1;
     
@@ -531,64 +945,137 @@ double func_mode(const double* values, int count) {
     return mode;
 }
 
+typedef struct {
+    double value;
+    int index;
+} IndexedValue;
+
+static int compare_indexed_value(const void* a, const void* b) {
+    const IndexedValue* x = (const IndexedValue*)a;
+    const IndexedValue* y = (const IndexedValue*)b;
+    if (x->value < y->value) return -1;
+    if (x->value > y->value) return 1;
+    return x->index - y->index;
+}
+
+static int values_match(double a, double b) {
+    return fabs(a - b) < FLOAT_COMPARISON_EPSILON;
+}
+
+// MODE in O(n log n) with exactly the pairwise definition: each value scores
+// 1 + the number of LATER values within epsilon of it, and the first value
+// with the highest score wins. The values within epsilon of v form one run
+// of the sorted array (found by binary search), and a Fenwick tree over
+// sorted positions counts how many of that run come later in input order.
+// Non-finite values never match anything, so they stay out of the tree.
+double func_mode(const double* values, int count) {
+    if (count == 0) return 0.0;
+    if (count <= 32) return mode_quadratic(values, count);
+    
+    IndexedValue* sorted = (IndexedValue*)malloc(count * sizeof(IndexedValue));
+    int* rank = (int*)malloc(count * sizeof(int));
+    int* tree = (int*)calloc(count + 1, sizeof(int));
+    int* score = (int*)malloc(count * sizeof(int));
+    if (!sorted || !rank || !tree || !score) {
+        free(sorted);
+        free(rank);
+        free(tree);
+        free(score);
+        return mode_quadratic(values, count);
+    }
+    
+    int finite = 0;
+    for (int i = 0; i < count; i++) {
+        rank[i] = -1;
+        if (isfinite(values[i])) {
+            sorted[finite].value = values[i];
+            sorted[finite].index = i;
+            finite++;
+        }
+    }
+    qsort(sorted, finite, sizeof(IndexedValue), compare_indexed_value);
+    for (int r = 0; r < finite; r++) {
+        rank[sorted[r].index] = r;
+    }
+    
+    for (int i = count - 1; i >= 0; i--) {
+        score[i] = 1;
+        if (rank[i] < 0) continue;
+        double v = values[i];
+        
+        // First sorted position inside the epsilon window around v
+        int lo = 0, hi = rank[i];
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (values_match(v, sorted[mid].value)) hi = mid;
+            else lo = mid + 1;
+        }
+        int first = lo;
+        
+        // One past the last sorted position inside the window
+        lo = rank[i];
+        hi = finite;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (sorted[mid].value <= v || values_match(v, sorted[mid].value)) lo = mid + 1;
+            else hi = mid;
+        }
+        int last = lo;
+        
+        // Later values already in the tree with positions in [first, last)
+        int later = 0;
+        for (int p = last; p > 0; p -= p & -p) later += tree[p];
+        for (int p = first; p > 0; p -= p & -p) later -= tree[p];
+        score[i] += later;
+        
+        for (int p = rank[i] + 1; p <= finite; p += p & -p) tree[p]++;
+    }
+    
+    double mode = values[0];
+    int max_count = 1;
+    for (int i = 0; i < count; i++) {
+        if (score[i] > max_count) {
+            max_count = score[i];
+            mode = values[i];
+        }
+    }
+    
+    free(sorted);
+    free(rank);
+    free(tree);
+    free(score);
+    return mode;
+}
+
 double func_if(double condition, double true_val, double false_val) {
     return (condition != 0.0) ? true_val : false_val;
 }
 
-double func_if_enhanced(double condition, double true_val, double false_val, 
+double func_if_enhanced(Cell* target, double condition, double true_val, double false_val, 
                        const char* true_str, const char* false_str) {
-    // Reset global string result flag
-    g_if_result_is_string = 0;
-    g_if_result_string[0] = '\0';
+    // Reset the cell's string result
+    if (target) {
+        free(target->data.formula.cached_string);
+        target->data.formula.cached_string = NULL;
+        target->data.formula.is_string_result = 0;
+    }
     
-    // Also reset the current cell's string result
-    if (g_current_evaluating_cell) {
-        if (g_current_evaluating_cell->data.formula.cached_string) {
-            free(g_current_evaluating_cell->data.formula.cached_string);
-            g_current_evaluating_cell->data.formula.cached_string = NULL;
-        }
-        g_current_evaluating_cell->data.formula.is_string_result = 0;
+    const char* result_str = (condition != 0.0) ? true_str : false_str;
+    if (!result_str) {
+        return (condition != 0.0) ? true_val : false_val;
     }
     
-    if (condition != 0.0) {
-        // True condition
-        if (true_str) {
-            strcpy_s(g_if_result_string, sizeof(g_if_result_string), true_str);
-            g_if_result_is_string = 1;
-            
-            // Store in current cell if available
-            if (g_current_evaluating_cell) {
-                char* cached = _strdup(true_str);
-                if (cached) {
-                    g_current_evaluating_cell->data.formula.cached_string = cached;
-                    g_current_evaluating_cell->data.formula.is_string_result = 1;
-                }
-            }
-            
-            return 1.0; // Return non-zero to indicate string result available
-        } else {
-            return true_val;
-        }
-    } else {
-        // False condition
-        if (false_str) {
-            strcpy_s(g_if_result_string, sizeof(g_if_result_string), false_str);
-            g_if_result_is_string = 1;
-            
-            // Store in current cell if available
-            if (g_current_evaluating_cell) {
-                char* cached = _strdup(false_str);
-                if (cached) {
-                    g_current_evaluating_cell->data.formula.cached_string = cached;
-                    g_current_evaluating_cell->data.formula.is_string_result = 1;
-                }
-            }
-            
-            return 0.0; // Return zero to indicate string result available
-        } else {
-            return false_val;
+    // Store in the cell if available
+    if (target) {
+        char* cached = _strdup(result_str);
+        if (cached) {
+            target->data.formula.cached_string = cached;
+            target->data.formula.is_string_result = 1;
         }
     }
+    
+    // Non-zero for the true branch, zero for the false one
+    return (condition != 0.0) ? 1.0 : 0.0;
 }
 
 double func_power(double base, double exponent) {
@@ -804,23 +1291,23 @@ void sheet_paste_range(Sheet* sheet, int start_row, int start_col) {
             
             Cell* src_cell = sheet->range_clipboard.cells[i][j];
             if (src_cell) {
-                Cell* dest_cell = sheet_get_or_create_cell(sheet, dest_row, dest_col);
+                switch (src_cell->type) {
+                    case CELL_NUMBER:
+                        sheet_set_number(sheet, dest_row, dest_col, src_cell->data.number);
+                        break;
+                    case CELL_STRING:
+                        sheet_set_string(sheet, dest_row, dest_col, src_cell->data.string);
+                        break;
+                    case CELL_FORMULA:
+                        sheet_set_formula(sheet, dest_row, dest_col, src_cell->data.formula.expression);
+                        break;
+                    default:
+                        sheet_get_or_create_cell(sheet, dest_row, dest_col);
+                        sheet_clear_cell(sheet, dest_row, dest_col);
+                        break;
+                }
+                Cell* dest_cell = sheet_get_cell(sheet, dest_row, dest_col);
                 if (dest_cell) {
-                    switch (src_cell->type) {
-                        case CELL_NUMBER:
-                            cell_set_number(dest_cell, src_cell->data.number);
-                            break;
-                        case CELL_STRING:
-                            cell_set_string(dest_cell, src_cell->data.string);
-                            break;
-                        case CELL_FORMULA:
-                            cell_set_formula(dest_cell, src_cell->data.formula.expression);
-                            sheet->needs_recalc = 1;  // Mark sheet for recalculation
-                            break;
-                        default:
-                            cell_clear(dest_cell);
-                            break;
-                    }
                     // Copy display and formatting properties
                     dest_cell->width = src_cell->width;
                     dest_cell->precision = src_cell->precision;
@@ -833,11 +1320,155 @@ void sheet_paste_range(Sheet* sheet, int start_row, int start_col) {
             }
         }
     }
-    
-    sheet_recalculate(sheet);
+    // Recalculation is left to the caller, as for the other setters
 }
 
-// Cell formatting functions
+// One clipboard field, terminated; grown as needed and reused for the next
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} PasteField;
+
+// Append n bytes; a NULL field only measures
+static int paste_field_append(PasteField* field, const char* bytes, size_t n) {
+    if (!field) return 1;
+    if (field->length + n + 1 > field->capacity) {
+        size_t new_capacity = field->capacity ? field->capacity * 2 : 256;
+        while (new_capacity < field->length + n + 1) new_capacity *= 2;
+        char* grown = (char*)realloc(field->data, new_capacity);
+        if (!grown) return 0;
+        field->data = grown;
+        field->capacity = new_capacity;
+    }
+    memcpy(field->data + field->length, bytes, n);
+    field->length += n;
+    field->data[field->length] = '\0';
+    return 1;
+}
+
+// Read the field at p. Fields end at a tab, rows at \n or \r\n; a field
+// opening with a quote runs to the closing one with "" for a quote, as Excel
+// writes cells holding tabs or line breaks. Sets *row_end after the last
+// field of a row and returns where the next field starts, or NULL when
+// memory runs out.
+static const char* paste_read_field(const char* p, const char* end, PasteField* field, int* row_end) {
+    if (field) field->length = 0;
+    if (!paste_field_append(field, "", 0)) return NULL;
+    
+    if (p < end && *p == '"') {
+        p++;
+        while (p < end) {
+            const char* quote = memchr(p, '"', end - p);
+            if (!quote) quote = end;
+            if (!paste_field_append(field, p, quote - p)) return NULL;
+            p = quote < end ? quote + 1 : end;
+            if (p < end && *p == '"') {
+                if (!paste_field_append(field, "\"", 1)) return NULL;
+                p++;
+            } else {
+                break;
+            }
+        }
+    }
+    
+    const char* stop = p;
+    while (stop < end && *stop != '\t' && *stop != '\n') stop++;
+    size_t n = stop - p;
+    if (n > 0 && p[n - 1] == '\r') n--;
+    if (!paste_field_append(field, p, n)) return NULL;
+    
+    *row_end = stop >= end || *stop == '\n';
+    return stop < end ? stop + 1 : end;
+}
+
+// Store a field as if it were typed into the cell. A bulk paste writes the
+// cell directly: its edges were all dropped beforehand and are rebuilt from
+// every formula by the next recalculation, as after a CSV load.
+static void paste_store(Sheet* sheet, int row, int col, const char* text, int bulk) {
+    char* endptr;
+    double value = 0.0;
+    int is_number = 0;
+    if (text[0] != '\0' && text[0] != '=') {
+        value = strtod(text, &endptr);
+        is_number = *endptr == '\0';
+    }
+    
+    if (!bulk) {
+        if (text[0] == '\0') sheet_clear_cell(sheet, row, col);
+        else if (text[0] == '=') sheet_set_formula(sheet, row, col, text);
+        else if (is_number) sheet_set_number(sheet, row, col, value);
+        else sheet_set_string(sheet, row, col, text);
+        return;
+    }
+    
+    Cell* cell = text[0] == '\0' ? sheet_get_cell(sheet, row, col) : sheet_get_or_create_cell(sheet, row, col);
+    if (!cell) return;
+    CellType old_type = cell->type;
+    if (text[0] == '\0') cell_clear(cell);
+    else if (text[0] == '=') cell_set_formula(cell, text);
+    else if (is_number) cell_set_number(cell, value);
+    else sheet_assign_string(sheet, cell, text);
+    sheet_track_used(sheet, cell, old_type);
+}
+
+// Walk the text, storing each field unless sheet is NULL
+static int paste_walk(Sheet* sheet, int start_row, int start_col, const char* text, size_t length,
+                      int bulk, int* rows, int* cols) {
+    PasteField field = { NULL, 0, 0 };
+    const char* p = text;
+    const char* end = text + length;
+    int row = 0, col = 0, ok = 1;
+    *cols = 0;
+    
+    while (p < end) {
+        int row_end;
+        p = paste_read_field(p, end, sheet ? &field : NULL, &row_end);
+        if (!p) {
+            ok = 0;
+            break;
+        }
+        
+        int dest_row = start_row + row;
+        int dest_col = start_col + col;
+        if (sheet && dest_row < sheet->rows && dest_col < sheet->cols) {
+            paste_store(sheet, dest_row, dest_col, field.data, bulk);
+        }
+        
+        if (++col > *cols) *cols = col;
+        if (row_end) {
+            row++;
+            col = 0;
+        }
+    }
+    *rows = row + (col > 0);
+    
+    free(field.data);
+    return ok;
+}
+
+void sheet_measure_text(const char* text, size_t length, int* rows, int* cols) {
+    paste_walk(NULL, 0, 0, text, length, 0, rows, cols);
+}
+
+int sheet_paste_text(Sheet* sheet, int start_row, int start_col, const char* text, size_t length) {
+    int rows, cols;
+    sheet_measure_text(text, length, &rows, &cols);
+    
+    // Dirtying each cell and its edges one by one costs more than one
+    // rebuild once the paste covers much of the sheet
+    int landed_rows = rows < sheet->rows - start_row ? rows : sheet->rows - start_row;
+    int landed_cols = cols < sheet->cols - start_col ? cols : sheet->cols - start_col;
+    long long landed = landed_rows > 0 && landed_cols > 0 ? (long long)landed_rows * landed_cols : 0;
+    int bulk = landed >= PASTE_BULK_MIN_CELLS && landed * 4 >= sheet->cells->cell_count;
+    if (bulk) sheet_invalidate_dependencies(sheet);
+    
+    int ok = paste_walk(sheet, start_row, start_col, text, length, bulk, &rows, &cols);
+    sheet->needs_recalc = 1;
+    return ok;
+}
+
+// Cell formatting functions
 void cell_set_format(Cell* cell, DataFormat format, FormatStyle style) {
     if (!cell) return;
     
@@ -845,9 +1476,59 @@ void cell_set_format(Cell* cell, DataFormat format, FormatStyle style) {
     cell->format_style = style;
 }
 
-char* format_cell_value(Cell* cell) {
-    static char buffer[256];
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+};
+
+// "%.*f" with trailing zeros and a bare point removed. When the value scaled
+// by 10^precision fits an integer and is clear of a halfway point by more
+// than the scaling error, the digits come from integer arithmetic; the rest,
+// exact ties included, go through snprintf so rounding matches the C library.
+static void format_general_number(char* buffer, size_t size, double value, int precision) {
+    if (precision >= 0 && precision < 16) {
+        double scaled = fabs(value) * powers_of_ten[precision];
+        if (scaled < 1e15) {
+            double whole = floor(scaled);
+            double fraction = scaled - whole;
+            if (fabs(fraction - 0.5) > scaled * 1e-15) {
+                unsigned long long digits = (unsigned long long)whole + (fraction > 0.5);
+                char reversed[32];
+                int count = 0;
+                
+                // At least one digit before the point
+                do {
+                    reversed[count++] = (char)('0' + digits % 10);
+                    digits /= 10;
+                } while (digits > 0 || count <= precision);
+                
+                // Fraction digits that are trailing zeros are never written
+                int skip = 0;
+                while (skip < precision && reversed[skip] == '0') skip++;
+                
+                char* p = buffer;
+                if (signbit(value)) *p++ = '-';
+                for (int i = count - 1; i >= precision; i--) *p++ = reversed[i];
+                if (skip < precision) {
+                    *p++ = '.';
+                    for (int i = precision - 1; i >= skip; i--) *p++ = reversed[i];
+                }
+                *p = '\0';
+                return;
+            }
+        }
+    }
     
+    snprintf(buffer, size, "%.*f", precision, value);
+    // Remove trailing zeros
+    char* dot = strchr(buffer, '.');
+    if (dot) {
+        char* end = buffer + strlen(buffer) - 1;
+        while (end > dot && *end == '0') *end-- = '\0';
+        if (*end == '.') *end = '\0';
+    }
+}
+
+char* format_cell_value(Cell* cell) {
     if (!cell || cell->type == CELL_EMPTY) {
         return "";
     }
@@ -868,6 +1549,7 @@ char* format_cell_value(Cell* cell) {
                     case ERROR_VALUE: return "#VALUE!";
                     case ERROR_PARSE: return "#PARSE!";
                     case ERROR_NA: return "#N/A!";
+                    case ERROR_CIRCULAR: return "#CIRC!";
                     default: return "#ERROR!";
                 }
             }
@@ -882,64 +1564,82 @@ char* format_cell_value(Cell* cell) {
             return "";
     }
     
+    // Reuse the text formatted last time unless the value or format changed
+    if (cell->display_valid && memcmp(&cell->display_value, &value, sizeof(value)) == 0 &&
+        cell->display_format == cell->format && cell->display_style == cell->format_style &&
+        cell->display_precision == cell->precision) {
+        return cell->display;
+    }
+    
+    char buffer[256];
+    
     // Apply formatting based on format type
     switch (cell->format) {
         case FORMAT_PERCENTAGE:
-            return format_number_as_percentage(value, cell->precision);
+            format_number_as_percentage(buffer, sizeof(buffer), value, cell->precision);
+            break;
             
         case FORMAT_CURRENCY:
-            return format_number_as_currency(value);
+            format_number_as_currency(buffer, sizeof(buffer), value);
+            break;
             
         case FORMAT_DATE:
-            return format_number_as_date(value, cell->format_style);
+            format_number_as_date(buffer, sizeof(buffer), value, cell->format_style);
+            break;
             
         case FORMAT_TIME:
-            return format_number_as_time(value, cell->format_style);
-              case FORMAT_DATETIME:
+            format_number_as_time(buffer, sizeof(buffer), value, cell->format_style);
+            break;
+            
+        case FORMAT_DATETIME:
             // Check if it's one of the enhanced datetime styles
             if (cell->format_style == DATETIME_STYLE_SHORT || 
                 cell->format_style == DATETIME_STYLE_LONG || 
                 cell->format_style == DATETIME_STYLE_ISO) {
-                return format_number_as_enhanced_datetime(value, cell->format_style);
+                format_number_as_enhanced_datetime(buffer, sizeof(buffer), value, cell->format_style);
             } else {
-                return format_number_as_datetime(value, DATE_STYLE_MM_DD_YYYY, TIME_STYLE_12HR);
+                format_number_as_datetime(buffer, sizeof(buffer), value, DATE_STYLE_MM_DD_YYYY, TIME_STYLE_12HR);
             }
+            break;
             
         case FORMAT_NUMBER:
         case FORMAT_GENERAL:
         default:
             // Standard number formatting
-            snprintf(buffer, sizeof(buffer), "%.*f", cell->precision, value);
-            // Remove trailing zeros
-            char* dot = strchr(buffer, '.');
-            if (dot) {
-                char* end = buffer + strlen(buffer) - 1;
-                while (end > dot && *end == '0') *end-- = '\0';
-                if (*end == '.') *end = '\0';
-            }
-            return buffer;
+            format_general_number(buffer, sizeof(buffer), value, cell->precision);
+            break;
+    }
+    
+    size_t length = strlen(buffer) + 1;
+    if (length > cell->display_capacity) {
+        size_t capacity = length < 16 ? 16 : length;
+        char* grown = (char*)realloc(cell->display, capacity);
+        if (!grown) return "#ERROR!";
+        cell->display = grown;
+        cell->display_capacity = capacity;
     }
+    memcpy(cell->display, buffer, length);
+    cell->display_value = value;
+    cell->display_format = cell->format;
+    cell->display_style = cell->format_style;
+    cell->display_precision = cell->precision;
+    cell->display_valid = 1;
+    return cell->display;
 }
 
-char* format_number_as_percentage(double value, int precision) {
-    static char buffer[64];
-    snprintf(buffer, sizeof(buffer), "%.*f%%", precision, value * 100.0);
-    return buffer;
+void format_number_as_percentage(char* buffer, size_t size, double value, int precision) {
+    snprintf(buffer, size, "%.*f%%", precision, value * 100.0);
 }
 
-char* format_number_as_currency(double value) {
-    static char buffer[64];
+void format_number_as_currency(char* buffer, size_t size, double value) {
     if (value < 0) {
-        snprintf(buffer, sizeof(buffer), "-$%.2f", -value);
+        snprintf(buffer, size, "-$%.2f", -value);
     } else {
-        snprintf(buffer, sizeof(buffer), "$%.2f", value);
+        snprintf(buffer, size, "$%.2f", value);
     }
-    return buffer;
 }
 
-char* format_number_as_date(double value, FormatStyle style) {
-    static char buffer[64];
-    
+void format_number_as_date(char* buffer, size_t size, double value, FormatStyle style) {
     // Convert Excel serial date to time_t (days since 1900-01-01)
     // Excel incorrectly treats 1900 as a leap year, so we need adjustment
     time_t base_time = (time_t)EXCEL_BASE_TIME;  // 1900-01-01 00:00:00 UTC (adjusted)
@@ -947,43 +1647,39 @@ char* format_number_as_date(double value, FormatStyle style) {
     
     struct tm date_struct;
     if (gmtime_s(&date_struct, &date_time) != 0) {
-        strcpy_s(buffer, sizeof(buffer), "#DATE!");
-        return buffer;
+        strcpy_s(buffer, size, "#DATE!");
+        return;
     }
     
     switch (style) {
         case DATE_STYLE_MM_DD_YYYY:
-            strftime(buffer, sizeof(buffer), "%m/%d/%Y", &date_struct);
+            strftime(buffer, size, "%m/%d/%Y", &date_struct);
             break;
         case DATE_STYLE_DD_MM_YYYY:
-            strftime(buffer, sizeof(buffer), "%d/%m/%Y", &date_struct);
+            strftime(buffer, size, "%d/%m/%Y", &date_struct);
             break;
         case DATE_STYLE_YYYY_MM_DD:
-            strftime(buffer, sizeof(buffer), "%Y-%m-%d", &date_struct);
+            strftime(buffer, size, "%Y-%m-%d", &date_struct);
             break;
         case DATE_STYLE_MON_DD_YYYY:
-            strftime(buffer, sizeof(buffer), "%b %d, %Y", &date_struct);
+            strftime(buffer, size, "%b %d, %Y", &date_struct);
             break;
         case DATE_STYLE_DD_MON_YYYY:
-            strftime(buffer, sizeof(buffer), "%d %b %Y", &date_struct);
+            strftime(buffer, size, "%d %b %Y", &date_struct);
             break;
         case DATE_STYLE_YYYY_MON_DD:
-            strftime(buffer, sizeof(buffer), "%Y %b %d", &date_struct);
+            strftime(buffer, size, "%Y %b %d", &date_struct);
             break;
         case DATE_STYLE_SHORT_DATE:
-            strftime(buffer, sizeof(buffer), "%m/%d/%y", &date_struct);
+            strftime(buffer, size, "%m/%d/%y", &date_struct);
             break;
         default:
-            strftime(buffer, sizeof(buffer), "%Y-%m-%d", &date_struct);
+            strftime(buffer, size, "%Y-%m-%d", &date_struct);
             break;
     }
-    
-    return buffer;
 }
 
-char* format_number_as_time(double value, FormatStyle style) {
-    static char buffer[64];
-    
+void format_number_as_time(char* buffer, size_t size, double value, FormatStyle style) {
     // Extract time portion (fractional part of the day)
     double time_fraction = value - floor(value);
     if (time_fraction < 0) time_fraction += 1.0;
@@ -1006,7 +1702,7 @@ char* format_number_as_time(double value, FormatStyle style) {
                     display_hours = hours - 12;
                     am_pm = "PM";
                 }
-                snprintf(buffer, sizeof(buffer), "%d:%02d %s", display_hours, minutes, am_pm);
+                snprintf(buffer, size, "%d:%02d %s", display_hours, minutes, am_pm);
             }
             break;
         case TIME_STYLE_12HR_SECONDS:
@@ -1021,41 +1717,37 @@ char* format_number_as_time(double value, FormatStyle style) {
                     display_hours = hours - 12;
                     am_pm = "PM";
                 }
-                snprintf(buffer, sizeof(buffer), "%d:%02d:%02d %s", display_hours, minutes, seconds, am_pm);
+                snprintf(buffer, size, "%d:%02d:%02d %s", display_hours, minutes, seconds, am_pm);
             }
             break;
         case TIME_STYLE_SECONDS:
-            snprintf(buffer, sizeof(buffer), "%02d:%02d:%02d", hours, minutes, seconds);
+            snprintf(buffer, size, "%02d:%02d:%02d", hours, minutes, seconds);
             break;
         case TIME_STYLE_24HR:
         default:
-            snprintf(buffer, sizeof(buffer), "%02d:%02d", hours, minutes);
+            snprintf(buffer, size, "%02d:%02d", hours, minutes);
             break;
     }
-    
-    return buffer;
 }
 
-char* format_number_as_datetime(double value, FormatStyle date_style, FormatStyle time_style) {
-    static char buffer[128];
-    char* date_part = format_number_as_date(value, date_style);
-    char* time_part = format_number_as_time(value, time_style);
-    snprintf(buffer, sizeof(buffer), "%s %s", date_part, time_part);
-    return buffer;
+void format_number_as_datetime(char* buffer, size_t size, double value, FormatStyle date_style, FormatStyle time_style) {
+    char date_part[64];
+    char time_part[64];
+    format_number_as_date(date_part, sizeof(date_part), value, date_style);
+    format_number_as_time(time_part, sizeof(time_part), value, time_style);
+    snprintf(buffer, size, "%s %s", date_part, time_part);
 }
 
 // Enhanced datetime formatting for special styles
-char* format_number_as_enhanced_datetime(double value, FormatStyle style) {
-    static char buffer[128];
-    
+void format_number_as_enhanced_datetime(char* buffer, size_t size, double value, FormatStyle style) {
     // Convert Excel serial date to time_t
     time_t base_time = (time_t)-2209161600LL;  // 1900-01-01 00:00:00 UTC (adjusted)
     time_t date_time = base_time + (time_t)(value * 86400);
     
     struct tm date_struct;
     if (gmtime_s(&date_struct, &date_time) != 0) {
-        strcpy_s(buffer, sizeof(buffer), "#DATE!");
-        return buffer;
+        strcpy_s(buffer, size, "#DATE!");
+        return;
     }
     
     // Extract time portion for time components
@@ -1079,7 +1771,7 @@ char* format_number_as_enhanced_datetime(double value, FormatStyle style) {
                     display_hours = hours - 12;
                     am_pm = "PM";
                 }
-                snprintf(buffer, sizeof(buffer), "%d/%d/%02d %d:%02d %s", 
+                snprintf(buffer, size, "%d/%d/%02d %d:%02d %s", 
                         date_struct.tm_mon + 1, date_struct.tm_mday, date_struct.tm_year % 100,
                         display_hours, minutes, am_pm);
             }
@@ -1096,56 +1788,37 @@ char* format_number_as_enhanced_datetime(double value, FormatStyle style) {
                     display_hours = hours - 12;
                     am_pm = "PM";
                 }
-                strftime(buffer, 80, "%b %d, %Y ", &date_struct);
+                strftime(buffer, size, "%b %d, %Y ", &date_struct);
                 char time_buf[48];
                 snprintf(time_buf, sizeof(time_buf), "%d:%02d:%02d %s", 
                         display_hours, minutes, seconds, am_pm);
-                strcat_s(buffer, sizeof(buffer), time_buf);
+                strcat_s(buffer, size, time_buf);
             }
             break;
         case DATETIME_STYLE_ISO:
-            snprintf(buffer, sizeof(buffer), "%04d-%02d-%02dT%02d:%02d:%02d",
+            snprintf(buffer, size, "%04d-%02d-%02dT%02d:%02d:%02d",
                     date_struct.tm_year + 1900, date_struct.tm_mon + 1, date_struct.tm_mday,
                     hours, minutes, seconds);
             break;
         default:
             // Fall back to regular datetime formatting
-            return format_number_as_datetime(value, DATE_STYLE_MM_DD_YYYY, TIME_STYLE_12HR);
+            format_number_as_datetime(buffer, size, value, DATE_STYLE_MM_DD_YYYY, TIME_STYLE_12HR);
+            break;
     }
-    
-    return buffer;
 }
 
 // XLOOKUP function
 // Searches in lookup_array and returns corresponding value from return_array
-double func_xlookup(Sheet* sheet, double lookup_value, const char* lookup_str,
-                   const char* lookup_array, const char* return_array, int exact_match, ErrorType* error) {
-    *error = ERROR_NONE;
-    
-    // Parse the lookup array range
-    CellRange lookup_range;
-    if (!parse_range(lookup_array, &lookup_range)) {
-        *error = ERROR_REF;
-        return 0.0;
-    }
-    
-    // Parse the return array range
-    CellRange return_range;
-    if (!parse_range(return_array, &return_range)) {
-        *error = ERROR_REF;
-        return 0.0;
-    }
-    
-    // Validate ranges have same dimensions
+// Both ranges are resolved when the formula is compiled
+// Linear XLOOKUP over the cells, used when the index cannot be allocated.
+// Defines the matching rules the index reproduces.
+static double xlookup_scan(Sheet* sheet, double lookup_value, const char* lookup_str,
+                           const CellRange* lookup_array, const CellRange* return_array,
+                           int exact_match, ErrorType* error) {
+    CellRange lookup_range = *lookup_array;
+    CellRange return_range = *return_array;
     int lookup_rows = lookup_range.end_row - lookup_range.start_row + 1;
     int lookup_cols = lookup_range.end_col - lookup_range.start_col + 1;
-    int return_rows = return_range.end_row - return_range.start_row + 1;
-    int return_cols = return_range.end_col - return_range.start_col + 1;
-    
-    if (lookup_rows != return_rows || lookup_cols != return_cols) {
-        *error = ERROR_REF;
-        return 0.0;
-    }
     
     // Search through the lookup array
     // Support both vertical (column) and horizontal (row) searches
@@ -1248,640 +1921,1177 @@ double func_xlookup(Sheet* sheet, double lookup_value, const char* lookup_str,
     return 0.0;
 }
 
-// Simple formula evaluator (basic arithmetic and cell references)
-double evaluate_formula(Sheet* sheet, const char* formula, ErrorType* error) {
-    *error = ERROR_NONE;
-    
-    // Skip leading '='
-    if (*formula == '=') formula++;
-    
-    // Try comparison expressions first (for IF function support)
-    return evaluate_comparison(sheet, formula, error);
-}
-
-// Helper function to get string value from a cell reference
-char* get_cell_string_value(Sheet* sheet, const char* ref) {
-    int row, col;
-    if (!parse_cell_reference(ref, &row, &col)) {
-        return NULL;
-    }
-    
+// Value of the return cell matching lookup position i. Returns 0 when that
+// cell holds text or an error, in which case the search moves on.
+static int xlookup_result(Sheet* sheet, const CellRange* return_range, int is_vertical, int i, double* value) {
+    int row = is_vertical ? return_range->start_row + i : return_range->start_row;
+    int col = is_vertical ? return_range->start_col : return_range->start_col + i;
     Cell* cell = sheet_get_cell(sheet, row, col);
-    if (!cell) return NULL;
     
+    if (!cell) {
+        *value = 0.0;  // Empty cell
+        return 1;
+    }
     switch (cell->type) {
-        case CELL_STRING:
-            return cell->data.string;
+        case CELL_NUMBER:
+            *value = cell->data.number;
+            return 1;
         case CELL_FORMULA:
-            if (cell->data.formula.is_string_result && cell->data.formula.cached_string) {
-                return cell->data.formula.cached_string;
+            if (cell->data.formula.error == ERROR_NONE) {
+                *value = cell->data.formula.cached_value;
+                return 1;
             }
-            break;
+            return 0;
+        case CELL_EMPTY:
+            *value = 0.0;
+            return 1;
         default:
-            break;
+            return 0;
     }
-    return NULL;
 }
 
-// Enhanced comparison evaluation with string support
-double evaluate_comparison(Sheet* sheet, const char* expr, ErrorType* error) {
-    const char* p = expr;
-    const char* start_left = p;
-    
-    // First, try to identify if we have a string comparison
-    // Look for pattern: cell_ref = "string" or "string" = cell_ref
-    
-    // Check if left side is a cell reference
-    char left_ref[32] = {0};
-    int left_ref_len = 0;
-    const char* temp_p = p;
+static int compare_int(const void* a, const void* b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+double func_xlookup(Sheet* sheet, double lookup_value, const char* lookup_str,
+                   const CellRange* lookup_array, const CellRange* return_array,
+                   int exact_match, ErrorType* error) {
+    *error = ERROR_NONE;
     
-    // Extract potential cell reference
-    while (*temp_p && (isalpha(*temp_p) || isdigit(*temp_p)) && left_ref_len < 31) {
-        left_ref[left_ref_len++] = *temp_p;
-        temp_p++;
-    }
-    left_ref[left_ref_len] = '\0';
+    // Validate ranges have same dimensions
+    int lookup_rows = lookup_array->end_row - lookup_array->start_row + 1;
+    int lookup_cols = lookup_array->end_col - lookup_array->start_col + 1;
+    int return_rows = return_array->end_row - return_array->start_row + 1;
+    int return_cols = return_array->end_col - return_array->start_col + 1;
     
-    // Check if it's a valid cell reference
-    int is_left_cell_ref = 0;
-    int left_row, left_col;
-    if (left_ref_len > 0 && parse_cell_reference(left_ref, &left_row, &left_col)) {
-        is_left_cell_ref = 1;
+    if (lookup_rows != return_rows || lookup_cols != return_cols) {
+        *error = ERROR_REF;
+        return 0.0;
     }
     
-    // Skip whitespace and look for comparison operator
-    skip_whitespace(&temp_p);
-    char comparison_op[3] = {0};
-    int op_len = 0;
-    
-    if (*temp_p == '=' || *temp_p == '<' || *temp_p == '>') {
-        comparison_op[op_len++] = *temp_p++;
-        if (*temp_p == '=' || (*temp_p == '>' && comparison_op[0] == '<')) {
-            comparison_op[op_len++] = *temp_p++;
-        }
-        comparison_op[op_len] = '\0';
+    LookupIndex* index = lookup_index_get(sheet, lookup_array);
+    if (!index) {
+        return xlookup_scan(sheet, lookup_value, lookup_str, lookup_array, return_array, exact_match, error);
     }
     
-    // Check if right side is a string literal
-    skip_whitespace(&temp_p);
-    int is_right_string = (*temp_p == '"');
-    
-    // If we have cell_ref = "string", handle as string comparison
-    if (is_left_cell_ref && strlen(comparison_op) > 0 && is_right_string) {
-        // Get the string value from the cell
-        char* left_str = get_cell_string_value(sheet, left_ref);
-        
-        // Parse the string literal
-        temp_p++; // Skip opening quote
-        char right_str[256] = {0};
-        int right_len = 0;
-        while (*temp_p && *temp_p != '"' && right_len < 255) {
-            right_str[right_len++] = *temp_p++;
-        }
-        if (*temp_p == '"') temp_p++; // Skip closing quote
-        
-        // Perform string comparison
-        int cmp_result = 0;
-        if (left_str) {
-            cmp_result = strcmp(left_str, right_str);
-        } else {
-            // If cell is empty or not string, compare with empty string
-            cmp_result = strcmp("", right_str);
-        }
-        
-        // Apply comparison operator
-        if (strcmp(comparison_op, "=") == 0) {
-            return (cmp_result == 0) ? 1.0 : 0.0;
-        } else if (strcmp(comparison_op, "<>") == 0) {
-            return (cmp_result != 0) ? 1.0 : 0.0;
-        } else if (strcmp(comparison_op, "<") == 0) {
-            return (cmp_result < 0) ? 1.0 : 0.0;
-        } else if (strcmp(comparison_op, "<=") == 0) {
-            return (cmp_result <= 0) ? 1.0 : 0.0;
-        } else if (strcmp(comparison_op, ">") == 0) {
-            return (cmp_result > 0) ? 1.0 : 0.0;
-        } else if (strcmp(comparison_op, ">=") == 0) {
-            return (cmp_result >= 0) ? 1.0 : 0.0;
+    // Candidates are tried in position order; the first returnable one wins
+    double value;
+    if (lookup_str) {
+        for (int e = lookup_string_first(index, lookup_str); e >= 0; e = lookup_string_next(index, e)) {
+            if (xlookup_result(sheet, return_array, index->is_vertical, index->string_positions[e], &value)) {
+                return value;
+            }
         }
-        
-        *error = ERROR_PARSE;
-        return 0.0;
-    }
-    
-    // Fall back to numeric comparison
-    double left = parse_arithmetic_expression(sheet, &p, error);
-    if (*error != ERROR_NONE) return left;
-    
-    skip_whitespace(&p);
-    
-    // Check for comparison operators
-    if (*p == '>') {
-        p++;
-        if (*p == '=') {
-            p++; // >=
-            double right = parse_arithmetic_expression(sheet, &p, error);
-            return (left >= right) ? 1.0 : 0.0;
-        } else {
-            // >
-            double right = parse_arithmetic_expression(sheet, &p, error);
-            return (left > right) ? 1.0 : 0.0;
+    } else if (exact_match) {
+        int start, end;
+        lookup_exact_window(index, lookup_value, &start, &end);
+        if (end - start == 1) {
+            if (xlookup_result(sheet, return_array, index->is_vertical, index->numbers[start].position, &value)) {
+                return value;
+            }
+        } else if (end > start) {
+            // Near-equal values sort by value first; put them back in position order
+            int* positions = (int*)malloc((end - start) * sizeof(int));
+            if (!positions) {
+                return xlookup_scan(sheet, lookup_value, lookup_str, lookup_array, return_array, exact_match, error);
+            }
+            for (int k = start; k < end; k++) {
+                positions[k - start] = index->numbers[k].position;
+            }
+            qsort(positions, end - start, sizeof(int), compare_int);
+            for (int k = 0; k < end - start; k++) {
+                if (xlookup_result(sheet, return_array, index->is_vertical, positions[k], &value)) {
+                    free(positions);
+                    return value;
+                }
+            }
+            free(positions);
         }
-    } else if (*p == '<') {
-        p++;
-        if (*p == '=') {
-            p++; // <=
-            double right = parse_arithmetic_expression(sheet, &p, error);
-            return (left <= right) ? 1.0 : 0.0;
-        } else if (*p == '>') {
-            p++; // <>
-            double right = parse_arithmetic_expression(sheet, &p, error);
-            return (left != right) ? 1.0 : 0.0;
-        } else {
-            // <
-            double right = parse_arithmetic_expression(sheet, &p, error);
-            return (left < right) ? 1.0 : 0.0;
-        }
-    } else if (*p == '=') {
-        p++; // =
-        double right = parse_arithmetic_expression(sheet, &p, error);
-        return (fabs(left - right) < FLOAT_COMPARISON_EPSILON) ? 1.0 : 0.0;
-    }
-    
-    // No comparison operator found, return the arithmetic expression result
-    return left;
-}
-
-// Parse term (handles * and /)
-double parse_term(Sheet* sheet, const char** expr, ErrorType* error) {
-    double result = parse_factor(sheet, expr, error);
-    if (*error != ERROR_NONE) return 0.0;
-    
-    while (1) {
-        skip_whitespace(expr);
-        if (**expr == '*') {
-            (*expr)++;
-            double right = parse_factor(sheet, expr, error);
-            if (*error != ERROR_NONE) return 0.0;
-            result *= right;
-        } else if (**expr == '/') {
-            (*expr)++;
-            double right = parse_factor(sheet, expr, error);
-            if (*error != ERROR_NONE) return 0.0;
-            if (right == 0.0) {
-                *error = ERROR_DIV_ZERO;
-                return 0.0;
+    } else {
+        // Approximate: position i matches when no later value <= the key is
+        // larger than its own. Walking the qualifying values from the largest
+        // down, a group of equal values matches at the positions after every
+        // larger value, which yields the matches in position order.
+        int end = lookup_floor_count(index, lookup_value);
+        int last_larger = -1;
+        while (end > 0) {
+            int start = end - 1;
+            while (start > 0 && index->numbers[start - 1].value == index->numbers[end - 1].value) start--;
+            for (int k = start; k < end; k++) {
+                int position = index->numbers[k].position;
+                if (position > last_larger &&
+                    xlookup_result(sheet, return_array, index->is_vertical, position, &value)) {
+                    return value;
+                }
             }
-            result /= right;
-        } else {
-            break;
+            if (index->numbers[end - 1].position > last_larger) {
+                last_larger = index->numbers[end - 1].position;
+            }
+            end = start;
         }
     }
     
-    return result;
+    // No match found
+    *error = ERROR_NA;
+    return 0.0;
 }
 
-// Parse a factor (number, cell reference, or function call)
-double parse_factor(Sheet* sheet, const char** expr, ErrorType* error) {
-    skip_whitespace(expr);
-    
-    if (**expr == '(') {
-        (*expr)++; // Skip '('
-        double result = parse_arithmetic_expression(sheet, expr, error);
-        if (*error != ERROR_NONE) return 0.0;
-        
-        skip_whitespace(expr);
-        if (**expr != ')') {
-            *error = ERROR_PARSE;
-            return 0.0;
+// Evaluate formula text directly (compiles a temporary program).
+// Cells keep their compiled program, see cell_set_formula.
+double evaluate_formula(Sheet* sheet, const char* formula, ErrorType* error) {
+    CompiledFormula* program = formula_compile(formula);
+    double value = formula_evaluate(sheet, program, error);
+    formula_free(program);
+    return value;
+}
+
+// Evaluate a comparison or arithmetic expression (no leading '=')
+double evaluate_comparison(Sheet* sheet, const char* expr, ErrorType* error) {
+    CompiledFormula* program = formula_compile_expression(expr);
+    double value = formula_evaluate(sheet, program, error);
+    formula_free(program);
+    return value;
+}
+
+// ============================================================================
+// Dependency tracking
+// ============================================================================
+//
+// Single-cell references are stored as edges on the cells themselves: the
+// formula lists its precedents in depends_on, and each precedent lists the
+// formula in dependents. Range references are kept per column as listeners
+// covering a span of rows, so SUM(A1:A50000) costs one entry rather than
+// fifty thousand edges. Edges are never searched for removal; when a formula
+// changes its dep_generation is bumped and old edges are dropped lazily the
+// next time they are walked.
+
+typedef struct {
+    Sheet* sheet;
+    Cell* cell;
+} DependencyContext;
+
+// An edit during a pass: queue what the pass has not reached yet, so the
+// next one covers that and whatever the edit itself affects
+static void recalc_cancel(Sheet* sheet) {
+    if (!sheet->calc_active) return;
+    sheet->calc_active = 0;
+
+    for (int i = 0; i < sheet->calc_affected_count; i++) {
+        Cell* cell = sheet->calc_affected[i];
+        if (cell->calc_pending >= 0) {
+            sheet_mark_dirty(sheet, cell);
         }
-        (*expr)++; // Skip ')'
-        
-        return result;
-    }
-    
-    // Check if this could be a function call (letters followed by '(')
-    const char* start = *expr;
-    const char* lookahead = *expr;
-    
-    // Look ahead to see if this is a function call
-    while (*lookahead && isalpha(*lookahead)) lookahead++;
-    skip_whitespace(&lookahead);
-    
-    if (*lookahead == '(') {
-        // This is a function call
-        return parse_function(sheet, expr, error);
     }
+    sheet->needs_recalc = 1;
+}
+
+// Queue a changed cell for the next recalculation
+void sheet_mark_dirty(Sheet* sheet, Cell* cell) {
+    if (!sheet || !cell) return;
+    recalc_cancel(sheet);
     
-    // Try to parse as cell reference or range
-    char ref_buf[32];
-    int i = 0;
-    
-    // Extract potential cell reference (letters followed by numbers, possibly with colon)
-    while (**expr && (isalpha(**expr) || isdigit(**expr) || **expr == ':') && i < 31) {
-        ref_buf[i++] = **expr;
-        (*expr)++;
-    }
-    ref_buf[i] = '\0';
-    
-    if (i > 0) {
-        // Check if it's a range (contains ':')
-        if (strchr(ref_buf, ':')) {
-            CellRange range;
-            if (parse_range(ref_buf, &range)) {
-                // For a range without a function, just return the sum
-                double values[MAX_RANGE_VALUES];
-                int count = get_range_values(sheet, &range, values, MAX_RANGE_VALUES);
-                return func_sum(values, count);
-            } else {
-                *error = ERROR_PARSE;
-                return 0.0;
-            }
-        } else {
-            // Single cell reference
-            int row, col;
-            if (parse_cell_reference(ref_buf, &row, &col)) {
-                Cell* cell = sheet_get_cell(sheet, row, col);
-                if (!cell) {
-                    return 0.0; // Empty cell
-                }
-                
-                switch (cell->type) {
-                    case CELL_EMPTY:
-                        return 0.0;
-                    case CELL_NUMBER:
-                        return cell->data.number;
-                    case CELL_FORMULA:
-                        if (cell->data.formula.error != ERROR_NONE) {
-                            *error = cell->data.formula.error;
-                            return 0.0;
-                        }
-                        return cell->data.formula.cached_value;
-                    default:
-                        *error = ERROR_VALUE;
-                        return 0.0;
-                }
-            }
+    if (cell->is_dirty) return;
+
+    DependencyGraph* graph = &sheet->dep_graph;
+    if (graph->dirty_count >= graph->dirty_capacity) {
+        int new_capacity = graph->dirty_capacity ? graph->dirty_capacity * 2 : 64;
+        Cell** dirty = (Cell**)realloc(graph->dirty, new_capacity * sizeof(Cell*));
+        if (!dirty) {
+            // Can't track the change; fall back to a full rebuild
+            graph->needs_rebuild = 1;
+            return;
         }
+        graph->dirty = dirty;
+        graph->dirty_capacity = new_capacity;
     }
-    
-    // Reset and try to parse as number
-    *expr = start;
-    char* endptr;
-    double value = strtod(*expr, &endptr);
-    if (endptr != *expr) {
-        *expr = endptr;
-        return value;
-    }
-    
-    *error = ERROR_PARSE;
-    return 0.0;
+
+    graph->dirty[graph->dirty_count++] = cell;
+    cell->is_dirty = 1;
 }
 
-// Enhanced arithmetic expression parser (with updated signature)
-double parse_arithmetic_expression(Sheet* sheet, const char** expr, ErrorType* error) {
-    double result = parse_term(sheet, expr, error);
-    if (*error != ERROR_NONE) return 0.0;
-    
-    while (1) {
-        skip_whitespace(expr);
-        if (**expr == '+') {
-            (*expr)++;
-            double right = parse_term(sheet, expr, error);
-            if (*error != ERROR_NONE) return 0.0;
-            result += right;
-        } else if (**expr == '-') {
-            (*expr)++;
-            double right = parse_term(sheet, expr, error);
-            if (*error != ERROR_NONE) return 0.0;
-            result -= right;
-        } else {
-            break;
-        }
+// Drop every edge and listener. Used before cells move or are freed.
+void sheet_invalidate_dependencies(Sheet* sheet) {
+    if (!sheet) return;
+    recalc_cancel(sheet);
+
+    DependencyGraph* graph = &sheet->dep_graph;
+
+    CellIterator it;
+    Cell* cell;
+    sheet_iter_begin(sheet, &it);
+    while ((cell = sheet_iter_next(&it)) != NULL) {
+        cell->depends_count = 0;
+        cell->dependents_count = 0;
+        cell->is_dirty = 0;
+    }
+
+    for (int col = 0; col < sheet->cols; col++) {
+        graph->listener_count[col] = 0;
     }
+
+    graph->dirty_count = 0;
+    graph->needs_rebuild = 1;
+    sheet->external_reader_count = 0;
     
-    return result;
+    // Cells may have moved under the indexed ranges
+    lookup_invalidate_all(sheet);
+    shared_range_reset_users(sheet);
+    shared_range_invalidate_all(sheet);
+    sheet_touch_all_columns(sheet);
 }
 
-// Recalculate all formulas in the sheet
-void sheet_recalculate(Sheet* sheet) {
-    if (!sheet->needs_recalc) return;
-    
-    // Use smart recalculation with dependency tracking
-    sheet_recalculate_smart(sheet);
-    
-    sheet->needs_recalc = 0;
+// Forget the precedents of a formula cell; edges pointing at it go stale
+static void dependency_detach(Cell* cell) {
+    if (!cell || cell->type != CELL_FORMULA) return;
+
+    cell->dep_generation++;
+    cell->depends_count = 0;
 }
 
-void sheet_recalculate_smart(Sheet* sheet) {
-    // Only recalculate cells that changed and their dependents
-    // Use iterative evaluation to handle dependencies
-    
-    // Build list of cells to recalculate
-    Cell** to_calc = (Cell**)malloc(sheet->rows * sheet->cols * sizeof(Cell*));
-    int calc_count = 0;
-    
-    // Add all formula cells to calculation queue
-    for (int row = 0; row < sheet->rows; row++) {
-        for (int col = 0; col < sheet->cols; col++) {
-            Cell* cell = sheet_get_cell(sheet, row, col);
-            if (cell && cell->type == CELL_FORMULA) {
-                to_calc[calc_count++] = cell;
+static int dependency_add_edge(Cell* precedent, Cell* cell) {
+    if (precedent->dependents_count >= precedent->dependents_capacity) {
+        // Compact stale edges before growing
+        int live = 0;
+        for (int i = 0; i < precedent->dependents_count; i++) {
+            DependentEdge edge = precedent->dependents[i];
+            if (edge.cell->dep_generation == edge.generation && edge.cell->type == CELL_FORMULA) {
+                precedent->dependents[live++] = edge;
             }
         }
+        precedent->dependents_count = live;
     }
-    
-    // Evaluate formulas multiple times to handle dependencies
-    // Keep iterating until no values change (or max iterations reached)
-    int max_iterations = 10;
-    for (int iter = 0; iter < max_iterations; iter++) {
-        int changed = 0;
-        
-        for (int i = 0; i < calc_count; i++) {
-            Cell* cell = to_calc[i];
-            double old_value = cell->data.formula.cached_value;
-            ErrorType error;
-            g_current_evaluating_cell = cell;
-            double value = evaluate_formula(sheet, cell->data.formula.expression, &error);
-            cell->data.formula.cached_value = value;
-            cell->data.formula.error = error;
-            g_current_evaluating_cell = NULL;
-            
-            // Check if value changed significantly
-            if (fabs(value - old_value) > 0.0001) {
-                changed = 1;
-            }
-        }
-        
-        // If no values changed, we're done
-        if (!changed) break;
+
+    if (precedent->dependents_count >= precedent->dependents_capacity) {
+        int new_capacity = precedent->dependents_capacity ? precedent->dependents_capacity * 2 : 4;
+        DependentEdge* dependents = (DependentEdge*)realloc(precedent->dependents,
+                                                            new_capacity * sizeof(DependentEdge));
+        if (!dependents) return 0;
+        precedent->dependents = dependents;
+        precedent->dependents_capacity = new_capacity;
     }
-    
-    free(to_calc);
+
+    precedent->dependents[precedent->dependents_count].cell = cell;
+    precedent->dependents[precedent->dependents_count].generation = cell->dep_generation;
+    precedent->dependents_count++;
+    return 1;
 }
 
-// Escape a string for CSV output (handle quotes and commas)
-char* escape_csv_string(const char* str) {
-    if (!str) return NULL;
-    
-    // Check if we need to escape (contains comma, quote, or newline)
-    int needs_escape = 0;
-    int quote_count = 0;
-    
-    for (const char* p = str; *p; p++) {
-        if (*p == ',' || *p == '\n' || *p == '\r') {
-            needs_escape = 1;
+static int dependency_add_listener(DependencyGraph* graph, int col, Cell* cell, int start_row, int end_row) {
+    if (graph->listener_count[col] >= graph->listener_capacity[col]) {
+        int new_capacity = graph->listener_capacity[col] ? graph->listener_capacity[col] * 2 : 8;
+        RangeListener* listeners = (RangeListener*)realloc(graph->column_listeners[col],
+                                                           new_capacity * sizeof(RangeListener));
+        if (!listeners) return 0;
+        graph->column_listeners[col] = listeners;
+        graph->listener_capacity[col] = new_capacity;
+    }
+
+    RangeListener* listener = &graph->column_listeners[col][graph->listener_count[col]++];
+    listener->cell = cell;
+    listener->generation = cell->dep_generation;
+    listener->start_row = start_row;
+    listener->end_row = end_row;
+    return 1;
+}
+
+static void dependency_register_reference(void* context, const CellRange* range, int is_range) {
+    DependencyContext* ctx = (DependencyContext*)context;
+    Sheet* sheet = ctx->sheet;
+    Cell* cell = ctx->cell;
+    int ok = 1;
+
+    if (!is_range) {
+        // Placeholder cells give empty precedents somewhere to hold edges
+        Cell* precedent = sheet_get_or_create_cell(sheet, range->start_row, range->start_col);
+        if (!precedent) return;
+
+        for (int i = 0; i < cell->depends_count; i++) {
+            if (cell->depends_on[i] == precedent) return;  // Already recorded
         }
-        if (*p == '"') {
-            needs_escape = 1;
-            quote_count++;
+
+        if (cell->depends_count >= cell->depends_capacity) {
+            int new_capacity = cell->depends_capacity ? cell->depends_capacity * 2 : 4;
+            Cell** depends_on = (Cell**)realloc(cell->depends_on, new_capacity * sizeof(Cell*));
+            if (!depends_on) {
+                sheet->dep_graph.needs_rebuild = 1;
+                return;
+            }
+            cell->depends_on = depends_on;
+            cell->depends_capacity = new_capacity;
         }
-    }    if (!needs_escape) {
-        // Return a copy of the original string
-        char* result = malloc(strlen(str) + 1);
-        if (result) {
-            strcpy_s(result, strlen(str) + 1, str);
+        cell->depends_on[cell->depends_count++] = precedent;
+        ok = dependency_add_edge(precedent, cell);
+    } else {
+        // Clip to the sheet; cells outside it can never change
+        int start_row = range->start_row < 0 ? 0 : range->start_row;
+        int end_row = range->end_row >= sheet->rows ? sheet->rows - 1 : range->end_row;
+        int start_col = range->start_col < 0 ? 0 : range->start_col;
+        int end_col = range->end_col >= sheet->cols ? sheet->cols - 1 : range->end_col;
+
+        for (int col = start_col; col <= end_col && start_row <= end_row && ok; col++) {
+            ok = dependency_add_listener(&sheet->dep_graph, col, cell, start_row, end_row);
         }
-        return result;
     }
-    
-    // Need to escape - allocate buffer (original + 2 for outer quotes + quotes to double)
-    char* result = malloc(strlen(str) + 2 + quote_count + 1);
-    if (!result) return NULL;
-    
-    char* p = result;
-    *p++ = '"';  // Opening quote
-    
-    for (const char* s = str; *s; s++) {
-        if (*s == '"') {
-            *p++ = '"';  // Double the quote
-            *p++ = '"';
-        } else {
-            *p++ = *s;
+
+    if (!ok) sheet->dep_graph.needs_rebuild = 1;
+}
+
+// List a formula reading other sheets; stale entries are dropped first
+static int dependency_add_external(Sheet* sheet, Cell* cell) {
+    if (sheet->external_reader_count >= sheet->external_reader_capacity) {
+        int live = 0;
+        for (int i = 0; i < sheet->external_reader_count; i++) {
+            DependentEdge edge = sheet->external_readers[i];
+            if (edge.cell->dep_generation == edge.generation && edge.cell->type == CELL_FORMULA) {
+                sheet->external_readers[live++] = edge;
+            }
         }
+        sheet->external_reader_count = live;
     }
-    
-    *p++ = '"';  // Closing quote
-    *p = '\0';
-    
-    return result;
-}
 
-// Parse a CSV field (handles quoted fields with commas and quotes)
-char* parse_csv_field(const char** csv_line, int* is_end) {
-    const char* start = *csv_line;
-    const char* p = start;
-    
-    *is_end = 0;
-    
-    // Skip leading whitespace
-    while (*p == ' ' || *p == '\t') p++;
-    
-    if (*p == '\0' || *p == '\n' || *p == '\r') {
-        *is_end = 1;
-        *csv_line = p;
-        return NULL;  // Empty field at end of line
+    if (sheet->external_reader_count >= sheet->external_reader_capacity) {
+        int new_capacity = sheet->external_reader_capacity ? sheet->external_reader_capacity * 2 : 16;
+        DependentEdge* readers = (DependentEdge*)realloc(sheet->external_readers,
+                                                         new_capacity * sizeof(DependentEdge));
+        if (!readers) return 0;
+        sheet->external_readers = readers;
+        sheet->external_reader_capacity = new_capacity;
     }
-    
-    if (*p == '"') {
-        // Quoted field
-        p++;  // Skip opening quote
-        // Dynamically grow buffer or scan first to determine size
-        size_t capacity = 256;
-        char* result = malloc(capacity);
-        if (!result) return NULL;
-        
-        char* dest = result;
-        size_t len = 0;
-        
-        while (*p && *p != '\n' && *p != '\r') {
-            if (*p == '"') {
-                if (*(p + 1) == '"') {
-                    // Escaped quote
-                    if (len >= capacity - 1) {
-                        capacity *= 2;
-                        char* new_result = realloc(result, capacity);
-                        if (!new_result) {
-                            free(result);
-                            return NULL;
-                        }
-                        result = new_result;
-                        dest = result + len;
+
+    sheet->external_readers[sheet->external_reader_count].cell = cell;
+    sheet->external_readers[sheet->external_reader_count].generation = cell->dep_generation;
+    sheet->external_reader_count++;
+    return 1;
+}
+
+// Record the precedents of a freshly compiled formula
+static void dependency_attach(Sheet* sheet, Cell* cell) {
+    if (!cell || cell->type != CELL_FORMULA || !cell->data.formula.compiled) return;
+
+    DependencyContext ctx;
+    ctx.sheet = sheet;
+    ctx.cell = cell;
+    formula_visit_references(cell->data.formula.compiled, dependency_register_reference, &ctx);
+    shared_range_link(sheet, cell->data.formula.compiled);
+
+    if (formula_reads_other_sheets(cell->data.formula.compiled) && !dependency_add_external(sheet, cell)) {
+        sheet->dep_graph.needs_rebuild = 1;
+    }
+}
+
+// Rebuild all edges from the formulas and queue every formula
+static void dependency_rebuild(Sheet* sheet) {
+    sheet_invalidate_dependencies(sheet);
+    sheet->dep_graph.needs_rebuild = 0;
+    sheet->has_circular = 0;    // Every formula is evaluated; cycles are found again
+
+    // Attaching creates placeholder cells; the iterator tolerates that
+    CellIterator it;
+    Cell* cell;
+    sheet_iter_begin(sheet, &it);
+    while ((cell = sheet_iter_next(&it)) != NULL) {
+        if (cell->type == CELL_FORMULA) {
+            dependency_attach(sheet, cell);
+            sheet_mark_dirty(sheet, cell);
+        }
+    }
+}
+
+// Collect the live formulas that read this cell. Stale edges and listeners
+// are compacted away as they are found. Returns -1 on allocation failure.
+static int dependency_collect(Sheet* sheet, Cell* cell, Cell*** buffer, int* capacity) {
+    int count = 0;
+
+    int live = 0;
+    for (int i = 0; i < cell->dependents_count; i++) {
+        DependentEdge edge = cell->dependents[i];
+        if (edge.cell->dep_generation != edge.generation || edge.cell->type != CELL_FORMULA) continue;
+        cell->dependents[live++] = edge;
+
+        if (count >= *capacity) {
+            int new_capacity = *capacity ? *capacity * 2 : 64;
+            Cell** grown = (Cell**)realloc(*buffer, new_capacity * sizeof(Cell*));
+            if (!grown) return -1;
+            *buffer = grown;
+            *capacity = new_capacity;
+        }
+        (*buffer)[count++] = edge.cell;
+    }
+    cell->dependents_count = live;
+
+    if (cell->col < 0 || cell->col >= sheet->cols) return count;
+
+    DependencyGraph* graph = &sheet->dep_graph;
+    RangeListener* listeners = graph->column_listeners[cell->col];
+    live = 0;
+    for (int i = 0; i < graph->listener_count[cell->col]; i++) {
+        RangeListener listener = listeners[i];
+        if (listener.cell->dep_generation != listener.generation || listener.cell->type != CELL_FORMULA) continue;
+        listeners[live++] = listener;
+
+        if (cell->row < listener.start_row || cell->row > listener.end_row) continue;
+
+        if (count >= *capacity) {
+            int new_capacity = *capacity ? *capacity * 2 : 64;
+            Cell** grown = (Cell**)realloc(*buffer, new_capacity * sizeof(Cell*));
+            if (!grown) return -1;
+            *buffer = grown;
+            *capacity = new_capacity;
+        }
+        (*buffer)[count++] = listener.cell;
+    }
+    graph->listener_count[cell->col] = live;
+
+    return count;
+}
+
+// A full pass leaves every cell on or downstream of a cycle at #CIRC!. A
+// later pass that does not reach the cycle must carry that on to new
+// readers itself: ranges skip error cells, so it would not surface.
+typedef struct {
+    Sheet* sheet;
+    int hit;
+} CircularCheck;
+
+static void circular_run(void* context, int row, const double* values, const unsigned char* kinds, int count) {
+    CircularCheck* check = (CircularCheck*)context;
+    (void)row;
+    if (!kinds || check->hit) return;
+    for (int i = 0; i < count; i++) {
+        if (kinds[i] == CELL_VALUE_ERROR && values[i] == (double)ERROR_CIRCULAR) {
+            check->hit = 1;
+            return;
+        }
+    }
+}
+
+static void note_circular_reference(void* context, const CellRange* range, int is_range) {
+    CircularCheck* check = (CircularCheck*)context;
+    (void)is_range;
+    for (int col = range->start_col; col <= range->end_col && !check->hit; col++) {
+        sheet_visit_column(check->sheet, col, range->start_row, range->end_row, circular_run, check);
+    }
+}
+
+static int formula_reads_circular(Sheet* sheet, const CompiledFormula* program) {
+    CircularCheck check = { sheet, 0 };
+    formula_visit_references(program, note_circular_reference, &check);
+    return check.hit;
+}
+
+static void evaluate_cell(Sheet* sheet, Cell* cell) {
+    EvalContext context = { sheet, cell };
+    ErrorType error;
+    double value;
+    long long start = stats_profiling() ? stats_now() : 0;
+    CompiledFormula* program = cell->data.formula.compiled;
+    if (!program) program = formula_compile(cell->data.formula.expression);
+    value = formula_evaluate_in(&context, program, &error);
+    if (sheet->has_circular && error != ERROR_CIRCULAR && formula_reads_circular(sheet, program)) {
+        value = 0.0;
+        error = ERROR_CIRCULAR;
+    }
+    if (program != cell->data.formula.compiled) formula_free(program);
+    cell->data.formula.cached_value = value;
+    cell->data.formula.error = error;
+    sheet_store_value(sheet, cell);
+    if (start) cell->eval_ticks += stats_now() - start;
+}
+
+// Formulas of one dependency level: none reads another's result
+typedef struct {
+    Sheet* sheet;
+    Cell** cells;
+} RecalcLevel;
+
+static void evaluate_level_task(void* context, int begin, int end) {
+    RecalcLevel* level = (RecalcLevel*)context;
+    for (int i = begin; i < end; i++) {
+        evaluate_cell(level->sheet, level->cells[i]);
+    }
+}
+
+// Build the XLOOKUP indexes and range memos a level will read while it
+// still runs on one thread
+static void prepare_shared_reads(Sheet* sheet, Cell** cells, int count) {
+    for (int i = 0; i < count; i++) {
+        const CompiledFormula* program = cells[i]->data.formula.compiled;
+        if (!program) continue;
+        for (int k = 0; k < program->lookup_count; k++) {
+            if (program->lookups[k].ranges_valid) {
+                lookup_index_get(sheet, &program->lookups[k].lookup_range);
+            }
+        }
+        for (int pc = 0; pc < program->code_count; pc++) {
+            const FormulaInstr* instr = &program->code[pc];
+            RangeAggregate agg;
+            if (instr->op == OP_RANGE_SUM) {
+                shared_range_aggregate(sheet, instr->index, &instr->u.range, 0, &agg);
+            } else if (instr->op == OP_AGG_RANGE && instr->arg != FUNC_MEDIAN && instr->arg != FUNC_MODE) {
+                shared_range_aggregate(sheet, instr->index, &instr->u.range,
+                                       instr->arg == FUNC_MIN || instr->arg == FUNC_MAX, &agg);
+            }
+        }
+    }
+}
+
+static void evaluate_level(Sheet* sheet, Cell** cells, int count) {
+    if (count >= RECALC_PARALLEL_MIN_CELLS && sheet->recalc_threads != 1) {
+        if (!sheet->recalc_pool) {
+            sheet->recalc_pool = thread_pool_create(sheet->recalc_threads);
+        }
+        if (sheet->recalc_pool && thread_pool_size(sheet->recalc_pool) > 1) {
+            RecalcLevel level = { sheet, cells };
+            stats_get()->recalc_parallel++;
+            prepare_shared_reads(sheet, cells, count);
+            sheet->lookup_read_only = 1;
+            thread_pool_run(sheet->recalc_pool, count, evaluate_level_task, &level);
+            sheet->lookup_read_only = 0;
+            
+            // Results published by the workers were not applied to memos
+            // or lookup indexes
+            for (int i = 0; i < count; i++) {
+                shared_range_invalidate_cell(sheet, cells[i]->row, cells[i]->col);
+                lookup_cell_changed(sheet, cells[i]->row, cells[i]->col);
+                sheet->column_versions[cells[i]->col]++;
+            }
+            return;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        evaluate_cell(sheet, cells[i]);
+    }
+}
+
+void sheet_set_recalc_threads(Sheet* sheet, int threads) {
+    if (threads < 0) threads = 0;
+    if (threads == sheet->recalc_threads) return;
+
+    // Restarted at the new size by the next large level
+    thread_pool_destroy(sheet->recalc_pool);
+    sheet->recalc_pool = NULL;
+    sheet->recalc_threads = threads;
+}
+
+// Queue a cell whose in-pass precedents are all evaluated
+static void recalc_push_ready(Sheet* sheet, Cell* cell) {
+    if (cell->calc_focus_pass == sheet->dep_graph.pass) {
+        sheet->calc_urgent[sheet->calc_urgent_count++] = cell;
+    } else {
+        sheet->calc_ready[sheet->calc_ready_tail++] = cell;
+    }
+}
+
+static int recalc_add_affected(Sheet* sheet, Cell* cell) {
+    if (sheet->calc_affected_count >= sheet->calc_affected_capacity) {
+        int new_capacity = sheet->calc_affected_capacity ? sheet->calc_affected_capacity * 2 : 64;
+        Cell** grown = (Cell**)realloc(sheet->calc_affected, new_capacity * sizeof(Cell*));
+        if (!grown) return 0;
+        sheet->calc_affected = grown;
+        sheet->calc_affected_capacity = new_capacity;
+    }
+    cell->calc_pass = sheet->dep_graph.pass;
+    cell->calc_pending = 0;
+    sheet->calc_affected[sheet->calc_affected_count++] = cell;
+    return 1;
+}
+
+// Stamp the unevaluated cells inside the focus and, through depends_on,
+// everything they are waiting for. Range precedents are not followed: a
+// range wide enough to matter would drag most of the pass along anyway.
+static void recalc_mark_focus(Sheet* sheet) {
+    if (!sheet->calc_active || !sheet->calc_focus_set) return;
+
+    unsigned int pass = sheet->dep_graph.pass;
+    const CellRange* focus = &sheet->calc_focus;
+    Cell** stack = sheet->calc_scratch;
+    int capacity = sheet->calc_scratch_capacity;
+
+    for (int i = 0; i < sheet->calc_affected_count; i++) {
+        Cell* cell = sheet->calc_affected[i];
+        if (cell->calc_pending < 0 || cell->calc_focus_pass == pass) continue;
+        if (cell->row < focus->start_row || cell->row > focus->end_row ||
+            cell->col < focus->start_col || cell->col > focus->end_col) continue;
+
+        int depth = 0;
+        cell->calc_focus_pass = pass;
+        if (depth >= capacity) {
+            int new_capacity = capacity ? capacity * 2 : 64;
+            Cell** grown = (Cell**)realloc(stack, new_capacity * sizeof(Cell*));
+            if (!grown) break;  // Only the order suffers
+            stack = grown;
+            capacity = new_capacity;
+        }
+        stack[depth++] = cell;
+
+        while (depth > 0) {
+            Cell* current = stack[--depth];
+            for (int k = 0; k < current->depends_count; k++) {
+                Cell* precedent = current->depends_on[k];
+                if (precedent->calc_pass != pass || precedent->calc_pending < 0 ||
+                    precedent->calc_focus_pass == pass) continue;
+                if (depth >= capacity) {
+                    int new_capacity = capacity ? capacity * 2 : 64;
+                    Cell** grown = (Cell**)realloc(stack, new_capacity * sizeof(Cell*));
+                    if (!grown) {
+                        depth = 0;
+                        break;
                     }
-                    *dest++ = '"';
-                    len++;
-                    p += 2;
-                } else {
-                    // End of quoted field
-                    p++;
-                    break;
+                    stack = grown;
+                    capacity = new_capacity;
                 }
-            } else {
-                if (len >= capacity - 1) {
-                    capacity *= 2;
-                    char* new_result = realloc(result, capacity);
-                    if (!new_result) {
-                        free(result);
-                        return NULL;
-                    }
-                    result = new_result;
-                    dest = result + len;
+                precedent->calc_focus_pass = pass;
+                stack[depth++] = precedent;
+            }
+        }
+    }
+
+    sheet->calc_scratch = stack;
+    sheet->calc_scratch_capacity = capacity;
+}
+
+// Start a pass: find the dirty cells' transitive dependents and count the
+// in-pass precedents of each
+static LLResult recalc_begin(Sheet* sheet) {
+    DependencyGraph* graph = &sheet->dep_graph;
+    long long start = stats_now();
+    sheet->calc_deferred = 0;
+
+    // Nothing recorded what changed: start from scratch. An empty dirty set
+    // otherwise means there is nothing to evaluate.
+    if (graph->needs_rebuild) {
+        dependency_rebuild(sheet);
+    }
+
+    graph->pass++;
+    sheet->calc_affected_count = 0;
+
+    // Seeds: dirty formulas themselves, and readers of dirty values
+    for (int i = 0; i < graph->dirty_count; i++) {
+        Cell* seed = graph->dirty[i];
+        seed->is_dirty = 0;
+
+        Cell* single = seed;
+        Cell** candidates = &single;
+        int candidate_count = 1;
+        if (seed->type != CELL_FORMULA) {
+            candidate_count = dependency_collect(sheet, seed, &sheet->calc_scratch, &sheet->calc_scratch_capacity);
+            if (candidate_count < 0) return LL_ERR_MEMORY;
+            candidates = sheet->calc_scratch;
+        }
+
+        for (int j = 0; j < candidate_count; j++) {
+            if (candidates[j]->calc_pass == graph->pass) continue;
+            if (!recalc_add_affected(sheet, candidates[j])) return LL_ERR_MEMORY;
+        }
+    }
+    graph->dirty_count = 0;
+
+    // Walk transitive dependents, counting in-pass precedents of each
+    for (int i = 0; i < sheet->calc_affected_count; i++) {
+        int count = dependency_collect(sheet, sheet->calc_affected[i], &sheet->calc_scratch, &sheet->calc_scratch_capacity);
+        if (count < 0) return LL_ERR_MEMORY;
+
+        for (int j = 0; j < count; j++) {
+            Cell* cell = sheet->calc_scratch[j];
+            if (cell->calc_pass != graph->pass && !recalc_add_affected(sheet, cell)) return LL_ERR_MEMORY;
+            cell->calc_pending++;
+        }
+    }
+
+    int affected_count = sheet->calc_affected_count;
+    if (affected_count > sheet->calc_capacity) {
+        Cell** order = (Cell**)realloc(sheet->calc_order, affected_count * sizeof(Cell*));
+        if (!order) return LL_ERR_MEMORY;
+        sheet->calc_order = order;
+        sheet->calc_capacity = affected_count;
+    }
+    if (affected_count > sheet->calc_queue_capacity) {
+        Cell** ready = (Cell**)realloc(sheet->calc_ready, affected_count * sizeof(Cell*));
+        if (ready) sheet->calc_ready = ready;
+        Cell** urgent = (Cell**)realloc(sheet->calc_urgent, affected_count * sizeof(Cell*));
+        if (urgent) sheet->calc_urgent = urgent;
+        if (!ready || !urgent) return LL_ERR_MEMORY;
+        sheet->calc_queue_capacity = affected_count;
+    }
+
+    sheet->calc_count = 0;
+    sheet->calc_ready_head = 0;
+    sheet->calc_ready_tail = 0;
+    sheet->calc_urgent_count = 0;
+    sheet->calc_active = 1;
+
+    recalc_mark_focus(sheet);
+    for (int i = 0; i < affected_count; i++) {
+        if (sheet->calc_affected[i]->calc_pending == 0) {
+            recalc_push_ready(sheet, sheet->calc_affected[i]);
+        }
+    }
+
+    Stats* stats = stats_get();
+    stats->recalc_passes++;
+    stats->cells_touched += affected_count;
+    stats_phase_add(STATS_RECALC_BEGIN, start);
+    return LL_OK;
+}
+
+// Leave the sheet flagged so the next recalc starts from scratch
+static LLResult recalc_fail(Sheet* sheet) {
+    sheet->dep_graph.dirty_count = 0;
+    sheet->dep_graph.needs_rebuild = 1;
+    sheet->needs_recalc = 1;
+    sheet->calc_active = 0;
+    return LL_ERR_MEMORY;
+}
+
+// Kahn's algorithm in batches: every ready cell has all its precedents
+// done, so any set of them can be evaluated together, in parallel if large
+static LLResult recalc_continue(Sheet* sheet, int budget_ms) {
+    DWORD start_time = GetTickCount();
+    long long start = stats_now();
+    Stats* stats = stats_get();
+    unsigned int pass = sheet->dep_graph.pass;
+    int limit = budget_ms > 0 ? RECALC_SLICE_CELLS : sheet->calc_affected_count;
+    stats->recalc_slices++;
+
+    for (;;) {
+        // Cells evaluate in place at the end of calc_order; on-screen ones first
+        Cell** batch = sheet->calc_order + sheet->calc_count;
+        int count = 0;
+        if (sheet->calc_urgent_count > 0) {
+            while (sheet->calc_urgent_count > 0 && count < limit) {
+                batch[count++] = sheet->calc_urgent[--sheet->calc_urgent_count];
+            }
+        } else {
+            while (sheet->calc_ready_head < sheet->calc_ready_tail && count < limit) {
+                Cell* cell = sheet->calc_ready[sheet->calc_ready_head++];
+                if (cell) batch[count++] = cell;
+            }
+        }
+        if (count == 0) break;
+
+        evaluate_level(sheet, batch, count);
+        sheet->calc_count += count;
+        stats->recalc_batches++;
+        stats->formulas_evaluated += count;
+
+        for (int i = 0; i < count; i++) {
+            Cell* cell = batch[i];
+            cell->calc_pending = -1;
+
+            int dependent_count = dependency_collect(sheet, cell, &sheet->calc_scratch, &sheet->calc_scratch_capacity);
+            if (dependent_count < 0) {
+                stats_phase_add(STATS_RECALC_EVALUATE, start);
+                return recalc_fail(sheet);
+            }
+            for (int j = 0; j < dependent_count; j++) {
+                Cell* dependent = sheet->calc_scratch[j];
+                if (dependent->calc_pass == pass && --dependent->calc_pending == 0) {
+                    recalc_push_ready(sheet, dependent);
                 }
-                *dest++ = *p++;
-                len++;
             }
         }
-        
-        *dest = '\0';
-        
-        // Skip to next comma or end of line
-        while (*p && *p != ',' && *p != '\n' && *p != '\r') p++;
-        if (*p == ',') p++;
-        else *is_end = 1;
-        
-        *csv_line = p;
-        return result;
-    } else {
-        // Unquoted field
-        const char* field_start = p;
-        while (*p && *p != ',' && *p != '\n' && *p != '\r') p++;
-        
-        int len = (int)(p - field_start);
-        char* result = malloc(len + 1);
-        if (!result) return NULL;
-        
-        strncpy_s(result, len + 1, field_start, len);
-        result[len] = '\0';
-        
-        // Trim trailing whitespace
-        while (len > 0 && (result[len-1] == ' ' || result[len-1] == '\t')) {
-            result[--len] = '\0';
+
+        if (budget_ms > 0 && GetTickCount() - start_time >= (DWORD)budget_ms) {
+            stats_phase_add(STATS_RECALC_EVALUATE, start);
+            return LL_IN_PROGRESS;
+        }
+    }
+    sheet->calc_active = 0;
+
+    // Whatever is still waiting sits on a cycle or downstream of one
+    LLResult result = LL_OK;
+    for (int i = 0; i < sheet->calc_affected_count; i++) {
+        Cell* cell = sheet->calc_affected[i];
+        if (cell->calc_pending > 0) {
+            cell->data.formula.cached_value = 0.0;
+            cell->data.formula.error = ERROR_CIRCULAR;
+            sheet_store_value(sheet, cell);
+            sheet->has_circular = 1;
+            result = LL_ERR_CIRCULAR_REF;
         }
-        
-        if (*p == ',') p++;
-        else *is_end = 1;
-        
-        *csv_line = p;
-        return result;
     }
+    stats_phase_add(STATS_RECALC_EVALUATE, start);
+    return result;
 }
 
-// Save sheet to CSV file
-int sheet_save_csv(Sheet* sheet, const char* filename, int preserve_formulas) {
-    FILE* file;
-    if (fopen_s(&file, filename, "w") != 0) {
-        return 0;  // Failed to open file
+// Recalculate all formulas in the sheet
+LLResult sheet_recalculate(Sheet* sheet) {
+    return sheet_recalculate_step(sheet, 0);
+}
+
+LLResult sheet_recalculate_step(Sheet* sheet, int budget_ms) {
+    if (!sheet->calc_active) {
+        if (!sheet->needs_recalc) return LL_OK;
+        sheet->needs_recalc = 0;
+
+        if (recalc_begin(sheet) != LL_OK) return recalc_fail(sheet);
+    }
+    return recalc_continue(sheet, budget_ms);
+}
+
+// Re-evaluate the dirty cells' transitive dependents, each exactly once,
+// in topological order. Cells on (or fed by) a cycle get #CIRC!.
+LLResult sheet_recalculate_smart(Sheet* sheet) {
+    if (!sheet->calc_active && recalc_begin(sheet) != LL_OK) return recalc_fail(sheet);
+    return recalc_continue(sheet, 0);
+}
+
+int sheet_recalc_pending(const Sheet* sheet) {
+    return sheet->calc_active || sheet->needs_recalc;
+}
+
+int sheet_recalc_progress(const Sheet* sheet, int* done, int* total) {
+    *done = sheet->calc_active ? sheet->calc_count : 0;
+    *total = sheet->calc_active ? sheet->calc_affected_count : 0;
+    return sheet->calc_active;
+}
+
+int sheet_cell_is_stale(const Sheet* sheet, const Cell* cell) {
+    if (!cell || cell->type != CELL_FORMULA) return 0;
+    if (cell->is_dirty || sheet->calc_deferred) return 1;
+    return sheet->calc_active && cell->calc_pass == sheet->dep_graph.pass && cell->calc_pending >= 0;
+}
+
+// First cell at or after *row, *col in range that still waits on the
+// pass, scanning row by row; 0 once none is left
+static int range_next_stale(Sheet* sheet, const CellRange* range, int* row, int* col) {
+    for (; *row <= range->end_row; (*row)++, *col = range->start_col) {
+        for (; *col <= range->end_col; (*col)++) {
+            if (sheet_cell_is_stale(sheet, sheet_get_cell(sheet, *row, *col))) return 1;
+        }
     }
+    return 0;
+}
+
+LLResult sheet_recalculate_range(Sheet* sheet, const CellRange* range) {
+    if (!sheet_recalc_pending(sheet)) return LL_OK;
     
-    // Find the actual used range
-    int max_row = 0, max_col = 0;
-    for (int row = 0; row < sheet->rows; row++) {
-        for (int col = 0; col < sheet->cols; col++) {
-            Cell* cell = sheet_get_cell(sheet, row, col);
-            if (cell && cell->type != CELL_EMPTY) {
-                if (row > max_row) max_row = row;
-                if (col > max_col) max_col = col;
-            }
+    // The range goes to the front of the pass; cells found current stay
+    // current until it ends, so the scan never goes back
+    CellRange saved_focus = sheet->calc_focus;
+    int had_focus = sheet->calc_focus_set;
+    sheet_set_recalc_focus(sheet, range);
+    
+    LLResult result = LL_OK;
+    int row = range->start_row < 0 ? 0 : range->start_row;
+    int col = range->start_col < 0 ? 0 : range->start_col;
+    CellRange clipped = *range;
+    if (clipped.end_row >= sheet->rows) clipped.end_row = sheet->rows - 1;
+    if (clipped.end_col >= sheet->cols) clipped.end_col = sheet->cols - 1;
+    
+    while (sheet_recalc_pending(sheet)) {
+        result = sheet_recalculate_step(sheet, 1);
+        if (result != LL_IN_PROGRESS) break;
+        if (!range_next_stale(sheet, &clipped, &row, &col)) {
+            result = LL_OK;
+            break;
         }
     }
     
-    // Write data
-    for (int row = 0; row <= max_row; row++) {
-        for (int col = 0; col <= max_col; col++) {
-            Cell* cell = sheet_get_cell(sheet, row, col);
-            
-            if (col > 0) {
-                fprintf(file, ",");
-            }
-            
-            if (cell && cell->type != CELL_EMPTY) {
-                if (preserve_formulas && cell->type == CELL_FORMULA) {
-                    // Save the formula expression
-                    char* escaped = escape_csv_string(cell->data.formula.expression);
-                    if (escaped) {
-                        fprintf(file, "%s", escaped);
-                        free(escaped);
-                    }
-                } else {
-                    // Save the display value
-                    char* display_value = sheet_get_display_value(sheet, row, col);
-                    if (display_value && strlen(display_value) > 0) {
-                        char* escaped = escape_csv_string(display_value);
-                        if (escaped) {
-                            fprintf(file, "%s", escaped);
-                            free(escaped);
-                        }
-                    }
+    sheet_set_recalc_focus(sheet, had_focus ? &saved_focus : NULL);
+    return result;
+}
+
+void sheet_set_lazy_recalc(Sheet* sheet, int enabled) {
+    sheet->lazy_recalc = enabled ? 1 : 0;
+}
+
+void sheet_recalculate_loaded(Sheet* sheet) {
+    if (!sheet->lazy_recalc) {
+        sheet_recalculate(sheet);
+        return;
+    }
+    // The pass will evaluate every formula when the edges are rebuilt (see
+    // recalc_begin); otherwise only the dirty cells, already shown stale
+    sheet->needs_recalc = 1;
+    sheet->calc_deferred = sheet->dep_graph.needs_rebuild;
+}
+
+void sheet_set_recalc_focus(Sheet* sheet, const CellRange* range) {
+    if (!range) {
+        sheet->calc_focus_set = 0;
+        return;
+    }
+    if (sheet->calc_focus_set && memcmp(&sheet->calc_focus, range, sizeof(CellRange)) == 0) return;
+    sheet->calc_focus = *range;
+    sheet->calc_focus_set = 1;
+    if (!sheet->calc_active) return;
+
+    // Pull newly visible cells that are already waiting to the front
+    recalc_mark_focus(sheet);
+    unsigned int pass = sheet->dep_graph.pass;
+    for (int i = sheet->calc_ready_head; i < sheet->calc_ready_tail; i++) {
+        Cell* cell = sheet->calc_ready[i];
+        if (cell && cell->calc_focus_pass == pass) {
+            sheet->calc_urgent[sheet->calc_urgent_count++] = cell;
+            sheet->calc_ready[i] = NULL;
+        }
+    }
+}
+
+// Reserve room for `extra` more bytes of snapshot text
+static int snapshot_reserve(SheetSnapshot* snapshot, size_t extra) {
+    if (snapshot->text_length + extra <= snapshot->text_capacity) return 1;
+    
+    size_t new_capacity = snapshot->text_capacity ? snapshot->text_capacity * 2 : 4096;
+    while (new_capacity < snapshot->text_length + extra) new_capacity *= 2;
+    char* grown = (char*)realloc(snapshot->text, new_capacity);
+    if (!grown) return 0;
+    snapshot->text = grown;
+    snapshot->text_capacity = new_capacity;
+    return 1;
+}
+
+// Append a field to the snapshot text, quoted when it holds a comma, quote
+// or line break, with quotes doubled
+static int snapshot_append_field(SheetSnapshot* snapshot, const char* str) {
+    size_t length = 0;
+    int quotes = 0;
+    int needs_escape = 0;
+    
+    for (const char* p = str; *p; p++) {
+        if (*p == '"') {
+            quotes++;
+            needs_escape = 1;
+        } else if (*p == ',' || *p == '\n' || *p == '\r') {
+            needs_escape = 1;
+        }
+        length++;
+    }
+    
+    size_t escaped_length = needs_escape ? length + quotes + 2 : length;
+    if (!snapshot_reserve(snapshot, escaped_length)) return 0;
+    
+    char* dest = snapshot->text + snapshot->text_length;
+    if (!needs_escape) {
+        memcpy(dest, str, length);
+    } else {
+        *dest++ = '"';  // Opening quote
+        for (const char* s = str; *s; s++) {
+            if (*s == '"') *dest++ = '"';  // Double the quote
+            *dest++ = *s;
+        }
+        *dest = '"';  // Closing quote
+    }
+    
+    SnapshotField* field = &snapshot->fields[snapshot->field_count++];
+    field->offset = snapshot->text_length;
+    field->length = escaped_length;
+    snapshot->text_length += escaped_length;
+    return 1;
+}
+
+static int compare_snapshot_field(const void* a, const void* b) {
+    const SnapshotField* x = (const SnapshotField*)a;
+    const SnapshotField* y = (const SnapshotField*)b;
+    if (x->row != y->row) return x->row - y->row;
+    return x->col - y->col;
+}
+
+// Put fields in row-major order: bucket by row, then order each row by
+// column. Cells come out of the store mostly in column order already.
+static int snapshot_sort_fields(SheetSnapshot* snapshot) {
+    int rows = snapshot->max_row + 1;
+    int* row_start = (int*)calloc(rows + 1, sizeof(int));
+    SnapshotField* sorted = (SnapshotField*)malloc(snapshot->field_count * sizeof(SnapshotField));
+    if (!row_start || !sorted) {
+        free(row_start);
+        free(sorted);
+        return 0;
+    }
+    
+    for (int i = 0; i < snapshot->field_count; i++) {
+        row_start[snapshot->fields[i].row + 1]++;
+    }
+    for (int row = 0; row < rows; row++) {
+        row_start[row + 1] += row_start[row];
+    }
+    for (int i = 0; i < snapshot->field_count; i++) {
+        sorted[row_start[snapshot->fields[i].row]++] = snapshot->fields[i];
+    }
+    
+    // row_start[row] now marks the end of the row
+    int begin = 0;
+    for (int row = 0; row < rows; row++) {
+        int end = row_start[row];
+        if (end - begin > 32) {
+            qsort(sorted + begin, end - begin, sizeof(SnapshotField), compare_snapshot_field);
+        } else {
+            for (int i = begin + 1; i < end; i++) {
+                SnapshotField field = sorted[i];
+                int j = i;
+                while (j > begin && sorted[j - 1].col > field.col) {
+                    sorted[j] = sorted[j - 1];
+                    j--;
                 }
+                sorted[j] = field;
             }
         }
-        fprintf(file, "\n");
+        begin = end;
     }
     
-    fclose(file);
-    return 1;  // Success
+    free(row_start);
+    free(snapshot->fields);
+    snapshot->fields = sorted;
+    return 1;
 }
 
-// Load sheet from CSV file
-int sheet_load_csv(Sheet* sheet, const char* filename, int preserve_formulas) {
-    FILE* file;
-    if (fopen_s(&file, filename, "r") != 0) {
-        return 0;  // Failed to open file
+// Capture every field sheet_save_csv would write, already escaped, so the
+// file can be written later without touching the live sheet
+SheetSnapshot* sheet_snapshot_create(Sheet* sheet, int preserve_formulas) {
+    // Written values must not be stale
+    if (!preserve_formulas) {
+        sheet_recalculate(sheet);
     }
     
-    // Clear existing data
-    for (int row = 0; row < sheet->rows; row++) {
-        for (int col = 0; col < sheet->cols; col++) {
-            sheet_clear_cell(sheet, row, col);
+    SheetSnapshot* snapshot = (SheetSnapshot*)calloc(1, sizeof(SheetSnapshot));
+    if (!snapshot) return NULL;
+    
+    int capacity = sheet->cells->cell_count;
+    if (capacity > 0) {
+        snapshot->fields = (SnapshotField*)malloc(capacity * sizeof(SnapshotField));
+        if (!snapshot->fields) {
+            free(snapshot);
+            return NULL;
         }
     }
     
-    char line[4096];  // Buffer for reading lines
-    int row = 0;
+    // The used range covers every non-empty cell, even one displaying ""
+    snapshot->max_row = sheet->used_rows > 0 ? sheet->used_rows - 1 : 0;
+    snapshot->max_col = sheet->used_cols > 0 ? sheet->used_cols - 1 : 0;
     
-    while (fgets(line, sizeof(line), file) && row < sheet->rows) {
-        const char* line_ptr = line;
-        int col = 0;
-        int is_end = 0;
+    CellIterator it;
+    Cell* cell;
+    sheet_iter_begin(sheet, &it);
+    while ((cell = sheet_iter_next(&it)) != NULL) {
+        if (cell->type == CELL_EMPTY) continue;
         
-        while (!is_end && col < sheet->cols) {
-            char* field = parse_csv_field(&line_ptr, &is_end);
-            
-            if (field && strlen(field) > 0) {
-                // Determine what type of data this is
-                if (preserve_formulas && field[0] == '=') {
-                    // It's a formula
-                    sheet_set_formula(sheet, row, col, field);
-                } else {
-                    // Check if it's a number
-                    char* endptr;
-                    double num_value = strtod(field, &endptr);
-                    
-                    if (*endptr == '\0' || (*endptr == '\0' && endptr != field)) {
-                        // It's a valid number
-                        sheet_set_number(sheet, row, col, num_value);
-                    } else {
-                        // It's a string
-                        sheet_set_string(sheet, row, col, field);
-                    }
-                }
-                free(field);
-            }
-            
-            col++;
+        const char* text;
+        if (preserve_formulas && cell->type == CELL_FORMULA) {
+            text = cell->data.formula.expression;
+        } else {
+            text = cell_get_display_value(cell);
         }
+        if (!text || text[0] == '\0') continue;
         
-        row++;
+        snapshot->fields[snapshot->field_count].row = cell->row;
+        snapshot->fields[snapshot->field_count].col = cell->col;
+        if (!snapshot_append_field(snapshot, text)) {
+            sheet_snapshot_free(snapshot);
+            return NULL;
+        }
+    }
+    
+    if (snapshot->field_count > 0 && !snapshot_sort_fields(snapshot)) {
+        sheet_snapshot_free(snapshot);
+        return NULL;
+    }
+    return snapshot;
+}
+
+void sheet_snapshot_free(SheetSnapshot* snapshot) {
+    if (!snapshot) return;
+    
+    free(snapshot->fields);
+    free(snapshot->text);
+    free(snapshot);
+}
+
+// Output collected in a large block so the file sees few, big writes
+typedef struct {
+    FILE* file;
+    char* buffer;
+    size_t used;
+    int failed;
+} CsvWriter;
+
+static void csv_writer_flush(CsvWriter* writer) {
+    if (writer->used > 0 && fwrite(writer->buffer, 1, writer->used, writer->file) != writer->used) {
+        writer->failed = 1;
+    }
+    writer->used = 0;
+}
+
+static void csv_writer_put(CsvWriter* writer, const char* data, size_t length) {
+    if (writer->used + length > CSV_WRITE_BUFFER_SIZE) {
+        csv_writer_flush(writer);
+        if (length > CSV_WRITE_BUFFER_SIZE) {
+            if (fwrite(data, 1, length, writer->file) != length) writer->failed = 1;
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->used, data, length);
+    writer->used += length;
+}
+
+static void csv_writer_fill(CsvWriter* writer, char c, int count) {
+    while (count > 0) {
+        if (writer->used == CSV_WRITE_BUFFER_SIZE) csv_writer_flush(writer);
+        size_t run = CSV_WRITE_BUFFER_SIZE - writer->used;
+        if (run > (size_t)count) run = count;
+        memset(writer->buffer + writer->used, c, run);
+        writer->used += run;
+        count -= run;
+    }
+}
+
+// Safe to call from any thread: only reads the snapshot
+int sheet_snapshot_save_csv(const SheetSnapshot* snapshot, const char* filename) {
+    CsvWriter writer = { NULL, NULL, 0, 0 };
+    writer.buffer = (char*)malloc(CSV_WRITE_BUFFER_SIZE);
+    if (!writer.buffer) {
+        return 0;
+    }
+    if (fopen_s(&writer.file, filename, "w") != 0) {
+        free(writer.buffer);
+        return 0;  // Failed to open file
     }
     
-    fclose(file);
+    const SnapshotField* next = snapshot->fields;
+    const SnapshotField* end = snapshot->fields + snapshot->field_count;
     
-    // Recalculate if we loaded formulas
-    if (preserve_formulas) {
-        sheet_recalculate(sheet);
+    // Each row is its fields separated by max_col commas in total
+    for (int row = 0; row <= snapshot->max_row; row++) {
+        int col = 0;
+        while (next < end && next->row == row) {
+            csv_writer_fill(&writer, ',', next->col - col);
+            csv_writer_put(&writer, snapshot->text + next->offset, next->length);
+            col = next->col;
+            next++;
+        }
+        csv_writer_fill(&writer, ',', snapshot->max_col - col);
+        csv_writer_fill(&writer, '\n', 1);
+    }
+    csv_writer_flush(&writer);
+    
+    int result = !writer.failed && !ferror(writer.file);
+    if (fclose(writer.file) != 0) {
+        result = 0;
+    }
+    free(writer.buffer);
+    return result;
+}
+
+// Save sheet to CSV file
+int sheet_save_csv(Sheet* sheet, const char* filename, int preserve_formulas) {
+    // Values are written in place of formulas, so they must be current
+    if (!preserve_formulas) sheet_recalculate(sheet);
+    
+    long long start = stats_now();
+    SheetSnapshot* snapshot = sheet_snapshot_create(sheet, preserve_formulas);
+    if (!snapshot) {
+        return 0;
     }
+    stats_phase_add(STATS_CSV_SNAPSHOT, start);
     
-    return 1;  // Success
+    start = stats_now();
+    int result = sheet_snapshot_save_csv(snapshot, filename);
+    sheet_snapshot_free(snapshot);
+    stats_phase_add(STATS_CSV_WRITE, start);
+    return result;
 }
 
 // Demo: Create a simple spreadsheet with some data
@@ -1921,413 +3131,6 @@ void demo_spreadsheet() {
       sheet_free(sheet);
 }
 
-// Enhanced parse_function to support XLOOKUP and other functions
-double parse_function(Sheet* sheet, const char** expr, ErrorType* error) {
-    skip_whitespace(expr);
-    
-    // Extract function name
-    const char* start = *expr;
-    char func_name[32];
-    int i = 0;
-    
-    while (**expr && isalpha(**expr) && i < 31) {
-        func_name[i++] = toupper(**expr);
-        (*expr)++;
-    }
-    func_name[i] = '\0';
-    
-    skip_whitespace(expr);
-    if (**expr != '(') {
-        *error = ERROR_PARSE;
-        return 0.0;
-    }
-    (*expr)++; // Skip '('
-    
-    // Handle XLOOKUP function
-    if (strcmp(func_name, "XLOOKUP") == 0) {
-        // XLOOKUP(lookup_value, lookup_array, return_array, [match_mode])
-        skip_whitespace(expr);
-        
-        // Parse lookup value (can be number or string)
-        double lookup_value = 0.0;
-        char lookup_str[256] = {0};
-        int is_string_lookup = 0;
-        
-        if (**expr == '"') {
-            // Parse string literal
-            (*expr)++; // Skip opening quote
-            int j = 0;
-            while (**expr && **expr != '"' && j < 255) {
-                lookup_str[j++] = **expr;
-                (*expr)++;
-            }
-            if (**expr == '"') {
-                (*expr)++; // Skip closing quote
-                is_string_lookup = 1;
-            } else {
-                *error = ERROR_PARSE;
-                return 0.0;
-            }
-        } else {
-            // Parse as numeric expression
-            lookup_value = parse_arithmetic_expression(sheet, expr, error);
-            if (*error != ERROR_NONE) return 0.0;
-        }
-        
-        // Expect comma
-        skip_whitespace(expr);
-        if (**expr != ',') {
-            *error = ERROR_PARSE;
-            return 0.0;
-        }
-        (*expr)++;
-        
-        // Parse lookup_array range
-        skip_whitespace(expr);
-        char lookup_array[64];
-        int lookup_len = 0;
-        
-        while (**expr && **expr != ',' && lookup_len < 63) {
-            lookup_array[lookup_len++] = **expr;
-            (*expr)++;
-        }
-        lookup_array[lookup_len] = '\0';
-        
-        // Expect comma
-        skip_whitespace(expr);
-        if (**expr != ',') {
-            *error = ERROR_PARSE;
-            return 0.0;
-        }
-        (*expr)++;
-        
-        // Parse return_array range
-        skip_whitespace(expr);
-        char return_array[64];
-        int return_len = 0;
-        
-        while (**expr && **expr != ',' && **expr != ')' && return_len < 63) {
-            return_array[return_len++] = **expr;
-            (*expr)++;
-        }
-        return_array[return_len] = '\0';
-        
-        // Parse optional match_mode parameter (default is exact match)
-        int exact_match = 1; // Default to exact match
-        skip_whitespace(expr);
-        if (**expr == ',') {
-            (*expr)++;
-            skip_whitespace(expr);
-            double mode_f = parse_arithmetic_expression(sheet, expr, error);
-            if (*error != ERROR_NONE) return 0.0;
-            exact_match = (mode_f == 0.0) ? 1 : 0; // 0 = exact (default), 1 = approximate
-        }
-        
-        // Expect closing parenthesis
-        skip_whitespace(expr);
-        if (**expr != ')') {
-            *error = ERROR_PARSE;
-            return 0.0;
-        }
-        (*expr)++;
-        
-        // Call XLOOKUP function
-        return func_xlookup(sheet, lookup_value, is_string_lookup ? lookup_str : NULL,
-                           lookup_array, return_array, exact_match, error);
-    }
-    
-    // Handle other existing functions (simplified for basic functionality)
-    double values[MAX_RANGE_VALUES];
-    int value_count = 0;
-    
-    if (strcmp(func_name, "SUM") == 0 || strcmp(func_name, "AVG") == 0 || 
-        strcmp(func_name, "MAX") == 0 || strcmp(func_name, "MIN") == 0 ||
-        strcmp(func_name, "MEDIAN") == 0 || strcmp(func_name, "MODE") == 0) {
-        
-        // Parse range or single values
-        skip_whitespace(expr);
-        const char* arg_start = *expr;
-        
-        // Find the end of the argument (look for closing parenthesis)
-        int paren_count = 1;
-        const char* arg_end = *expr;
-        while (*arg_end && paren_count > 0) {
-            if (*arg_end == '(') paren_count++;
-            else if (*arg_end == ')') paren_count--;
-            if (paren_count > 0) arg_end++;
-        }
-        
-        // Extract the argument
-        int arg_len = (int)(arg_end - arg_start);
-        char arg[256];
-        if (arg_len >= sizeof(arg)) {
-            *error = ERROR_PARSE;
-            return 0.0;
-        }
-        
-        strncpy_s(arg, sizeof(arg), arg_start, arg_len);
-        arg[arg_len] = '\0';
-        
-        // Check if it's a range (contains ':')
-        if (strchr(arg, ':')) {
-            CellRange range;
-            if (parse_range(arg, &range)) {
-                value_count = get_range_values(sheet, &range, values, MAX_RANGE_VALUES);
-            } else {
-                *error = ERROR_PARSE;
-                return 0.0;
-            }
-        } else {
-            // Single cell reference or value
-            int row, col;
-            if (parse_cell_reference(arg, &row, &col)) {
-                Cell* cell = sheet_get_cell(sheet, row, col);
-                if (cell) {
-                    switch (cell->type) {
-                        case CELL_NUMBER:
-                            values[0] = cell->data.number;
-                            value_count = 1;
-                            break;
-                        case CELL_FORMULA:
-                            if (cell->data.formula.error == ERROR_NONE) {
-                                values[0] = cell->data.formula.cached_value;
-                                value_count = 1;
-                            }
-                            break;
-                        case CELL_EMPTY:
-                            values[0] = 0.0;
-                            value_count = 1;
-                            break;
-                        default:
-                            *error = ERROR_VALUE;
-                            return 0.0;
-                    }
-                } else {
-                    values[0] = 0.0;
-                    value_count = 1;
-                }
-            } else {
-                // Try to parse as number
-                char* endptr;
-                double val = strtod(arg, &endptr);
-                if (*endptr == '\0') {
-                    values[0] = val;
-                    value_count = 1;
-                } else {
-                    *error = ERROR_PARSE;
-                    return 0.0;
-                }
-            }
-        }
-        
-        *expr = arg_end + 1; // Skip closing ')'
-        
-        // Call appropriate function
-        if (strcmp(func_name, "SUM") == 0) {
-            return func_sum(values, value_count);
-        } else if (strcmp(func_name, "AVG") == 0) {
-            return func_avg(values, value_count);
-        } else if (strcmp(func_name, "MAX") == 0) {
-            return func_max(values, value_count);
-        } else if (strcmp(func_name, "MIN") == 0) {
-            return func_min(values, value_count);
-        } else if (strcmp(func_name, "MEDIAN") == 0) {
-            return func_median(values, value_count);
-        } else if (strcmp(func_name, "MODE") == 0) {
-            return func_mode(values, value_count);
-        }
-        
-    } else if (strcmp(func_name, "POWER") == 0) {
-        // POWER function: POWER(base, exponent)
-        skip_whitespace(expr);
-        
-        // Parse first argument (base)
-        double base = parse_arithmetic_expression(sheet, expr, error);
-        if (*error != ERROR_NONE) return 0.0;
-        
-        skip_whitespace(expr);
-        if (**expr != ',') {
-            *error = ERROR_PARSE;
-            return 0.0;
-        }
-        (*expr)++; // Skip comma
-        
-        // Parse second argument (exponent)  
-        double exponent = parse_arithmetic_expression(sheet, expr, error);
-        if (*error != ERROR_NONE) return 0.0;
-        
-        skip_whitespace(expr);
-        if (**expr != ')') {
-            *error = ERROR_PARSE;
-            return 0.0;
-        }
-        (*expr)++; // Skip closing parenthesis
-        
-        return func_power(base, exponent);
-    } else if (strcmp(func_name, "IF") == 0) {
-        // IF function: IF(condition, true_value, false_value)
-        skip_whitespace(expr);
-        
-        // Parse condition
-        double condition = evaluate_comparison(sheet, *expr, error);
-        if (*error != ERROR_NONE) return 0.0;
-        
-        // Find the comma after condition
-        int paren_depth = 0;
-        while (**expr) {
-            if (**expr == '(') paren_depth++;
-            else if (**expr == ')') paren_depth--;
-            else if (**expr == ',' && paren_depth == 0) break;
-            (*expr)++;
-        }
-        
-        if (**expr != ',') {
-            *error = ERROR_PARSE;
-            return 0.0;
-        }
-        (*expr)++; // Skip comma
-        
-        // Parse true value (can be string or number)
-        skip_whitespace(expr);
-        double true_val = 0.0;
-        char true_str[256] = {0};
-        int has_true_str = 0;
-        
-        if (**expr == '"') {
-            // String literal
-            (*expr)++; // Skip opening quote
-            int j = 0;
-            while (**expr && **expr != '"' && j < 255) {
-                if (**expr == '"' && *(*expr + 1) == '"') {
-                    // Escaped quote
-                    true_str[j++] = '"';
-                    (*expr) += 2;
-                } else {
-                    true_str[j++] = **expr;
-                    (*expr)++;
-                }
-            }
-            if (**expr == '"') {
-                (*expr)++; // Skip closing quote
-                true_str[j] = '\0';
-                has_true_str = 1;
-            } else {
-                *error = ERROR_PARSE;
-                return 0.0;
-            }
-        } else {
-            // Numeric expression - need to find the comma
-            const char* true_start = *expr;
-            paren_depth = 0;
-            while (**expr) {
-                if (**expr == '(') paren_depth++;
-                else if (**expr == ')') paren_depth--;
-                else if (**expr == ',' && paren_depth == 0) break;
-                (*expr)++;
-            }
-            
-            // Temporarily null-terminate and parse
-            char true_expr[256];
-            int true_len = (int)(*expr - true_start);
-            if (true_len >= sizeof(true_expr)) {
-                *error = ERROR_PARSE;
-                return 0.0;
-            }
-            // strncpy_s already handles truncation safely
-            strncpy_s(true_expr, sizeof(true_expr), true_start, (true_len < sizeof(true_expr) - 1) ? true_len : sizeof(true_expr) - 1);
-            true_expr[(true_len < sizeof(true_expr) - 1) ? true_len : sizeof(true_expr) - 1] = '\0';
-            
-            const char* true_ptr = true_expr;
-            true_val = parse_arithmetic_expression(sheet, &true_ptr, error);
-            if (*error != ERROR_NONE) return 0.0;
-        }
-        
-        // Expect comma
-        skip_whitespace(expr);
-        if (**expr != ',') {
-            *error = ERROR_PARSE;
-            return 0.0;
-        }
-        (*expr)++; // Skip comma
-        
-        // Parse false value (can be string or number)
-        skip_whitespace(expr);
-        double false_val = 0.0;
-        char false_str[256] = {0};
-        int has_false_str = 0;
-        
-        if (**expr == '"') {
-            // String literal
-            (*expr)++; // Skip opening quote
-            int j = 0;
-            while (**expr && **expr != '"' && j < 255) {
-                if (**expr == '"' && *(*expr + 1) == '"') {
-                    // Escaped quote
-                    false_str[j++] = '"';
-                    (*expr) += 2;
-                } else {
-                    false_str[j++] = **expr;
-                    (*expr)++;
-                }
-            }
-            if (**expr == '"') {
-                (*expr)++; // Skip closing quote
-                false_str[j] = '\0';
-                has_false_str = 1;
-            } else {
-                *error = ERROR_PARSE;
-                return 0.0;
-            }
-        } else {
-            // Numeric expression - need to find the closing paren
-            const char* false_start = *expr;
-            paren_depth = 0;
-            while (**expr) {
-                if (**expr == '(') paren_depth++;
-                else if (**expr == ')') {
-                    if (paren_depth == 0) break;
-                    paren_depth--;
-                }
-                (*expr)++;
-            }
-            
-            // Temporarily null-terminate and parse
-            char false_expr[256];
-            int false_len = (int)(*expr - false_start);
-            if (false_len >= sizeof(false_expr)) {
-                *error = ERROR_PARSE;
-                return 0.0;
-            }
-            // strncpy_s already handles truncation safely
-            strncpy_s(false_expr, sizeof(false_expr), false_start, (false_len < sizeof(false_expr) - 1) ? false_len : sizeof(false_expr) - 1);
-            false_expr[(false_len < sizeof(false_expr) - 1) ? false_len : sizeof(false_expr) - 1] = '\0';
-            
-            const char* false_ptr = false_expr;
-            false_val = parse_arithmetic_expression(sheet, &false_ptr, error);
-            if (*error != ERROR_NONE) return 0.0;
-        }
-        
-        // Expect closing parenthesis
-        skip_whitespace(expr);
-        if (**expr != ')') {
-            *error = ERROR_PARSE;
-            return 0.0;
-        }
-        (*expr)++; // Skip closing parenthesis
-        
-        // Call IF function
-        if (has_true_str || has_false_str) {
-            return func_if_enhanced(condition, true_val, false_val,
-                                   has_true_str ? true_str : NULL,
-                                   has_false_str ? false_str : NULL);
-        } else {
-            return func_if(condition, true_val, false_val);
-        }
-    }
-      *error = ERROR_PARSE;
-    return 0.0;
-}
-
 // Cell color formatting functions
 void cell_set_text_color(Cell* cell, int color) {
     if (cell) {
@@ -2436,28 +3239,336 @@ void sheet_resize_rows_in_range(Sheet* sheet, int start_row, int end_row, int de
     }
 }
 
+// Whether the shift drops a cell at this row or column
+static int shift_drops(const ReferenceShift* shift, int pos) {
+    return shift->delta < 0 ? pos == shift->at : pos + 1 >= shift->limit;
+}
+
+static int append_cell(Cell*** cells, int* count, int* capacity, Cell* cell) {
+    if (*count >= *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 64;
+        Cell** grown = (Cell**)realloc(*cells, new_capacity * sizeof(Cell*));
+        if (!grown) return 0;
+        *cells = grown;
+        *capacity = new_capacity;
+    }
+    (*cells)[(*count)++] = cell;
+    return 1;
+}
+
+// Drop every stale edge, listener and cross-sheet reader, so that none is left naming a cell
+// about to go back to the pool
+static void dependency_compact(Sheet* sheet) {
+    DependencyGraph* graph = &sheet->dep_graph;
+    CellIterator it;
+    Cell* cell;
+    sheet_iter_begin(sheet, &it);
+    while ((cell = sheet_iter_next(&it)) != NULL) {
+        int live = 0;
+        for (int i = 0; i < cell->dependents_count; i++) {
+            DependentEdge edge = cell->dependents[i];
+            if (edge.cell->dep_generation == edge.generation && edge.cell->type == CELL_FORMULA) {
+                cell->dependents[live++] = edge;
+            }
+        }
+        cell->dependents_count = live;
+    }
+
+    for (int col = 0; col < sheet->cols; col++) {
+        RangeListener* listeners = graph->column_listeners[col];
+        int live = 0;
+        for (int i = 0; i < graph->listener_count[col]; i++) {
+            if (listeners[i].cell->dep_generation == listeners[i].generation &&
+                listeners[i].cell->type == CELL_FORMULA) {
+                listeners[live++] = listeners[i];
+            }
+        }
+        graph->listener_count[col] = live;
+    }
+
+    int live = 0;
+    for (int i = 0; i < sheet->external_reader_count; i++) {
+        DependentEdge edge = sheet->external_readers[i];
+        if (edge.cell->dep_generation == edge.generation && edge.cell->type == CELL_FORMULA) {
+            sheet->external_readers[live++] = edge;
+        }
+    }
+    sheet->external_reader_count = live;
+}
+
+static void note_range_reference(void* context, const CellRange* range, int is_range) {
+    (void)range;
+    if (is_range) *(int*)context = 1;
+}
+
+// A reader whose text did not change may still have had cells move inside
+// one of its ranges: one clipped at the sheet's edge cannot grow or shrink.
+// first/last hold, per row (or column) across the shift, the span of
+// positions the moving cells started at.
+typedef struct {
+    const ReferenceShift* shift;
+    const int* first;
+    const int* last;
+    int across;             // Columns for a row shift, rows for a column shift
+    int hit;
+} ShiftedRangeCheck;
+
+static void note_shifted_range(void* context, const CellRange* range, int is_range) {
+    ShiftedRangeCheck* check = (ShiftedRangeCheck*)context;
+    if (!is_range || check->hit) return;
+
+    int by_row = check->shift->by_row;
+    int start = by_row ? range->start_col : range->start_row;
+    int end = by_row ? range->end_col : range->end_row;
+    int along_start = by_row ? range->start_row : range->start_col;
+    int along_end = by_row ? range->end_row : range->end_col;
+    if (start < 0) start = 0;
+    if (end >= check->across) end = check->across - 1;
+
+    // A cell one past either end moves into the range
+    for (int i = start; i <= end; i++) {
+        if (check->last[i] >= 0 && check->first[i] <= along_end + 1 && check->last[i] >= along_start - 1) {
+            check->hit = 1;
+            return;
+        }
+    }
+}
+
+// Keep the used-range counts in step with cells that moved or were dropped
+static void sheet_shift_used(Sheet* sheet, const ReferenceShift* shift) {
+    int* counts = shift->by_row ? sheet->row_used : sheet->col_used;
+    int* used = shift->by_row ? &sheet->used_rows : &sheet->used_cols;
+    int tail = shift->limit - shift->at - 1;
+
+    if (shift->delta > 0) {
+        memmove(counts + shift->at + 1, counts + shift->at, tail * sizeof(int));
+        counts[shift->at] = 0;
+        if (*used > shift->at && *used < shift->limit) (*used)++;
+    } else {
+        memmove(counts + shift->at, counts + shift->at + 1, tail * sizeof(int));
+        counts[shift->limit - 1] = 0;
+    }
+
+    while (sheet->used_rows > 0 && sheet->row_used[sheet->used_rows - 1] == 0) sheet->used_rows--;
+    while (sheet->used_cols > 0 && sheet->col_used[sheet->used_cols - 1] == 0) sheet->used_cols--;
+}
+
+// Insert (delta 1) or delete (delta -1) row or column `at`. Only the cells
+// from `at` on move, and only the formulas reading them are rewritten: the
+// dependency graph names those, and since its edges point at cells rather
+// than positions it stays valid without a rebuild.
+static void sheet_shift_cells(Sheet* sheet, int by_row, int at, int delta) {
+    DependencyGraph* graph = &sheet->dep_graph;
+    CellStore* store = sheet->cells;
+    ReferenceShift shift = { by_row, at, delta, by_row ? sheet->rows : sheet->cols };
+    Cell** moving = NULL;
+    int count = 0, capacity = 0;
+    Cell** readers = NULL;
+    int reader_count = 0, reader_capacity = 0;
+    int* moved_first = NULL;
+    int* moved_last = NULL;
+    int dropped_named = 0;
+
+    // Edits mid-pass are requeued before any cell can go away
+    recalc_cancel(sheet);
+    lookup_invalidate_all(sheet);
+    shared_range_invalidate_all(sheet);
+    sheet_touch_all_columns(sheet);
+
+    // Cells at or past `at`, found through the chunks that reach that far
+    for (int k = 0; k < store->chunk_count; k++) {
+        CellChunk* chunk = store->chunks[k];
+        int last = by_row ? (chunk->chunk_row + 1) * CELL_CHUNK_ROWS - 1
+                          : (chunk->chunk_col + 1) * CELL_CHUNK_COLS - 1;
+        if (last < at || chunk->count == 0) continue;
+
+        for (int slot = 0; slot < CELL_CHUNK_ROWS * CELL_CHUNK_COLS; slot++) {
+            Cell* cell = chunk->slots[slot];
+            if (!cell || (by_row ? cell->row : cell->col) < at) continue;
+            if (!append_cell(&moving, &count, &capacity, cell)) goto out_of_memory;
+        }
+    }
+
+    // Formulas whose references move: readers of those cells by edge, and
+    // every range reaching `at`
+    unsigned int mark = ++graph->pass;
+    if (graph->needs_rebuild) {
+        // No edges to go by; the rebuild that follows covers everything anyway
+        CellIterator it;
+        Cell* cell;
+        sheet_iter_begin(sheet, &it);
+        while ((cell = sheet_iter_next(&it)) != NULL) {
+            if (cell->type == CELL_FORMULA && !append_cell(&readers, &reader_count, &reader_capacity, cell)) {
+                goto out_of_memory;
+            }
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            Cell* cell = moving[i];
+            for (int j = 0; j < cell->dependents_count; j++) {
+                DependentEdge edge = cell->dependents[j];
+                if (edge.cell->dep_generation != edge.generation || edge.cell->type != CELL_FORMULA) continue;
+                if (edge.cell->calc_pass == mark) continue;
+                edge.cell->calc_pass = mark;
+                if (!append_cell(&readers, &reader_count, &reader_capacity, edge.cell)) goto out_of_memory;
+            }
+        }
+        for (int col = by_row ? 0 : at; col < sheet->cols; col++) {
+            for (int i = 0; i < graph->listener_count[col]; i++) {
+                RangeListener listener = graph->column_listeners[col][i];
+                if (listener.cell->dep_generation != listener.generation || listener.cell->type != CELL_FORMULA) continue;
+                if ((by_row && listener.end_row < at) || listener.cell->calc_pass == mark) continue;
+                listener.cell->calc_pass = mark;
+                if (!append_cell(&readers, &reader_count, &reader_capacity, listener.cell)) goto out_of_memory;
+            }
+        }
+    }
+
+    // Cells about to be dropped: clearing a formula turns whatever still
+    // names it stale, then those edges are swept out. A cell that stopped
+    // being a formula (its generation moved on) may still be named by stale
+    // edges and listeners too; its pool slot is about to be reused with the
+    // generation back at 0, where they would match again.
+    for (int i = 0; i < count; i++) {
+        Cell* cell = moving[i];
+        if (!shift_drops(&shift, by_row ? cell->row : cell->col)) continue;
+        if (cell->type != CELL_EMPTY) {
+            if (by_row) sheet->col_used[cell->col]--;
+            else sheet->row_used[cell->row]--;
+        }
+        if (cell->type == CELL_FORMULA || cell->dep_generation != 0) dropped_named = 1;
+        if (cell->type == CELL_FORMULA) {
+            dependency_detach(cell);
+            cell_clear(cell);
+        }
+    }
+    if (dropped_named) dependency_compact(sheet);
+
+    int live = 0;
+    for (int i = 0; i < reader_count; i++) {
+        if (readers[i]->type == CELL_FORMULA) readers[live++] = readers[i];
+    }
+    reader_count = live;
+
+    live = 0;
+    for (int i = 0; i < graph->dirty_count; i++) {
+        Cell* cell = graph->dirty[i];
+        if (shift_drops(&shift, by_row ? cell->row : cell->col)) {
+            cell->is_dirty = 0;
+            continue;
+        }
+        graph->dirty[live++] = cell;
+    }
+    graph->dirty_count = live;
+
+    // Where the moving cells started, for readers whose text stays the same
+    int across = by_row ? sheet->cols : sheet->rows;
+    if (reader_count > 0) {
+        moved_first = (int*)malloc(across * sizeof(int));
+        moved_last = (int*)malloc(across * sizeof(int));
+        if (!moved_first || !moved_last) goto out_of_memory;
+        for (int i = 0; i < across; i++) {
+            moved_first[i] = shift.limit;
+            moved_last[i] = -1;
+        }
+        for (int i = 0; i < count; i++) {
+            int pos = by_row ? moving[i]->row : moving[i]->col;
+            int other = by_row ? moving[i]->col : moving[i]->row;
+            if (pos < moved_first[other]) moved_first[other] = pos;
+            if (pos > moved_last[other]) moved_last[other] = pos;
+        }
+    }
+
+    // Take everything out first so moved cells never collide with unmoved ones
+    for (int i = 0; i < count; i++) {
+        cell_store_take(store, moving[i]->row, moving[i]->col);
+    }
+
+    for (int i = 0; i < count; i++) {
+        Cell* cell = moving[i];
+        int pos = by_row ? cell->row : cell->col;
+        if (shift_drops(&shift, pos)) {
+            sheet_release_cell(sheet, cell);
+            continue;
+        }
+
+        if (by_row) cell->row = pos + delta;
+        else cell->col = pos + delta;
+
+        if (!cell_store_put(store, cell->row, cell->col, cell)) {
+            // Nothing may keep pointing at it
+            sheet_invalidate_dependencies(sheet);
+            sheet_release_cell(sheet, cell);
+            continue;
+        }
+        sheet_store_value(sheet, cell);
+    }
+    sheet_shift_used(sheet, &shift);
+
+    // Rewrite the readers. One that still reads the same cells keeps its
+    // value and edges; only range listeners hold positions to redo. One
+    // whose text is unchanged is only evaluated again if cells moved within
+    // its ranges. The rest are set again like any other edit.
+    for (int i = 0; i < reader_count; i++) {
+        Cell* cell = readers[i];
+        char* expression;
+        int result = formula_shift_references(cell->data.formula.expression, &shift, &expression);
+        if (result < 0) goto out_of_memory;
+        if (result == 0) {
+            ShiftedRangeCheck check = { &shift, moved_first, moved_last, across, 0 };
+            if (cell->data.formula.compiled) {
+                formula_visit_references(cell->data.formula.compiled, note_shifted_range, &check);
+            } else {
+                check.hit = 1;
+            }
+            if (check.hit) sheet_mark_dirty(sheet, cell);
+            continue;
+        }
+
+        CompiledFormula* program = cell->data.formula.compiled;
+        if (result == FORMULA_SHIFT_MOVED && program) {
+            free(cell->data.formula.expression);
+            cell->data.formula.expression = expression;
+            formula_shift_program(program, &shift);
+
+            int has_range = 0;
+            formula_visit_references(program, note_range_reference, &has_range);
+            if (has_range) {
+                dependency_detach(cell);
+                dependency_attach(sheet, cell);
+            }
+        } else {
+            sheet_set_formula(sheet, cell->row, cell->col, expression);
+            free(expression);
+        }
+    }
+
+    free(moving);
+    free(readers);
+    free(moved_first);
+    free(moved_last);
+    sheet->needs_recalc = 1;
+    return;
+
+out_of_memory:
+    // Cells are still where they were (or already moved); edges are rebuilt
+    free(moving);
+    free(readers);
+    free(moved_first);
+    free(moved_last);
+    sheet_invalidate_dependencies(sheet);
+    sheet->needs_recalc = 1;
+}
+
 // Insert/Delete Row and Column functions
 void sheet_insert_row(Sheet* sheet, int row) {
     if (!sheet || row < 0 || row >= sheet->rows) return;
     
     // Shift all rows down from the insertion point
+    sheet_shift_cells(sheet, 1, row, 1);
     for (int r = sheet->rows - 1; r > row; r--) {
-        for (int c = 0; c < sheet->cols; c++) {
-            if (sheet->cells[r-1][c]) {
-                // Move cell from row r-1 to row r
-                sheet->cells[r][c] = sheet->cells[r-1][c];
-                sheet->cells[r][c]->row = r;
-                sheet->cells[r-1][c] = NULL;
-            }
-        }
-        // Move row height
         sheet->row_heights[r] = sheet->row_heights[r-1];
     }
-    
-    // Clear the inserted row and set default height
-    for (int c = 0; c < sheet->cols; c++) {
-        sheet->cells[row][c] = NULL;
-    }
     sheet->row_heights[row] = 1; // Default height
     
     // Mark sheet for recalculation
@@ -2468,23 +3579,10 @@ void sheet_insert_column(Sheet* sheet, int col) {
     if (!sheet || col < 0 || col >= sheet->cols) return;
     
     // Shift all columns right from the insertion point
+    sheet_shift_cells(sheet, 0, col, 1);
     for (int c = sheet->cols - 1; c > col; c--) {
-        for (int r = 0; r < sheet->rows; r++) {
-            if (sheet->cells[r][c-1]) {
-                // Move cell from column c-1 to column c
-                sheet->cells[r][c] = sheet->cells[r][c-1];
-                sheet->cells[r][c]->col = c;
-                sheet->cells[r][c-1] = NULL;
-            }
-        }
-        // Move column width
         sheet->col_widths[c] = sheet->col_widths[c-1];
     }
-    
-    // Clear the inserted column and set default width
-    for (int r = 0; r < sheet->rows; r++) {
-        sheet->cells[r][col] = NULL;
-    }
     sheet->col_widths[col] = DEFAULT_COLUMN_WIDTH;
     
     // Mark sheet for recalculation
@@ -2494,32 +3592,11 @@ void sheet_insert_column(Sheet* sheet, int col) {
 void sheet_delete_row(Sheet* sheet, int row) {
     if (!sheet || row < 0 || row >= sheet->rows) return;
     
-    // Clear and free all cells in the row to be deleted
-    for (int c = 0; c < sheet->cols; c++) {
-        if (sheet->cells[row][c]) {
-            cell_free(sheet->cells[row][c]);
-            sheet->cells[row][c] = NULL;
-        }
-    }
-    
-    // Shift all rows up from the deletion point
+    // Free the deleted row and shift the rows below it up
+    sheet_shift_cells(sheet, 1, row, -1);
     for (int r = row; r < sheet->rows - 1; r++) {
-        for (int c = 0; c < sheet->cols; c++) {
-            if (sheet->cells[r+1][c]) {
-                // Move cell from row r+1 to row r
-                sheet->cells[r][c] = sheet->cells[r+1][c];
-                sheet->cells[r][c]->row = r;
-                sheet->cells[r+1][c] = NULL;
-            }
-        }
-        // Move row height
         sheet->row_heights[r] = sheet->row_heights[r+1];
     }
-    
-    // Clear the last row and set default height
-    for (int c = 0; c < sheet->cols; c++) {
-        sheet->cells[sheet->rows - 1][c] = NULL;
-    }
     sheet->row_heights[sheet->rows - 1] = 1; // Default height
     
     // Mark sheet for recalculation
@@ -2529,32 +3606,11 @@ void sheet_delete_row(Sheet* sheet, int row) {
 void sheet_delete_column(Sheet* sheet, int col) {
     if (!sheet || col < 0 || col >= sheet->cols) return;
     
-    // Clear and free all cells in the column to be deleted
-    for (int r = 0; r < sheet->rows; r++) {
-        if (sheet->cells[r][col]) {
-            cell_free(sheet->cells[r][col]);
-            sheet->cells[r][col] = NULL;
-        }
-    }
-    
-    // Shift all columns left from the deletion point
+    // Free the deleted column and shift the columns after it left
+    sheet_shift_cells(sheet, 0, col, -1);
     for (int c = col; c < sheet->cols - 1; c++) {
-        for (int r = 0; r < sheet->rows; r++) {
-            if (sheet->cells[r][c+1]) {
-                // Move cell from column c+1 to column c
-                sheet->cells[r][c] = sheet->cells[r][c+1];
-                sheet->cells[r][c]->col = c;
-                sheet->cells[r][c+1] = NULL;
-            }
-        }
-        // Move column width
         sheet->col_widths[c] = sheet->col_widths[c+1];
     }
-    
-    // Clear the last column and set default width
-    for (int r = 0; r < sheet->rows; r++) {
-        sheet->cells[r][sheet->cols - 1] = NULL;
-    }
     sheet->col_widths[sheet->cols - 1] = DEFAULT_COLUMN_WIDTH;
     
     // Mark sheet for recalculation
@@ -9,6 +9,8 @@
 #include <ctype.h>
 #include <time.h>
 #include "constants.h"
+#include "cellstore.h"
+#include "pool.h"
 
 // Cell types
 typedef enum {
@@ -26,7 +28,8 @@ typedef enum {
     ERROR_REF,
     ERROR_VALUE,
     ERROR_PARSE,
-    ERROR_NA
+    ERROR_NA,
+    ERROR_CIRCULAR
 } ErrorType;
 
 // Data formatting types
@@ -58,6 +61,13 @@ typedef enum {
     DATETIME_STYLE_ISO        // 2023-12-25T14:30:45
 } FormatStyle;
 
+// Edge from a cell to a formula that reads it. The edge is stale once the
+// formula's dep_generation moves on (formula edited, cleared or replaced).
+typedef struct {
+    struct Cell* cell;
+    unsigned int generation;
+} DependentEdge;
+
 // Cell structure
 typedef struct Cell {
     CellType type;
@@ -70,6 +80,7 @@ typedef struct Cell {
             char* cached_string;    // For IF function string results
             int is_string_result;   // Flag indicating if result is a string
             ErrorType error;
+            struct CompiledFormula* compiled;  // Bytecode built once by cell_set_formula
         } formula;
     } data;
     
@@ -89,24 +100,65 @@ typedef struct Cell {
     // Size properties
     int row_height;         // Custom row height (-1 for default)
     
-    // Dependencies
+    // Formatted text of the numeric value, reused while the key matches
+    char* display;
+    size_t display_capacity;
+    double display_value;
+    DataFormat display_format;
+    FormatStyle display_style;
+    int display_precision;
+    int display_valid;
+    
+    // Dependencies (single-cell references; ranges live in Sheet.dep_graph)
     struct Cell** depends_on;    // Cells this cell depends on
     int depends_count;
-    struct Cell** dependents;    // Cells that depend on this cell
+    int depends_capacity;
+    DependentEdge* dependents;   // Cells that depend on this cell
     int dependents_count;
+    int dependents_capacity;
+    unsigned int dep_generation; // Bumped when this formula's edges are dropped
+    
+    // Recalculation bookkeeping
+    unsigned int calc_pass;      // Last recalculation pass that reached this cell
+    int calc_pending;            // Precedents still to be evaluated in that pass (-1 once done)
+    unsigned int calc_focus_pass; // Pass in which this cell feeds an on-screen cell
+    int is_dirty;                // Queued in dep_graph.dirty
+    long long eval_ticks;        // Evaluation time while profiling (stats.h)
     
     // Position (for dependency tracking)
     int row;
     int col;
+    
+    // Ownership
+    int is_pooled;               // Memory belongs to a sheet's cell_pool
+    int is_interned;             // data.string belongs to a sheet's string table
 } Cell;
 
+// Formula reading rows start_row..end_row of one column through a range
+typedef struct {
+    struct Cell* cell;
+    unsigned int generation;     // Matches cell->dep_generation while valid
+    int start_row, end_row;
+} RangeListener;
+
 // Dependency graph structure for optimized recalculation
 typedef struct {
-    int* in_degree;          // Number of dependencies for each cell
-    int** dependents;        // List of cells that depend on each cell
-    int* dependent_count;    // Count of dependents for each cell
+    RangeListener** column_listeners;  // Range references bucketed by column
+    int* listener_count;
+    int* listener_capacity;
+    struct Cell** dirty;               // Cells changed since the last recalculation
+    int dirty_count;
+    int dirty_capacity;
+    unsigned int pass;                 // Current recalculation pass number
+    int needs_rebuild;                 // Edges must be rebuilt from every formula
 } DependencyGraph;
 
+// Cell range used by formulas (start <= end after parse_range)
+typedef struct {
+    int start_row, start_col;
+    int end_row, end_col;
+} CellRange;
+
 // Range selection structure
 typedef struct {
     int start_row, start_col;
@@ -123,36 +175,163 @@ typedef struct {
 
 // Sheet structure
 typedef struct Sheet {
-    Cell*** cells;      // 2D array of cell pointers
+    CellStore* cells;   // Sparse storage; only populated cells are allocated
     int rows;
     int cols;
     int* col_widths;
     int* row_heights;   // Array of row heights
     char* name;
+    struct Workbook* workbook;  // Resolves Sheet!A1 references; NULL for a sheet on its own
     
     // Calculation state
     int needs_recalc;
-    Cell** calc_order;  // Topological sort of cells for calculation
+    Cell** calc_order;  // Cells evaluated by the current or last pass, in order
     int calc_count;
+    int calc_capacity;
     DependencyGraph dep_graph;  // Dependency tracking
     
+    // Pass started by sheet_recalculate_step and not finished yet
+    int calc_active;
+    Cell** calc_affected;       // Every cell the pass re-evaluates
+    int calc_affected_count;
+    int calc_affected_capacity;
+    Cell** calc_ready;          // Precedents done, FIFO (NULL = moved to calc_urgent)
+    int calc_ready_head;
+    int calc_ready_tail;
+    Cell** calc_urgent;         // Ready cells that feed the viewport, taken first
+    int calc_urgent_count;
+    int calc_queue_capacity;    // Of calc_ready and calc_urgent each
+    Cell** calc_scratch;        // Dependents of the cell being finished
+    int calc_scratch_capacity;
+    CellRange calc_focus;       // Cells on screen (see sheet_set_recalc_focus)
+    int calc_focus_set;
+    int lazy_recalc;            // Loads leave the pass to sheet_recalculate_step
+    int calc_deferred;          // Loaded lazily and no pass begun: every formula is stale
+    int has_circular;           // Some cell holds #CIRC!; formulas reading it get #CIRC! too
+    
+    // XLOOKUP indexes, one per distinct lookup range (see lookup.h)
+    struct LookupIndex** lookup_indexes;
+    int lookup_index_count;
+    int lookup_index_capacity;
+    int** lookup_columns;       // Positions in lookup_indexes, bucketed by column
+    int* lookup_column_count;
+    int* lookup_column_capacity;
+    int lookup_read_only;       // Set while formulas evaluate in parallel: indexes and memos are not built
+    
+    // Distinct ranges named by formulas, shared between them (see ranges.h)
+    struct SharedRange* shared_ranges;
+    int shared_range_count;
+    int shared_range_capacity;
+    int* shared_range_slots;    // Open-addressed hash of id + 1 (0 = empty)
+    int shared_range_slot_capacity;
+    int** memo_columns;         // Ids of memoized ranges, bucketed by column
+    int* memo_column_count;
+    int* memo_column_capacity;
+    
+    // Parallel recalculation of large dependency levels (see threadpool.h)
+    struct ThreadPool* recalc_pool;     // Started by the first level that needs it
+    int recalc_threads;                 // 0 = one per processor, 1 = calling thread only
+    
+    // Storage owned by the sheet and released in bulk by sheet_free
+    ObjectPool cell_pool;       // Slabs backing every cell in `cells`
+    StringTable strings;        // Interned text of string cells
+    StringTable* string_pool;   // Where new text is interned: strings, or the workbook's
+    
+    // Used range, kept current by every edit so saves never scan for it
+    int* row_used;              // Non-empty cells in each row
+    int* col_used;              // Non-empty cells in each column
+    int used_rows;              // One past the last non-empty row, 0 when empty
+    int used_cols;              // One past the last non-empty column
+    
+    // Bumped by every edit in the column and whenever a value in it
+    // changes, so views built from it (charts, readers on other sheets)
+    // can tell whether they are still current
+    unsigned int* column_versions;
+    unsigned int content_edits; // Bumped by every change to a cell's contents
+    
+    // Formulas reading other sheets, for the workbook to dirty when those
+    // change (see workbook.h)
+    DependentEdge* external_readers;
+    int external_reader_count;
+    int external_reader_capacity;
+    
     // Range operations
     RangeSelection selection;
     RangeClipboard range_clipboard;
 } Sheet;
 
+// One non-empty CSV field of a snapshot
+typedef struct {
+    int row;
+    int col;
+    size_t offset;      // CSV-escaped text in the snapshot's text buffer
+    size_t length;
+} SnapshotField;
+
+// Sheet contents frozen for saving
+typedef struct {
+    SnapshotField* fields;  // Row-major order
+    int field_count;
+    char* text;             // Every escaped field, back to back
+    size_t text_length;
+    size_t text_capacity;
+    int max_row;            // Used range written by the save
+    int max_col;
+} SheetSnapshot;
+
 // Function prototypes
 Sheet* sheet_new(int rows, int cols);
 void sheet_free(Sheet* sheet);
 Cell* sheet_get_cell(Sheet* sheet, int row, int col);
 Cell* sheet_get_or_create_cell(Sheet* sheet, int row, int col);
+
+// Visit every allocated cell (unspecified order, empty grid area is skipped)
+void sheet_iter_begin(Sheet* sheet, CellIterator* it);
+Cell* sheet_iter_next(CellIterator* it);
 void sheet_set_number(Sheet* sheet, int row, int col, double value);
 void sheet_set_string(Sheet* sheet, int row, int col, const char* str);
+// Content only: no dependency or recalculation bookkeeping (bulk loads)
+void sheet_assign_string(Sheet* sheet, Cell* cell, const char* str);
 void sheet_set_formula(Sheet* sheet, int row, int col, const char* formula);
 void sheet_clear_cell(Sheet* sheet, int row, int col);
 char* sheet_get_display_value(Sheet* sheet, int row, int col);
-void sheet_recalculate(Sheet* sheet);
-void sheet_recalculate_smart(Sheet* sheet);
+LLResult sheet_recalculate(Sheet* sheet);
+LLResult sheet_recalculate_smart(Sheet* sheet);
+// Recalculate for about budget_ms (0 = until done), resuming the pass the
+// last call left off. LL_IN_PROGRESS means cells are still stale; any edit
+// in between cancels the pass, and the next step redoes only what the
+// edit and the unfinished part affect.
+LLResult sheet_recalculate_step(Sheet* sheet, int budget_ms);
+int sheet_recalc_pending(const Sheet* sheet);
+// Cells evaluated and in total in the running pass; 0 when none is running
+int sheet_recalc_progress(const Sheet* sheet, int* done, int* total);
+// A formula whose value waits on the running pass or on an edit
+int sheet_cell_is_stale(const Sheet* sheet, const Cell* cell);
+// Cells evaluated before the rest of a pass: those inside range (NULL = none)
+// and what they read through single-cell references
+void sheet_set_recalc_focus(Sheet* sheet, const CellRange* range);
+// Bring every value in range, and what it reads, up to date now; the rest
+// of a pending pass is left for later steps
+LLResult sheet_recalculate_range(Sheet* sheet, const CellRange* range);
+// In lazy mode loading a file does not recalculate: formulas show as stale
+// and are evaluated by sheet_recalculate_step, on-screen ones first.
+void sheet_set_lazy_recalc(Sheet* sheet, int enabled);
+// Recalculate after a load, or in lazy mode leave it to the next steps
+void sheet_recalculate_loaded(Sheet* sheet);
+// Threads used for large recalculations, including the calling one.
+// 0 (the default) uses every processor; 1 keeps recalculation serial.
+void sheet_set_recalc_threads(Sheet* sheet, int threads);
+
+// Sum of the value versions of columns first..last: changes whenever a
+// value in them does
+unsigned long long sheet_columns_version(const Sheet* sheet, int first_col, int last_col);
+
+// Dependency tracking
+void sheet_mark_dirty(Sheet* sheet, Cell* cell);
+void sheet_invalidate_dependencies(Sheet* sheet);
+
+// Recount the used range from the occupied cells (after bulk changes)
+void sheet_recount_used_range(Sheet* sheet);
 
 // Copy/paste operations
 void sheet_copy_cell(Sheet* sheet, int src_row, int src_col, int dest_row, int dest_col);
@@ -161,7 +340,13 @@ void sheet_set_clipboard_cell(Cell* cell);
 
 // CSV operations
 int sheet_save_csv(Sheet* sheet, const char* filename, int preserve_formulas);
-int sheet_load_csv(Sheet* sheet, const char* filename, int preserve_formulas);
+int sheet_load_csv(Sheet* sheet, const char* filename, int preserve_formulas);  // csvload.c
+
+// Frozen copy of the fields a CSV save writes. Taking one only formats
+// cells; writing it never touches the sheet, so it may run on another thread.
+SheetSnapshot* sheet_snapshot_create(Sheet* sheet, int preserve_formulas);
+void sheet_snapshot_free(SheetSnapshot* snapshot);
+int sheet_snapshot_save_csv(const SheetSnapshot* snapshot, const char* filename);
 
 // Cell operations
 Cell* cell_new(int row, int col);
@@ -169,15 +354,60 @@ void cell_free(Cell* cell);
 void cell_set_number(Cell* cell, double value);
 void cell_set_string(Cell* cell, const char* str);
 void cell_set_formula(Cell* cell, const char* formula);
+void cell_set_formula_compiled(Cell* cell, const char* formula, struct CompiledFormula* program);
 void cell_clear(Cell* cell);
 char* cell_get_display_value(Cell* cell);
 
 // Formula evaluation
 double evaluate_formula(Sheet* sheet, const char* formula, ErrorType* error);
-double evaluate_expression(Sheet* sheet, const char* expr, ErrorType* error);
 double evaluate_comparison(Sheet* sheet, const char* expr, ErrorType* error);
 int parse_cell_reference(const char* ref, int* row, int* col);
 void cell_reference_to_string(int row, int col, char* buffer, size_t size);
+int parse_range(const char* range_str, CellRange* range);
+int get_range_values(Sheet* sheet, const CellRange* range, double* values, int max_values);
+
+// Range values in row-major order, delivered in batches of up to
+// RANGE_VALUE_BATCH. Empty cells read as 0; strings and errors are skipped.
+// Returns the number of values visited.
+typedef void (*RangeValueVisitor)(void* context, const double* values, int count);
+int sheet_visit_range_values(Sheet* sheet, const CellRange* range, RangeValueVisitor visit, void* context);
+
+// Rows start_row..end_row of one column as the store keeps them: count
+// values and CellValueKinds from row on, read in place. Both are NULL where
+// no cells exist, which reads as CELL_VALUE_EMPTY throughout.
+typedef void (*ColumnRunVisitor)(void* context, int row, const double* values, const unsigned char* kinds, int count);
+void sheet_visit_column(Sheet* sheet, int col, int start_row, int end_row, ColumnRunVisitor visit, void* context);
+// Copy of the same, into arrays of end_row - start_row + 1 entries
+void sheet_read_column(Sheet* sheet, int col, int start_row, int end_row, double* values, unsigned char* kinds);
+
+// Streaming SUM/AVG/MIN/MAX/COUNT state fed by sheet_visit_range_values
+typedef struct {
+    double sum;
+    double compensation;    // Neumaier correction, folded into sum when done
+    double min;
+    double max;
+    int count;
+} RangeAggregate;
+
+void range_aggregate_init(RangeAggregate* agg);
+void range_aggregate_add(void* agg, const double* values, int count);  // RangeValueVisitor
+void sheet_aggregate_range(Sheet* sheet, const CellRange* range, RangeAggregate* agg);
+
+// Formula functions (called by the bytecode evaluator in formula.c)
+double func_sum(const double* values, int count);
+double func_avg(const double* values, int count);
+double func_max(const double* values, int count);
+double func_min(const double* values, int count);
+double func_median(double* values, int count);
+double func_mode(const double* values, int count);
+double func_if(double condition, double true_val, double false_val);
+// target (may be NULL) receives the string result
+double func_if_enhanced(Cell* target, double condition, double true_val, double false_val,
+                       const char* true_str, const char* false_str);
+double func_power(double base, double exponent);
+double func_xlookup(Sheet* sheet, double lookup_value, const char* lookup_str,
+                   const CellRange* lookup_range, const CellRange* return_range,
+                   int exact_match, ErrorType* error);
 
 // Skip whitespace in expression
 void skip_whitespace(const char** expr);
@@ -187,18 +417,27 @@ void sheet_start_range_selection(Sheet* sheet, int row, int col);
 void sheet_extend_range_selection(Sheet* sheet, int row, int col);
 void sheet_copy_range(Sheet* sheet);
 void sheet_paste_range(Sheet* sheet, int start_row, int start_col);
+// Rows and columns of tab-separated text, as Excel puts on the clipboard
+void sheet_measure_text(const char* text, size_t length, int* rows, int* cols);
+// Paste tab-separated text with its top left at start_row, start_col. The
+// text is read where it lies and need not be terminated; each field is
+// taken like keyboard entry and an empty one clears its cell. Recalculation
+// is left to the caller. 0 if memory ran out part way.
+int sheet_paste_text(Sheet* sheet, int start_row, int start_col, const char* text, size_t length);
 void sheet_clear_range_selection(Sheet* sheet);
 int sheet_is_in_selection(Sheet* sheet, int row, int col);
 
 // Cell formatting functions
 void cell_set_format(Cell* cell, DataFormat format, FormatStyle style);
+// Returns text owned by the cell, valid until the cell is next changed
 char* format_cell_value(Cell* cell);
-char* format_number_as_percentage(double value, int precision);
-char* format_number_as_currency(double value);
-char* format_number_as_date(double value, FormatStyle style);
-char* format_number_as_time(double value, FormatStyle style);
-char* format_number_as_datetime(double value, FormatStyle date_style, FormatStyle time_style);
-char* format_number_as_enhanced_datetime(double value, FormatStyle style);
+// Caller provides buffer
+void format_number_as_percentage(char* buffer, size_t size, double value, int precision);
+void format_number_as_currency(char* buffer, size_t size, double value);
+void format_number_as_date(char* buffer, size_t size, double value, FormatStyle style);
+void format_number_as_time(char* buffer, size_t size, double value, FormatStyle style);
+void format_number_as_datetime(char* buffer, size_t size, double value, FormatStyle date_style, FormatStyle time_style);
+void format_number_as_enhanced_datetime(char* buffer, size_t size, double value, FormatStyle style);
 
 // Cell color formatting functions
 void cell_set_text_color(Cell* cell, int color);
@@ -0,0 +1,177 @@
+// stats.c - Counters and timers for finding out why a workbook is slow
+//
+// Recalculation, CSV and rendering add to one process-wide Stats block as
+// they run; :stats shows it and :stats dump writes it out with the formulas
+// that cost the most. Plain counters are cheap enough to keep on always.
+// Timing every function call and every formula is not, so that part only
+// runs while profiling is switched on.
+#include "stats.h"
+#include <stdio.h>
+#include <string.h>
+
+static Stats g_stats;
+static LARGE_INTEGER g_frequency;
+
+static const char* function_names[STATS_FUNC_COUNT] = {
+    "SUM", "AVG", "MAX", "MIN", "MEDIAN", "MODE", "XLOOKUP", "IF", "POWER"
+};
+
+static const char* phase_names[STATS_PHASE_COUNT] = {
+    "recalc find affected", "recalc evaluate",
+    "csv load read", "csv load parse", "csv load apply",
+    "csv save snapshot", "csv save write",
+    "render", "console flip"
+};
+
+Stats* stats_get(void) {
+    return &g_stats;
+}
+
+long long stats_now(void) {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+double stats_ms(long long ticks) {
+    if (g_frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&g_frequency);
+    }
+    return (double)ticks * 1000.0 / (double)g_frequency.QuadPart;
+}
+
+void stats_phase_add(StatsPhase phase, long long start) {
+    StatsTimer* timer = &g_stats.phases[phase];
+    long long elapsed = stats_now() - start;
+    timer->count++;
+    timer->ticks += elapsed;
+    timer->last_ticks = elapsed;
+}
+
+void stats_set_profiling(int enabled) {
+    g_stats.profiling = enabled ? 1 : 0;
+}
+
+int stats_profiling(void) {
+    return g_stats.profiling;
+}
+
+void stats_function_add(StatsFunction function, long long start) {
+    long long elapsed = stats_now() - start;
+    InterlockedExchangeAdd64(&g_stats.function_calls[function], 1);
+    InterlockedExchangeAdd64(&g_stats.function_ticks[function], elapsed);
+}
+
+const char* stats_function_name(StatsFunction function) {
+    if (function < 0 || function >= STATS_FUNC_COUNT) return "?";
+    return function_names[function];
+}
+
+void stats_reset(Sheet* sheet) {
+    int profiling = g_stats.profiling;
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.profiling = profiling;
+
+    if (sheet) {
+        CellIterator it;
+        Cell* cell;
+        sheet_iter_begin(sheet, &it);
+        while ((cell = sheet_iter_next(&it)) != NULL) {
+            cell->eval_ticks = 0;
+        }
+    }
+}
+
+int stats_top_formulas(Sheet* sheet, Cell** cells, int max) {
+    int count = 0;
+    CellIterator it;
+    Cell* cell;
+
+    // Insertion into a short sorted list; max is small
+    sheet_iter_begin(sheet, &it);
+    while ((cell = sheet_iter_next(&it)) != NULL) {
+        if (cell->type != CELL_FORMULA || cell->eval_ticks <= 0) continue;
+        if (count == max && cell->eval_ticks <= cells[count - 1]->eval_ticks) continue;
+
+        int pos = count < max ? count++ : max - 1;
+        while (pos > 0 && cells[pos - 1]->eval_ticks < cell->eval_ticks) {
+            cells[pos] = cells[pos - 1];
+            pos--;
+        }
+        cells[pos] = cell;
+    }
+    return count;
+}
+
+static double average_ms(const StatsTimer* timer) {
+    return timer->count > 0 ? stats_ms(timer->ticks) / (double)timer->count : 0.0;
+}
+
+void stats_format_summary(char* buffer, size_t size) {
+    const StatsTimer* begin = &g_stats.phases[STATS_RECALC_BEGIN];
+    const StatsTimer* evaluate = &g_stats.phases[STATS_RECALC_EVALUATE];
+
+    snprintf(buffer, size, "Recalc: %lld passes, %lld formulas, %.1f ms | Frame: %.2f ms avg | Profiling %s",
+             g_stats.recalc_passes, g_stats.formulas_evaluated,
+             stats_ms(begin->ticks + evaluate->ticks),
+             average_ms(&g_stats.phases[STATS_RENDER]) + average_ms(&g_stats.phases[STATS_FLIP]),
+             g_stats.profiling ? "on" : "off");
+}
+
+void stats_format_overlay(char* buffer, size_t size) {
+    snprintf(buffer, size, "frame %.1f+%.1f ms | recalc %.1f ms",
+             stats_ms(g_stats.phases[STATS_RENDER].last_ticks),
+             stats_ms(g_stats.phases[STATS_FLIP].last_ticks),
+             stats_ms(g_stats.phases[STATS_RECALC_BEGIN].last_ticks +
+                      g_stats.phases[STATS_RECALC_EVALUATE].last_ticks));
+}
+
+int stats_write_report(Sheet* sheet, const char* filename) {
+    FILE* file = NULL;
+    if (fopen_s(&file, filename, "w") != 0 || !file) {
+        return 0;
+    }
+
+    fprintf(file, "LiveLedger statistics\n\n");
+    fprintf(file, "Recalculation\n");
+    fprintf(file, "  passes              %lld\n", g_stats.recalc_passes);
+    fprintf(file, "  slices              %lld\n", g_stats.recalc_slices);
+    fprintf(file, "  batches             %lld (%lld parallel)\n", g_stats.recalc_batches, g_stats.recalc_parallel);
+    fprintf(file, "  formulas evaluated  %lld\n", g_stats.formulas_evaluated);
+    fprintf(file, "  cells touched       %lld\n", g_stats.cells_touched);
+
+    fprintf(file, "\nPhases                     runs     total ms      avg ms\n");
+    for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+        const StatsTimer* timer = &g_stats.phases[i];
+        fprintf(file, "  %-22s %8lld %12.2f %11.3f\n", phase_names[i], timer->count,
+                stats_ms(timer->ticks), average_ms(timer));
+    }
+
+    fprintf(file, "\nFunctions (profiling %s)     calls     total ms\n", g_stats.profiling ? "on" : "off");
+    for (int i = 0; i < STATS_FUNC_COUNT; i++) {
+        fprintf(file, "  %-22s %10lld %12.2f\n", function_names[i], (long long)g_stats.function_calls[i],
+                stats_ms(g_stats.function_ticks[i]));
+    }
+
+    if (sheet) {
+        Cell* top[STATS_TOP_FORMULAS];
+        int count = stats_top_formulas(sheet, top, STATS_TOP_FORMULAS);
+
+        fprintf(file, "\nMost expensive formulas (profiled time)\n");
+        if (count == 0) {
+            fprintf(file, "  none recorded; turn on :stats profile and recalculate\n");
+        }
+        for (int i = 0; i < count; i++) {
+            char ref[16];
+            cell_reference_to_string(top[i]->row, top[i]->col, ref, sizeof(ref));
+            fprintf(file, "  %2d. %-8s %10.3f ms  %s\n", i + 1, ref, stats_ms(top[i]->eval_ticks),
+                    top[i]->data.formula.expression ? top[i]->data.formula.expression : "");
+        }
+    }
+
+    int result = !ferror(file);
+    if (fclose(file) != 0) {
+        result = 0;
+    }
+    return result;
+}
@@ -0,0 +1,97 @@
+// stats.h - Counters and timers for finding out why a workbook is slow
+#ifndef STATS_H
+#define STATS_H
+
+#include <windows.h>
+#include "sheet.h"
+
+#define STATS_TOP_FORMULAS      10
+
+// Timed phases. Only the main thread times these.
+typedef enum {
+    STATS_RECALC_BEGIN,     // Finding what a recalculation pass must evaluate
+    STATS_RECALC_EVALUATE,  // Evaluating it
+    STATS_CSV_READ,         // Reading the file into memory
+    STATS_CSV_PARSE,        // Splitting and parsing fields on the worker threads
+    STATS_CSV_APPLY,        // Storing parsed fields into the sheet
+    STATS_CSV_SNAPSHOT,     // Copying the sheet out for saving
+    STATS_CSV_WRITE,        // Formatting and writing the file
+    STATS_RENDER,           // Drawing a frame into the back buffer
+    STATS_FLIP,             // Copying the back buffer to the console
+    STATS_PHASE_COUNT
+} StatsPhase;
+
+// Formula functions timed per call while profiling. The first six follow
+// FormulaFunction, so an aggregate's function code indexes them directly.
+typedef enum {
+    STATS_FUNC_SUM,
+    STATS_FUNC_AVG,
+    STATS_FUNC_MAX,
+    STATS_FUNC_MIN,
+    STATS_FUNC_MEDIAN,
+    STATS_FUNC_MODE,
+    STATS_FUNC_XLOOKUP,
+    STATS_FUNC_IF,
+    STATS_FUNC_POWER,
+    STATS_FUNC_COUNT
+} StatsFunction;
+
+typedef struct {
+    long long count;
+    long long ticks;        // Total, in QueryPerformanceCounter units
+    long long last_ticks;   // Most recent run
+} StatsTimer;
+
+typedef struct {
+    StatsTimer phases[STATS_PHASE_COUNT];
+
+    // Recalculation
+    long long recalc_passes;
+    long long recalc_slices;        // Calls that continued a pass (one per UI slice)
+    long long recalc_batches;       // Sets of ready cells evaluated together
+    long long recalc_parallel;      // Of those, run on the thread pool
+    long long formulas_evaluated;
+    long long cells_touched;        // Cells recalculation passes found affected
+
+    // Updated from recalculation workers, so only ever added to atomically
+    volatile LONG64 function_calls[STATS_FUNC_COUNT];
+    volatile LONG64 function_ticks[STATS_FUNC_COUNT];
+
+    int profiling;                  // Per-function and per-formula timing is on
+} Stats;
+
+// The process-wide counters. They are only cleared by stats_reset.
+Stats* stats_get(void);
+
+long long stats_now(void);
+double stats_ms(long long ticks);
+
+// Add the time since start (from stats_now) to a phase
+void stats_phase_add(StatsPhase phase, long long start);
+
+// Per-function and per-formula timing cost two clock reads per call, so it
+// is off unless asked for
+void stats_set_profiling(int enabled);
+int stats_profiling(void);
+
+// Safe to call from recalculation workers
+void stats_function_add(StatsFunction function, long long start);
+const char* stats_function_name(StatsFunction function);
+
+// Clear every counter, and the formula costs of the sheet if given
+void stats_reset(Sheet* sheet);
+
+// Formula cells with the highest evaluation cost, most expensive first.
+// Returns how many were written to cells (at most max).
+int stats_top_formulas(Sheet* sheet, Cell** cells, int max);
+
+// One-line summaries: totals for the :stats message, and the latest frame
+// and pass for the status bar overlay
+void stats_format_summary(char* buffer, size_t size);
+void stats_format_overlay(char* buffer, size_t size);
+
+// Write every counter, the per-function table and the top formulas to a
+// text file: 1 on success, 0 if it could not be written
+int stats_write_report(Sheet* sheet, const char* filename);
+
+#endif // STATS_H
@@ -1,5 +1,5 @@
 // test_liveledger.c - Comprehensive Unit Tests for LiveLedger
-// Compile with: cl /O2 /W3 /TC test_liveledger.c sheet.c console.c charts.c /Fe:test_liveledger.exe /link user32.lib
+// Compile with: cl /O2 /W3 /TC test_liveledger.c sheet.c formula.c cellstore.c pool.c reduce.c lookup.c autosave.c journal.c csvload.c llb.c threadpool.c undo.c ranges.c stats.c workbook.c console.c charts.c /Fe:test_liveledger.exe /link user32.lib
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,7 +10,19 @@
 
 // Include the headers
 #include "sheet.h"
+#include "formula.h"
+#include "reduce.h"
+#include "autosave.h"
+#include "journal.h"
+#include "undo.h"
+#include "ranges.h"
+#include "lookup.h"
+#include "stats.h"
+#include "workbook.h"
+#include "llb.h"
+#include "threadpool.h"
 #include "console.h"
+#include "charts.h"
 #include "constants.h"
 
 // Test framework macros
@@ -158,6 +170,143 @@ void test_sheet_get_or_create_cell(void) {
 // CELL OPERATIONS TESTS
 // ============================================================================
 
+void test_sparse_storage(void) {
+    TEST_SECTION("Sparse Cell Storage");
+    
+    // A huge grid costs nothing until cells are populated
+    Sheet* sheet = sheet_new(1000000, 16384);
+    TEST_ASSERT(sheet != NULL, "Million-row sheet should be created");
+    TEST_ASSERT_EQ_INT(0, sheet->cells->cell_count, "New sheet should hold no cells");
+    
+    sheet_set_number(sheet, 0, 0, 1.0);
+    sheet_set_number(sheet, 999999, 16383, 2.0);
+    sheet_set_formula(sheet, 500000, 100, "=A1+1");
+    sheet_recalculate(sheet);
+    
+    Cell* cell = sheet_get_cell(sheet, 999999, 16383);
+    TEST_ASSERT(cell != NULL, "Far corner cell should exist");
+    TEST_ASSERT_EQ_DOUBLE(2.0, cell->data.number, 0.0001, "Far corner should be 2");
+    TEST_ASSERT(sheet_get_cell(sheet, 999998, 16383) == NULL, "Neighbouring empty cell should not be allocated");
+    cell = sheet_get_cell(sheet, 500000, 100);
+    TEST_ASSERT_EQ_DOUBLE(2.0, cell->data.formula.cached_value, 0.0001, "Formula far from its input should evaluate");
+    
+    // Iteration only visits populated cells
+    CellIterator it;
+    int visited = 0;
+    sheet_iter_begin(sheet, &it);
+    while ((cell = sheet_iter_next(&it)) != NULL) {
+        TEST_ASSERT(sheet_get_cell(sheet, cell->row, cell->col) == cell, "Iterated cell should be stored at its position");
+        visited++;
+    }
+    TEST_ASSERT_EQ_INT(3, visited, "Iterator should visit exactly the populated cells");
+    
+    // Structural edits move only populated cells; the last row falls off
+    sheet_insert_row(sheet, 10);
+    TEST_ASSERT(sheet_get_cell(sheet, 999999, 16383) == NULL, "Cell pushed past the last row should be dropped");
+    cell = sheet_get_cell(sheet, 500001, 100);
+    TEST_ASSERT(cell != NULL && cell->row == 500001, "Formula should move down one row");
+    sheet_delete_column(sheet, 0);
+    TEST_ASSERT_EQ_INT(1, sheet->cells->cell_count, "Deleting column A should free A1");
+    cell = sheet_get_cell(sheet, 500001, 99);
+    TEST_ASSERT(cell != NULL && cell->col == 99, "Formula should move left one column");
+    
+    sheet_free(sheet);
+}
+
+void test_cell_pool_and_interning(void) {
+    TEST_SECTION("Cell Pool and String Interning");
+    
+    Sheet* sheet = sheet_new(100, 26);
+    
+    // Repeated labels share one interned copy
+    sheet_set_string(sheet, 0, 0, "Groceries");
+    sheet_set_string(sheet, 1, 0, "Groceries");
+    sheet_set_string(sheet, 2, 0, "Rent");
+    Cell* a1 = sheet_get_cell(sheet, 0, 0);
+    Cell* a2 = sheet_get_cell(sheet, 1, 0);
+    TEST_ASSERT(a1->is_pooled, "Sheet cells should come from the cell pool");
+    TEST_ASSERT(a1->is_interned, "Sheet strings should be interned");
+    TEST_ASSERT(a1->data.string == a2->data.string, "Equal labels should share storage");
+    TEST_ASSERT_EQ_INT(2, sheet->strings.entry_count, "Two distinct labels should be interned");
+    
+    // Clearing or overwriting one cell leaves the shared label intact
+    sheet_clear_cell(sheet, 0, 0);
+    TEST_ASSERT_EQ_STR("Groceries", a2->data.string, "Shared label should survive clearing another cell");
+    cell_set_string(a1, "Private");
+    TEST_ASSERT(!a1->is_interned, "cell_set_string should keep a private copy");
+    TEST_ASSERT_EQ_STR("Private", a1->data.string, "Private string should be stored");
+    
+    // Freed cells are reused by the pool
+    sheet_delete_row(sheet, 2);
+    int free_before = sheet->cell_pool.free_count;
+    TEST_ASSERT_EQ_INT(1, free_before, "Deleted cell should return to the pool");
+    sheet_set_number(sheet, 50, 5, 1.0);
+    TEST_ASSERT_EQ_INT(0, sheet->cell_pool.free_count, "New cell should reuse the released slot");
+    
+    sheet_free(sheet);
+}
+
+void test_columnar_values(void) {
+    TEST_SECTION("Columnar Cell Values");
+    
+    Sheet* sheet = sheet_new(1000, 26);
+    
+    // Values land in the store's per-column arrays as cells change
+    sheet_set_number(sheet, 0, 0, 5.0);
+    sheet_set_string(sheet, 1, 0, "label");
+    sheet_set_formula(sheet, 2, 0, "=A1*2");
+    sheet_set_formula(sheet, 3, 0, "=1/0");
+    sheet_recalculate(sheet);
+    
+    double values[6];
+    unsigned char kinds[6];
+    sheet_read_column(sheet, 0, 0, 5, values, kinds);
+    TEST_ASSERT_EQ_INT(CELL_VALUE_NUMBER, kinds[0], "Number should read as a number");
+    TEST_ASSERT_EQ_DOUBLE(5.0, values[0], 0.0, "Number value should be stored");
+    TEST_ASSERT_EQ_INT(CELL_VALUE_TEXT, kinds[1], "String should read as text");
+    TEST_ASSERT_EQ_INT(CELL_VALUE_NUMBER, kinds[2], "Evaluated formula should read as a number");
+    TEST_ASSERT_EQ_DOUBLE(10.0, values[2], 0.0, "Formula result should be stored");
+    TEST_ASSERT_EQ_INT(CELL_VALUE_ERROR, kinds[3], "Failed formula should read as an error");
+    TEST_ASSERT_EQ_INT(CELL_VALUE_EMPTY, kinds[4], "Missing cell should read as empty");
+    
+    sheet_set_number(sheet, 0, 0, 7.0);
+    sheet_recalculate(sheet);
+    sheet_clear_cell(sheet, 1, 0);
+    sheet_read_column(sheet, 0, 0, 2, values, kinds);
+    TEST_ASSERT_EQ_DOUBLE(14.0, values[2], 0.0, "Recalculated result should be stored");
+    TEST_ASSERT_EQ_INT(CELL_VALUE_EMPTY, kinds[1], "Cleared cell should read as empty");
+    
+    // Structural edits carry values with their cells
+    sheet_insert_row(sheet, 0);
+    sheet_read_column(sheet, 0, 0, 3, values, kinds);
+    TEST_ASSERT_EQ_INT(CELL_VALUE_EMPTY, kinds[0], "Inserted row should read as empty");
+    TEST_ASSERT_EQ_DOUBLE(7.0, values[1], 0.0, "Shifted number should keep its value");
+    TEST_ASSERT_EQ_DOUBLE(14.0, values[3], 0.0, "Shifted formula should keep its result");
+    
+    // Range functions read the arrays across chunk boundaries, skipping
+    // strings and errors as before
+    for (int row = 0; row < 300; row++) {
+        sheet_set_number(sheet, row, 1, row + 1);
+        sheet_set_number(sheet, row, 6, 1.0);
+    }
+    sheet_set_string(sheet, 100, 1, "skip");
+    sheet_set_formula(sheet, 0, 10, "=SUM(B1:B300)");
+    sheet_set_formula(sheet, 1, 10, "=AVG(B1:B300)");
+    sheet_set_formula(sheet, 2, 10, "=SUM(B1:G300)");
+    sheet_set_formula(sheet, 3, 10, "=MAX(B1:B2000)");
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_DOUBLE(45150.0 - 101.0, sheet_get_cell(sheet, 0, 10)->data.formula.cached_value, 0.0001,
+                          "Column SUM should skip the string");
+    TEST_ASSERT_EQ_DOUBLE((45150.0 - 101.0) / 299.0, sheet_get_cell(sheet, 1, 10)->data.formula.cached_value, 0.0001,
+                          "Column AVG should count only values");
+    TEST_ASSERT_EQ_DOUBLE(45150.0 - 101.0 + 300.0, sheet_get_cell(sheet, 2, 10)->data.formula.cached_value, 0.0001,
+                          "Multi-column SUM should read every column");
+    TEST_ASSERT_EQ_DOUBLE(300.0, sheet_get_cell(sheet, 3, 10)->data.formula.cached_value, 0.0001,
+                          "Range past the populated rows should read as zeros");
+    
+    sheet_free(sheet);
+}
+
 void test_cell_creation(void) {
     TEST_SECTION("Cell Creation");
     
@@ -622,6 +771,39 @@ void test_max_min_functions(void) {
     sheet_free(sheet);
 }
 
+void test_reduction_kernels(void) {
+    TEST_SECTION("Vectorized Reductions");
+    
+    double values[1003];
+    for (int i = 0; i < 1003; i++) {
+        values[i] = (i % 7) * 0.1 - (i % 3) * 1234.567;
+    }
+    values[500] = -99999.5;
+    values[777] = 88888.25;
+    
+    // Every kernel must produce bit-identical results
+    ReduceKernel best = reduce_active_kernel();
+    reduce_force_kernel(REDUCE_SCALAR);
+    double scalar_sum = reduce_sum(values, 1003);
+    double scalar_tail = reduce_sum(values, 7);
+    for (int k = REDUCE_SCALAR; k <= (int)best; k++) {
+        reduce_force_kernel((ReduceKernel)k);
+        TEST_ASSERT(reduce_sum(values, 1003) == scalar_sum, "Kernel SUM should match scalar exactly");
+        TEST_ASSERT(reduce_sum(values, 7) == scalar_tail, "Kernel SUM of a short array should match scalar");
+        TEST_ASSERT_EQ_DOUBLE(-99999.5, reduce_min(values, 1003), 0.0, "Kernel MIN should find the minimum");
+        TEST_ASSERT_EQ_DOUBLE(88888.25, reduce_max(values, 1003), 0.0, "Kernel MAX should find the maximum");
+        TEST_ASSERT_EQ_DOUBLE(0.0, reduce_sum(values, 0), 0.0, "SUM of nothing should be 0");
+    }
+    reduce_force_kernel(best);
+    
+    // Compensated summation keeps digits a naive loop loses
+    double cancel[6] = {1e16, 1.0, -1e16, 0.1, 0.1, 0.1};
+    TEST_ASSERT_EQ_DOUBLE(1.3, func_sum(cancel, 6), 1e-15, "SUM should survive catastrophic cancellation");
+    double tenths[10];
+    for (int i = 0; i < 10; i++) tenths[i] = 0.1;
+    TEST_ASSERT(func_sum(tenths, 10) == 1.0, "Ten 0.1s should sum to exactly 1");
+}
+
 void test_median_function(void) {
     TEST_SECTION("MEDIAN Function");
     
@@ -683,6 +865,41 @@ void test_mode_function(void) {
     sheet_free(sheet);
 }
 
+void test_mode_median_large(void) {
+    TEST_SECTION("MODE and MEDIAN on Large Inputs");
+    
+    double values[5000];
+    
+    // Ties go to the value that occurs first
+    for (int i = 0; i < 5000; i++) {
+        values[i] = (double)((i * 7919) % 1000);
+    }
+    TEST_ASSERT_EQ_DOUBLE(0.0, func_mode(values, 5000), 0.0001, "MODE tie should pick first occurrence");
+    values[4999] = 500.0;
+    values[4998] = 500.0;
+    TEST_ASSERT_EQ_DOUBLE(500.0, func_mode(values, 5000), 0.0001, "MODE should find the most frequent value");
+    
+    // Values within epsilon count as equal
+    for (int i = 0; i < 100; i++) {
+        values[i] = (i % 2) ? 3.0 + 1e-12 : 42.0 + (double)i;
+    }
+    TEST_ASSERT_EQ_DOUBLE(3.0, func_mode(values, 100), 0.0001, "MODE should match values within epsilon");
+    
+    // MEDIAN of a shuffled sequence, odd and even counts
+    for (int i = 0; i < 5000; i++) {
+        values[i] = (double)((i * 7) % 5000);
+    }
+    TEST_ASSERT_EQ_DOUBLE(2499.5, func_median(values, 5000), 0.0001, "MEDIAN of 0..4999 should be 2499.5");
+    for (int i = 0; i < 4999; i++) {
+        values[i] = (double)((i * 7) % 4999);
+    }
+    TEST_ASSERT_EQ_DOUBLE(2499.0, func_median(values, 4999), 0.0001, "MEDIAN of 0..4998 should be 2499");
+    for (int i = 0; i < 5000; i++) {
+        values[i] = (i < 2600) ? 1.0 : 2.0;
+    }
+    TEST_ASSERT_EQ_DOUBLE(1.0, func_median(values, 5000), 0.0001, "MEDIAN with heavy duplicates should be 1");
+}
+
 void test_if_function(void) {
     TEST_SECTION("IF Function");
     
@@ -827,6 +1044,362 @@ void test_xlookup_function(void) {
     sheet_free(sheet);
 }
 
+void test_xlookup_index(void) {
+    TEST_SECTION("XLOOKUP Shared Index");
+    
+    Sheet* sheet = sheet_new(3000, 26);
+    
+    // Rate table A1:B2000, read by many lookups
+    for (int i = 0; i < 2000; i++) {
+        char code[16];
+        sprintf_s(code, sizeof(code), "R%d", i);
+        sheet_set_string(sheet, i, 0, code);
+        sheet_set_number(sheet, i, 1, i * 1.5);
+        sheet_set_number(sheet, i, 2, (double)(i * 10));
+    }
+    for (int i = 0; i < 200; i++) {
+        char formula[64];
+        sprintf_s(formula, sizeof(formula), "=XLOOKUP(\"R%d\", A1:A2000, B1:B2000, 0)", i * 7);
+        sheet_set_formula(sheet, i, 4, formula);
+    }
+    sheet_set_formula(sheet, 0, 5, "=XLOOKUP(995, C1:C2000, B1:B2000, 1)");
+    sheet_set_formula(sheet, 1, 5, "=XLOOKUP(990, C1:C2000, B1:B2000, 0)");
+    sheet_recalculate(sheet);
+    
+    TEST_ASSERT_EQ_INT(2, sheet->lookup_index_count, "Lookups over one range should share an index");
+    Cell* cell = sheet_get_cell(sheet, 199, 4);
+    TEST_ASSERT_EQ_DOUBLE(1393 * 1.5, cell->data.formula.cached_value, 0.0001, "Indexed string lookup should find R1393");
+    cell = sheet_get_cell(sheet, 0, 5);
+    TEST_ASSERT_EQ_DOUBLE(99 * 1.5, cell->data.formula.cached_value, 0.0001, "Approximate lookup should take the largest value <= key");
+    cell = sheet_get_cell(sheet, 1, 5);
+    TEST_ASSERT_EQ_DOUBLE(99 * 1.5, cell->data.formula.cached_value, 0.0001, "Exact numeric lookup should match");
+    
+    // Editing the lookup range rebuilds the index on next use
+    sheet_set_string(sheet, 1393, 0, "moved");
+    sheet_set_string(sheet, 1999, 0, "R1393");
+    sheet_recalculate(sheet);
+    cell = sheet_get_cell(sheet, 199, 4);
+    TEST_ASSERT_EQ_DOUBLE(1999 * 1.5, cell->data.formula.cached_value, 0.0001, "Lookup should see the edited key");
+    
+    // Text in the return column is skipped in favour of the next match
+    sheet_set_string(sheet, 1999, 1, "n/a");
+    sheet_set_formula(sheet, 2, 5, "=XLOOKUP(990, C1:C2000, B1:B2000, 1)");
+    sheet_set_number(sheet, 1998, 2, 990);
+    sheet_set_number(sheet, 1999, 2, 990);
+    sheet_recalculate(sheet);
+    cell = sheet_get_cell(sheet, 2, 5);
+    TEST_ASSERT_EQ_DOUBLE(99 * 1.5, cell->data.formula.cached_value, 0.0001, "First match in position order should win");
+    cell = sheet_get_cell(sheet, 199, 4);
+    TEST_ASSERT_EQ_INT(ERROR_NA, cell->data.formula.error, "Only match with a text result should be #N/A");
+    
+    // A key recalculated to the same result leaves its index alone
+    sheet_set_number(sheet, 0, 6, 1);
+    sheet_set_formula(sheet, 1, 2, "=G1*0+10");
+    sheet_recalculate(sheet);
+    LookupIndex* numeric = NULL;
+    for (int i = 0; i < sheet->lookup_index_count; i++) {
+        if (sheet->lookup_indexes[i]->range.start_col == 2) numeric = sheet->lookup_indexes[i];
+    }
+    TEST_ASSERT(numeric && numeric->valid, "Numeric lookup index should be built");
+    sheet_set_number(sheet, 0, 6, 2);
+    sheet_recalculate(sheet);
+    TEST_ASSERT(numeric && numeric->valid, "Unchanged result should keep the index");
+    sheet_set_number(sheet, 0, 6, 3);
+    sheet_set_formula(sheet, 1, 2, "=G1*0+11");
+    sheet_set_formula(sheet, 3, 5, "=XLOOKUP(11, C1:C2000, B1:B2000, 0)");
+    sheet_recalculate(sheet);
+    TEST_ASSERT(numeric && numeric->valid, "Index should be rebuilt for the lookups after a new result");
+    TEST_ASSERT_EQ_DOUBLE(1.5, sheet_get_cell(sheet, 3, 5)->data.formula.cached_value, 0.0001, "Lookup should see the new result");
+    
+    sheet_free(sheet);
+}
+
+void test_shared_ranges(void) {
+    TEST_SECTION("Shared Range Descriptors");
+    
+    Sheet* sheet = sheet_new(100, 26);
+    for (int i = 0; i < 10; i++) {
+        sheet_set_number(sheet, i, 0, i + 1);
+    }
+    
+    // Formulas naming the same cells link to one descriptor
+    sheet_set_formula(sheet, 0, 2, "=SUM(A1:A10)");
+    sheet_set_formula(sheet, 1, 2, "=AVG(A1:A10)*2");
+    sheet_set_formula(sheet, 2, 2, "=MAX(A1:A5)");
+    sheet_recalculate(sheet);
+    
+    const FormulaInstr* sum = &sheet_get_cell(sheet, 0, 2)->data.formula.compiled->code[0];
+    const FormulaInstr* avg = &sheet_get_cell(sheet, 1, 2)->data.formula.compiled->code[0];
+    const FormulaInstr* max = &sheet_get_cell(sheet, 2, 2)->data.formula.compiled->code[0];
+    TEST_ASSERT(sum->index >= 0, "Range instruction should be linked");
+    TEST_ASSERT_EQ_INT(sum->index, avg->index, "Identical ranges should share a descriptor");
+    TEST_ASSERT(max->index != sum->index, "Different ranges should not share");
+    SharedRange* shared = shared_range_get(sheet, sum->index, &sum->u.range);
+    TEST_ASSERT(shared != NULL, "Linked id should resolve to its range");
+    TEST_ASSERT_EQ_INT(2, shared ? shared->users : 0, "Both formulas should be counted as users");
+    CellRange other = { 0, 0, 3, 0 };
+    TEST_ASSERT(shared_range_get(sheet, sum->index, &other) == NULL, "Id must not resolve for another range");
+    TEST_ASSERT_EQ_INT(-1, shared_range_find(sheet, &other), "Unnamed range should not be found");
+    
+    // A moved formula is linked to the descriptor of its new range
+    sheet_insert_row(sheet, 0);
+    sheet_recalculate(sheet);
+    sum = &sheet_get_cell(sheet, 1, 2)->data.formula.compiled->code[0];
+    TEST_ASSERT_EQ_INT(1, sum->u.range.start_row, "Range should move with its cells");
+    TEST_ASSERT(shared_range_get(sheet, sum->index, &sum->u.range) != NULL, "Moved range should be relinked");
+    TEST_ASSERT_EQ_DOUBLE(55.0, sheet_get_cell(sheet, 1, 2)->data.formula.cached_value, 0.0001,
+                          "Moved SUM should still evaluate");
+    
+    // XLOOKUP finds its index through the descriptor of its lookup range
+    sheet_set_formula(sheet, 5, 3, "=XLOOKUP(4, A2:A11, A2:A11, 0)");
+    sheet_set_formula(sheet, 6, 3, "=XLOOKUP(7, A2:A11, A2:A11, 0)");
+    sheet_recalculate(sheet);
+    CellRange table = { 1, 0, 10, 0 };
+    int id = shared_range_find(sheet, &table);
+    TEST_ASSERT(id >= 0 && sheet->shared_ranges[id].lookup != NULL, "Lookup range should hold its index");
+    TEST_ASSERT_EQ_INT(1, sheet->lookup_index_count, "Both lookups should share one index");
+    TEST_ASSERT_EQ_DOUBLE(7.0, sheet_get_cell(sheet, 6, 3)->data.formula.cached_value, 0.0001,
+                          "Lookup through the shared index should match");
+    
+    sheet_free(sheet);
+}
+
+void test_memoized_aggregates(void) {
+    TEST_SECTION("Memoized Range Aggregates");
+    
+    Sheet* sheet = sheet_new(300000, 26);
+    for (int i = 0; i < 200000; i++) {
+        sheet_set_number(sheet, i, 0, (i % 100) + 1);
+    }
+    sheet_set_formula(sheet, 0, 2, "=SUM(A1:A200000)");
+    sheet_set_formula(sheet, 1, 2, "=AVG(A1:A200000)");
+    sheet_set_formula(sheet, 2, 2, "=MAX(A1:A200000)");
+    sheet_set_formula(sheet, 3, 2, "=MIN(A1:A200000)");
+    sheet_set_formula(sheet, 4, 2, "=A1:A200000");
+    sheet_recalculate(sheet);
+    
+    Cell* sum = sheet_get_cell(sheet, 0, 2);
+    Cell* avg = sheet_get_cell(sheet, 1, 2);
+    Cell* max = sheet_get_cell(sheet, 2, 2);
+    Cell* min = sheet_get_cell(sheet, 3, 2);
+    TEST_ASSERT_EQ_DOUBLE(10100000.0, sum->data.formula.cached_value, 0.0001, "SUM should cover the range");
+    TEST_ASSERT_EQ_DOUBLE(50.5, avg->data.formula.cached_value, 0.0001, "AVG should cover the range");
+    TEST_ASSERT_EQ_DOUBLE(10100000.0, sheet_get_cell(sheet, 4, 2)->data.formula.cached_value, 0.0001,
+                          "Bare range should share the SUM memo");
+    
+    const FormulaInstr* instr = &sum->data.formula.compiled->code[0];
+    SharedRange* shared = shared_range_get(sheet, instr->index, &instr->u.range);
+    TEST_ASSERT(shared && shared->memo_valid, "Range should be memoized");
+    TEST_ASSERT_EQ_INT(5, shared ? shared->users : 0, "All five formulas should share the range");
+    
+    // One edit is applied to the memo as a delta
+    sheet_set_number(sheet, 5050, 0, 1001.0);
+    sheet_recalculate(sheet);
+    TEST_ASSERT(shared->memo_valid && shared->memo_updates == 1, "Edit should update the memo in place");
+    TEST_ASSERT_EQ_DOUBLE(10100000.0 + 950.0, sum->data.formula.cached_value, 0.0001, "SUM should apply the delta");
+    TEST_ASSERT_EQ_DOUBLE(1001.0, max->data.formula.cached_value, 0.0001, "New maximum should be taken");
+    
+    // Removing the extreme forces MIN/MAX, and only them, to rescan
+    sheet_set_number(sheet, 5050, 0, 51.0);
+    TEST_ASSERT(!shared->extremes_valid, "Removing the maximum should drop the extremes");
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_DOUBLE(100.0, max->data.formula.cached_value, 0.0001, "MAX should be recomputed");
+    TEST_ASSERT_EQ_DOUBLE(1.0, min->data.formula.cached_value, 0.0001, "MIN should be unchanged");
+    TEST_ASSERT_EQ_DOUBLE(10100000.0, sum->data.formula.cached_value, 0.0001, "SUM should return to the start");
+    
+    // Text and errors leave the count; infinities force a rescan
+    sheet_set_string(sheet, 0, 0, "text");
+    sheet_set_formula(sheet, 1, 0, "=1/0");
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_DOUBLE((10100000.0 - 3.0) / 199998.0, avg->data.formula.cached_value, 1e-9,
+                          "AVG should count only values");
+    sheet_set_number(sheet, 2, 0, INFINITY);
+    sheet_recalculate(sheet);
+    TEST_ASSERT(!isfinite(sum->data.formula.cached_value), "Infinite input should carry into SUM");
+    sheet_set_number(sheet, 2, 0, 3.0);
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_DOUBLE(10100000.0 - 3.0, sum->data.formula.cached_value, 0.0001, "SUM should recover from infinity");
+    
+    // Formulas evaluated in parallel and structural edits invalidate memos
+    sheet_set_recalc_threads(sheet, 4);
+    sheet_set_number(sheet, 0, 5, 2.0);
+    for (int i = 0; i < 2000; i++) {
+        char formula[32];
+        sprintf_s(formula, sizeof(formula), "=F1*%d", i);
+        sheet_set_formula(sheet, i, 6, formula);
+    }
+    sheet_set_formula(sheet, 0, 7, "=SUM(G1:G2000)");
+    sheet_recalculate(sheet);
+    sheet_set_number(sheet, 0, 5, 3.0);
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_DOUBLE(3.0 * 1999000.0, sheet_get_cell(sheet, 0, 7)->data.formula.cached_value, 0.0001,
+                          "SUM over parallel results should see every new value");
+    sheet_insert_row(sheet, 0);
+    sheet_set_number(sheet, 0, 0, 1000.0);
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_DOUBLE(10100000.0 - 3.0, sheet_get_cell(sheet, 1, 2)->data.formula.cached_value, 0.0001,
+                          "Shifted SUM should skip the inserted row");
+    
+    sheet_free(sheet);
+}
+
+void test_stats_counters(void) {
+    TEST_SECTION("Recalculation Statistics");
+    
+    Sheet* sheet = sheet_new(60000, 26);
+    for (int i = 0; i < 50000; i++) {
+        sheet_set_number(sheet, i, 0, (i * 7) % 1000);
+    }
+    for (int i = 0; i < 20; i++) {
+        char formula[32];
+        sprintf_s(formula, sizeof(formula), "=A%d*2", i + 1);
+        sheet_set_formula(sheet, i, 1, formula);
+    }
+    sheet_set_formula(sheet, 5, 2, "=MEDIAN(A1:A50000)");
+    sheet_recalculate(sheet);
+    
+    // Counters only cover work done after a reset
+    stats_reset(sheet);
+    stats_set_profiling(1);
+    sheet_set_number(sheet, 0, 0, 999.0);
+    sheet_recalculate(sheet);
+    
+    Stats* stats = stats_get();
+    TEST_ASSERT_EQ_INT(1, (int)stats->recalc_passes, "One edit should run one pass");
+    TEST_ASSERT_EQ_INT(2, (int)stats->formulas_evaluated, "Pass should evaluate B1 and the MEDIAN");
+    TEST_ASSERT_EQ_INT(2, (int)stats->cells_touched, "Pass should touch only the readers of A1");
+    TEST_ASSERT_EQ_INT(1, (int)stats->function_calls[STATS_FUNC_MEDIAN], "MEDIAN should be timed once");
+    TEST_ASSERT_EQ_INT(0, (int)stats->function_calls[STATS_FUNC_SUM], "Untouched functions should stay at zero");
+    TEST_ASSERT(stats->phases[STATS_RECALC_EVALUATE].count >= 1, "Evaluation should be timed");
+    
+    // The MEDIAN over 50,000 cells dominates the ranking
+    sheet_invalidate_dependencies(sheet);
+    sheet_recalculate_smart(sheet);
+    Cell* top[STATS_TOP_FORMULAS];
+    int count = stats_top_formulas(sheet, top, STATS_TOP_FORMULAS);
+    TEST_ASSERT_EQ_INT(STATS_TOP_FORMULAS, count, "Ranking should be cut at ten formulas");
+    TEST_ASSERT(count > 0 && top[0] == sheet_get_cell(sheet, 5, 2), "MEDIAN should cost the most");
+    int ordered = 1;
+    for (int i = 1; i < count; i++) {
+        if (top[i]->eval_ticks > top[i - 1]->eval_ticks) ordered = 0;
+    }
+    TEST_ASSERT(ordered, "Ranking should be most expensive first");
+    
+    const char* filename = "test_stats_report.txt";
+    TEST_ASSERT(stats_write_report(sheet, filename), "Report should be written");
+    remove(filename);
+    
+    // Without profiling no per-formula cost is recorded
+    stats_set_profiling(0);
+    stats_reset(sheet);
+    sheet_set_number(sheet, 0, 0, 1.0);
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_INT(0, stats_top_formulas(sheet, top, STATS_TOP_FORMULAS), "Costs need profiling");
+    TEST_ASSERT_EQ_INT(2, (int)stats->formulas_evaluated, "Counters should run without profiling");
+    
+    sheet_free(sheet);
+}
+
+void test_chart_extraction(void) {
+    TEST_SECTION("Chart Data Extraction");
+    
+    Sheet* sheet = sheet_new(600000, 26);
+    sheet_set_string(sheet, 0, 0, "Month");
+    sheet_set_string(sheet, 0, 1, "Sales");
+    sheet_set_string(sheet, 1, 0, "Jan");
+    sheet_set_number(sheet, 1, 1, 10.0);
+    sheet_set_string(sheet, 2, 0, "Feb");
+    sheet_set_string(sheet, 2, 1, "n/a");
+    sheet_set_string(sheet, 3, 0, "Mar");
+    sheet_set_formula(sheet, 3, 1, "=B2*3");
+    sheet_recalculate(sheet);
+    
+    // Categories keep every point; labels point at the cell text
+    RangeSelection range = { 0, 0, 3, 1, 1 };
+    Chart* chart = chart_create(CHART_BAR, "Month", "Sales");
+    TEST_ASSERT(chart_add_data_from_range(chart, sheet, &range), "Bar data should be extracted");
+    TEST_ASSERT_EQ_INT(1, chart->series_count, "One Y column should give one series");
+    const char* name = chart->series[0].name;
+    TEST_ASSERT_EQ_STR("Sales", name, "Header should name the series");
+    TEST_ASSERT_EQ_INT(2, chart->series[0].count, "Text values should be skipped");
+    TEST_ASSERT(chart->series[0].points[1].label == sheet_get_cell(sheet, 3, 0)->data.string,
+                "Label should refer to the cell text");
+    TEST_ASSERT_EQ_DOUBLE(30.0, chart->series[0].points[1].y, 0.0001, "Formula result should be plotted");
+    TEST_ASSERT_EQ_DOUBLE(1.0, chart->series[0].points[1].x, 0.0001, "Text X should plot at its index");
+    
+    // Rendered once, then reused until a value in the range's columns changes
+    TEST_ASSERT(chart_refresh(chart, sheet) && chart->cells, "Chart should render on first refresh");
+    TEST_ASSERT(chart_matches(chart, sheet, &range, CHART_BAR, "Month", "Sales",
+                              DEFAULT_CHART_WIDTH + 20, DEFAULT_CHART_HEIGHT), "Same layout should match");
+    TEST_ASSERT(!chart_matches(chart, sheet, &range, CHART_LINE, "Month", "Sales",
+                               DEFAULT_CHART_WIDTH + 20, DEFAULT_CHART_HEIGHT), "Other type should not match");
+    chart->cells[0].Char.AsciiChar = '!';
+    sheet_set_number(sheet, 1, 5, 7.0);
+    chart_refresh(chart, sheet);
+    TEST_ASSERT(chart->cells[0].Char.AsciiChar == '!', "Edit outside the range should keep the render");
+    sheet_set_number(sheet, 1, 1, 20.0);
+    sheet_recalculate(sheet);
+    TEST_ASSERT(chart_refresh(chart, sheet), "Changed chart should refresh");
+    TEST_ASSERT(chart->cells[0].Char.AsciiChar != '!', "Edit inside the range should render again");
+    TEST_ASSERT_EQ_DOUBLE(60.0, chart->series[0].points[1].y, 0.0001, "Refresh should read the new values");
+    
+    // Relabelling changes no value, but the chart still has to follow it
+    chart->cells[0].Char.AsciiChar = '!';
+    sheet_set_string(sheet, 3, 0, "March");
+    TEST_ASSERT(chart_refresh(chart, sheet), "Relabelled chart should refresh");
+    TEST_ASSERT(chart->cells[0].Char.AsciiChar != '!', "Label edit should render again");
+    TEST_ASSERT_EQ_STR("March", chart->series[0].points[1].label, "Refresh should read the new label");
+    
+    // Blitted straight into the back buffer, clipped to the screen
+    Console console;
+    memset(&console, 0, sizeof(console));
+    console.width = 40;
+    console.height = 10;
+    console.backBuffer = (CHAR_INFO*)calloc(console.width * console.height, sizeof(CHAR_INFO));
+    chart_blit(chart, &console, 2, 1, 100, 100);
+    TEST_ASSERT(console.backBuffer[1 * 40 + 2].Attributes == chart->cells[0].Attributes &&
+                console.backBuffer[9 * 40 + 39].Char.AsciiChar == chart->cells[8 * chart->canvas_width + 37].Char.AsciiChar,
+                "Blit should copy the rendered cells");
+    TEST_ASSERT(console.backBuffer[0].Attributes == 0, "Blit should leave cells outside the chart alone");
+    free(console.backBuffer);
+    chart_free(chart);
+    
+    // A long line series is reduced to two points per plot column, and the
+    // spike inside it survives
+    for (int row = 0; row < 500000; row++) {
+        sheet_set_number(sheet, row, 3, row);
+        sheet_set_number(sheet, row, 4, row % 10);
+    }
+    sheet_set_number(sheet, 250000, 4, 1000000.0);
+    RangeSelection long_range = { 0, 3, 499999, 4, 1 };
+    chart = chart_create_sized(CHART_LINE, "Row", "Value", 100, 30);
+    TEST_ASSERT(chart_add_data_from_range(chart, sheet, &long_range), "Line data should be extracted");
+    int count = chart->series[0].count;
+    TEST_ASSERT(count > 100 && count <= 200, "Series should be reduced to the plot width");
+    int has_spike = 0, ordered = 1;
+    for (int i = 0; i < count; i++) {
+        if (chart->series[0].points[i].y == 1000000.0) has_spike = 1;
+        if (i > 0 && chart->series[0].points[i].x <= chart->series[0].points[i - 1].x) ordered = 0;
+    }
+    TEST_ASSERT(has_spike, "Extremes should be kept");
+    TEST_ASSERT(ordered, "Kept points should stay in row order");
+    TEST_ASSERT(chart->x_max >= 499999.0 && chart->x_min <= 0.0, "Bounds should cover every row");
+    chart_render(chart);
+    chart_free(chart);
+    
+    // Scatter X values jump around between rows, so every point is kept
+    for (int row = 0; row < 1000; row++) {
+        sheet_set_number(sheet, row, 3, (row * 37) % 1000);
+    }
+    RangeSelection scatter_range = { 0, 3, 999, 4, 1 };
+    chart = chart_create_sized(CHART_SCATTER, "X", "Y", 100, 30);
+    TEST_ASSERT(chart_add_data_from_range(chart, sheet, &scatter_range), "Scatter data should be extracted");
+    TEST_ASSERT_EQ_INT(1000, chart->series[0].count, "Scatter points should not be reduced");
+    chart_free(chart);
+    
+    sheet_free(sheet);
+}
+
 void test_nested_functions(void) {
     TEST_SECTION("Nested Functions");
     
@@ -851,6 +1424,58 @@ void test_nested_functions(void) {
     sheet_free(sheet);
 }
 
+void test_compiled_formulas(void) {
+    TEST_SECTION("Compiled Formulas");
+    
+    Sheet* sheet = sheet_new(100, 26);
+    
+    // Formula is compiled once when set
+    sheet_set_number(sheet, 0, 0, 4.0);   // A1
+    sheet_set_formula(sheet, 0, 1, "=A1*2+SUM(A1:A3)");  // B1
+    Cell* cell = sheet_get_cell(sheet, 0, 1);
+    TEST_ASSERT(cell->data.formula.compiled != NULL, "Formula should be compiled when set");
+    
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_DOUBLE(12.0, cell->data.formula.cached_value, 0.0001, "Compiled formula should evaluate to 12");
+    
+    // Same program is reused when inputs change
+    CompiledFormula* program = cell->data.formula.compiled;
+    sheet_set_number(sheet, 0, 0, 10.0);
+    sheet_recalculate(sheet);
+    TEST_ASSERT(cell->data.formula.compiled == program, "Recalc should reuse the compiled program");
+    TEST_ASSERT_EQ_DOUBLE(30.0, cell->data.formula.cached_value, 0.0001, "Recompute with new input should be 30");
+    
+    // Syntax errors compile to a program that reports ERROR_PARSE
+    sheet_set_formula(sheet, 1, 1, "=SUM(A1:A3");
+    cell = sheet_get_cell(sheet, 1, 1);
+    TEST_ASSERT(cell->data.formula.compiled != NULL, "Invalid formula should still compile");
+    sheet_set_formula(sheet, 2, 1, "=FOO(1)");
+    sheet_recalculate(sheet);
+    cell = sheet_get_cell(sheet, 2, 1);
+    TEST_ASSERT_EQ_INT(ERROR_PARSE, cell->data.formula.error, "Unknown function should be ERROR_PARSE");
+    
+    // Runtime errors before a syntax error win, as with the text parser
+    sheet_set_string(sheet, 3, 0, "text");  // A4
+    ErrorType error;
+    evaluate_formula(sheet, "=A4+", &error);
+    TEST_ASSERT_EQ_INT(ERROR_VALUE, error, "String operand should be reported before the syntax error");
+    
+    // Programs can be compiled and run directly
+    program = formula_compile("=IF(A1>5, POWER(2, 3), 1)");
+    TEST_ASSERT(program != NULL, "formula_compile should return a program");
+    double value = formula_evaluate(sheet, program, &error);
+    TEST_ASSERT_EQ_INT(ERROR_NONE, error, "Compiled IF should not error");
+    TEST_ASSERT_EQ_DOUBLE(8.0, value, 0.0001, "Compiled IF should return POWER branch");
+    formula_free(program);
+    
+    // Overwriting the formula releases the program
+    sheet_set_number(sheet, 0, 1, 1.0);
+    cell = sheet_get_cell(sheet, 0, 1);
+    TEST_ASSERT_EQ_INT(CELL_NUMBER, cell->type, "B1 should now be a number");
+    
+    sheet_free(sheet);
+}
+
 // ============================================================================
 // FORMATTING TESTS
 // ============================================================================
@@ -979,6 +1604,54 @@ void test_time_formats(void) {
     sheet_free(sheet);
 }
 
+void test_display_cache(void) {
+    TEST_SECTION("Display String Cache");
+    
+    Sheet* sheet = sheet_new(100, 26);
+    sheet_set_number(sheet, 0, 0, 1234.5);
+    sheet_set_number(sheet, 0, 1, 0.25);
+    Cell* cell = sheet_get_cell(sheet, 0, 0);
+    Cell* other = sheet_get_cell(sheet, 0, 1);
+    cell_set_format(other, FORMAT_PERCENTAGE, 0);
+    
+    // Each cell owns its text, so two results can be held at once
+    char* first = format_cell_value(cell);
+    char* second = format_cell_value(other);
+    TEST_ASSERT_EQ_STR("1234.5", first, "First display should survive formatting another cell");
+    TEST_ASSERT_EQ_STR("25.00%", second, "Second display should be formatted");
+    TEST_ASSERT(format_cell_value(cell) == first, "Unchanged cell should return the same text");
+    
+    // Changing the format, style, precision or value refreshes the text
+    cell_set_format(cell, FORMAT_CURRENCY, 0);
+    TEST_ASSERT_EQ_STR("$1234.50", format_cell_value(cell), "Format change should refresh the text");
+    cell_set_format(cell, FORMAT_DATE, DATE_STYLE_YYYY_MM_DD);
+    char date[64];
+    strcpy_s(date, sizeof(date), format_cell_value(cell));
+    cell->format_style = DATE_STYLE_MM_DD_YYYY;
+    TEST_ASSERT(strchr(date, '-') != NULL && strchr(format_cell_value(cell), '/') != NULL,
+                "Style change should refresh the text");
+    other->precision = 1;
+    TEST_ASSERT_EQ_STR("25.0%", format_cell_value(other), "Precision change should refresh the text");
+    sheet_set_number(sheet, 0, 1, 0.5);
+    TEST_ASSERT_EQ_STR("50.0%", format_cell_value(other), "Value change should refresh the text");
+    
+    // Formula results are keyed on the cached value
+    sheet_set_formula(sheet, 1, 0, "=B1*10");
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_STR("5", sheet_get_display_value(sheet, 1, 0), "Formula display should show its result");
+    sheet_set_number(sheet, 0, 1, 0.7);
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_STR("7", sheet_get_display_value(sheet, 1, 0), "Recalculated formula should refresh the text");
+    
+    // Clearing and refilling with an equal value still shows the right type
+    sheet_set_string(sheet, 0, 1, "text");
+    TEST_ASSERT_EQ_STR("text", format_cell_value(other), "String contents should not use the number cache");
+    sheet_set_number(sheet, 0, 1, 0.7);
+    TEST_ASSERT_EQ_STR("70.0%", format_cell_value(other), "Number should be formatted again after a string");
+    
+    sheet_free(sheet);
+}
+
 void test_cell_colors(void) {
     TEST_SECTION("Cell Colors");
     
@@ -1068,6 +1741,94 @@ void test_range_selection(void) {
     sheet_free(sheet);
 }
 
+void test_paste_text(void) {
+    TEST_SECTION("Clipboard Text Paste");
+    
+    // Excel's layout: tabs between fields, \r\n after every row, quotes
+    // around cells holding line breaks; the text is not terminated
+    const char text[] = "1\tName\t=A10*2\r\n\"two\nlines\"\t\"say \"\"hi\"\"\"\t\r\n3.5\r\nNOT PASTED";
+    size_t length = sizeof(text) - 1 - strlen("NOT PASTED");
+    int rows = 0, cols = 0;
+    sheet_measure_text(text, length, &rows, &cols);
+    TEST_ASSERT_EQ_INT(3, rows, "Pasted text rows");
+    TEST_ASSERT_EQ_INT(3, cols, "Pasted text columns");
+    
+    Sheet* sheet = sheet_new(100, 26);
+    sheet_set_number(sheet, 10, 2, 99);
+    TEST_ASSERT(sheet_paste_text(sheet, 9, 0, text, length), "Text should paste");
+    TEST_ASSERT_EQ_DOUBLE(1.0, sheet_get_cell(sheet, 9, 0)->data.number, 0.0001, "Number field");
+    TEST_ASSERT_EQ_STR("Name", sheet_get_cell(sheet, 9, 1)->data.string, "Text field");
+    TEST_ASSERT_EQ_INT(CELL_FORMULA, sheet_get_cell(sheet, 9, 2)->type, "Formula field");
+    TEST_ASSERT_EQ_STR("two\nlines", sheet_get_cell(sheet, 10, 0)->data.string, "Quoted line break");
+    TEST_ASSERT_EQ_STR("say \"hi\"", sheet_get_cell(sheet, 10, 1)->data.string, "Doubled quotes");
+    Cell* cleared = sheet_get_cell(sheet, 10, 2);
+    TEST_ASSERT(!cleared || cleared->type == CELL_EMPTY, "Empty field should clear its cell");
+    TEST_ASSERT_EQ_DOUBLE(3.5, sheet_get_cell(sheet, 11, 0)->data.number, 0.0001, "Last row without its trailing text");
+    TEST_ASSERT(sheet_recalc_pending(sheet), "Paste should leave one recalculation pending");
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_DOUBLE(2.0, sheet_get_cell(sheet, 9, 2)->data.formula.cached_value, 0.0001, "Pasted formula value");
+    
+    // Fields past the sheet edge are dropped
+    TEST_ASSERT(sheet_paste_text(sheet, 99, 25, "7\t8\n9", 5), "Paste at the edge should succeed");
+    TEST_ASSERT_EQ_DOUBLE(7.0, sheet_get_cell(sheet, 99, 25)->data.number, 0.0001, "Corner field");
+    
+    // A large paste is a single undo step
+    const int paste_rows = 2000;
+    char* block = (char*)malloc(paste_rows * 16);
+    size_t used = 0;
+    for (int i = 0; i < paste_rows; i++) {
+        used += sprintf_s(block + used, paste_rows * 16 - used, "%d\t%d\r\n", i, i * 2);
+    }
+    UndoHistory history;
+    undo_history_init(&history, 64 * 1024 * 1024, NULL);
+    sheet_measure_text(block, used, &rows, &cols);
+    undo_begin(&history, sheet, "Paste from clipboard", 0);
+    undo_note_range(&history, sheet, 20, 3, 20 + rows - 1, 3 + cols - 1);
+    TEST_ASSERT(sheet_paste_text(sheet, 20, 3, block, used), "Block should paste");
+    TEST_ASSERT(undo_commit(&history, sheet), "Block paste should be undoable");
+    Cell* bottom = sheet_get_cell(sheet, 99, 4);
+    TEST_ASSERT_EQ_DOUBLE(2.0 * 79, bottom ? bottom->data.number : -1.0, 0.0001, "Block should stop at the last row");
+    TEST_ASSERT(undo_undo(&history, sheet) != NULL, "Block paste should undo");
+    Cell* undone = sheet_get_cell(sheet, 20, 3);
+    TEST_ASSERT(!undone || undone->type == CELL_EMPTY, "Undo should restore the whole block in one step");
+    TEST_ASSERT(undo_undo(&history, sheet) == NULL, "Only one record for the block");
+    
+    undo_history_free(&history);
+    free(block);
+    sheet_free(sheet);
+    
+    // Covering most of the sheet, the paste writes cells directly and has
+    // the graph rebuilt; formulas inside and outside it still follow
+    Sheet* bulk = sheet_new(300, 26);
+    sheet_set_formula(bulk, 0, 25, "=SUM(A1:A100)+B100");
+    sheet_set_formula(bulk, 250, 0, "=A1");
+    sheet_recalculate(bulk);
+    size_t capacity = 200 * 25 * 8;
+    block = (char*)malloc(capacity);
+    used = 0;
+    for (int row = 0; row < 200; row++) {
+        for (int col = 0; col < 25; col++) {
+            if (col == 1) used += sprintf_s(block + used, capacity - used, "=A%d*2", row + 1);
+            else if (col == 2) used += sprintf_s(block + used, capacity - used, "r%d", row);
+            else used += sprintf_s(block + used, capacity - used, "%d", row);
+            used += sprintf_s(block + used, capacity - used, col < 24 ? "\t" : "\r\n");
+        }
+    }
+    TEST_ASSERT(sheet_paste_text(bulk, 0, 0, block, used), "Bulk paste should succeed");
+    TEST_ASSERT(bulk->dep_graph.needs_rebuild, "Large paste should rebuild the graph");
+    TEST_ASSERT_EQ_STR("r7", sheet_get_cell(bulk, 7, 2)->data.string, "Bulk text field");
+    sheet_recalculate(bulk);
+    TEST_ASSERT_EQ_DOUBLE(198.0, sheet_get_cell(bulk, 99, 1)->data.formula.cached_value, 0.0001, "Pasted formula");
+    TEST_ASSERT_EQ_DOUBLE(4950.0 + 198.0, sheet_get_cell(bulk, 0, 25)->data.formula.cached_value, 0.0001,
+                          "Formula reading the paste");
+    sheet_set_number(bulk, 0, 0, 1000);
+    sheet_recalculate(bulk);
+    TEST_ASSERT_EQ_DOUBLE(1000.0, sheet_get_cell(bulk, 250, 0)->data.formula.cached_value, 0.0001,
+                          "Edges should be back after the paste");
+    free(block);
+    sheet_free(bulk);
+}
+
 void test_range_copy_paste(void) {
     TEST_SECTION("Range Copy/Paste");
     
@@ -1336,6 +2097,140 @@ void test_delete_column(void) {
     sheet_free(sheet);
 }
 
+void test_structural_reference_shift(void) {
+    TEST_SECTION("References Follow Inserted and Deleted Rows/Columns");
+    
+    Sheet* sheet = sheet_new(100, 26);
+    for (int row = 0; row < 5; row++) {
+        sheet_set_number(sheet, row, 0, row + 1);                // A1:A5 = 1..5
+    }
+    sheet_set_formula(sheet, 0, 3, "=A3*10");                   // D1
+    sheet_set_formula(sheet, 0, 4, "=SUM(A1:A5)");              // E1
+    sheet_set_formula(sheet, 4, 5, "=A1+A5");                   // F5
+    sheet_set_formula(sheet, 0, 6, "=IF(A1>0,\"A5\",\"no\")");  // G1
+    sheet_recalculate(sheet);
+    
+    // Insert: references past the new row follow their cells, ranges grow
+    sheet_insert_row(sheet, 1);
+    TEST_ASSERT_EQ_STR("=A4*10", sheet_get_cell(sheet, 0, 3)->data.formula.expression, "Reference below the insert should move");
+    TEST_ASSERT_EQ_STR("=SUM(A1:A6)", sheet_get_cell(sheet, 0, 4)->data.formula.expression, "Range spanning the insert should grow");
+    TEST_ASSERT_EQ_STR("=A1+A6", sheet_get_cell(sheet, 5, 5)->data.formula.expression, "Moved formula should keep its targets");
+    TEST_ASSERT_EQ_STR("=IF(A1>0,\"A5\",\"no\")", sheet_get_cell(sheet, 0, 6)->data.formula.expression, "String literals should be left alone");
+    TEST_ASSERT(!sheet->dep_graph.needs_rebuild, "Insert should not force a dependency rebuild");
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_DOUBLE(30.0, sheet_get_cell(sheet, 0, 3)->data.formula.cached_value, 0.0001, "D1 after insert");
+    TEST_ASSERT_EQ_DOUBLE(15.0, sheet_get_cell(sheet, 0, 4)->data.formula.cached_value, 0.0001, "E1 after insert");
+    TEST_ASSERT_EQ_DOUBLE(6.0, sheet_get_cell(sheet, 5, 5)->data.formula.cached_value, 0.0001, "F6 after insert");
+    
+    // The edges moved with the cells: an edit reaches just its readers
+    sheet_set_number(sheet, 5, 0, 50);
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_INT(2, sheet->calc_count, "Only the readers of the moved input should recalculate");
+    TEST_ASSERT_EQ_DOUBLE(60.0, sheet_get_cell(sheet, 0, 4)->data.formula.cached_value, 0.0001, "Range should see the moved input");
+    TEST_ASSERT_EQ_DOUBLE(51.0, sheet_get_cell(sheet, 5, 5)->data.formula.cached_value, 0.0001, "Moved formula should see the moved input");
+    
+    // Delete: a reference to the deleted row becomes #REF!, ranges shrink
+    sheet_delete_row(sheet, 3);
+    sheet_recalculate(sheet);
+    Cell* cell = sheet_get_cell(sheet, 0, 3);
+    TEST_ASSERT_EQ_STR("=#REF!*10", cell->data.formula.expression, "Reference to a deleted row should become #REF!");
+    TEST_ASSERT_EQ_INT(ERROR_REF, cell->data.formula.error, "Deleted reference should evaluate to #REF!");
+    TEST_ASSERT_EQ_STR("=SUM(A1:A5)", sheet_get_cell(sheet, 0, 4)->data.formula.expression, "Range spanning the delete should shrink");
+    TEST_ASSERT_EQ_DOUBLE(57.0, sheet_get_cell(sheet, 0, 4)->data.formula.cached_value, 0.0001, "E1 after delete");
+    TEST_ASSERT_EQ_DOUBLE(51.0, sheet_get_cell(sheet, 4, 5)->data.formula.cached_value, 0.0001, "F5 after delete");
+    
+    // Deleting a formula that others read leaves them #REF!
+    sheet_set_formula(sheet, 2, 7, "=A3*2");                    // H3
+    sheet_set_formula(sheet, 0, 7, "=H3+1");                    // H1
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_DOUBLE(5.0, sheet_get_cell(sheet, 0, 7)->data.formula.cached_value, 0.0001, "H1 before delete");
+    sheet_delete_row(sheet, 2);
+    sheet_set_formula(sheet, 20, 7, "=H1+E1");                  // Reuses the freed cell
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_STR("=#REF!+1", sheet_get_cell(sheet, 0, 7)->data.formula.expression, "Reader of a deleted formula should become #REF!");
+    TEST_ASSERT_EQ_DOUBLE(55.0, sheet_get_cell(sheet, 0, 4)->data.formula.cached_value, 0.0001, "E1 after second delete");
+    TEST_ASSERT_EQ_INT(ERROR_REF, sheet_get_cell(sheet, 20, 7)->data.formula.error, "#REF! should propagate to new readers");
+    sheet_free(sheet);
+    
+    // Columns, and cells pushed off the sheet
+    sheet = sheet_new(10, 6);
+    sheet_set_number(sheet, 0, 1, 1);
+    sheet_set_number(sheet, 2, 2, 2);
+    sheet_set_number(sheet, 9, 0, 7);
+    sheet_set_formula(sheet, 0, 3, "=SUM(B1:C3)");              // D1
+    sheet_set_formula(sheet, 0, 4, "=A10");                     // E1
+    sheet_insert_column(sheet, 2);
+    TEST_ASSERT_EQ_STR("=SUM(B1:D3)", sheet_get_cell(sheet, 0, 4)->data.formula.expression, "Column range should grow");
+    sheet_delete_column(sheet, 1);
+    sheet_recalculate(sheet);
+    cell = sheet_get_cell(sheet, 0, 3);
+    TEST_ASSERT_EQ_STR("=SUM(B1:C3)", cell->data.formula.expression, "Column range should shrink");
+    TEST_ASSERT_EQ_DOUBLE(2.0, cell->data.formula.cached_value, 0.0001, "Column range should sum what is left");
+    sheet_insert_row(sheet, 0);
+    TEST_ASSERT_EQ_STR("=#REF!", sheet_get_cell(sheet, 1, 4)->data.formula.expression, "Reference pushed off the sheet should become #REF!");
+    sheet_free(sheet);
+    
+    // Inserting past every formula's references changes nothing, so nothing
+    // is evaluated; the dirty set stays the measure of work
+    sheet = sheet_new(1000, 26);
+    for (int row = 0; row < 200; row++) {
+        char formula[32];
+        sheet_set_number(sheet, row, 0, row);
+        sprintf_s(formula, sizeof(formula), "=A%d*2", row + 1);
+        sheet_set_formula(sheet, row, 1, formula);
+    }
+    sheet_set_formula(sheet, 0, 2, "=SUM(A1:A200)");
+    sheet_recalculate(sheet);
+    sheet_insert_row(sheet, 500);
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_INT(0, sheet->calc_count, "Row inserted below the data should evaluate nothing");
+    sheet_insert_column(sheet, 10);
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_INT(0, sheet->calc_count, "Column inserted right of the data should evaluate nothing");
+    sheet_insert_row(sheet, 100);
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_INT(1, sheet->calc_count, "Insert inside a range should evaluate just its reader");
+    TEST_ASSERT_EQ_DOUBLE(19900.0, sheet_get_cell(sheet, 0, 2)->data.formula.cached_value, 0.0001, "Range reader after insert");
+    sheet_free(sheet);
+    
+    // A range that ends at the sheet's edge keeps its text, but the cells
+    // in it still moved: its readers are evaluated again
+    sheet = sheet_new(10, 6);
+    sheet_set_number(sheet, 0, 2, 1);
+    sheet_set_number(sheet, 0, 3, 2);
+    sheet_set_number(sheet, 0, 5, 9);
+    sheet_set_formula(sheet, 1, 0, "=SUM(C1:F1)");              // A2
+    sheet_set_formula(sheet, 2, 0, "=MEDIAN(C1:F1)");           // A3
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_DOUBLE(12.0, sheet_get_cell(sheet, 1, 0)->data.formula.cached_value, 0.0001, "Edge range before insert");
+    sheet_insert_column(sheet, 5);
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_STR("=SUM(C1:F1)", sheet_get_cell(sheet, 1, 0)->data.formula.expression, "Range at the edge cannot grow");
+    TEST_ASSERT_EQ_DOUBLE(3.0, sheet_get_cell(sheet, 1, 0)->data.formula.cached_value, 0.0001, "Cell pushed off the edge should leave the sum");
+    TEST_ASSERT_EQ_DOUBLE(0.5, sheet_get_cell(sheet, 2, 0)->data.formula.cached_value, 0.0001, "Cell pushed off the edge should leave the median");
+    sheet_free(sheet);
+    
+    // A dropped cell that used to be a formula leaves nothing naming its
+    // slot; the next formula reuses it without inheriting its ranges
+    for (int by_row = 1; by_row >= 0; by_row--) {
+        sheet = sheet_new(100, 26);
+        sheet_set_formula(sheet, 9, 5, "=MEDIAN(B4:C8)");       // F10
+        sheet_recalculate(sheet);
+        sheet_set_number(sheet, 9, 5, 1);
+        sheet_recalculate(sheet);
+        if (by_row) sheet_delete_row(sheet, 9);
+        else sheet_delete_column(sheet, 5);
+        sheet_recalculate(sheet);
+        sheet_set_formula(sheet, 4, 1, "=F4+E4");               // B5
+        sheet_recalculate(sheet);
+        cell = sheet_get_cell(sheet, 4, 1);
+        TEST_ASSERT_EQ_INT(ERROR_NONE, cell->data.formula.error,
+                           by_row ? "Formula after a row delete should not read a dropped cell's ranges"
+                                  : "Formula after a column delete should not read a dropped cell's ranges");
+        sheet_free(sheet);
+    }
+}
+
 // ============================================================================
 // CSV OPERATIONS TESTS
 // ============================================================================
@@ -1458,10 +2353,612 @@ void test_csv_special_characters(void) {
     remove(filename);
 }
 
+void test_csv_bulk_load(void) {
+    TEST_SECTION("CSV Bulk Load");
+    
+    // Rows longer than a line buffer, CRLF endings and quoted line breaks
+    const char* filename = "test_bulk.csv";
+    FILE* file;
+    TEST_ASSERT(fopen_s(&file, filename, "wb") == 0, "Bulk CSV should be created");
+    fputs("1,\"two\r\nlines\",3\r\n", file);
+    fputc('"', file);
+    for (int i = 0; i < 6000; i++) fputc('x', file);
+    fputs("\",42\r\n", file);
+    fputs("  padded  ,\"say \"\"hi\"\"\" ,=A1+C1\r\n", file);
+    fclose(file);
+    
+    Sheet* sheet = sheet_new(1000, 26);
+    sheet_set_string(sheet, 50, 5, "stale");
+    TEST_ASSERT(sheet_load_csv(sheet, filename, 1), "Bulk CSV should load");
+    
+    Cell* cell = sheet_get_cell(sheet, 0, 1);
+    TEST_ASSERT(cell && cell->type == CELL_STRING && strcmp(cell->data.string, "two\nlines") == 0,
+                "Quoted line break should stay inside the field");
+    TEST_ASSERT_EQ_DOUBLE(3.0, sheet_get_cell(sheet, 0, 2)->data.number, 0.001, "Field after a quoted line break");
+    cell = sheet_get_cell(sheet, 1, 0);
+    TEST_ASSERT(cell && cell->type == CELL_STRING && strlen(cell->data.string) == 6000,
+                "Long row should not be split");
+    TEST_ASSERT_EQ_DOUBLE(42.0, sheet_get_cell(sheet, 1, 1)->data.number, 0.001, "Field after a long field");
+    TEST_ASSERT_EQ_STR("padded", sheet_get_display_value(sheet, 2, 0), "Unquoted field should be trimmed");
+    TEST_ASSERT_EQ_STR("say \"hi\"", sheet_get_display_value(sheet, 2, 1), "Doubled quotes should unescape");
+    cell = sheet_get_cell(sheet, 2, 2);
+    TEST_ASSERT(cell && cell->type == CELL_FORMULA, "Formula should be preserved");
+    TEST_ASSERT_EQ_DOUBLE(4.0, cell->data.formula.cached_value, 0.001, "Formula should be calculated on load");
+    cell = sheet_get_cell(sheet, 50, 5);
+    TEST_ASSERT(!cell || cell->type == CELL_EMPTY, "Existing cells should be cleared");
+    
+    // Old Mac files end lines with a lone CR
+    TEST_ASSERT(fopen_s(&file, filename, "wb") == 0, "CR-only CSV should be created");
+    fputs("1,2\r3,\"x\ry\"\r5,6", file);
+    fclose(file);
+    TEST_ASSERT(sheet_load_csv(sheet, filename, 1), "CR-only CSV should load");
+    TEST_ASSERT_EQ_DOUBLE(2.0, sheet_get_cell(sheet, 0, 1)->data.number, 0.001, "First CR-ended row");
+    TEST_ASSERT_EQ_DOUBLE(3.0, sheet_get_cell(sheet, 1, 0)->data.number, 0.001, "A lone CR should end the row");
+    TEST_ASSERT_EQ_STR("x\ry", sheet_get_cell(sheet, 1, 1)->data.string, "A CR inside quotes stays in the field");
+    TEST_ASSERT_EQ_DOUBLE(6.0, sheet_get_cell(sheet, 2, 1)->data.number, 0.001, "Last row without a line ending");
+    
+    // Over CSV_PARALLEL_MIN_BYTES, so rows are parsed on several threads
+    TEST_ASSERT(fopen_s(&file, filename, "wb") == 0, "Large CSV should be created");
+    for (int row = 0; row < 1000; row++) {
+        for (int col = 0; col < 20; col++) {
+            fprintf(file, "%d,", row * 100 + col);
+        }
+        fprintf(file, "\"label %d, ", row % 7);
+        for (int i = 0; i < 1200; i++) fputc('.', file);
+        fputs("\",", file);
+        fprintf(file, "=SUM(A%d:T%d)\n", row + 1, row + 1);
+    }
+    fclose(file);
+    
+    TEST_ASSERT(sheet_load_csv(sheet, filename, 1), "Large CSV should load");
+    int numbers_ok = 1;
+    int totals_ok = 1;
+    for (int row = 0; row < 1000; row++) {
+        for (int col = 0; col < 20; col++) {
+            cell = sheet_get_cell(sheet, row, col);
+            if (!cell || cell->type != CELL_NUMBER || cell->data.number != row * 100 + col) numbers_ok = 0;
+        }
+        cell = sheet_get_cell(sheet, row, 21);
+        if (!cell || cell->type != CELL_FORMULA ||
+            fabs(cell->data.formula.cached_value - (row * 2000.0 + 190.0)) > 0.001) totals_ok = 0;
+    }
+    TEST_ASSERT(numbers_ok, "Every number should land in its cell");
+    TEST_ASSERT(totals_ok, "Every formula should be calculated once loading finishes");
+    cell = sheet_get_cell(sheet, 997, 20);
+    TEST_ASSERT(cell && cell->type == CELL_STRING && strncmp(cell->data.string, "label 3, ...", 12) == 0 &&
+                strlen(cell->data.string) == 1209, "Quoted comma in a late row");
+    remove(filename);
+    
+    // A failed load leaves the sheet alone
+    TEST_ASSERT(!sheet_load_csv(sheet, "missing_bulk.csv", 1), "Missing file should fail");
+    TEST_ASSERT_EQ_DOUBLE(99919.0, sheet_get_cell(sheet, 999, 19)->data.number, 0.001, "Failed load should keep cells");
+    
+    sheet_free(sheet);
+}
+
+void test_csv_used_range_save(void) {
+    TEST_SECTION("CSV Used Range and Buffered Save");
+    
+    Sheet* sheet = sheet_new(100, 26);
+    TEST_ASSERT(sheet->used_rows == 0 && sheet->used_cols == 0, "New sheet should have no used range");
+    
+    sheet_set_number(sheet, 4, 2, 1.5);
+    sheet_set_string(sheet, 1, 6, "far, right");
+    TEST_ASSERT_EQ_INT(5, sheet->used_rows, "Used rows should grow with edits");
+    TEST_ASSERT_EQ_INT(7, sheet->used_cols, "Used columns should grow with edits");
+    
+    // Formatting alone does not extend the range; clearing shrinks it
+    Cell* cell = sheet_get_or_create_cell(sheet, 9, 9);
+    cell->background_color = 4;
+    sheet_clear_cell(sheet, 1, 6);
+    TEST_ASSERT_EQ_INT(5, sheet->used_rows, "Formatted empty cell should not count");
+    TEST_ASSERT_EQ_INT(3, sheet->used_cols, "Clearing the last column should shrink the range");
+    
+    sheet_insert_row(sheet, 0);
+    TEST_ASSERT_EQ_INT(6, sheet->used_rows, "Inserted row should move the range");
+    sheet_delete_column(sheet, 2);
+    TEST_ASSERT(sheet->used_rows == 0 && sheet->used_cols == 0, "Deleting the only column in use should empty the range");
+    
+    // Exact output: padding commas, escaping and number text
+    sheet_set_number(sheet, 0, 0, 2.5);
+    sheet_set_number(sheet, 0, 3, -0.001);
+    sheet_set_string(sheet, 2, 1, "say \"hi\", \"bye\"");
+    sheet_set_number(sheet, 2, 2, 1234567.125);
+    cell = sheet_get_cell(sheet, 2, 2);
+    cell->precision = 3;
+    
+    const char* filename = "test_used_range.csv";
+    TEST_ASSERT(sheet_save_csv(sheet, filename, 0), "Save should succeed");
+    
+    FILE* file;
+    char contents[256] = "";
+    if (fopen_s(&file, filename, "r") == 0) {
+        size_t read = fread(contents, 1, sizeof(contents) - 1, file);
+        contents[read] = '\0';
+        fclose(file);
+    }
+    TEST_ASSERT_EQ_STR("2.5,,,-0\n,,,\n,\"say \"\"hi\"\", \"\"bye\"\"\",1234567.125,\n", contents,
+                       "Saved CSV should match the used range exactly");
+    
+    // Fields larger than the write buffer bypass it
+    size_t big_length = CSV_WRITE_BUFFER_SIZE + 100;
+    char* big = (char*)malloc(big_length + 1);
+    memset(big, 'q', big_length);
+    big[big_length] = '\0';
+    sheet_set_string(sheet, 1, 1, big);
+    TEST_ASSERT(sheet_save_csv(sheet, filename, 0), "Save with a large field should succeed");
+    
+    Sheet* loaded = sheet_new(100, 26);
+    TEST_ASSERT(sheet_load_csv(loaded, filename, 0), "Large field should load back");
+    cell = sheet_get_cell(loaded, 1, 1);
+    TEST_ASSERT(cell && cell->type == CELL_STRING && strcmp(cell->data.string, big) == 0,
+                "Large field should round-trip");
+    TEST_ASSERT_EQ_STR("say \"hi\", \"bye\"", sheet_get_display_value(loaded, 2, 1), "Escaped field should round-trip");
+    TEST_ASSERT_EQ_INT(3, loaded->used_rows, "Loaded sheet should know its used rows");
+    TEST_ASSERT_EQ_INT(4, loaded->used_cols, "Loaded sheet should know its used columns");
+    
+    free(big);
+    sheet_free(loaded);
+    sheet_free(sheet);
+    remove(filename);
+}
+
+void test_background_autosave(void) {
+    TEST_SECTION("Background Autosave");
+    
+    AutosaveJob job;
+    TEST_ASSERT(autosave_init(&job), "Autosave job should initialize");
+    
+    // The job owns the buffer; a second save waits for the first
+    const char* filename = "test_autosave.llj";
+    const char* text = "R\nN 0 0 5\n";
+    char* buffer = _strdup(text);
+    TEST_ASSERT(autosave_start_buffer(&job, buffer, strlen(text), filename), "Autosave should start");
+    TEST_ASSERT(!autosave_start_buffer(&job, _strdup(text), strlen(text), filename),
+                "Second autosave should not start while one is running");
+    
+    TEST_ASSERT_EQ_INT(WAIT_OBJECT_0, (int)WaitForSingleObject(job.done_event, INFINITE), "Autosave should signal completion");
+    TEST_ASSERT(autosave_finish(&job), "Autosave should succeed");
+    
+    char actual[256] = {0};
+    FILE* file;
+    if (fopen_s(&file, filename, "rb") == 0) {
+        fread(actual, 1, sizeof(actual) - 1, file);
+        fclose(file);
+    }
+    TEST_ASSERT_EQ_STR(text, actual, "Autosave should write the buffer as given");
+    
+    // The temporary file is renamed into place
+    TEST_ASSERT(fopen_s(&file, "test_autosave.llj.tmp", "r") != 0, "Temporary autosave file should be gone");
+    
+    autosave_cleanup(&job);
+    remove(filename);
+}
+
+static long test_file_size(const char* path) {
+    FILE* file;
+    if (fopen_s(&file, path, "rb") != 0) return -1;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+void test_journal_recovery(void) {
+    TEST_SECTION("Change Journal Recovery");
+    
+    const char* path = "test_journal.llj";
+    remove(path);
+    
+    Sheet* sheet = sheet_new(100, 26);
+    Journal journal;
+    int recovered = -1;
+    TEST_ASSERT(journal_open(&journal, path, sheet, &recovered), "Journal should open");
+    TEST_ASSERT_EQ_INT(0, recovered, "A new journal has nothing to recover");
+    
+    sheet_set_number(sheet, 0, 0, 0.1);
+    sheet_set_string(sheet, 0, 1, "Line1\nC:\\temp");
+    sheet_set_formula(sheet, 1, 0, "=A1*10");
+    Cell* cell = sheet_get_or_create_cell(sheet, 2, 2);
+    cell_set_format(cell, FORMAT_CURRENCY, 0);
+    cell_set_background_color(cell, COLOR_BLUE);
+    sheet_set_column_width(sheet, 3, 17);
+    journal_touch_range(&journal, 0, 0, 2, 2);
+    journal_touch_columns(&journal, 3, 3);
+    TEST_ASSERT(journal_flush(&journal, sheet), "Journal flush should succeed");
+    
+    // Structural edits are replayed as the same operation
+    journal_log_structure(&journal, sheet, JOURNAL_INSERT_ROW, 0);
+    sheet_insert_row(sheet, 0);
+    sheet_set_number(sheet, 0, 0, 7.0);
+    journal_touch_cell(&journal, 0, 0);
+    journal_flush(&journal, sheet);
+    sheet_recalculate(sheet);
+    
+    Sheet* replayed = sheet_new(100, 26);
+    TEST_ASSERT(journal_replay(replayed, path) > 0, "Journal should replay");
+    TEST_ASSERT_EQ_DOUBLE(7.0, sheet_get_cell(replayed, 0, 0)->data.number, 0.0001, "Edit after insert should replay");
+    TEST_ASSERT_EQ_DOUBLE(0.1, sheet_get_cell(replayed, 1, 0)->data.number, 0.0, "Numbers should round-trip exactly");
+    TEST_ASSERT_EQ_STR("Line1\nC:\\temp", sheet_get_cell(replayed, 1, 1)->data.string, "Escaped text should round-trip");
+    TEST_ASSERT_EQ_DOUBLE(sheet_get_cell(sheet, 2, 0)->data.formula.cached_value,
+                          sheet_get_cell(replayed, 2, 0)->data.formula.cached_value, 0.0001, "Formula should replay and recalculate");
+    cell = sheet_get_cell(replayed, 3, 2);
+    TEST_ASSERT(cell != NULL && cell->format == FORMAT_CURRENCY && cell->background_color == COLOR_BLUE,
+                "Formatting of an empty cell should replay");
+    TEST_ASSERT_EQ_INT(17, sheet_get_column_width(replayed, 3), "Column width should replay");
+    sheet_free(replayed);
+    
+    // Compaction rewrites the file; edits made meanwhile are held and appended
+    size_t size;
+    int records;
+    char* snapshot = journal_snapshot(sheet, &size, &records);
+    TEST_ASSERT(snapshot != NULL, "Journal snapshot should build");
+    
+    AutosaveJob job;
+    autosave_init(&job);
+    TEST_ASSERT(autosave_start_buffer(&job, snapshot, size, path), "Compaction write should start");
+    journal_begin_compaction(&journal, records);
+    
+    sheet_set_string(sheet, 5, 5, "during");
+    journal_touch_cell(&journal, 5, 5);
+    journal_flush(&journal, sheet);
+    
+    WaitForSingleObject(job.done_event, INFINITE);
+    int succeeded = autosave_finish(&job);
+    TEST_ASSERT(succeeded, "Compaction write should succeed");
+    journal_end_compaction(&journal, succeeded);
+    TEST_ASSERT_EQ_INT(records + 1, journal.record_count, "Compacted journal should hold the snapshot and held records");
+    autosave_cleanup(&job);
+    
+    replayed = sheet_new(100, 26);
+    TEST_ASSERT_EQ_INT(records + 1, journal_replay(replayed, path), "Compacted journal should replay every record");
+    TEST_ASSERT_EQ_STR("during", sheet_get_display_value(replayed, 5, 5), "Held record should survive compaction");
+    TEST_ASSERT_EQ_DOUBLE(7.0, sheet_get_cell(replayed, 0, 0)->data.number, 0.0001, "Compacted journal should keep contents");
+    TEST_ASSERT_EQ_INT(17, sheet_get_column_width(replayed, 3), "Compacted journal should keep column widths");
+    sheet_free(replayed);
+    
+    journal_close(&journal, 1);
+    FILE* file;
+    TEST_ASSERT(fopen_s(&file, path, "r") != 0, "Clean close should discard the journal");
+    
+    sheet_free(sheet);
+    
+    // Each sheet has its own journal, so a crash recovers every sheet into itself
+    char first_path[MAX_PATH], second_path[MAX_PATH], third_path[MAX_PATH];
+    journal_sheet_path("Data", first_path, sizeof(first_path));
+    journal_sheet_path("a/b", second_path, sizeof(second_path));
+    journal_sheet_path("a_2Fb", third_path, sizeof(third_path));
+    TEST_ASSERT_EQ_STR("AS\\journal-Data.llj", first_path, "Plain sheet names should be kept in the journal name");
+    TEST_ASSERT_EQ_STR("AS\\journal-a%2Fb.llj", second_path, "Characters a file name cannot hold should be encoded");
+    TEST_ASSERT(strcmp(second_path, third_path) != 0, "Different sheet names should get different journals");
+    
+    // Edit one sheet, switch to the other and edit it, then switch back,
+    // the way app_switch_sheet does
+    CreateDirectoryA("AS", NULL);
+    journal_sheet_path("JournalA", first_path, sizeof(first_path));
+    journal_sheet_path("JournalB", second_path, sizeof(second_path));
+    remove(first_path);
+    remove(second_path);
+    
+    Workbook workbook;
+    workbook_init(&workbook, 0);
+    int first = workbook_add_sheet(&workbook, "JournalA", 100, 26);
+    int second = workbook_add_sheet(&workbook, "JournalB", 100, 26);
+    JournalShelf shelf = { NULL, 0 };
+    sheet = workbook_activate(&workbook, first);
+    TEST_ASSERT(journal_open(&journal, first_path, sheet, &recovered), "First sheet's journal should open");
+    sheet_set_number(sheet, 0, 0, 1.0);
+    journal_touch_cell(&journal, 0, 0);
+    
+    TEST_ASSERT(journal_shelf_reserve(&shelf, workbook.count), "Shelf should make room for the workbook");
+    journal_flush(&journal, sheet);
+    sheet = workbook_activate(&workbook, second);
+    journal_switch(&journal, &shelf, first, second, sheet, &recovered);
+    TEST_ASSERT_EQ_STR(second_path, journal.path, "Switching should take the shown sheet's own journal");
+    long first_size = test_file_size(first_path);
+    
+    sheet_set_number(sheet, 0, 0, 2.0);
+    sheet_set_number(sheet, 4, 4, 5.0);
+    journal_touch_cell(&journal, 0, 0);
+    journal_touch_cell(&journal, 4, 4);
+    journal_flush(&journal, sheet);
+    sheet = workbook_activate(&workbook, first);
+    journal_switch(&journal, &shelf, second, first, sheet, &recovered);
+    TEST_ASSERT_EQ_STR(first_path, journal.path, "Switching back should take the first journal again");
+    TEST_ASSERT_EQ_INT(1, journal.record_count, "Switching should not add records to a shelved journal");
+    TEST_ASSERT_EQ_INT(first_size, test_file_size(first_path), "Switching should not write to a shelved journal");
+    TEST_ASSERT_EQ_INT(2, shelf.journals[second].record_count, "Second journal should hold just its own edits");
+    
+    sheet_set_number(sheet, 1, 0, 3.0);
+    journal_touch_cell(&journal, 1, 0);
+    journal_flush(&journal, sheet);
+    
+    // A crash leaves both journals; each recovers into its own sheet
+    journal_close(&journal, 0);
+    journal_shelf_close(&shelf, 0);
+    workbook_free(&workbook);
+    
+    workbook_init(&workbook, 0);
+    first = workbook_add_sheet(&workbook, "JournalA", 100, 26);
+    second = workbook_add_sheet(&workbook, "JournalB", 100, 26);
+    sheet = workbook_activate(&workbook, first);
+    journal_open(&journal, first_path, sheet, &recovered);
+    TEST_ASSERT_EQ_INT(2, recovered, "First sheet should recover its own edits");
+    TEST_ASSERT_EQ_DOUBLE(1.0, sheet_get_cell(sheet, 0, 0)->data.number, 0.0001, "First sheet should keep its value");
+    TEST_ASSERT_EQ_DOUBLE(3.0, sheet_get_cell(sheet, 1, 0)->data.number, 0.0001, "Edit after switching back should recover");
+    TEST_ASSERT(sheet_get_cell(sheet, 4, 4) == NULL, "First sheet should not receive the second sheet's cells");
+    
+    journal_shelf_reserve(&shelf, workbook.count);
+    sheet = workbook_activate(&workbook, second);
+    journal_switch(&journal, &shelf, first, second, sheet, &recovered);
+    TEST_ASSERT_EQ_INT(2, recovered, "Second sheet should recover when first shown");
+    TEST_ASSERT_EQ_DOUBLE(2.0, sheet_get_cell(sheet, 0, 0)->data.number, 0.0001, "Second sheet should keep its value");
+    TEST_ASSERT_EQ_DOUBLE(5.0, sheet_get_cell(sheet, 4, 4)->data.number, 0.0001, "Second sheet should keep its other value");
+    
+    journal_close(&journal, 1);
+    journal_shelf_close(&shelf, 1);
+    TEST_ASSERT(fopen_s(&file, first_path, "r") != 0 && fopen_s(&file, second_path, "r") != 0,
+                "Clean close should discard every sheet's journal");
+    workbook_free(&workbook);
+}
+
 // ============================================================================
 // DISPLAY VALUE TESTS
 // ============================================================================
 
+void test_undo_history(void) {
+    TEST_SECTION("Undo History");
+    
+    Sheet* sheet = sheet_new(100, 26);
+    UndoHistory history;
+    undo_history_init(&history, UNDO_MEMORY_BUDGET, NULL);
+    history.coalesce_ms = 0;
+    const char* description;
+    
+    // Content is restored through the sheet, so formulas recalculate
+    undo_begin(&history, sheet, "Enter number", 1);
+    undo_note_cell(&history, sheet, 0, 0);
+    sheet_set_number(sheet, 0, 0, 42);
+    TEST_ASSERT(undo_commit(&history, sheet), "Record should be kept");
+    undo_begin(&history, sheet, "Enter formula", 1);
+    undo_note_cell(&history, sheet, 1, 0);
+    sheet_set_formula(sheet, 1, 0, "=A1*2");
+    undo_commit(&history, sheet);
+    TEST_ASSERT_EQ_INT(2, history.count, "Typing is not joined when coalescing is off");
+    
+    description = undo_undo(&history, sheet);
+    TEST_ASSERT_EQ_STR("Enter formula", description, "Undo names the action");
+    Cell* cell = sheet_get_cell(sheet, 1, 0);
+    TEST_ASSERT(!cell || cell->type == CELL_EMPTY, "Undo should clear the entered formula");
+    description = undo_undo(&history, sheet);
+    TEST_ASSERT_EQ_STR("Enter number", description, "Second undo");
+    TEST_ASSERT(undo_undo(&history, sheet) == NULL, "Nothing left to undo");
+    description = undo_redo(&history, sheet);
+    TEST_ASSERT_EQ_STR("Enter number", description, "Redo names the action");
+    description = undo_redo(&history, sheet);
+    TEST_ASSERT_EQ_STR("Enter formula", description, "Second redo");
+    TEST_ASSERT(undo_redo(&history, sheet) == NULL, "Nothing left to redo");
+    sheet_recalculate(sheet);
+    cell = sheet_get_cell(sheet, 1, 0);
+    TEST_ASSERT(cell && cell->type == CELL_FORMULA, "Redo should restore the formula");
+    TEST_ASSERT_EQ_DOUBLE(84.0, cell ? cell->data.formula.cached_value : 0.0, 0.001, "Restored formula recalculates");
+    
+    // A format change records only the format
+    size_t bytes = history.bytes;
+    undo_begin(&history, sheet, "Format cell", 0);
+    undo_note_cell(&history, sheet, 0, 0);
+    cell_set_format(sheet_get_cell(sheet, 0, 0), FORMAT_CURRENCY, 0);
+    undo_commit(&history, sheet);
+    TEST_ASSERT(history.bytes - bytes <= sizeof(UndoRecord) + 16, "Format entry stays a few bytes");
+    undo_undo(&history, sheet);
+    cell = sheet_get_cell(sheet, 0, 0);
+    TEST_ASSERT_EQ_INT(FORMAT_GENERAL, cell->format, "Undo restores the format");
+    TEST_ASSERT_EQ_DOUBLE(42.0, cell->data.number, 0.001, "Undoing a format keeps the value");
+    
+    // String text is shared with the sheet's string table
+    char text[201];
+    memset(text, 'x', 200);
+    text[200] = '\0';
+    sheet_set_string(sheet, 5, 0, text);
+    const char* interned = sheet_get_cell(sheet, 5, 0)->data.string;
+    bytes = history.bytes;
+    undo_begin(&history, sheet, "Enter number", 0);
+    undo_note_cell(&history, sheet, 5, 0);
+    sheet_set_number(sheet, 5, 0, 1);
+    undo_commit(&history, sheet);
+    TEST_ASSERT(history.bytes - bytes < sizeof(UndoRecord) + 64, "Long text costs a pointer");
+    undo_undo(&history, sheet);
+    cell = sheet_get_cell(sheet, 5, 0);
+    TEST_ASSERT(cell->type == CELL_STRING && cell->data.string == interned, "Undo restores the interned text");
+    
+    // Only the cells a range edit changed are kept
+    for (int row = 10; row < 20; row++) {
+        for (int col = 0; col < 3; col++) sheet_set_number(sheet, row, col, row * 10 + col);
+    }
+    undo_begin(&history, sheet, "Paste range", 0);
+    undo_note_range(&history, sheet, 10, 0, 19, 2);
+    sheet_set_number(sheet, 12, 1, -1);
+    sheet_set_string(sheet, 15, 2, "changed");
+    sheet_set_number(sheet, 17, 0, 170);  // Same value
+    undo_commit(&history, sheet);
+    TEST_ASSERT_EQ_INT(2, history.records[history.count - 1].entry_count, "Unchanged cells are not recorded");
+    undo_undo(&history, sheet);
+    TEST_ASSERT_EQ_DOUBLE(121.0, sheet_get_cell(sheet, 12, 1)->data.number, 0.001, "Range undo restores a number");
+    TEST_ASSERT_EQ_DOUBLE(152.0, sheet_get_cell(sheet, 15, 2)->data.number, 0.001, "Range undo restores over text");
+    undo_redo(&history, sheet);
+    TEST_ASSERT_EQ_STR("changed", sheet_get_cell(sheet, 15, 2)->data.string, "Range redo reapplies text");
+    
+    // Column widths
+    int width = sheet_get_column_width(sheet, 3);
+    undo_begin(&history, sheet, "Resize columns", 0);
+    undo_note_columns(&history, sheet, 3, 3);
+    sheet_set_column_width(sheet, 3, width + 5);
+    undo_commit(&history, sheet);
+    undo_undo(&history, sheet);
+    TEST_ASSERT_EQ_INT(width, sheet_get_column_width(sheet, 3), "Undo restores a column width");
+    undo_redo(&history, sheet);
+    TEST_ASSERT_EQ_INT(width + 5, sheet_get_column_width(sheet, 3), "Redo reapplies a column width");
+    
+    // Typing in quick succession undoes as one step
+    history.coalesce_ms = 60000;
+    int count = history.count;
+    undo_begin(&history, sheet, "Enter number", 1);
+    undo_note_cell(&history, sheet, 30, 0);
+    sheet_set_number(sheet, 30, 0, 1);
+    undo_commit(&history, sheet);
+    undo_begin(&history, sheet, "Enter number", 1);
+    undo_note_cell(&history, sheet, 31, 0);
+    sheet_set_number(sheet, 31, 0, 2);
+    undo_commit(&history, sheet);
+    undo_begin(&history, sheet, "Enter number", 1);
+    undo_note_cell(&history, sheet, 30, 0);
+    sheet_set_number(sheet, 30, 0, 3);
+    undo_commit(&history, sheet);
+    TEST_ASSERT_EQ_INT(count + 1, history.count, "Typed edits join one record");
+    description = undo_undo(&history, sheet);
+    TEST_ASSERT_EQ_STR("Typing", description, "Joined record is undone at once");
+    TEST_ASSERT(sheet_get_cell(sheet, 30, 0)->type == CELL_EMPTY, "First typed cell is back to empty");
+    TEST_ASSERT(sheet_get_cell(sheet, 31, 0)->type == CELL_EMPTY, "Second typed cell is back to empty");
+    undo_redo(&history, sheet);
+    TEST_ASSERT_EQ_DOUBLE(3.0, sheet_get_cell(sheet, 30, 0)->data.number, 0.001, "Redo gives the last typed value");
+    TEST_ASSERT_EQ_DOUBLE(2.0, sheet_get_cell(sheet, 31, 0)->data.number, 0.001, "Redo gives the other typed value");
+    history.coalesce_ms = 0;
+    
+    // The budget drops the oldest records first
+    undo_set_budget(&history, 4096);
+    TEST_ASSERT(history.bytes <= 4096, "Lowering the budget trims the history");
+    for (int i = 0; i < 500; i++) {
+        undo_begin(&history, sheet, "Enter number", 0);
+        undo_note_cell(&history, sheet, 40 + i % 50, 5);
+        sheet_set_number(sheet, 40 + i % 50, 5, i);
+        undo_commit(&history, sheet);
+    }
+    TEST_ASSERT(history.bytes <= 4096, "History stays within its budget");
+    TEST_ASSERT(history.count > 10 && history.count < 500, "Only the newest records are kept");
+    count = history.count;
+    int undone = 0;
+    while (undo_undo(&history, sheet)) undone++;
+    TEST_ASSERT_EQ_INT(count, undone, "Every kept record can be undone");
+    TEST_ASSERT_EQ_DOUBLE((double)(499 - count), sheet_get_cell(sheet, 40 + (499 - count) % 50, 5)->data.number, 0.001,
+                          "Undo stops at the oldest kept record");
+    
+    // A record larger than the whole budget cannot be kept
+    undo_set_budget(&history, 256);
+    undo_begin(&history, sheet, "Paste range", 0);
+    undo_note_range(&history, sheet, 0, 10, 99, 10);
+    for (int row = 0; row < 100; row++) sheet_set_number(sheet, row, 10, row);
+    TEST_ASSERT(!undo_commit(&history, sheet), "Oversized record is refused");
+    TEST_ASSERT_EQ_INT(0, history.count, "Refusing a record empties the history");
+    TEST_ASSERT(undo_undo(&history, sheet) == NULL, "Nothing to undo after an oversized edit");
+    
+    undo_history_free(&history);
+    sheet_free(sheet);
+}
+
+void test_llb_round_trip(void) {
+    TEST_SECTION("Native LLB Files");
+    
+    Sheet* sheet = sheet_new(100, 26);
+    free(sheet->name);
+    sheet->name = _strdup("Budget");
+    sheet_set_number(sheet, 0, 0, 7.0);
+    sheet_set_string(sheet, 0, 1, "Orange");
+    sheet_set_number(sheet, 0, 2, 3.25);
+    sheet_set_formula(sheet, 1, 0, "=A1*2+C1");
+    sheet_set_formula(sheet, 1, 1, "=IF(A1>5, \"High\", \"Low\")");
+    sheet_set_formula(sheet, 1, 2, "=XLOOKUP(\"Orange\", B1:B1, C1:C1, 0)");
+    sheet_set_formula(sheet, 70, 8, "=A2+1");
+    sheet_recalculate(sheet);
+    
+    Cell* cell = sheet_get_cell(sheet, 0, 2);
+    cell_set_format(cell, FORMAT_CURRENCY, 0);
+    cell->precision = 3;
+    cell->text_color = 12;
+    cell = sheet_get_or_create_cell(sheet, 5, 5);
+    cell->background_color = 4;
+    sheet->col_widths[3] = 22;
+    sheet->row_heights[4] = 3;
+    
+    const char* filename = "test_sheet.llb";
+    TEST_ASSERT(sheet_save_llb(sheet, filename), "LLB save should succeed");
+    
+    // Loading replaces everything and needs no recalculation
+    Sheet* loaded = sheet_new(100, 26);
+    sheet_set_number(loaded, 50, 10, 1.0);
+    loaded->selection.is_active = 1;
+    TEST_ASSERT(sheet_load_llb(loaded, filename), "LLB load should succeed");
+    TEST_ASSERT(!loaded->needs_recalc, "Loaded sheet should not need recalculation");
+    TEST_ASSERT(sheet_get_cell(loaded, 50, 10) == NULL || sheet_get_cell(loaded, 50, 10)->type == CELL_EMPTY,
+                "Old contents should be replaced");
+    TEST_ASSERT(loaded->selection.is_active, "Selection should be kept");
+    TEST_ASSERT_EQ_STR("Budget", loaded->name, "Sheet name should round-trip");
+    TEST_ASSERT_EQ_STR("Orange", sheet_get_display_value(loaded, 0, 1), "String should round-trip");
+    TEST_ASSERT_EQ_DOUBLE(17.25, sheet_get_cell(loaded, 1, 0)->data.formula.cached_value, 0.001, "Cached value should round-trip");
+    TEST_ASSERT_EQ_STR("High", sheet_get_display_value(loaded, 1, 1), "String result should round-trip");
+    TEST_ASSERT_EQ_STR(sheet_get_display_value(sheet, 1, 2), sheet_get_display_value(loaded, 1, 2), "Lookup result should round-trip");
+    TEST_ASSERT_EQ_DOUBLE(18.25, sheet_get_cell(loaded, 70, 8)->data.formula.cached_value, 0.001, "Cells in later chunks should load");
+    
+    cell = sheet_get_cell(loaded, 0, 2);
+    TEST_ASSERT(cell->format == FORMAT_CURRENCY && cell->precision == 3 && cell->text_color == 12,
+                "Formatting should round-trip");
+    cell = sheet_get_cell(loaded, 5, 5);
+    TEST_ASSERT(cell && cell->type == CELL_EMPTY && cell->background_color == 4, "Formatted empty cell should round-trip");
+    TEST_ASSERT_EQ_INT(22, loaded->col_widths[3], "Column width should round-trip");
+    TEST_ASSERT_EQ_INT(3, loaded->row_heights[4], "Row height should round-trip");
+    TEST_ASSERT_EQ_INT(71, loaded->used_rows, "Loaded sheet should know its used rows");
+    
+    // Loaded programs and rebuilt dependencies keep working
+    sheet_set_number(loaded, 0, 0, 1.0);
+    sheet_recalculate(loaded);
+    TEST_ASSERT_EQ_DOUBLE(5.25, sheet_get_cell(loaded, 1, 0)->data.formula.cached_value, 0.001, "Loaded formula should recalculate");
+    TEST_ASSERT_EQ_STR("Low", sheet_get_display_value(loaded, 1, 1), "Loaded IF should recalculate");
+    TEST_ASSERT_EQ_DOUBLE(6.25, sheet_get_cell(loaded, 70, 8)->data.formula.cached_value, 0.001, "Dependents should recalculate");
+    
+    // Read the file back to damage it
+    FILE* file;
+    char* bytes = NULL;
+    long length = 0;
+    if (fopen_s(&file, filename, "rb") == 0) {
+        fseek(file, 0, SEEK_END);
+        length = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        bytes = (char*)malloc(length);
+        fread(bytes, 1, length, file);
+        fclose(file);
+    }
+    TEST_ASSERT(bytes != NULL && length > 64, "LLB file should be readable");
+    
+    // Programs from another bytecode version are compiled from their text
+    unsigned int other_version = FORMULA_BYTECODE_VERSION + 1;
+    memcpy(bytes + 8, &other_version, sizeof(other_version));
+    if (fopen_s(&file, filename, "wb") == 0) {
+        fwrite(bytes, 1, length, file);
+        fclose(file);
+    }
+    Sheet* small = sheet_new(10, 3);
+    TEST_ASSERT(sheet_load_llb(small, filename), "Older bytecode should still load");
+    TEST_ASSERT(sheet_get_cell(small, 70, 8) == NULL, "Cells outside the sheet should be skipped");
+    TEST_ASSERT_EQ_STR("High", sheet_get_display_value(small, 1, 1), "Cached results should load with older bytecode");
+    sheet_set_number(small, 0, 0, 2.0);
+    sheet_recalculate(small);
+    TEST_ASSERT_EQ_DOUBLE(7.25, sheet_get_cell(small, 1, 0)->data.formula.cached_value, 0.001, "Recompiled formula should evaluate");
+    
+    // A truncated file is rejected and leaves the sheet as it was
+    if (fopen_s(&file, filename, "wb") == 0) {
+        fwrite(bytes, 1, length / 2, file);
+        fclose(file);
+    }
+    TEST_ASSERT(!sheet_load_llb(small, filename), "Truncated file should fail");
+    TEST_ASSERT_EQ_DOUBLE(2.0, sheet_get_cell(small, 0, 0)->data.number, 0.001, "Failed load should keep cells");
+    TEST_ASSERT(!sheet_load_llb(small, "missing_sheet.llb"), "Missing file should fail");
+    
+    free(bytes);
+    sheet_free(small);
+    sheet_free(loaded);
+    sheet_free(sheet);
+    remove(filename);
+}
+
 void test_display_values(void) {
     TEST_SECTION("Display Values");
     
@@ -1585,6 +3082,408 @@ void test_recalc_after_clear(void) {
     sheet_free(sheet);
 }
 
+void test_dependency_recalc(void) {
+    TEST_SECTION("Dependency Graph Recalculation");
+    
+    Sheet* sheet = sheet_new(1000, 26);
+    
+    // Unrelated formulas should not be re-evaluated by an edit
+    for (int row = 0; row < 50; row++) {
+        sheet_set_formula(sheet, row, 5, "=1+1");  // F column
+    }
+    sheet_set_number(sheet, 0, 0, 2.0);          // A1
+    sheet_set_formula(sheet, 0, 1, "=A1*10");    // B1
+    sheet_set_formula(sheet, 0, 2, "=B1+SUM(A1:A5)");  // C1
+    TEST_ASSERT_EQ_INT(LL_OK, sheet_recalculate(sheet), "Acyclic recalc should return LL_OK");
+    
+    Cell* cell = sheet_get_cell(sheet, 0, 2);
+    TEST_ASSERT_EQ_DOUBLE(22.0, cell->data.formula.cached_value, 0.0001, "C1 should be 22");
+    
+    sheet_set_number(sheet, 0, 0, 3.0);
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_INT(2, sheet->calc_count, "Editing A1 should evaluate only B1 and C1");
+    TEST_ASSERT_EQ_DOUBLE(33.0, cell->data.formula.cached_value, 0.0001, "C1 should update to 33");
+    TEST_ASSERT(sheet->calc_order[0] == sheet_get_cell(sheet, 0, 1), "B1 should be evaluated before C1");
+    
+    // Range precedents: a cell inside SUM(A1:A5) that was never set
+    sheet_set_number(sheet, 3, 0, 7.0);  // A4
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_INT(1, sheet->calc_count, "Editing A4 should evaluate only C1");
+    TEST_ASSERT_EQ_DOUBLE(40.0, cell->data.formula.cached_value, 0.0001, "C1 should include A4");
+    
+    // Strings feed comparisons
+    sheet_set_formula(sheet, 1, 1, "=IF(D2=\"yes\", 1, 0)");  // B2
+    sheet_set_string(sheet, 1, 3, "yes");  // D2
+    sheet_recalculate(sheet);
+    cell = sheet_get_cell(sheet, 1, 1);
+    TEST_ASSERT_EQ_DOUBLE(1.0, cell->data.formula.cached_value, 0.0001, "B2 should see D2 string");
+    sheet_set_string(sheet, 1, 3, "no");
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_DOUBLE(0.0, cell->data.formula.cached_value, 0.0001, "B2 should update after D2 string edit");
+    
+    // A long chain entered bottom-up still settles in one pass
+    for (int row = 999; row >= 1; row--) {
+        char formula[32];
+        sprintf_s(formula, sizeof(formula), "=H%d+1", row);
+        sheet_set_formula(sheet, row, 7, formula);
+    }
+    sheet_set_number(sheet, 0, 7, 0.0);  // H1
+    sheet_recalculate(sheet);
+    cell = sheet_get_cell(sheet, 999, 7);
+    TEST_ASSERT_EQ_DOUBLE(999.0, cell->data.formula.cached_value, 0.0001, "H1000 should be 999");
+    sheet_set_number(sheet, 0, 7, 1.0);
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_INT(999, sheet->calc_count, "Chain edit should evaluate each link once");
+    TEST_ASSERT_EQ_DOUBLE(1000.0, cell->data.formula.cached_value, 0.0001, "H1000 should be 1000");
+    
+    sheet_free(sheet);
+}
+
+// Marks each item it is given; several threads never share an item
+static void count_items_task(void* context, int begin, int end) {
+    LONG* counts = (LONG*)context;
+    for (int i = begin; i < end; i++) {
+        InterlockedIncrement(&counts[i]);
+    }
+}
+
+void test_thread_pool(void) {
+    TEST_SECTION("Thread Pool");
+    
+    ThreadPool* pool = thread_pool_create(4);
+    TEST_ASSERT(pool != NULL, "Pool should be created");
+    TEST_ASSERT(thread_pool_size(pool) >= 1 && thread_pool_size(pool) <= 4, "Pool should have at most the threads asked for");
+    
+    int sizes[] = { 0, 1, 3, 63, 65, 100000 };
+    LONG* counts = (LONG*)calloc(100000, sizeof(LONG));
+    for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        for (int repeat = 0; repeat < 3; repeat++) {
+            memset(counts, 0, 100000 * sizeof(LONG));
+            thread_pool_run(pool, sizes[s], count_items_task, counts);
+            
+            int wrong = 0;
+            for (int i = 0; i < sizes[s]; i++) {
+                if (counts[i] != 1) wrong++;
+            }
+            TEST_ASSERT_EQ_INT(0, wrong, "Every item should be processed exactly once");
+        }
+    }
+    thread_pool_destroy(pool);
+    
+    // A single-thread pool runs on the caller
+    pool = thread_pool_create(1);
+    TEST_ASSERT_EQ_INT(1, thread_pool_size(pool), "Single-thread pool should have one participant");
+    memset(counts, 0, 100000 * sizeof(LONG));
+    thread_pool_run(pool, 1000, count_items_task, counts);
+    TEST_ASSERT_EQ_INT(1, (int)counts[999], "Single-thread pool should process items");
+    thread_pool_destroy(pool);
+    
+    free(counts);
+}
+
+void test_recalc_steps(void) {
+    TEST_SECTION("Stepped Recalculation");
+    
+    const int count = 40000;
+    Sheet* sheet = sheet_new(count + 10, 10);
+    for (int i = 0; i < count; i++) {
+        char formula[32];
+        sheet_set_number(sheet, i, 0, i);
+        sprintf_s(formula, sizeof(formula), "=A%d*2", i + 1);
+        sheet_set_formula(sheet, i, 1, formula);
+    }
+    sheet_set_formula(sheet, 0, 2, "=SUM(B1:B40000)");
+    sheet_set_formula(sheet, 0, 3, "=B40000+1");
+    
+    // Cells on screen come first: the focused input in the first batch,
+    // the formula reading it in the one after
+    CellRange focus = { count - 1, 1, count - 1, 1 };
+    sheet_set_recalc_focus(sheet, &focus);
+    Cell* focused = sheet_get_cell(sheet, count - 1, 1);
+    TEST_ASSERT(sheet_cell_is_stale(sheet, focused), "Edited formula should be stale before recalculation");
+    LLResult result = sheet_recalculate_step(sheet, 1);
+    TEST_ASSERT(!sheet_cell_is_stale(sheet, focused), "Focused cell should be evaluated by the first step");
+    TEST_ASSERT_EQ_DOUBLE(2.0 * (count - 1), focused->data.formula.cached_value, 0.001, "Focused cell value");
+    
+    focus.start_col = focus.end_col = 3;
+    focus.start_row = focus.end_row = 0;
+    sheet_set_recalc_focus(sheet, &focus);
+    Cell* reader = sheet_get_cell(sheet, 0, 3);
+    if (result == LL_IN_PROGRESS) {
+        result = sheet_recalculate_step(sheet, 1);
+    }
+    TEST_ASSERT(!sheet_cell_is_stale(sheet, reader), "Newly focused cell should be evaluated by the next step");
+    TEST_ASSERT_EQ_DOUBLE(2.0 * (count - 1) + 1, reader->data.formula.cached_value, 0.001, "Newly focused cell value");
+    
+    int done, total;
+    if (sheet_recalc_progress(sheet, &done, &total)) {
+        TEST_ASSERT(done < total, "A running pass should have cells left");
+        TEST_ASSERT_EQ_INT(count + 2, total, "Pass should cover every formula");
+    }
+    
+    // Edit between steps: the pass is cancelled and resumed with the change
+    sheet_set_number(sheet, 7, 0, 1000);
+    TEST_ASSERT(!sheet_recalc_progress(sheet, &done, &total), "An edit should cancel the running pass");
+    TEST_ASSERT(sheet_recalc_pending(sheet), "Cancelled work should still be pending");
+    int steps = 0;
+    while ((result = sheet_recalculate_step(sheet, 1)) == LL_IN_PROGRESS) {
+        steps++;
+        if (steps == 1) sheet_set_number(sheet, 9, 0, -50);
+    }
+    TEST_ASSERT_EQ_INT(LL_OK, result, "Stepped recalculation should finish");
+    TEST_ASSERT(!sheet_recalc_pending(sheet), "Nothing should be pending after the last step");
+    
+    double expected = 0;
+    int wrong = 0;
+    for (int i = 0; i < count; i++) {
+        Cell* cell = sheet_get_cell(sheet, i, 1);
+        double value = sheet_get_cell(sheet, i, 0)->data.number * 2;
+        if (cell->data.formula.cached_value != value || sheet_cell_is_stale(sheet, cell)) wrong++;
+        expected += value;
+    }
+    TEST_ASSERT_EQ_INT(0, wrong, "Every formula should hold its current value");
+    TEST_ASSERT_EQ_DOUBLE(expected, sheet_get_cell(sheet, 0, 2)->data.formula.cached_value, 0.001, "Total should include both edits");
+    
+    // A cycle is still reported when the pass ends
+    sheet_set_formula(sheet, count + 1, 0, "=B40002");
+    sheet_set_formula(sheet, count + 1, 1, "=A40002");
+    while ((result = sheet_recalculate_step(sheet, 1)) == LL_IN_PROGRESS) {}
+    TEST_ASSERT_EQ_INT(LL_ERR_CIRCULAR_REF, result, "Stepped recalculation should report cycles");
+    
+    sheet_free(sheet);
+}
+
+void test_lazy_load(void) {
+    TEST_SECTION("Lazy Loading");
+    
+    const int count = 20000;
+    const char* filename = "test_lazy_load.csv";
+    Sheet* sheet = sheet_new(count + 10, 10);
+    for (int i = 0; i < count; i++) {
+        char formula[32];
+        sheet_set_number(sheet, i, 0, i);
+        sprintf_s(formula, sizeof(formula), "=A%d*2", i + 1);
+        sheet_set_formula(sheet, i, 1, formula);
+    }
+    sheet_set_formula(sheet, 0, 2, "=SUM(B1:B20000)");
+    sheet_recalculate(sheet);
+    TEST_ASSERT(sheet_save_csv(sheet, filename, 1), "Sheet should save with formulas");
+    sheet_free(sheet);
+    
+    // Nothing is evaluated by the load itself
+    Sheet* loaded = sheet_new(count + 10, 10);
+    sheet_set_lazy_recalc(loaded, 1);
+    TEST_ASSERT(sheet_load_csv(loaded, filename, 1), "Lazy CSV should load");
+    Cell* last = sheet_get_cell(loaded, count - 1, 1);
+    Cell* total = sheet_get_cell(loaded, 0, 2);
+    TEST_ASSERT(sheet_recalc_pending(loaded), "Lazy load should leave the recalculation pending");
+    TEST_ASSERT(sheet_cell_is_stale(loaded, last), "Loaded formulas should show as stale");
+    TEST_ASSERT(sheet_cell_is_stale(loaded, total), "Every loaded formula should show as stale");
+    
+    // A range on demand, with what it reads; the rest can wait
+    CellRange range = { count - 3, 1, count - 1, 1 };
+    TEST_ASSERT_EQ_INT(LL_OK, sheet_recalculate_range(loaded, &range), "Range recalculation should succeed");
+    TEST_ASSERT(!sheet_cell_is_stale(loaded, last), "Requested cells should be current");
+    TEST_ASSERT_EQ_DOUBLE(2.0 * (count - 1), last->data.formula.cached_value, 0.001, "Requested cell value");
+    TEST_ASSERT(!loaded->calc_focus_set, "The screen focus should be left as it was");
+    
+    range.start_row = range.end_row = 0;
+    range.start_col = range.end_col = 2;
+    TEST_ASSERT_EQ_INT(LL_OK, sheet_recalculate_range(loaded, &range), "Range over a total should succeed");
+    TEST_ASSERT_EQ_DOUBLE((double)count * (count - 1), total->data.formula.cached_value, 0.001, "Total over the whole column");
+    
+    LLResult result;
+    while ((result = sheet_recalculate_step(loaded, 1)) == LL_IN_PROGRESS) {}
+    TEST_ASSERT_EQ_INT(LL_OK, result, "Background steps should finish the pass");
+    int wrong = 0;
+    for (int i = 0; i < count; i++) {
+        Cell* cell = sheet_get_cell(loaded, i, 1);
+        if (cell->data.formula.cached_value != 2.0 * i || sheet_cell_is_stale(loaded, cell)) wrong++;
+    }
+    TEST_ASSERT_EQ_INT(0, wrong, "Every loaded formula should end up current");
+    
+    // Saving values needs them current, pending or not
+    sheet_set_number(loaded, 0, 0, 5);
+    TEST_ASSERT(sheet_save_csv(loaded, filename, 0), "Values should save");
+    Sheet* values = sheet_new(count + 10, 10);
+    TEST_ASSERT(sheet_load_csv(values, filename, 0), "Values should load back");
+    TEST_ASSERT_EQ_DOUBLE(10.0, sheet_get_cell(values, 0, 1)->data.number, 0.001, "Saved value should follow the edit");
+    
+    sheet_free(values);
+    sheet_free(loaded);
+    remove(filename);
+}
+
+void test_workbook(void) {
+    TEST_SECTION("Workbooks");
+    
+    Workbook workbook;
+    workbook_init(&workbook, 0);
+    int data_index = workbook_add_sheet(&workbook, "Data", 100, 10);
+    int report_index = workbook_add_sheet(&workbook, "Report", 100, 10);
+    TEST_ASSERT(data_index >= 0 && report_index >= 0, "Sheets should be added");
+    TEST_ASSERT_EQ_INT(-1, workbook_add_sheet(&workbook, "data", 100, 10), "Names should be unique in any case");
+    TEST_ASSERT_EQ_INT(-1, workbook_add_sheet(&workbook, "It's", 100, 10), "Names should not hold quotes");
+    Sheet* data = workbook_sheet(&workbook, data_index);
+    Sheet* report = workbook_activate(&workbook, report_index);
+    TEST_ASSERT_EQ_STR("Data", data->name, "Sheet should carry its name");
+    
+    sheet_set_number(data, 0, 0, 5);
+    sheet_set_number(data, 0, 1, 7);
+    sheet_set_formula(report, 0, 0, "=Data!A1*2");
+    sheet_set_formula(report, 0, 1, "='Data'!B1+1");
+    sheet_set_formula(report, 0, 2, "=10+1");
+    TEST_ASSERT_EQ_INT(LL_OK, workbook_recalculate(&workbook), "Workbook should recalculate");
+    Cell* doubled = sheet_get_cell(report, 0, 0);
+    TEST_ASSERT_EQ_DOUBLE(10.0, doubled->data.formula.cached_value, 0.001, "Sheet!A1 should read the other sheet");
+    TEST_ASSERT_EQ_DOUBLE(8.0, sheet_get_cell(report, 0, 1)->data.formula.cached_value, 0.001, "Quoted sheet names should work");
+    
+    // An edit reaches only the formulas reading its column
+    Stats* stats = stats_get();
+    stats_reset(NULL);
+    sheet_set_number(data, 0, 0, 6);
+    TEST_ASSERT(workbook_recalc_pending(&workbook), "An edit should leave work pending");
+    TEST_ASSERT_EQ_INT(LL_OK, workbook_recalculate(&workbook), "Change should be passed on");
+    TEST_ASSERT_EQ_DOUBLE(12.0, doubled->data.formula.cached_value, 0.001, "Reader should follow the edit");
+    TEST_ASSERT_EQ_INT(1, (int)stats->formulas_evaluated, "Only the reader of the changed column should run");
+    TEST_ASSERT(!workbook_recalc_pending(&workbook), "Nothing should be left pending");
+    
+    // Changes that keep the stored kind still reach readers: new text, or
+    // one error turning into another
+    sheet_set_string(data, 0, 5, "old");
+    unsigned int text_version = data->column_versions[5];
+    sheet_set_string(data, 0, 5, "new");
+    TEST_ASSERT(data->column_versions[5] != text_version, "Edited text should move its column's version");
+    sheet_set_formula(data, 0, 4, "=1/G1");
+    sheet_set_formula(data, 0, 2, "=E1+0");
+    sheet_set_formula(report, 0, 4, "=Data!C1");
+    workbook_recalculate(&workbook);
+    TEST_ASSERT_EQ_INT(ERROR_DIV_ZERO, sheet_get_cell(report, 0, 4)->data.formula.error, "Reader should see the error");
+    sheet_set_formula(data, 0, 4, "=Missing!A1");
+    workbook_recalculate(&workbook);
+    TEST_ASSERT_EQ_INT(ERROR_REF, sheet_get_cell(report, 0, 4)->data.formula.error, "Reader should see the new error");
+    
+    // Outside a workbook or to an unknown sheet, the reference is broken
+    Sheet* standalone = sheet_new(10, 10);
+    sheet_set_formula(standalone, 0, 0, "=Data!A1");
+    sheet_recalculate(standalone);
+    TEST_ASSERT_EQ_INT(ERROR_REF, sheet_get_cell(standalone, 0, 0)->data.formula.error, "No workbook should give #REF!");
+    sheet_free(standalone);
+    sheet_set_formula(report, 1, 0, "=Missing!A1");
+    sheet_set_formula(report, 2, 0, "=Data!A1:A5");
+    workbook_recalculate(&workbook);
+    TEST_ASSERT_EQ_INT(ERROR_REF, sheet_get_cell(report, 1, 0)->data.formula.error, "Unknown sheet should give #REF!");
+    TEST_ASSERT_EQ_INT(ERROR_REF, sheet_get_cell(report, 2, 0)->data.formula.error, "Ranges on other sheets are not supported");
+    
+    // Strings of every sheet share one table
+    sheet_set_string(data, 5, 0, "Quarter");
+    sheet_set_string(report, 5, 0, "Quarter");
+    TEST_ASSERT(sheet_get_cell(data, 5, 0)->data.string == sheet_get_cell(report, 5, 0)->data.string,
+                "Equal text should be stored once");
+    
+    // Qualified references stay put when the reading sheet shifts
+    int q1 = workbook_add_sheet(&workbook, "Q1 Sales", 10, 10);
+    sheet_set_number(workbook_sheet(&workbook, q1), 0, 0, 4);
+    sheet_set_formula(report, 3, 0, "='Q1 Sales'!A1+A1");
+    sheet_insert_row(report, 0);
+    TEST_ASSERT_EQ_STR("=Data!A1*2", sheet_get_cell(report, 1, 0)->data.formula.expression, "Other sheet's reference should not shift");
+    TEST_ASSERT_EQ_STR("='Q1 Sales'!A1+A2", sheet_get_cell(report, 4, 0)->data.formula.expression, "Quoted names should not shift");
+    workbook_recalculate(&workbook);
+    TEST_ASSERT_EQ_DOUBLE(12.0, sheet_get_cell(report, 1, 0)->data.formula.cached_value, 0.001, "Shifted reader should still read Data");
+    TEST_ASSERT_EQ_DOUBLE(16.0, sheet_get_cell(report, 4, 0)->data.formula.cached_value, 0.001, "Quoted names with spaces should read");
+    
+    // File sheets are read in when a formula first needs them
+    const char* filename = "test_workbook.csv";
+    Sheet* source = sheet_new(10, 10);
+    sheet_set_number(source, 0, 0, 3);
+    TEST_ASSERT(sheet_save_csv(source, filename, 1), "Source sheet should save");
+    sheet_free(source);
+    int rates_index = workbook_add_file(&workbook, "Rates", filename, 10, 10);
+    int archive_index = workbook_add_file(&workbook, "Archive", filename, 10, 10);
+    TEST_ASSERT(rates_index >= 0 && archive_index >= 0, "File sheets should be added");
+    TEST_ASSERT(workbook.sheets[rates_index].sheet == NULL, "File sheets should wait until used");
+    sheet_set_formula(report, 0, 3, "=Rates!A1*10");
+    TEST_ASSERT_EQ_INT(LL_OK, workbook_recalculate(&workbook), "Reading an unloaded sheet should load it");
+    TEST_ASSERT(workbook.sheets[rates_index].sheet != NULL, "Read sheet should be loaded");
+    TEST_ASSERT(workbook.sheets[archive_index].sheet == NULL, "Unread sheet should stay unloaded");
+    TEST_ASSERT_EQ_DOUBLE(30.0, sheet_get_cell(report, 0, 3)->data.formula.cached_value, 0.001, "Reader should see the loaded value");
+    
+    // Over budget, only idle sheets nothing reads are dropped
+    TEST_ASSERT(workbook_sheet(&workbook, archive_index) != NULL, "Archive should load when asked for");
+    workbook.memory_budget = 1;
+    TEST_ASSERT_EQ_INT(1, workbook_trim(&workbook), "One sheet should be unloaded");
+    TEST_ASSERT(workbook.sheets[archive_index].sheet == NULL, "The unread file sheet should go");
+    TEST_ASSERT(workbook.sheets[rates_index].sheet != NULL, "A sheet still read should stay");
+    TEST_ASSERT(workbook.sheets[data_index].sheet != NULL, "A sheet with no file should stay");
+    Sheet* archive = workbook_sheet(&workbook, archive_index);
+    TEST_ASSERT(archive != NULL, "Unloaded sheet should read back in");
+    TEST_ASSERT_EQ_DOUBLE(3.0, sheet_get_cell(archive, 0, 0)->data.number, 0.001, "Reloaded sheet should keep its contents");
+    workbook.memory_budget = 0;
+    
+    // Sheets reading each other in a loop settle instead of running forever
+    int left = workbook_add_sheet(&workbook, "Left", 10, 10);
+    int right = workbook_add_sheet(&workbook, "Right", 10, 10);
+    sheet_set_formula(workbook_sheet(&workbook, left), 0, 0, "=Right!A1+1");
+    sheet_set_formula(workbook_sheet(&workbook, right), 0, 0, "=Left!A1+1");
+    workbook_recalculate(&workbook);
+    TEST_ASSERT(!workbook_recalc_pending(&workbook), "A loop between sheets should stop");
+    
+    workbook_free(&workbook);
+    remove(filename);
+}
+
+void test_circular_references(void) {
+    TEST_SECTION("Circular References");
+    
+    Sheet* sheet = sheet_new(100, 26);
+    
+    sheet_set_formula(sheet, 0, 0, "=B1+1");  // A1
+    sheet_set_formula(sheet, 0, 1, "=A1+1");  // B1
+    sheet_set_formula(sheet, 0, 2, "=A1*2");  // C1 reads the cycle
+    sheet_set_formula(sheet, 1, 0, "=A2");    // A2 reads itself
+    TEST_ASSERT_EQ_INT(LL_ERR_CIRCULAR_REF, sheet_recalculate(sheet), "Cycle should return LL_ERR_CIRCULAR_REF");
+    
+    Cell* cell = sheet_get_cell(sheet, 0, 0);
+    TEST_ASSERT_EQ_INT(ERROR_CIRCULAR, cell->data.formula.error, "A1 should be ERROR_CIRCULAR");
+    cell = sheet_get_cell(sheet, 0, 2);
+    TEST_ASSERT_EQ_INT(ERROR_CIRCULAR, cell->data.formula.error, "C1 downstream of the cycle should be ERROR_CIRCULAR");
+    cell = sheet_get_cell(sheet, 1, 0);
+    TEST_ASSERT_EQ_INT(ERROR_CIRCULAR, cell->data.formula.error, "Self reference should be ERROR_CIRCULAR");
+    TEST_ASSERT_EQ_STR("#CIRC!", sheet_get_display_value(sheet, 1, 0), "Circular cell should display #CIRC!");
+    
+    // Breaking the cycle recovers
+    sheet_set_number(sheet, 0, 1, 5.0);  // B1
+    sheet_set_number(sheet, 1, 0, 1.0);  // A2
+    TEST_ASSERT_EQ_INT(LL_OK, sheet_recalculate(sheet), "Broken cycle should return LL_OK");
+    cell = sheet_get_cell(sheet, 0, 2);
+    TEST_ASSERT_EQ_INT(ERROR_NONE, cell->data.formula.error, "C1 should recover");
+    TEST_ASSERT_EQ_DOUBLE(12.0, cell->data.formula.cached_value, 0.0001, "C1 should be (5+1)*2");
+    
+    // A range that includes its own cell is circular too
+    sheet_set_formula(sheet, 4, 4, "=SUM(E1:E5)");  // E5
+    TEST_ASSERT_EQ_INT(LL_ERR_CIRCULAR_REF, sheet_recalculate(sheet), "Range over itself should be circular");
+    sheet_free(sheet);
+    
+    // A formula added later that reads a cycle through a range is #CIRC! as
+    // well, as a full recalculation of the same sheet would make it
+    sheet = sheet_new(100, 26);
+    sheet_set_number(sheet, 5, 1, 1.0);                        // B6
+    sheet_set_formula(sheet, 7, 1, "=MODE(B2:B8)");            // B8
+    sheet_recalculate(sheet);
+    sheet_set_formula(sheet, 5, 4, "=AVG(B6:B8)+A11");         // E6
+    sheet_set_formula(sheet, 6, 4, "=E6+1");                   // E7
+    sheet_recalculate(sheet);
+    TEST_ASSERT_EQ_INT(ERROR_CIRCULAR, sheet_get_cell(sheet, 5, 4)->data.formula.error, "New reader of a cycle should be #CIRC!");
+    TEST_ASSERT_EQ_INT(ERROR_CIRCULAR, sheet_get_cell(sheet, 6, 4)->data.formula.error, "Its readers should be #CIRC! too");
+    
+    // Once the cycle is gone its readers recover
+    sheet_set_number(sheet, 7, 1, 1.0);
+    TEST_ASSERT_EQ_INT(LL_OK, sheet_recalculate(sheet), "Removed cycle should return LL_OK");
+    TEST_ASSERT_EQ_INT(ERROR_NONE, sheet_get_cell(sheet, 5, 4)->data.formula.error, "Reader should recover");
+    TEST_ASSERT_EQ_DOUBLE(2.0 / 3.0, sheet_get_cell(sheet, 5, 4)->data.formula.cached_value, 0.0001, "Reader should average B6:B8");
+    sheet_free(sheet);
+}
+
 // ============================================================================
 // EDGE CASE TESTS
 // ============================================================================
@@ -1702,6 +3601,9 @@ int main(void) {
     test_sheet_creation();
     test_sheet_get_cell();
     test_sheet_get_or_create_cell();
+    test_sparse_storage();
+    test_cell_pool_and_interning();
+    test_columnar_values();
     
     // Cell Operations
     test_cell_creation();
@@ -1723,24 +3625,34 @@ int main(void) {
     test_sum_function();
     test_avg_function();
     test_max_min_functions();
+    test_reduction_kernels();
     test_median_function();
     test_mode_function();
+    test_mode_median_large();
     test_if_function();
     test_power_function();
     test_xlookup_function();
+    test_xlookup_index();
+    test_shared_ranges();
+    test_memoized_aggregates();
+    test_stats_counters();
+    test_chart_extraction();
     test_nested_functions();
+    test_compiled_formulas();
     
     // Formatting
     test_percentage_format();
     test_currency_format();
     test_date_formats();
     test_time_formats();
+    test_display_cache();
     test_cell_colors();
     test_color_parsing();
     
     // Range Operations
     test_range_selection();
     test_range_copy_paste();
+    test_paste_text();
     test_clipboard_cell();
     
     // Column/Row Sizing
@@ -1752,11 +3664,18 @@ int main(void) {
     test_delete_row();
     test_insert_column();
     test_delete_column();
+    test_structural_reference_shift();
     
     // CSV Operations
     test_csv_save_load_flatten();
     test_csv_save_load_preserve();
     test_csv_special_characters();
+    test_csv_bulk_load();
+    test_csv_used_range_save();
+    test_background_autosave();
+    test_journal_recovery();
+    test_undo_history();
+    test_llb_round_trip();
     
     // Display Values
     test_display_values();
@@ -1767,6 +3686,12 @@ int main(void) {
     // Recalculation
     test_recalculation();
     test_recalc_after_clear();
+    test_dependency_recalc();
+    test_thread_pool();
+    test_recalc_steps();
+    test_lazy_load();
+    test_workbook();
+    test_circular_references();
     
     // Edge Cases
     test_edge_cases();
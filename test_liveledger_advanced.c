@@ -1,5 +1,5 @@
 // test_liveledger_advanced.c - Advanced Integration and Stress Tests for LiveLedger
-// Compile with: cl /O2 /W3 /TC test_liveledger_advanced.c sheet.c console.c charts.c /Fe:test_advanced.exe /link user32.lib
+// Compile with: cl /O2 /W3 /TC test_liveledger_advanced.c sheet.c formula.c cellstore.c pool.c reduce.c lookup.c autosave.c journal.c csvload.c llb.c threadpool.c undo.c ranges.c stats.c workbook.c console.c charts.c /Fe:test_advanced.exe /link user32.lib
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -174,6 +174,58 @@ void test_large_ranges(void) {
     sheet_free(sheet);
 }
 
+void test_ranges_beyond_old_limit(void) {
+    TEST_SECTION("Ranges Beyond 1000 Cells");
+    
+    Sheet* sheet = sheet_new(600000, 10);
+    
+    // Ranges used to be truncated to their first 1000 values
+    for (int i = 0; i < 5000; i++) {
+        sheet_set_number(sheet, i, 0, (double)(i + 1));
+    }
+    sheet_set_formula(sheet, 0, 1, "=SUM(A1:A5000)");
+    sheet_set_formula(sheet, 1, 1, "=AVG(A1:A5000)");
+    sheet_set_formula(sheet, 2, 1, "=MAX(A1:A5000)");
+    sheet_set_formula(sheet, 3, 1, "=MEDIAN(A1:A5000)");
+    sheet_set_formula(sheet, 4, 1, "=MIN(A2:A5000)");
+    sheet_recalculate(sheet);
+    
+    Cell* cell = sheet_get_cell(sheet, 0, 1);
+    TEST_ASSERT_EQ_DOUBLE(12502500.0, cell->data.formula.cached_value, 0.0001, "SUM of 1-5000 should be 12502500");
+    cell = sheet_get_cell(sheet, 1, 1);
+    TEST_ASSERT_EQ_DOUBLE(2500.5, cell->data.formula.cached_value, 0.0001, "AVG of 1-5000 should be 2500.5");
+    cell = sheet_get_cell(sheet, 2, 1);
+    TEST_ASSERT_EQ_DOUBLE(5000.0, cell->data.formula.cached_value, 0.0001, "MAX of 1-5000 should be 5000");
+    cell = sheet_get_cell(sheet, 3, 1);
+    TEST_ASSERT_EQ_DOUBLE(2500.5, cell->data.formula.cached_value, 0.0001, "MEDIAN of 1-5000 should be 2500.5");
+    cell = sheet_get_cell(sheet, 4, 1);
+    TEST_ASSERT_EQ_DOUBLE(2.0, cell->data.formula.cached_value, 0.0001, "MIN of 2-5000 should be 2");
+    
+    // MODE sees repeats past the first 1000 values
+    for (int i = 0; i < 1200; i++) {
+        sheet_set_number(sheet, i, 2, (double)(i + 1));
+    }
+    sheet_set_number(sheet, 1100, 2, 42.0);
+    sheet_set_number(sheet, 1101, 2, 42.0);
+    sheet_set_formula(sheet, 5, 3, "=MODE(C1:C1200)");
+    sheet_recalculate(sheet);
+    cell = sheet_get_cell(sheet, 5, 3);
+    TEST_ASSERT_EQ_DOUBLE(42.0, cell->data.formula.cached_value, 0.0001, "MODE should count repeats beyond 1000 cells");
+    
+    // Whole-column sums over sparse data, strings skipped, empty cells as 0
+    sheet_set_number(sheet, 599999, 4, 5.0);
+    sheet_set_string(sheet, 300000, 4, "note");
+    sheet_set_formula(sheet, 0, 5, "=SUM(E1:E600000)");
+    sheet_set_formula(sheet, 1, 5, "=AVG(E1:E600000)");
+    sheet_recalculate(sheet);
+    cell = sheet_get_cell(sheet, 0, 5);
+    TEST_ASSERT_EQ_DOUBLE(5.0, cell->data.formula.cached_value, 0.0001, "Column SUM should reach the last row");
+    cell = sheet_get_cell(sheet, 1, 5);
+    TEST_ASSERT_EQ_DOUBLE(5.0 / 599999.0, cell->data.formula.cached_value, 1e-12, "AVG should count empty cells but not strings");
+    
+    sheet_free(sheet);
+}
+
 void test_rectangular_ranges(void) {
     TEST_SECTION("Rectangular Ranges");
     
@@ -627,6 +679,136 @@ void test_stress_repeated_recalc(void) {
     sheet_free(sheet);
 }
 
+void test_stress_parallel_recalc(void) {
+    TEST_SECTION("Stress Test: Parallel Recalculation");
+    
+    const int count = 2000;
+    Sheet* parallel = sheet_new(count + 10, 10);
+    Sheet* serial = sheet_new(count + 10, 10);
+    sheet_set_recalc_threads(parallel, 4);
+    sheet_set_recalc_threads(serial, 1);
+    
+    // Wide levels: B and D depend only on A, C, E and F on B and D
+    Sheet* sheets[2] = { parallel, serial };
+    char formula[128];
+    for (int s = 0; s < 2; s++) {
+        for (int i = 0; i < count; i++) {
+            int row = i + 1;
+            sheet_set_number(sheets[s], i, 0, (double)row);
+            sprintf_s(formula, sizeof(formula), "=A%d*2+1", row);
+            sheet_set_formula(sheets[s], i, 1, formula);
+            sprintf_s(formula, sizeof(formula), "=IF(B%d>2000, \"big\", \"small\")", row);
+            sheet_set_formula(sheets[s], i, 2, formula);
+            sprintf_s(formula, sizeof(formula), "=XLOOKUP(A%d, A1:A%d, B1:B%d, 0)", row, count, count);
+            sheet_set_formula(sheets[s], i, 3, formula);
+            sprintf_s(formula, sizeof(formula), "=B%d+D%d", row, row);
+            sheet_set_formula(sheets[s], i, 4, formula);
+            sprintf_s(formula, sizeof(formula), "=XLOOKUP(B%d, B1:B%d, A1:A%d, 0)", row, count, count);
+            sheet_set_formula(sheets[s], i, 5, formula);
+        }
+    }
+    
+    for (int round = 0; round < 2; round++) {
+        DWORD start = GetTickCount();
+        sheet_recalculate(parallel);
+        DWORD parallel_time = GetTickCount() - start;
+        start = GetTickCount();
+        sheet_recalculate(serial);
+        DWORD serial_time = GetTickCount() - start;
+        printf("  INFO: Recalculating %d formulas took %lu ms in parallel, %lu ms serially\n",
+               count * 5, parallel_time, serial_time);
+        
+        int mismatches = 0;
+        for (int i = 0; i < count; i++) {
+            for (int col = 1; col <= 5; col++) {
+                if (strcmp(sheet_get_display_value(parallel, i, col), sheet_get_display_value(serial, i, col)) != 0) {
+                    mismatches++;
+                }
+            }
+        }
+        TEST_ASSERT_EQ_INT(0, mismatches, "Parallel results should match serial results");
+        
+        double a = sheet_get_cell(parallel, count - 1, 0)->data.number;
+        TEST_ASSERT_EQ_DOUBLE(2 * a + 1, sheet_get_cell(parallel, count - 1, 1)->data.formula.cached_value, 0.0001, "Level one should be evaluated");
+        TEST_ASSERT_EQ_DOUBLE(4 * a + 2, sheet_get_cell(parallel, count - 1, 4)->data.formula.cached_value, 0.0001, "Level two should see level one");
+        TEST_ASSERT_EQ_DOUBLE(a, sheet_get_cell(parallel, count - 1, 5)->data.formula.cached_value, 0.0001, "Lookups over recalculated cells should use fresh values");
+        TEST_ASSERT_EQ_STR(2 * a + 1 > 2000 ? "big" : "small", sheet_get_display_value(parallel, count - 1, 2),
+                           "String results should be kept per cell");
+        a = sheet_get_cell(parallel, 0, 0)->data.number;
+        TEST_ASSERT_EQ_STR(2 * a + 1 > 2000 ? "big" : "small", sheet_get_display_value(parallel, 0, 2),
+                           "String results should be kept per cell");
+        
+        // Second round: every input changes
+        for (int s = 0; s < 2; s++) {
+            for (int i = 0; i < count; i++) {
+                sheet_set_number(sheets[s], i, 0, (double)(count - i) * 3);
+            }
+        }
+    }
+    
+    sheet_free(parallel);
+    sheet_free(serial);
+}
+
+void test_stress_structural_edits(void) {
+    TEST_SECTION("Stress Test: Inserts and Deletes Among Formulas");
+    
+    // Every insert or delete patches the live graph in place; a sheet
+    // rebuilt from the rewritten text must agree with it
+    const int size = 40;
+    Sheet* sheet = sheet_new(size, size);
+    for (int row = 0; row < size / 2; row++) {
+        char formula[64];
+        sheet_set_number(sheet, row, 0, row + 1);
+        sprintf_s(formula, sizeof(formula), "=A%d*2+B%d", row + 1, row > 0 ? row : 1);
+        sheet_set_formula(sheet, row, 2, formula);
+        sprintf_s(formula, sizeof(formula), "=SUM(A%d:C%d)", row + 1, row + 5);
+        sheet_set_formula(sheet, row, 3, formula);
+    }
+    sheet_set_formula(sheet, 0, 5, "=SUM(C1:D20)+XLOOKUP(3,A1:A20,C1:C20)");
+    sheet_recalculate(sheet);
+    
+    unsigned int seed = 12345;
+    int mismatches = 0;
+    for (int round = 0; round < 60; round++) {
+        seed = seed * 1103515245 + 12345;
+        int at = (int)((seed >> 16) % (size / 2));
+        switch ((seed >> 8) % 4) {
+            case 0: sheet_insert_row(sheet, at); break;
+            case 1: sheet_delete_row(sheet, at); break;
+            case 2: sheet_insert_column(sheet, at % 6); break;
+            default: sheet_delete_column(sheet, at % 6); break;
+        }
+        sheet_set_number(sheet, at, 0, round);
+        sheet_recalculate(sheet);
+        
+        Sheet* rebuilt = sheet_new(size, size);
+        CellIterator it;
+        Cell* cell;
+        sheet_iter_begin(sheet, &it);
+        while ((cell = sheet_iter_next(&it)) != NULL) {
+            if (cell->type == CELL_NUMBER) sheet_set_number(rebuilt, cell->row, cell->col, cell->data.number);
+            else if (cell->type == CELL_FORMULA) sheet_set_formula(rebuilt, cell->row, cell->col, cell->data.formula.expression);
+        }
+        sheet_recalculate(rebuilt);
+        
+        sheet_iter_begin(sheet, &it);
+        while ((cell = sheet_iter_next(&it)) != NULL) {
+            if (cell->type != CELL_FORMULA) continue;
+            Cell* other = sheet_get_cell(rebuilt, cell->row, cell->col);
+            if (cell->data.formula.error != other->data.formula.error ||
+                (cell->data.formula.error == ERROR_NONE &&
+                 fabs(cell->data.formula.cached_value - other->data.formula.cached_value) > 1e-9)) {
+                mismatches++;
+            }
+        }
+        sheet_free(rebuilt);
+    }
+    TEST_ASSERT_EQ_INT(0, mismatches, "Shifted sheet should match one rebuilt from its formulas");
+    
+    sheet_free(sheet);
+}
+
 void test_stress_csv_large(void) {
     TEST_SECTION("Stress Test: Large CSV");
     
@@ -749,6 +931,7 @@ int main(void) {
     test_complex_formula_chains();
     test_cross_references();
     test_large_ranges();
+    test_ranges_beyond_old_limit();
     test_rectangular_ranges();
     
     // IF Function Advanced
@@ -775,6 +958,8 @@ int main(void) {
     test_stress_many_cells();
     test_stress_many_formulas();
     test_stress_repeated_recalc();
+    test_stress_parallel_recalc();
+    test_stress_structural_edits();
     test_stress_csv_large();
     
     // Memory Tests
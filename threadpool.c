@@ -0,0 +1,159 @@
+// threadpool.c - Worker threads that share out a run of items
+//
+// Each job's items are cut into one contiguous share per participant. A
+// participant claims batches from the front of its own share, and once that
+// is empty it steals batches from the others' shares in turn, so threads
+// that draw cheap items end up helping with the expensive ones. Claims are a
+// single atomic add, which both owners and thieves use.
+#include <windows.h>
+#include <stdlib.h>
+#include "threadpool.h"
+#include "constants.h"
+
+typedef struct {
+    volatile LONG next;         // Next unclaimed item (may overshoot end)
+    LONG end;
+    char padding[64 - 2 * sizeof(LONG)];   // Shares sit on separate cache lines
+} PoolShare;
+
+typedef struct {
+    struct ThreadPool* pool;
+    int index;                  // Participant number; 0 is the calling thread
+    HANDLE thread;
+    HANDLE start_event;
+} PoolWorker;
+
+struct ThreadPool {
+    int size;                   // Participants, including the calling thread
+    PoolWorker* workers;        // size - 1 background threads
+    PoolShare* shares;          // One per participant
+    HANDLE done_event;
+    volatile LONG remaining;    // Workers still busy with the current job
+    volatile LONG shutdown;
+    ThreadPoolTask task;
+    void* context;
+};
+
+static int claim(PoolShare* share, int* begin, int* end) {
+    LONG start = InterlockedExchangeAdd(&share->next, THREAD_POOL_BATCH);
+    if (start >= share->end) return 0;
+
+    *begin = (int)start;
+    *end = (int)(share->end - start > THREAD_POOL_BATCH ? start + THREAD_POOL_BATCH : share->end);
+    return 1;
+}
+
+// Own share first, then everyone else's
+static void pool_work(ThreadPool* pool, int self) {
+    int begin, end;
+    for (int k = 0; k < pool->size; k++) {
+        PoolShare* share = &pool->shares[(self + k) % pool->size];
+        while (claim(share, &begin, &end)) {
+            pool->task(pool->context, begin, end);
+        }
+    }
+}
+
+static DWORD WINAPI pool_worker_main(LPVOID param) {
+    PoolWorker* worker = (PoolWorker*)param;
+    ThreadPool* pool = worker->pool;
+
+    for (;;) {
+        WaitForSingleObject(worker->start_event, INFINITE);
+        if (pool->shutdown) break;
+
+        pool_work(pool, worker->index);
+        if (InterlockedDecrement(&pool->remaining) == 0) {
+            SetEvent(pool->done_event);
+        }
+    }
+    return 0;
+}
+
+ThreadPool* thread_pool_create(int thread_count) {
+    if (thread_count <= 0) {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        thread_count = (int)info.dwNumberOfProcessors;
+    }
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > THREAD_POOL_MAX_THREADS) thread_count = THREAD_POOL_MAX_THREADS;
+
+    ThreadPool* pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    if (!pool) return NULL;
+    pool->shares = (PoolShare*)calloc(thread_count, sizeof(PoolShare));
+    pool->workers = (PoolWorker*)calloc(thread_count, sizeof(PoolWorker));
+    pool->done_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!pool->shares || !pool->workers || !pool->done_event) {
+        if (pool->done_event) CloseHandle(pool->done_event);
+        free(pool->shares);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+
+    // Run with however many threads could be started
+    pool->size = 1;
+    for (int i = 1; i < thread_count; i++) {
+        PoolWorker* worker = &pool->workers[i - 1];
+        worker->pool = pool;
+        worker->index = i;
+        worker->start_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (!worker->start_event) break;
+
+        worker->thread = CreateThread(NULL, 0, pool_worker_main, worker, 0, NULL);
+        if (!worker->thread) {
+            CloseHandle(worker->start_event);
+            worker->start_event = NULL;
+            break;
+        }
+        pool->size++;
+    }
+    return pool;
+}
+
+void thread_pool_destroy(ThreadPool* pool) {
+    if (!pool) return;
+
+    pool->shutdown = 1;
+    for (int i = 0; i < pool->size - 1; i++) {
+        SetEvent(pool->workers[i].start_event);
+    }
+    for (int i = 0; i < pool->size - 1; i++) {
+        WaitForSingleObject(pool->workers[i].thread, INFINITE);
+        CloseHandle(pool->workers[i].thread);
+        CloseHandle(pool->workers[i].start_event);
+    }
+
+    CloseHandle(pool->done_event);
+    free(pool->shares);
+    free(pool->workers);
+    free(pool);
+}
+
+int thread_pool_size(const ThreadPool* pool) {
+    return pool->size;
+}
+
+void thread_pool_run(ThreadPool* pool, int count, ThreadPoolTask task, void* context) {
+    if (count <= 0) return;
+
+    pool->task = task;
+    pool->context = context;
+    for (int i = 0; i < pool->size; i++) {
+        pool->shares[i].next = (LONG)((long long)count * i / pool->size);
+        pool->shares[i].end = (LONG)((long long)count * (i + 1) / pool->size);
+    }
+
+    if (pool->size == 1) {
+        pool_work(pool, 0);
+        return;
+    }
+
+    pool->remaining = pool->size - 1;
+    for (int i = 0; i < pool->size - 1; i++) {
+        SetEvent(pool->workers[i].start_event);
+    }
+    pool_work(pool, 0);
+    WaitForSingleObject(pool->done_event, INFINITE);
+}
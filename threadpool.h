@@ -0,0 +1,19 @@
+// threadpool.h - Worker threads that share out a run of items
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+// Processes items begin..end-1 of the current job
+typedef void (*ThreadPoolTask)(void* context, int begin, int end);
+
+typedef struct ThreadPool ThreadPool;
+
+// thread_count includes the calling thread; 0 means one per processor
+ThreadPool* thread_pool_create(int thread_count);
+void thread_pool_destroy(ThreadPool* pool);
+int thread_pool_size(const ThreadPool* pool);
+
+// Run task over items 0..count-1 and return once every item is done. The
+// calling thread takes part. Not re-entrant: one job at a time per pool.
+void thread_pool_run(ThreadPool* pool, int count, ThreadPoolTask task, void* context);
+
+#endif // THREADPOOL_H
@@ -0,0 +1,655 @@
+// undo.c - Undo history kept as compact diffs under a memory budget
+//
+// While a record is open, each noted position has its state captured in
+// full. Committing compares every capture with the position's new state and
+// encodes one entry per position that changed, back to back:
+//
+//   CELL    <row> <col> <mask> then, per field in mask, old value, new value
+//   COLUMN  <col> <old width> <new width>
+//   ROW     <row> <old height> <new height>
+//
+// Content is a type byte and its payload: a double, the interned pointer of
+// string cell text, or formula text stored inline. Undo applies old values
+// last entry first; redo applies new values first entry first.
+#include <stdlib.h>
+#include <string.h>
+#include "undo.h"
+#include "constants.h"
+
+enum {
+    UNDO_ENTRY_CELL,
+    UNDO_ENTRY_COLUMN,
+    UNDO_ENTRY_ROW
+};
+
+// Cell fields an entry can carry
+#define UNDO_FIELD_CONTENT      0x01
+#define UNDO_FIELD_FORMAT       0x02
+#define UNDO_FIELD_TEXT_COLOR   0x04
+#define UNDO_FIELD_BACKGROUND   0x08
+
+#define UNDO_INITIAL_CAPTURES   16
+
+// A cell's undoable state; text is borrowed from wherever it lives
+typedef struct {
+    CellType type;
+    double number;
+    const char* text;           // String cell (interned) or formula text
+    DataFormat format;
+    FormatStyle format_style;
+    int text_color;
+    int background_color;
+} UndoCellState;
+
+// Appends to data, or only measures when data is NULL
+typedef struct {
+    unsigned char* data;
+    size_t size;
+} UndoWriter;
+
+typedef struct {
+    const unsigned char* data;
+    size_t offset;
+} UndoReader;
+
+static void write_bytes(UndoWriter* writer, const void* bytes, size_t length) {
+    if (writer->data) memcpy(writer->data + writer->size, bytes, length);
+    writer->size += length;
+}
+
+static void write_byte(UndoWriter* writer, int value) {
+    unsigned char byte = (unsigned char)value;
+    write_bytes(writer, &byte, 1);
+}
+
+static void write_int(UndoWriter* writer, int value) {
+    write_bytes(writer, &value, sizeof(value));
+}
+
+static void read_bytes(UndoReader* reader, void* bytes, size_t length) {
+    memcpy(bytes, reader->data + reader->offset, length);
+    reader->offset += length;
+}
+
+static int read_byte(UndoReader* reader) {
+    return reader->data[reader->offset++];
+}
+
+static int read_signed_byte(UndoReader* reader) {
+    return (signed char)reader->data[reader->offset++];
+}
+
+static int read_int(UndoReader* reader) {
+    int value;
+    read_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static size_t record_bytes(const UndoRecord* record) {
+    return sizeof(UndoRecord) + record->size;
+}
+
+static void record_free(UndoRecord* record) {
+    free(record->data);
+    record->data = NULL;
+    record->size = 0;
+    record->entry_count = 0;
+}
+
+// Drop records[first ..] (the redo branch, or everything)
+static void history_truncate(UndoHistory* history, int first) {
+    for (int i = first; i < history->count; i++) {
+        history->bytes -= record_bytes(&history->records[i]);
+        record_free(&history->records[i]);
+    }
+    history->count = first;
+    if (history->current > first) history->current = first;
+}
+
+static void history_drop_oldest(UndoHistory* history) {
+    history->bytes -= record_bytes(&history->records[0]);
+    record_free(&history->records[0]);
+    memmove(&history->records[0], &history->records[1], sizeof(UndoRecord) * (history->count - 1));
+    history->count--;
+    if (history->current > 0) history->current--;
+}
+
+static void history_trim(UndoHistory* history) {
+    while (history->count > 0 && history->bytes > history->budget) {
+        history_drop_oldest(history);
+    }
+}
+
+void undo_history_init(UndoHistory* history, size_t budget, Journal* journal) {
+    memset(history, 0, sizeof(*history));
+    history->budget = budget;
+    history->coalesce_ms = UNDO_COALESCE_MS;
+    history->journal = journal;
+}
+
+void undo_history_free(UndoHistory* history) {
+    history_truncate(history, 0);
+    free(history->records);
+    free(history->captures);
+    free(history->capture_text);
+    memset(history, 0, sizeof(*history));
+}
+
+void undo_history_clear(UndoHistory* history) {
+    history_truncate(history, 0);
+    history->open = 0;
+    history->capture_count = 0;
+    history->capture_text_size = 0;
+    history->failed = 0;
+}
+
+void undo_set_budget(UndoHistory* history, size_t budget) {
+    history->budget = budget;
+    history_trim(history);
+}
+
+// Current state of a cell; a missing cell reads as an empty default one
+static void cell_state_read(Sheet* sheet, int row, int col, UndoCellState* state) {
+    Cell* cell = sheet_get_cell(sheet, row, col);
+    memset(state, 0, sizeof(*state));
+    state->type = CELL_EMPTY;
+    state->format = FORMAT_GENERAL;
+    state->text_color = -1;
+    state->background_color = -1;
+    if (!cell) return;
+
+    state->type = cell->type;
+    state->format = cell->format;
+    state->format_style = cell->format_style;
+    state->text_color = cell->text_color;
+    state->background_color = cell->background_color;
+    switch (cell->type) {
+        case CELL_NUMBER:
+            state->number = cell->data.number;
+            break;
+        case CELL_STRING:
+            state->text = cell->data.string;
+            if (!cell->is_interned) {
+                state->text = string_table_intern(sheet->string_pool, cell->data.string);
+            }
+            break;
+        case CELL_FORMULA:
+            state->text = cell->data.formula.expression ? cell->data.formula.expression : "";
+            break;
+        default:
+            break;
+    }
+}
+
+static int content_equal(const UndoCellState* a, const UndoCellState* b) {
+    if (a->type != b->type) return 0;
+    switch (a->type) {
+        case CELL_NUMBER:
+            return memcmp(&a->number, &b->number, sizeof(a->number)) == 0;
+        case CELL_STRING:
+            return a->text == b->text;  // Same table, so equal text is the same pointer
+        case CELL_FORMULA:
+            return strcmp(a->text, b->text) == 0;
+        default:
+            return 1;
+    }
+}
+
+static int cell_state_diff(const UndoCellState* before, const UndoCellState* after) {
+    int mask = 0;
+    if (!content_equal(before, after)) mask |= UNDO_FIELD_CONTENT;
+    if (before->format != after->format || before->format_style != after->format_style) {
+        mask |= UNDO_FIELD_FORMAT;
+    }
+    if (before->text_color != after->text_color) mask |= UNDO_FIELD_TEXT_COLOR;
+    if (before->background_color != after->background_color) mask |= UNDO_FIELD_BACKGROUND;
+    return mask;
+}
+
+static void write_content(UndoWriter* writer, const UndoCellState* state) {
+    write_byte(writer, state->type);
+    switch (state->type) {
+        case CELL_NUMBER:
+            write_bytes(writer, &state->number, sizeof(state->number));
+            break;
+        case CELL_STRING:
+            write_bytes(writer, &state->text, sizeof(state->text));
+            break;
+        case CELL_FORMULA: {
+            int length = (int)strlen(state->text) + 1;
+            write_int(writer, length);
+            write_bytes(writer, state->text, length);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Formula text is returned in place, pointing into the record
+static void read_content(UndoReader* reader, UndoCellState* state) {
+    state->type = (CellType)read_byte(reader);
+    switch (state->type) {
+        case CELL_NUMBER:
+            read_bytes(reader, &state->number, sizeof(state->number));
+            break;
+        case CELL_STRING:
+            read_bytes(reader, &state->text, sizeof(state->text));
+            break;
+        case CELL_FORMULA: {
+            int length = read_int(reader);
+            state->text = (const char*)(reader->data + reader->offset);
+            reader->offset += length;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// One field pair per bit of mask, old value first
+static void write_cell_entry(UndoWriter* writer, int row, int col, int mask,
+                             const UndoCellState* before, const UndoCellState* after) {
+    const UndoCellState* states[2] = { before, after };
+    write_byte(writer, UNDO_ENTRY_CELL);
+    write_int(writer, row);
+    write_int(writer, col);
+    write_byte(writer, mask);
+    if (mask & UNDO_FIELD_CONTENT) {
+        for (int i = 0; i < 2; i++) write_content(writer, states[i]);
+    }
+    if (mask & UNDO_FIELD_FORMAT) {
+        for (int i = 0; i < 2; i++) {
+            write_byte(writer, states[i]->format);
+            write_byte(writer, states[i]->format_style);
+        }
+    }
+    if (mask & UNDO_FIELD_TEXT_COLOR) {
+        for (int i = 0; i < 2; i++) write_byte(writer, states[i]->text_color);
+    }
+    if (mask & UNDO_FIELD_BACKGROUND) {
+        for (int i = 0; i < 2; i++) write_byte(writer, states[i]->background_color);
+    }
+}
+
+// Decoded cell entry; only the fields in mask are set
+typedef struct {
+    int kind;
+    int row, col;
+    int mask;
+    UndoCellState state[2];     // Old, new
+    int size[2];                // Column width or row height, old and new
+} UndoEntry;
+
+static void read_entry(UndoReader* reader, UndoEntry* entry) {
+    entry->kind = read_byte(reader);
+    if (entry->kind != UNDO_ENTRY_CELL) {
+        entry->row = entry->col = read_int(reader);
+        entry->size[0] = read_int(reader);
+        entry->size[1] = read_int(reader);
+        return;
+    }
+
+    entry->row = read_int(reader);
+    entry->col = read_int(reader);
+    entry->mask = read_byte(reader);
+    if (entry->mask & UNDO_FIELD_CONTENT) {
+        for (int i = 0; i < 2; i++) read_content(reader, &entry->state[i]);
+    }
+    if (entry->mask & UNDO_FIELD_FORMAT) {
+        for (int i = 0; i < 2; i++) {
+            entry->state[i].format = (DataFormat)read_byte(reader);
+            entry->state[i].format_style = (FormatStyle)read_byte(reader);
+        }
+    }
+    if (entry->mask & UNDO_FIELD_TEXT_COLOR) {
+        for (int i = 0; i < 2; i++) entry->state[i].text_color = read_signed_byte(reader);
+    }
+    if (entry->mask & UNDO_FIELD_BACKGROUND) {
+        for (int i = 0; i < 2; i++) entry->state[i].background_color = read_signed_byte(reader);
+    }
+}
+
+static UndoCapture* capture_add(UndoHistory* history, int kind, int row, int col) {
+    if (history->capture_count >= history->capture_capacity) {
+        int new_capacity = history->capture_capacity ? history->capture_capacity * 2 : UNDO_INITIAL_CAPTURES;
+        UndoCapture* grown = (UndoCapture*)realloc(history->captures, sizeof(UndoCapture) * new_capacity);
+        if (!grown) {
+            history->failed = 1;
+            return NULL;
+        }
+        history->captures = grown;
+        history->capture_capacity = new_capacity;
+    }
+
+    UndoCapture* capture = &history->captures[history->capture_count++];
+    memset(capture, 0, sizeof(*capture));
+    capture->kind = kind;
+    capture->row = row;
+    capture->col = col;
+    return capture;
+}
+
+static int capture_store_text(UndoHistory* history, const char* text, size_t* offset) {
+    size_t length = strlen(text) + 1;
+    if (history->capture_text_size + length > history->capture_text_capacity) {
+        size_t new_capacity = history->capture_text_capacity ? history->capture_text_capacity : 1024;
+        while (new_capacity < history->capture_text_size + length) new_capacity *= 2;
+        char* grown = (char*)realloc(history->capture_text, new_capacity);
+        if (!grown) {
+            history->failed = 1;
+            return 0;
+        }
+        history->capture_text = grown;
+        history->capture_text_capacity = new_capacity;
+    }
+
+    *offset = history->capture_text_size;
+    memcpy(history->capture_text + history->capture_text_size, text, length);
+    history->capture_text_size += length;
+    return 1;
+}
+
+static void capture_set_state(UndoHistory* history, UndoCapture* capture, const UndoCellState* state) {
+    capture->type = state->type;
+    capture->number = state->number;
+    capture->format = state->format;
+    capture->format_style = state->format_style;
+    capture->text_color = state->text_color;
+    capture->background_color = state->background_color;
+    if (state->type == CELL_STRING) {
+        capture->string = state->text;
+        if (!state->text) history->failed = 1;  // Text could not be interned
+    } else if (state->type == CELL_FORMULA) {
+        capture_store_text(history, state->text, &capture->formula);
+    }
+}
+
+static void capture_get_state(const UndoHistory* history, const UndoCapture* capture, UndoCellState* state) {
+    state->type = capture->type;
+    state->number = capture->number;
+    state->text = capture->type == CELL_STRING ? capture->string
+                : capture->type == CELL_FORMULA ? history->capture_text + capture->formula : NULL;
+    state->format = capture->format;
+    state->format_style = capture->format_style;
+    state->text_color = capture->text_color;
+    state->background_color = capture->background_color;
+}
+
+static int size_read(Sheet* sheet, int kind, int index) {
+    return kind == UNDO_ENTRY_COLUMN ? sheet_get_column_width(sheet, index) : sheet_get_row_height(sheet, index);
+}
+
+// Turn the newest record back into captures so typing can join it. Fields
+// it left alone are captured as they are now.
+static void history_reopen_last(UndoHistory* history, Sheet* sheet) {
+    UndoRecord* record = &history->records[history->count - 1];
+    UndoReader reader = { record->data, 0 };
+    for (int i = 0; i < record->entry_count && !history->failed; i++) {
+        UndoEntry entry;
+        read_entry(&reader, &entry);
+        UndoCapture* capture = capture_add(history, entry.kind, entry.row, entry.col);
+        if (!capture) break;
+        if (entry.kind != UNDO_ENTRY_CELL) {
+            capture->size = entry.size[0];
+            continue;
+        }
+
+        UndoCellState state;
+        cell_state_read(sheet, entry.row, entry.col, &state);
+        if (entry.mask & UNDO_FIELD_CONTENT) {
+            state.type = entry.state[0].type;
+            state.number = entry.state[0].number;
+            state.text = entry.state[0].text;
+        }
+        if (entry.mask & UNDO_FIELD_FORMAT) {
+            state.format = entry.state[0].format;
+            state.format_style = entry.state[0].format_style;
+        }
+        if (entry.mask & UNDO_FIELD_TEXT_COLOR) state.text_color = entry.state[0].text_color;
+        if (entry.mask & UNDO_FIELD_BACKGROUND) state.background_color = entry.state[0].background_color;
+        capture_set_state(history, capture, &state);
+    }
+    history_truncate(history, history->count - 1);
+}
+
+void undo_begin(UndoHistory* history, Sheet* sheet, const char* description, int typed) {
+    if (history->open) undo_commit(history, sheet);
+
+    // Typing only joins the newest record, never one exposed by undo
+    int at_end = history->current == history->count;
+    history_truncate(history, history->current);
+    history->open = 1;
+    history->open_description = description;
+    history->open_typed = typed;
+    history->capture_count = 0;
+    history->capture_text_size = 0;
+    history->failed = 0;
+
+    if (typed && at_end && history->coalesce_ms > 0 && history->count > 0) {
+        UndoRecord* last = &history->records[history->count - 1];
+        if (last->typed && GetTickCount() - last->last_edit <= history->coalesce_ms) {
+            history->open_description = "Typing";
+            history_reopen_last(history, sheet);
+        }
+    }
+}
+
+static void note_cell(UndoHistory* history, Sheet* sheet, int row, int col) {
+    UndoCapture* capture = capture_add(history, UNDO_ENTRY_CELL, row, col);
+    if (capture) {
+        UndoCellState state;
+        cell_state_read(sheet, row, col, &state);
+        capture_set_state(history, capture, &state);
+    }
+}
+
+void undo_note_cell(UndoHistory* history, Sheet* sheet, int row, int col) {
+    if (!history->open) return;
+    if (history->journal) journal_touch_cell(history->journal, row, col);
+
+    // A position keeps the state it had when first noted
+    for (int i = 0; i < history->capture_count; i++) {
+        UndoCapture* capture = &history->captures[i];
+        if (capture->kind == UNDO_ENTRY_CELL && capture->row == row && capture->col == col) return;
+    }
+    note_cell(history, sheet, row, col);
+}
+
+void undo_note_range(UndoHistory* history, Sheet* sheet, int start_row, int start_col, int end_row, int end_col) {
+    if (!history->open) return;
+    if (end_row >= sheet->rows) end_row = sheet->rows - 1;
+    if (end_col >= sheet->cols) end_col = sheet->cols - 1;
+    if (history->journal) journal_touch_range(history->journal, start_row, start_col, end_row, end_col);
+
+    for (int row = start_row; row <= end_row && !history->failed; row++) {
+        for (int col = start_col; col <= end_col && !history->failed; col++) {
+            note_cell(history, sheet, row, col);
+        }
+    }
+}
+
+static void note_sizes(UndoHistory* history, Sheet* sheet, int kind, int start, int end) {
+    for (int index = start; index <= end && !history->failed; index++) {
+        UndoCapture* capture = capture_add(history, kind, index, index);
+        if (capture) capture->size = size_read(sheet, kind, index);
+    }
+}
+
+void undo_note_columns(UndoHistory* history, Sheet* sheet, int start_col, int end_col) {
+    if (!history->open) return;
+    if (history->journal) journal_touch_columns(history->journal, start_col, end_col);
+    note_sizes(history, sheet, UNDO_ENTRY_COLUMN, start_col, end_col);
+}
+
+void undo_note_rows(UndoHistory* history, Sheet* sheet, int start_row, int end_row) {
+    if (!history->open) return;
+    if (history->journal) journal_touch_rows(history->journal, start_row, end_row);
+    note_sizes(history, sheet, UNDO_ENTRY_ROW, start_row, end_row);
+}
+
+// Encode every capture that changed; returns the number of entries
+static int encode_captures(UndoHistory* history, Sheet* sheet, UndoWriter* writer) {
+    int entries = 0;
+    for (int i = 0; i < history->capture_count; i++) {
+        const UndoCapture* capture = &history->captures[i];
+        if (capture->kind != UNDO_ENTRY_CELL) {
+            int size = size_read(sheet, capture->kind, capture->row);
+            if (size == capture->size) continue;
+            write_byte(writer, capture->kind);
+            write_int(writer, capture->row);
+            write_int(writer, capture->size);
+            write_int(writer, size);
+            entries++;
+            continue;
+        }
+
+        UndoCellState before, after;
+        capture_get_state(history, capture, &before);
+        cell_state_read(sheet, capture->row, capture->col, &after);
+        if (after.type == CELL_STRING && !after.text) {
+            history->failed = 1;
+            return 0;
+        }
+        int mask = cell_state_diff(&before, &after);
+        if (!mask) continue;
+        write_cell_entry(writer, capture->row, capture->col, mask, &before, &after);
+        entries++;
+    }
+    return entries;
+}
+
+int undo_commit(UndoHistory* history, Sheet* sheet) {
+    if (!history->open) return 1;
+    history->open = 0;
+
+    // Measure, then encode into a buffer of exactly that size
+    UndoWriter writer = { NULL, 0 };
+    int entries = history->failed ? 0 : encode_captures(history, sheet, &writer);
+    UndoRecord record = { history->open_description, history->open_typed, GetTickCount(), NULL, 0, entries };
+    if (!history->failed && writer.size > 0) {
+        record.data = (unsigned char*)malloc(writer.size);
+        if (record.data) {
+            writer.data = record.data;
+            writer.size = 0;
+            encode_captures(history, sheet, &writer);
+            record.size = writer.size;
+        } else {
+            history->failed = 1;
+        }
+    }
+
+    if (!history->failed && history->count >= history->capacity) {
+        int new_capacity = history->capacity ? history->capacity * 2 : UNDO_INITIAL_CAPTURES;
+        UndoRecord* grown = (UndoRecord*)realloc(history->records, sizeof(UndoRecord) * new_capacity);
+        if (grown) {
+            history->records = grown;
+            history->capacity = new_capacity;
+        } else {
+            history->failed = 1;
+        }
+    }
+
+    history->capture_count = 0;
+    history->capture_text_size = 0;
+
+    // Without this record the older ones no longer line up with the sheet
+    if (history->failed) {
+        free(record.data);
+        history_truncate(history, 0);
+        return 0;
+    }
+
+    history->records[history->count++] = record;
+    history->current = history->count;
+    history->bytes += record_bytes(&record);
+    history_trim(history);
+    return history->count > 0;
+}
+
+static void apply_entry(UndoHistory* history, Sheet* sheet, const UndoEntry* entry, int side) {
+    if (entry->kind == UNDO_ENTRY_COLUMN) {
+        sheet_set_column_width(sheet, entry->col, entry->size[side]);
+        if (history->journal) journal_touch_columns(history->journal, entry->col, entry->col);
+        return;
+    }
+    if (entry->kind == UNDO_ENTRY_ROW) {
+        sheet_set_row_height(sheet, entry->row, entry->size[side]);
+        if (history->journal) journal_touch_rows(history->journal, entry->row, entry->row);
+        return;
+    }
+
+    const UndoCellState* state = &entry->state[side];
+    if (history->journal) journal_touch_cell(history->journal, entry->row, entry->col);
+
+    // Content goes through the sheet so dependencies are re-registered
+    if (entry->mask & UNDO_FIELD_CONTENT) {
+        switch (state->type) {
+            case CELL_NUMBER:
+                sheet_set_number(sheet, entry->row, entry->col, state->number);
+                break;
+            case CELL_STRING:
+                sheet_set_string(sheet, entry->row, entry->col, state->text);
+                break;
+            case CELL_FORMULA:
+                sheet_set_formula(sheet, entry->row, entry->col, state->text);
+                break;
+            default:
+                sheet_clear_cell(sheet, entry->row, entry->col);
+                break;
+        }
+    }
+
+    if (entry->mask & (UNDO_FIELD_FORMAT | UNDO_FIELD_TEXT_COLOR | UNDO_FIELD_BACKGROUND)) {
+        Cell* cell = sheet_get_or_create_cell(sheet, entry->row, entry->col);
+        if (!cell) return;
+        if (entry->mask & UNDO_FIELD_FORMAT) cell_set_format(cell, state->format, state->format_style);
+        if (entry->mask & UNDO_FIELD_TEXT_COLOR) cell_set_text_color(cell, state->text_color);
+        if (entry->mask & UNDO_FIELD_BACKGROUND) cell_set_background_color(cell, state->background_color);
+    }
+}
+
+// side 0 restores old values in reverse, side 1 new values in order
+static int apply_record(UndoHistory* history, Sheet* sheet, const UndoRecord* record, int side) {
+    size_t* offsets = NULL;
+    if (record->entry_count > 0) {
+        offsets = (size_t*)malloc(sizeof(size_t) * record->entry_count);
+        if (!offsets) return 0;
+    }
+
+    UndoReader reader = { record->data, 0 };
+    for (int i = 0; i < record->entry_count; i++) {
+        UndoEntry entry;
+        offsets[i] = reader.offset;
+        read_entry(&reader, &entry);
+    }
+    for (int k = 0; k < record->entry_count; k++) {
+        int i = side == 0 ? record->entry_count - 1 - k : k;
+        UndoEntry entry;
+        reader.offset = offsets[i];
+        read_entry(&reader, &entry);
+        apply_entry(history, sheet, &entry, side);
+    }
+    free(offsets);
+    return 1;
+}
+
+const char* undo_undo(UndoHistory* history, Sheet* sheet) {
+    if (history->open) undo_commit(history, sheet);
+    if (history->current == 0) return NULL;
+
+    UndoRecord* record = &history->records[history->current - 1];
+    if (!apply_record(history, sheet, record, 0)) return NULL;
+    history->current--;
+    return record->description;
+}
+
+const char* undo_redo(UndoHistory* history, Sheet* sheet) {
+    if (history->open) undo_commit(history, sheet);
+    if (history->current >= history->count) return NULL;
+
+    UndoRecord* record = &history->records[history->current];
+    if (!apply_record(history, sheet, record, 1)) return NULL;
+    history->current++;
+    return record->description;
+}
@@ -0,0 +1,83 @@
+// undo.h - Undo history kept as compact diffs under a memory budget
+#ifndef UNDO_H
+#define UNDO_H
+
+#include <windows.h>
+#include "sheet.h"
+#include "journal.h"
+
+// The state of one noted position from before the edit. Content text
+// lives in the history's capture buffer until the record is committed.
+typedef struct {
+    int kind;                   // UNDO_ENTRY_* (undo.c)
+    int row, col;
+    CellType type;
+    double number;
+    const char* string;         // Interned text of a string cell
+    size_t formula;             // Formula text: offset into capture_text
+    DataFormat format;
+    FormatStyle format_style;
+    int text_color;
+    int background_color;
+    int size;                   // Column width or row height
+} UndoCapture;
+
+// One undoable action. Entries are encoded back to back and hold only the
+// fields the action changed, old value then new value; string cell text is
+// the sheet's interned copy, so it costs a pointer.
+typedef struct {
+    const char* description;    // String literal shown after "Undid: "
+    int typed;                  // Entered by typing; later typing may join it
+    DWORD last_edit;            // GetTickCount() of its newest edit
+    unsigned char* data;
+    size_t size;
+    int entry_count;
+} UndoRecord;
+
+typedef struct {
+    UndoRecord* records;        // Oldest first
+    int count;
+    int capacity;
+    int current;                // records[0 .. current) can be undone, the rest redone
+
+    size_t bytes;               // Memory held by the records
+    size_t budget;              // Oldest records are dropped to stay within this
+    DWORD coalesce_ms;          // Typing this soon after typing joins its record (0 = never)
+
+    // Record being built between undo_begin and undo_commit
+    int open;
+    const char* open_description;
+    int open_typed;
+    UndoCapture* captures;
+    int capture_count;
+    int capture_capacity;
+    char* capture_text;
+    size_t capture_text_size;
+    size_t capture_text_capacity;
+    int failed;                 // A capture ran out of memory; the record is dropped
+
+    Journal* journal;           // Positions noted or restored are queued here (optional)
+} UndoHistory;
+
+void undo_history_init(UndoHistory* history, size_t budget, Journal* journal);
+void undo_history_free(UndoHistory* history);
+void undo_history_clear(UndoHistory* history);  // After loads and structural edits
+void undo_set_budget(UndoHistory* history, size_t budget);
+
+// Open a record, note each position before changing it, then commit once
+// the edit is done. Committing compares every noted position with its new
+// state and keeps only what changed. A typed record may instead reopen the
+// previous one if it was typed within coalesce_ms.
+void undo_begin(UndoHistory* history, Sheet* sheet, const char* description, int typed);
+void undo_note_cell(UndoHistory* history, Sheet* sheet, int row, int col);
+void undo_note_range(UndoHistory* history, Sheet* sheet, int start_row, int start_col, int end_row, int end_col);
+void undo_note_columns(UndoHistory* history, Sheet* sheet, int start_col, int end_col);
+void undo_note_rows(UndoHistory* history, Sheet* sheet, int start_row, int end_row);
+// 0 if the record could not be kept (out of memory, or larger than the budget)
+int undo_commit(UndoHistory* history, Sheet* sheet);
+
+// Return the description of the action undone or redone, or NULL if none
+const char* undo_undo(UndoHistory* history, Sheet* sheet);
+const char* undo_redo(UndoHistory* history, Sheet* sheet);
+
+#endif // UNDO_H
@@ -0,0 +1,338 @@
+// workbook.c - Sheets that refer to each other by name
+//
+// Each sheet keeps its own dependency graph. Formulas naming another sheet
+// (Sheet!A1) are listed on their sheet as external readers instead, and
+// the workbook joins the graphs at column granularity: once a sheet's pass
+// is over, every column whose version moved since it was last synced has
+// its readers on other sheets marked dirty. Those sheets then recalculate
+// through their own graphs, and the change travels on from there.
+//
+// String cells of every sheet are interned in one table, so labels shared
+// between sheets are stored once. Cells stay in per-sheet slabs, so that
+// unloading an idle sheet gives its memory back.
+#include "workbook.h"
+#include "formula.h"
+#include "constants.h"
+
+#define WORKBOOK_INITIAL_SHEETS     4
+
+void workbook_init(Workbook* workbook, size_t memory_budget) {
+    memset(workbook, 0, sizeof(Workbook));
+    string_table_init(&workbook->strings);
+    workbook->memory_budget = memory_budget;
+}
+
+void workbook_free(Workbook* workbook) {
+    // Sheets first: their cells point into the shared strings
+    for (int i = 0; i < workbook->count; i++) {
+        WorkbookSheet* entry = &workbook->sheets[i];
+        sheet_free(entry->sheet);
+        free(entry->name);
+        free(entry->path);
+        free(entry->synced_versions);
+    }
+    free(workbook->sheets);
+    string_table_destroy(&workbook->strings);
+    memset(workbook, 0, sizeof(Workbook));
+}
+
+int workbook_find(const Workbook* workbook, const char* name) {
+    for (int i = 0; i < workbook->count; i++) {
+        if (_stricmp(workbook->sheets[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+// Names must be writable in a formula: 'Name'!A1 cannot hold a quote
+static int name_valid(const char* name) {
+    size_t length = strlen(name);
+    return length > 0 && length < MAX_SHEET_NAME_LENGTH && !strchr(name, '\'') && !strchr(name, '!');
+}
+
+// ============================================================================
+// Readers on other sheets
+// ============================================================================
+
+typedef struct {
+    const char* name;               // Sheet whose readers are wanted
+    const unsigned int* versions;   // Its column versions, or NULL for any column
+    const unsigned int* synced;
+    int cols;
+    int hit;
+} ReaderMatch;
+
+static void match_reference(void* context, const char* sheet_name, int row, int col) {
+    ReaderMatch* match = (ReaderMatch*)context;
+    (void)row;
+    if (match->hit || _stricmp(sheet_name, match->name) != 0) return;
+    if (!match->versions || (col < match->cols && match->versions[col] != match->synced[col])) {
+        match->hit = 1;
+    }
+}
+
+// Find the live formulas on loaded sheets that match, marking them dirty
+// if asked (else stopping at the first). Returns how many were found.
+static int for_each_reader(Workbook* workbook, ReaderMatch* match, int dirty) {
+    int found = 0;
+    for (int i = 0; i < workbook->count; i++) {
+        Sheet* reader = workbook->sheets[i].sheet;
+        if (!reader) continue;
+
+        for (int r = 0; r < reader->external_reader_count; r++) {
+            DependentEdge edge = reader->external_readers[r];
+            Cell* cell = edge.cell;
+            if (cell->dep_generation != edge.generation || cell->type != CELL_FORMULA) continue;
+
+            match->hit = 0;
+            formula_visit_sheet_references(cell->data.formula.compiled, match_reference, match);
+            if (!match->hit) continue;
+
+            found++;
+            if (!dirty) return found;
+            sheet_mark_dirty(reader, cell);
+            reader->needs_recalc = 1;
+        }
+    }
+    return found;
+}
+
+// Readers of a sheet that just appeared read #REF! before; evaluate them again
+static void refresh_readers(Workbook* workbook, const char* name) {
+    ReaderMatch match = { name, NULL, NULL, 0, 0 };
+    for_each_reader(workbook, &match, 1);
+}
+
+static int sheet_is_read(Workbook* workbook, int index) {
+    ReaderMatch match = { workbook->sheets[index].name, NULL, NULL, 0, 0 };
+    return for_each_reader(workbook, &match, 0) > 0;
+}
+
+// Pass changed columns on to their readers. Sheets in the middle of a pass
+// are left until it ends, so a reader sees each change once.
+static void workbook_propagate(Workbook* workbook) {
+    unsigned int edits = 0;
+    for (int i = 0; i < workbook->count; i++) {
+        if (workbook->sheets[i].sheet) edits += workbook->sheets[i].sheet->content_edits;
+    }
+    if (edits != workbook->edits_seen) {
+        workbook->edits_seen = edits;
+        workbook->settle_rounds = 0;
+    }
+
+    int marked = 0;
+    int settled = workbook->settle_rounds >= WORKBOOK_RECALC_ROUNDS * workbook->count;
+    for (int i = 0; i < workbook->count; i++) {
+        WorkbookSheet* entry = &workbook->sheets[i];
+        Sheet* sheet = entry->sheet;
+        if (!sheet || sheet->calc_active) continue;
+        if (memcmp(sheet->column_versions, entry->synced_versions, entry->cols * sizeof(unsigned int)) == 0) continue;
+
+        if (!settled) {
+            ReaderMatch match = { entry->name, sheet->column_versions, entry->synced_versions, entry->cols, 0 };
+            marked += for_each_reader(workbook, &match, 1);
+        }
+        memcpy(entry->synced_versions, sheet->column_versions, entry->cols * sizeof(unsigned int));
+    }
+    if (marked > 0) workbook->settle_rounds++;
+}
+
+// ============================================================================
+// Loading and unloading
+// ============================================================================
+
+static int workbook_append(Workbook* workbook, const char* name, const char* path, int rows, int cols) {
+    if (!name_valid(name) || workbook_find(workbook, name) >= 0) return -1;
+
+    if (workbook->count >= workbook->capacity) {
+        int new_capacity = workbook->capacity ? workbook->capacity * 2 : WORKBOOK_INITIAL_SHEETS;
+        WorkbookSheet* grown = (WorkbookSheet*)realloc(workbook->sheets, new_capacity * sizeof(WorkbookSheet));
+        if (!grown) return -1;
+        workbook->sheets = grown;
+        workbook->capacity = new_capacity;
+    }
+
+    WorkbookSheet* entry = &workbook->sheets[workbook->count];
+    memset(entry, 0, sizeof(*entry));
+    entry->name = _strdup(name);
+    entry->path = path ? _strdup(path) : NULL;
+    entry->synced_versions = (unsigned int*)calloc(cols, sizeof(unsigned int));
+    entry->rows = rows;
+    entry->cols = cols;
+    if (!entry->name || (path && !entry->path) || !entry->synced_versions) {
+        free(entry->name);
+        free(entry->path);
+        free(entry->synced_versions);
+        return -1;
+    }
+    return workbook->count++;
+}
+
+// Create the entry's sheet and read its file, if any
+static Sheet* workbook_load(Workbook* workbook, int index) {
+    WorkbookSheet* entry = &workbook->sheets[index];
+    Sheet* sheet = sheet_new(entry->rows, entry->cols);
+    if (!sheet) return NULL;
+
+    char* name = _strdup(entry->name);
+    if (!name) {
+        sheet_free(sheet);
+        return NULL;
+    }
+    free(sheet->name);
+    sheet->name = name;
+    sheet->workbook = workbook;
+    sheet->string_pool = &workbook->strings;
+    sheet_set_lazy_recalc(sheet, 1);
+
+    if (entry->path && !sheet_load_csv(sheet, entry->path, 1)) {
+        sheet_free(sheet);
+        return NULL;
+    }
+
+    entry->sheet = sheet;
+    entry->clean_edits = sheet->content_edits;
+    memset(entry->synced_versions, 0, entry->cols * sizeof(unsigned int));
+    refresh_readers(workbook, entry->name);
+    return sheet;
+}
+
+int workbook_add_sheet(Workbook* workbook, const char* name, int rows, int cols) {
+    int index = workbook_append(workbook, name, NULL, rows, cols);
+    if (index < 0) return -1;
+
+    if (!workbook_load(workbook, index)) {
+        WorkbookSheet* entry = &workbook->sheets[index];
+        free(entry->name);
+        free(entry->synced_versions);
+        workbook->count--;
+        return -1;
+    }
+    workbook->sheets[index].last_used = GetTickCount();
+    return index;
+}
+
+int workbook_add_file(Workbook* workbook, const char* name, const char* path, int rows, int cols) {
+    return workbook_append(workbook, name, path, rows, cols);
+}
+
+Sheet* workbook_sheet(Workbook* workbook, int index) {
+    if (index < 0 || index >= workbook->count) return NULL;
+
+    WorkbookSheet* entry = &workbook->sheets[index];
+    entry->last_used = GetTickCount();
+    return entry->sheet ? entry->sheet : workbook_load(workbook, index);
+}
+
+Sheet* workbook_activate(Workbook* workbook, int index) {
+    Sheet* sheet = workbook_sheet(workbook, index);
+    if (!sheet) return NULL;
+
+    workbook->active = index;
+    workbook_trim(workbook);
+    return sheet;
+}
+
+Sheet* workbook_find_loaded(Workbook* workbook, const char* name) {
+    if (!workbook) return NULL;
+
+    int index = workbook_find(workbook, name);
+    if (index < 0) return NULL;
+
+    WorkbookSheet* entry = &workbook->sheets[index];
+    if (!entry->sheet) {
+        InterlockedExchange(&entry->wanted, 1);
+        return NULL;
+    }
+    return entry->sheet;
+}
+
+// Load the sheets formulas asked for while they were not loaded
+static void workbook_load_wanted(Workbook* workbook) {
+    for (int i = 0; i < workbook->count; i++) {
+        WorkbookSheet* entry = &workbook->sheets[i];
+        if (!entry->wanted) continue;
+        entry->wanted = 0;
+        if (!entry->sheet) workbook_sheet(workbook, i);
+    }
+}
+
+size_t workbook_sheet_memory(const Sheet* sheet) {
+    return (size_t)sheet->cell_pool.slab_count * sheet->cell_pool.objects_per_slab * sheet->cell_pool.object_size;
+}
+
+int workbook_trim(Workbook* workbook) {
+    if (workbook->memory_budget == 0) return 0;
+
+    size_t total = 0;
+    for (int i = 0; i < workbook->count; i++) {
+        if (workbook->sheets[i].sheet) total += workbook_sheet_memory(workbook->sheets[i].sheet);
+    }
+
+    int unloaded = 0;
+    while (total > workbook->memory_budget) {
+        int oldest = -1;
+        for (int i = 0; i < workbook->count; i++) {
+            WorkbookSheet* entry = &workbook->sheets[i];
+            Sheet* sheet = entry->sheet;
+            if (!sheet || i == workbook->active || !entry->path) continue;
+            // Recalculation left unfinished is redone from the file on reload
+            if (sheet->content_edits != entry->clean_edits) continue;
+            if (oldest >= 0 && (LONG)(entry->last_used - workbook->sheets[oldest].last_used) >= 0) continue;
+            if (sheet_is_read(workbook, i)) continue;
+            oldest = i;
+        }
+        if (oldest < 0) break;
+
+        WorkbookSheet* entry = &workbook->sheets[oldest];
+        total -= workbook_sheet_memory(entry->sheet);
+        sheet_free(entry->sheet);
+        entry->sheet = NULL;
+        unloaded++;
+    }
+    return unloaded;
+}
+
+// ============================================================================
+// Recalculation
+// ============================================================================
+
+int workbook_recalc_pending(const Workbook* workbook) {
+    for (int i = 0; i < workbook->count; i++) {
+        const WorkbookSheet* entry = &workbook->sheets[i];
+        if (entry->wanted) return 1;
+        if (entry->sheet && sheet_recalc_pending(entry->sheet)) return 1;
+    }
+    return 0;
+}
+
+LLResult workbook_recalculate_step(Workbook* workbook, int budget_ms) {
+    workbook_load_wanted(workbook);
+    workbook_propagate(workbook);
+
+    Sheet* target = NULL;
+    if (workbook->active < workbook->count) {
+        Sheet* active = workbook->sheets[workbook->active].sheet;
+        if (active && sheet_recalc_pending(active)) target = active;
+    }
+    for (int i = 0; i < workbook->count && !target; i++) {
+        Sheet* sheet = workbook->sheets[i].sheet;
+        if (sheet && sheet_recalc_pending(sheet)) target = sheet;
+    }
+    if (!target) return LL_OK;
+
+    LLResult result = sheet_recalculate_step(target, budget_ms);
+    workbook_load_wanted(workbook);
+    workbook_propagate(workbook);
+    if (result == LL_OK && workbook_recalc_pending(workbook)) result = LL_IN_PROGRESS;
+    return result;
+}
+
+LLResult workbook_recalculate(Workbook* workbook) {
+    LLResult result = LL_OK;
+    LLResult step;
+    while ((step = workbook_recalculate_step(workbook, 0)) != LL_OK) {
+        if (step != LL_IN_PROGRESS) result = step;
+        if (!workbook_recalc_pending(workbook)) break;
+    }
+    return result;
+}
@@ -0,0 +1,74 @@
+// workbook.h - Sheets that refer to each other by name
+#ifndef WORKBOOK_H
+#define WORKBOOK_H
+
+#include <windows.h>
+#include "sheet.h"
+#include "pool.h"
+
+// One sheet of the workbook. A sheet backed by a file is only read in when
+// something needs it, and may be dropped again while unchanged.
+typedef struct {
+    char* name;
+    char* path;                     // CSV it is loaded from (formulas kept), or NULL
+    int rows, cols;
+    Sheet* sheet;                   // NULL while not loaded
+    unsigned int* synced_versions;  // column_versions as last passed on to readers
+    unsigned int clean_edits;       // content_edits right after loading
+    DWORD last_used;                // GetTickCount() when last asked for
+    volatile LONG wanted;           // A formula read it while it was not loaded
+} WorkbookSheet;
+
+typedef struct Workbook {
+    WorkbookSheet* sheets;
+    int count;
+    int capacity;
+    int active;                     // Shown sheet: recalculated first, never unloaded
+
+    StringTable strings;            // Text of every sheet's string cells, stored once
+    size_t memory_budget;           // Cell memory idle sheets are unloaded to stay within (0 = no limit)
+
+    // Sheets reading each other in a loop would recalculate forever; after
+    // this many rounds of changes passed between sheets with no edit in
+    // between, they are left as they are
+    int settle_rounds;
+    unsigned int edits_seen;
+} Workbook;
+
+void workbook_init(Workbook* workbook, size_t memory_budget);
+void workbook_free(Workbook* workbook);
+
+// Add an empty sheet, or one read from a CSV the first time it is needed.
+// Returns its index, or -1 if the name is taken or invalid or memory ran out.
+int workbook_add_sheet(Workbook* workbook, const char* name, int rows, int cols);
+int workbook_add_file(Workbook* workbook, const char* name, const char* path, int rows, int cols);
+
+// Index of the sheet with this name (any case), or -1
+int workbook_find(const Workbook* workbook, const char* name);
+
+// The sheet at index, loading it if needed; NULL if it could not be loaded
+Sheet* workbook_sheet(Workbook* workbook, int index);
+// Make a sheet the shown one, then unload idle sheets if over budget
+Sheet* workbook_activate(Workbook* workbook, int index);
+
+// The named sheet if it is loaded, for Sheet!A1 during evaluation. Safe on
+// recalculation workers: a sheet that is not loaded is only flagged, and
+// loaded by the next workbook step.
+Sheet* workbook_find_loaded(Workbook* workbook, const char* name);
+
+// Cross-sheet recalculation. A change on one sheet dirties just the
+// formulas on other sheets that read its changed columns, so only sheets
+// with such formulas (or edits of their own) are recalculated.
+int workbook_recalc_pending(const Workbook* workbook);
+LLResult workbook_recalculate(Workbook* workbook);
+// One slice for the main loop, the active sheet first
+LLResult workbook_recalculate_step(Workbook* workbook, int budget_ms);
+
+// Bytes of cells a loaded sheet holds
+size_t workbook_sheet_memory(const Sheet* sheet);
+// Unload the least recently used sheets that can be read back unchanged
+// (file-backed, unedited, not read by a loaded sheet) until the loaded
+// sheets fit memory_budget. Returns how many were unloaded.
+int workbook_trim(Workbook* workbook);
+
+#endif // WORKBOOK_H